@@ -1,7 +1,11 @@
 #include "CommandWindow.h"
+#include "Condition.h"
+#include "dp2200Window.h"
+#include "ProgramLoader.h"
+#include "RegisterWindow.h"
+#include "Session.h"
 #include <algorithm>
-
-extern bool running;
+#include <climits>
 
 void commandWindow::doHelp(std::vector<Param> params) {
   wprintw(innerWin, "All commands can be shorted until they becaome ambigous. \nFor example A for ATTACH.\n");
@@ -16,6 +20,7 @@ void commandWindow::doHelp(std::vector<Param> params) {
 }
 
 void commandWindow::doStep(std::vector<Param> params) { 
+  session->history.recordStep(cpu->instructions);
   cpu->interruptPending = 0;
   cpu->execute(); 
 }
@@ -26,14 +31,14 @@ void commandWindow::doExit(std::vector<Param> params) {
 }
 
 void commandWindow::doOct(std::vector<Param> params) {
-  rw->octal = true;
-  rw->setOctal(rw->octal);
+  session->panel->octal = true;
+  session->panel->setOctal(session->panel->octal);
   cpu->octal=true;
 }
 
 void commandWindow::doHex(std::vector<Param> params) {
-  rw->octal=false;
-  rw->setOctal(rw->octal); 
+  session->panel->octal=false;
+  session->panel->setOctal(session->panel->octal); 
   cpu->octal=false; 
 }
 
@@ -47,46 +52,464 @@ void commandWindow::doYield(std::vector<Param> params) {
   if (value <0 || value >100) {
     wprintw(innerWin, "Value out of range %d. Should be between 0 and 100.\n", value);
   } else {
-    yield =(float) value;
+    session->machine.yield =(float) value;
   };   
 }
 
+void commandWindow::doRefresh(std::vector<Param> params) {
+  int value=0;
+  for (auto it = params.begin(); it < params.end(); it++) {
+    if (it->paramId == VALUE) {
+      value = it->paramValue.i;
+    }
+  }
+  if (session->panel->setRefreshRate(value)) {
+    wprintw(innerWin, "Value out of range %d. Should be between 0 and 100.\n", value);
+  }
+}
+
+// Report the outcome of the last SAVESTATE once its worker has finished.
+void commandWindow::checkPendingSave(bool wait) {
+  int ret;
+  if (!pendingSave.valid()) return;
+  if (!wait && pendingSave.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+  ret = pendingSave.get();
+  if (ret != STATE_OK) {
+    wprintw(innerWin, "Saving state to %s failed: %s\n", pendingSaveFile.c_str(), StateFile::errorString(ret));
+  }
+  pendingSave = std::shared_future<int>();
+}
+
+void commandWindow::doSaveState(std::vector<Param> params) {
+  std::string fileName;
+  int ret;
+  for (auto it = params.begin(); it < params.end(); it++) {
+    if (it->paramId == FILENAME) {
+      fileName = it->paramValue.s;
+    }
+  }
+  if (fileName.size() == 0) {
+    wprintw(innerWin, "No FILENAME given.\n");
+    return;
+  }
+  checkPendingSave(true);
+  ret = session->saveState(fileName, &pendingSave);
+  if (ret != STATE_OK) {
+    wprintw(innerWin, "Unable to save state: %s\n", StateFile::errorString(ret));
+    return;
+  }
+  pendingSaveFile = fileName;
+  wprintw(innerWin, "Saving state to %s\n", fileName.c_str());
+}
+
+void commandWindow::doLoadState(std::vector<Param> params) {
+  std::string fileName;
+  int ret;
+  for (auto it = params.begin(); it < params.end(); it++) {
+    if (it->paramId == FILENAME) {
+      fileName = it->paramValue.s;
+    }
+  }
+  if (fileName.size() == 0) {
+    wprintw(innerWin, "No FILENAME given.\n");
+    return;
+  }
+  checkPendingSave(true);
+  ret = session->loadState(fileName);
+  if (ret != STATE_OK) {
+    wprintw(innerWin, "Unable to load state from %s: %s\n", fileName.c_str(), StateFile::errorString(ret));
+    return;
+  }
+  session->history.clear();
+  wprintw(innerWin, "Loaded state from %s. Use CONTINUE to run.\n", fileName.c_str());
+}
+
+// The starting state is written next to the recording as FILENAME.state.
+void commandWindow::doRecord(std::vector<Param> params) {
+  std::string fileName;
+  int ret;
+  for (auto it = params.begin(); it < params.end(); it++) {
+    if (it->paramId == FILENAME) {
+      fileName = it->paramValue.s;
+    }
+  }
+  if (fileName.size() == 0) {
+    if (session->recorder.isRecording()) {
+      session->recorder.stopRecording();
+      wprintw(innerWin, "Recording stopped at instruction %lu\n", cpu->instructions);
+    } else {
+      wprintw(innerWin, "Not recording.\n");
+    }
+    return;
+  }
+  if (session->recorder.isReplaying()) {
+    wprintw(innerWin, "Stop the replay first.\n");
+    return;
+  }
+  session->recorder.stopRecording();
+  checkPendingSave(true);
+  session->recorder.stateFile = fileName + ".state";
+  ret = session->saveState(session->recorder.stateFile, &pendingSave);
+  if (ret != STATE_OK) {
+    wprintw(innerWin, "Unable to save the starting state: %s\n", StateFile::errorString(ret));
+    return;
+  }
+  pendingSaveFile = session->recorder.stateFile;
+  session->recorder.running = session->machine.running;
+  session->recorder.latency = {{"FLOPPY", cpu->ioCtrl->floppyDevice->latency.getModeName()},
+                      {"9350", cpu->ioCtrl->disk9350Device->latency.getModeName()},
+                      {"9370", cpu->ioCtrl->disk9370Device->latency.getModeName()}};
+  if (session->recorder.startRecording(fileName) != RECORD_OK) {
+    wprintw(innerWin, "Unable to open %s\n", fileName.c_str());
+    return;
+  }
+  wprintw(innerWin, "Recording to %s from instruction %lu\n", fileName.c_str(), cpu->instructions);
+}
+
+void commandWindow::doReplay(std::vector<Param> params) {
+  std::string fileName;
+  int ret;
+  for (auto it = params.begin(); it < params.end(); it++) {
+    if (it->paramId == FILENAME) {
+      fileName = it->paramValue.s;
+    }
+  }
+  if (fileName.size() == 0) {
+    if (session->recorder.isReplaying()) {
+      session->recorder.stopReplay();
+      wprintw(innerWin, "Replay stopped at instruction %lu\n", cpu->instructions);
+    } else {
+      wprintw(innerWin, "Not replaying.\n");
+    }
+    return;
+  }
+  if (session->recorder.isRecording()) {
+    wprintw(innerWin, "Stop the recording first.\n");
+    return;
+  }
+  ret = session->recorder.startReplay(fileName);
+  if (ret != RECORD_OK) {
+    wprintw(innerWin, "Unable to replay %s: %s\n", fileName.c_str(), ret == RECORD_FILE_ERROR ? "Unable to read the file" : "Not a recording or the file is damaged");
+    return;
+  }
+  checkPendingSave(true);
+  ret = session->loadState(session->recorder.stateFile);
+  if (ret != STATE_OK) {
+    session->recorder.stopReplay();
+    wprintw(innerWin, "Unable to load state from %s: %s\n", session->recorder.stateFile.c_str(), StateFile::errorString(ret));
+    return;
+  }
+  for (auto it = session->recorder.latency.begin(); it < session->recorder.latency.end(); it++) {
+    setLatency(it->first, it->second);
+  }
+  session->machine.running = session->recorder.running;
+  session->history.clear();
+  wprintw(innerWin, "Replaying %s from instruction %lu\n", fileName.c_str(), cpu->instructions);
+}
+
+// Printed over the prompt, which is then redrawn with what has been typed so far.
+void commandWindow::runCommand(std::string line) {
+  int y, x;
+  std::string typed = commandLine;
+  getyx(innerWin, y, x);
+  wmove(innerWin, y, 1);
+  wclrtoeol(innerWin);
+  wprintw(innerWin, "%s\n", line.c_str());
+  commandLine = line;
+  processCommand('\n');
+  commandLine = typed;
+  wprintw(innerWin, ">%s", typed.c_str());
+  wrefresh(innerWin);
+  getyx(innerWin, cursorY, cursorX);
+}
+
+void commandWindow::replayEvents() {
+  struct recordedEvent e;
+  int y, x;
+  while (session->recorder.nextEvent(cpu->instructions, &e)) {
+    if (e.type == RECORD_KEY) {
+      session->history.recordKey(cpu->instructions, e.key);
+      session->screen->handleKey(e.key);
+    } else {
+      runCommand(e.command);
+    }
+    session->panel->stateChanged();
+  }
+  if (session->recorder.isReplaying() && session->recorder.nextInstruction() == ULONG_MAX) {
+    session->recorder.stopReplay();
+    getyx(innerWin, y, x);
+    wmove(innerWin, y, 0);
+    wclrtoeol(innerWin);
+    wprintw(innerWin, "Replay finished at instruction %lu\n>%s", cpu->instructions, commandLine.c_str());
+    wrefresh(innerWin);
+    getyx(innerWin, cursorY, cursorX);
+  }
+}
+
+void commandWindow::doBackstep(std::vector<Param> params) {
+  int value=1, ret;
+  for (auto it = params.begin(); it < params.end(); it++) {
+    if (it->paramId == VALUE) {
+      value = it->paramValue.i;
+    }
+  }
+  if (value < 1) {
+    wprintw(innerWin, "Value out of range %d. Should be at least 1.\n", value);
+    return;
+  }
+  session->machine.running = false;
+  ret = session->history.stepBack(value);
+  if (ret != HISTORY_OK) {
+    wprintw(innerWin, "Unable to step back: %s\n", History::errorString(ret));
+    return;
+  }
+  wprintw(innerWin, "Stepped back to instruction %lu\n", cpu->instructions);
+}
+
+void commandWindow::doReverseContinue(std::vector<Param> params) {
+  int ret;
+  session->machine.running = false;
+  ret = session->history.reverseContinue();
+  if (ret != HISTORY_OK) {
+    wprintw(innerWin, "%s. Now at instruction %lu\n", History::errorString(ret), cpu->instructions);
+    return;
+  }
+  wprintw(innerWin, "Stopped at instruction %lu\n", cpu->instructions);
+}
+
+// VALUE is in thousands of instructions.
+void commandWindow::doCheckpoint(std::vector<Param> params) {
+  int value=HISTORY_INTERVAL/1000;
+  for (auto it = params.begin(); it < params.end(); it++) {
+    if (it->paramId == VALUE) {
+      value = it->paramValue.i;
+    }
+  }
+  if (value < 0) {
+    wprintw(innerWin, "Value out of range %d. Should be 0 or more.\n", value);
+    return;
+  }
+  session->history.setInterval((unsigned long) value * 1000);
+  if (value == 0) {
+    wprintw(innerWin, "Checkpoints turned off.\n");
+  } else {
+    wprintw(innerWin, "Checkpoint every %d000 instructions, keeping %d.\n", value, HISTORY_DEPTH);
+  }
+}
+
+// With FILENAME the counters are also written to the file every VALUE seconds. VALUE=0 stops that.
+void commandWindow::doStats(std::vector<Param> params) {
+  std::string fileName;
+  int value=STATS_DUMP_INTERVAL;
+  for (auto it = params.begin(); it < params.end(); it++) {
+    if (it->paramId == FILENAME) {
+      fileName = it->paramValue.s;
+    }
+    if (it->paramId == VALUE) {
+      value = it->paramValue.i;
+    }
+  }
+  if (value < 0) {
+    wprintw(innerWin, "Value out of range %d. Should be 0 or more.\n", value);
+    return;
+  }
+  if (value == 0) {
+    session->stats.stopDump();
+    wprintw(innerWin, "Statistics dump stopped.\n");
+    return;
+  }
+  if (fileName.size() > 0) {
+    if (session->stats.startDump(fileName, value) != STATS_OK) {
+      wprintw(innerWin, "Unable to open %s\n", fileName.c_str());
+      return;
+    }
+    wprintw(innerWin, "Writing statistics to %s every %d s\n", fileName.c_str(), value);
+  }
+  auto lines = session->stats.report();
+  for (auto it = lines.begin(); it < lines.end(); it++) {
+    wprintw(innerWin, "%s\n", it->c_str());
+  }
+}
+
+// Without TYPE the hooks are listed. TYPE is a hook name or ALL.
+void commandWindow::doHle(std::vector<Param> params) {
+  std::string type;
+  bool enabled = true;
+  for (auto it = params.begin(); it < params.end(); it++) {
+    if (it->paramId == TYPE) {
+      type = it->paramValue.s;
+    }
+    if (it->paramId == ENABLED) {
+      enabled = it->paramValue.b;
+    }
+  }
+  if (type.size() > 0 && session->machine.hooks.enable(type, enabled) != ROM_HOOKS_OK) {
+    wprintw(innerWin, "No hook named %s\n", type.c_str());
+    return;
+  }
+  auto lines = session->machine.hooks.report();
+  for (auto it = lines.begin(); it < lines.end(); it++) {
+    wprintw(innerWin, "%s\n", it->c_str());
+  }
+}
+
 void commandWindow::doLoadBoot(std::vector<Param> params) {
   if (!cpu->ioCtrl->cassetteDevice->loadBoot([memory=cpu->memory](int address, unsigned char data)->void { memory->physicalMemoryWrite(address, data);})) {
     wprintw(innerWin, "Unable to load bootstrap into memory.\n");
   }
+  session->history.clear();
+}
+// P is set to the start address of the file, if it has one.
+void commandWindow::doLoadFile(std::vector<Param> params) {
+  std::string fileName, type;
+  class ProgramLoader loader(cpu);
+  int number=0, address=0, start, bytes, ret;
+  for (auto it = params.begin(); it < params.end(); it++) {
+    if (it->paramId == FILENAME) {
+      fileName = it->paramValue.s;
+    }
+    if (it->paramId == TYPE) {
+      type = it->paramValue.s;
+    }
+    if (it->paramId == FILENUMBER) {
+      number = it->paramValue.i;
+    }
+    if (it->paramId == ADDRESS) {
+      address = strtol(it->paramValue.s, NULL, session->panel->octal ? 8 : 16);
+    }
+  }
+  if (fileName.size() == 0) {
+    wprintw(innerWin, "No FILENAME given.\n");
+    return;
+  }
+  type = ProgramLoader::typeOf(fileName, type);
+  if (type == "TAP") {
+    ret = loader.loadTap(fileName, number, &start, &bytes);
+  } else if (type == "HEX") {
+    ret = loader.loadHex(fileName, &start, &bytes);
+  } else if (type == "RAW") {
+    start = -1;
+    ret = loader.loadRaw(fileName, address, &bytes);
+  } else {
+    wprintw(innerWin, "Invalid TYPE %s. Should be TAP, HEX or RAW.\n", type.c_str());
+    return;
+  }
+  session->machine.running = false;
+  session->history.clear();
+  if (ret == LOADER_CHECKSUM_ERROR || ret == LOADER_BAD_FORMAT) {
+    wprintw(innerWin, "Unable to load %s: %s, record %d.\n", fileName.c_str(), ProgramLoader::errorString(ret), loader.getRecords());
+    return;
+  } else if (ret != LOADER_OK) {
+    wprintw(innerWin, "Unable to load %s: %s.\n", fileName.c_str(), ProgramLoader::errorString(ret));
+    return;
+  }
+  if (start >= 0) {
+    cpu->P = start & cpu->pMask;
+    wprintw(innerWin, session->panel->octal ? "Loaded %d bytes. P=%06o. Use CONTINUE to run.\n" : "Loaded %d bytes. P=%04X. Use CONTINUE to run.\n", bytes, cpu->P);
+  } else {
+    wprintw(innerWin, "Loaded %d bytes.\n", bytes);
+  }
 }
+
+void commandWindow::doSaveFile(std::vector<Param> params) {
+  std::string fileName, type;
+  class ProgramLoader loader(cpu);
+  int address=0, length=0, ret;
+  for (auto it = params.begin(); it < params.end(); it++) {
+    if (it->paramId == FILENAME) {
+      fileName = it->paramValue.s;
+    }
+    if (it->paramId == TYPE) {
+      type = it->paramValue.s;
+    }
+    if (it->paramId == ADDRESS) {
+      address = strtol(it->paramValue.s, NULL, session->panel->octal ? 8 : 16);
+    }
+    if (it->paramId == LENGTH) {
+      length = strtol(it->paramValue.s, NULL, session->panel->octal ? 8 : 16);
+    }
+  }
+  if (fileName.size() == 0) {
+    wprintw(innerWin, "No FILENAME given.\n");
+    return;
+  }
+  type = ProgramLoader::typeOf(fileName, type);
+  if (type == "HEX") {
+    ret = loader.saveHex(fileName, address, length);
+  } else if (type == "RAW") {
+    ret = loader.saveRaw(fileName, address, length);
+  } else {
+    wprintw(innerWin, "Invalid TYPE %s. Should be HEX or RAW.\n", type.c_str());
+    return;
+  }
+  if (ret != LOADER_OK) {
+    wprintw(innerWin, "Unable to save %s: %s.\n", fileName.c_str(), ProgramLoader::errorString(ret));
+    return;
+  }
+  wprintw(innerWin, "Saved %d bytes to %s\n", length, fileName.c_str());
+}
+
 void commandWindow::doClear(std::vector<Param> params) {
   cpu->clear();
+  session->history.clear();
 }
 void commandWindow::doRun(std::vector<Param> params) {
   cpu->totalInstructionTime.tv_nsec=0;
   cpu->totalInstructionTime.tv_sec=0;
-  running = true;
+  session->history.clear();
+  session->machine.running = true;
 }
 
 void commandWindow::doContinue(std::vector<Param> params) {
-  running = true;
+  session->machine.running = true;
 }
 
 void commandWindow::doReset(std::vector<Param> params) {
   cpu->reset();
-  running=false;
+  session->machine.running=false;
+  session->history.clear();
 }
 
 void commandWindow::doTrace(std::vector<Param> params) {
   cpu->traceEnabled=true;
 }
 
+void commandWindow::setLatency(std::string type, std::string mode) {
+  class LatencyModel * latency;
+  std::transform(type.begin(), type.end(), type.begin(),::toupper);
+  if (type == "FLOPPY") {
+    latency = &cpu->ioCtrl->floppyDevice->latency;
+  } else if (type == "9350") {
+    latency = &cpu->ioCtrl->disk9350Device->latency;
+  } else if (type == "9370") {
+    latency = &cpu->ioCtrl->disk9370Device->latency;
+  } else {
+    wprintw(innerWin, "Latency model is not available for type %s\n", type.c_str());
+    return;
+  }
+  if (latency->setMode(mode)) {
+    wprintw(innerWin, "Invalid latency model: %s. Should be FIXED, REALISTIC or INSTANT.\n", mode.c_str());
+  } else {
+    wprintw(innerWin, "%s latency model is %s\n", type.c_str(), latency->getModeName());
+  }
+}
+
 void commandWindow::doSet(std::vector<Param> params) {
+  std::string type, latency;
   for (auto it = params.begin(); it < params.end(); it++) {
+    if (it->paramId == TYPE) {
+      type = it->paramValue.s;
+    }
+    if (it->paramId == LATENCY) {
+      latency = it->paramValue.s;
+    }
     if (it->paramId == CPU) {
       if (it->paramValue.i == 5500) {
         cpu->setCPUtype5500();
-        rw->set2200Mode(false); 
+        session->panel->set2200Mode(false); 
       } else if (it->paramValue.i == 2200) {
         cpu->setCPUtype2200(); 
-        rw->set2200Mode(true); 
+        session->panel->set2200Mode(true); 
       } else {
         wprintw(innerWin, "Invalid CPU type: %d\n", it->paramValue.i);  
       }
@@ -102,36 +525,56 @@ void commandWindow::doSet(std::vector<Param> params) {
       cpu->setAutorestart(it->paramValue.b);
     }
   }  
+  if (latency.size() > 0) {
+    if (type.size() > 0) {
+      setLatency(type, latency);
+    } else {
+      setLatency("FLOPPY", latency);
+      setLatency("9350", latency);
+      setLatency("9370", latency);
+    }
+  }
+  session->history.clear();
 }
 void commandWindow::doNoTrace(std::vector<Param> params) {
   cpu->traceEnabled=false; 
 }
 
 void commandWindow::doRestart(std::vector<Param> params) {
-  running = false;
+  session->machine.running = false;
   cpu->reset();
   if (cpu->cpuIs2200()) {
     cpu->ioCtrl->cassetteDevice->loadBoot([memory=cpu->memory](int address, unsigned char data)->void { return memory->physicalMemoryWrite(address,data);});
   }
   cpu->totalInstructionTime.tv_nsec=0;
   cpu->totalInstructionTime.tv_sec=0;
-  running = true;  
+  session->history.clear();
+  session->machine.running = true;  
 }
 void commandWindow::doHalt(std::vector<Param> params) {
-  running = false;
+  session->machine.running = false;
 }
 void commandWindow::doAddBreakpoint(std::vector<Param> params) {
   unsigned short address=0;
+  std::shared_ptr<class Condition> condition;
+  int ret;
   for (auto it = params.begin(); it < params.end(); it++) {
     if (it->paramId == ADDRESS) {
-      if (rw->octal) {
+      if (session->panel->octal) {
         address = strtol(it->paramValue.s, NULL, 8);
       } else {
         address = strtol(it->paramValue.s, NULL, 16);  
       }
     }
+    if (it->paramId == CONDITION && strlen(it->paramValue.s) > 0) {
+      condition = std::make_shared<class Condition>(cpu);
+      if ((ret = condition->compile(it->paramValue.s, session->panel->octal, false)) != CONDITION_OK) {
+        wprintw(innerWin, "Invalid condition %s: %s\n", it->paramValue.s, Condition::errorString(ret));
+        return;
+      }
+    }
   }
-  if (cpu->addBreakpoint(address)) {
+  if (cpu->addBreakpoint(address, condition)) {
     wprintw(innerWin, "Failed to add breakpoint at address %04X\n", address);
   };   
 }
@@ -139,7 +582,7 @@ void commandWindow::doRemoveBreakpoint(std::vector<Param> params) {
   unsigned short address=0;
   for (auto it = params.begin(); it < params.end(); it++) {
     if (it->paramId == ADDRESS) {
-      if (rw->octal) {
+      if (session->panel->octal) {
         address = strtol(it->paramValue.s, NULL, 8);
       } else {
         address = strtol(it->paramValue.s, NULL, 16);  
@@ -153,16 +596,25 @@ void commandWindow::doRemoveBreakpoint(std::vector<Param> params) {
 
 void commandWindow::doAddWatch(std::vector<Param> params) {
   unsigned short address=0;
+  std::shared_ptr<class Condition> condition;
+  int ret;
   for (auto it = params.begin(); it < params.end(); it++) {
     if (it->paramId == ADDRESS) {
-      if (rw->octal) {
+      if (session->panel->octal) {
         address = strtol(it->paramValue.s, NULL, 8);
       } else {
         address = strtol(it->paramValue.s, NULL, 16);  
       }
     }
+    if (it->paramId == CONDITION && strlen(it->paramValue.s) > 0) {
+      condition = std::make_shared<class Condition>(cpu);
+      if ((ret = condition->compile(it->paramValue.s, session->panel->octal, true)) != CONDITION_OK) {
+        wprintw(innerWin, "Invalid condition %s: %s\n", it->paramValue.s, Condition::errorString(ret));
+        return;
+      }
+    }
   }
-  if (cpu->memory->addWatch(address)) {
+  if (cpu->memory->addWatch(address, condition)) {
     wprintw(innerWin, "Failed to add memory watch at address %04X\n", address);
   };   
 }
@@ -170,7 +622,7 @@ void commandWindow::doRemoveWatch(std::vector<Param> params) {
   unsigned short address=0;
   for (auto it = params.begin(); it < params.end(); it++) {
     if (it->paramId == ADDRESS) {
-      if (rw->octal) {
+      if (session->panel->octal) {
         address = strtol(it->paramValue.s, NULL, 8);
       } else {
         address = strtol(it->paramValue.s, NULL, 16);  
@@ -195,6 +647,7 @@ void commandWindow::doDetach(std::vector<Param> params) {
     }
   }
   std::transform(type.begin(), type.end(), type.begin(),::toupper);
+  session->history.clear();
   if (type == "CASSETTE") {
     cpu->ioCtrl->cassetteDevice->closeFile(drive);
     wprintw(innerWin, "Detaching file %s to drive %d\n",cpu->ioCtrl->cassetteDevice->getFileName(drive).c_str(), drive);
@@ -212,9 +665,9 @@ void commandWindow::doDetach(std::vector<Param> params) {
 }
 
 void commandWindow::doAttach(std::vector<Param> params) {
-  std::string fileName, type;
+  std::string fileName, type, latency;
   int drive=0, ret;
-  bool writeProtect=true, writeBack=false;
+  bool writeProtect=true, writeBack=false, overlay=false;
   
   for (auto it = params.begin(); it < params.end(); it++) {
     printLog("INFO", "paramName=%s paramType=%d paramId=%d\n",
@@ -245,9 +698,19 @@ void commandWindow::doAttach(std::vector<Param> params) {
     if (it->paramId == WRITEPROTECT) {
       writeProtect = it->paramValue.b;
     }
+    if (it->paramId == LATENCY) {
+      latency = it->paramValue.s;
+    }
+    if (it->paramId == OVERLAY) {
+      overlay = it->paramValue.b;
+    }
   }
   std::transform(type.begin(), type.end(), type.begin(),
                   ::toupper);
+  session->history.clear();
+  if (latency.size() > 0) {
+    setLatency(type, latency);
+  }
 
   if (type == "CASSETTE") {
     if (cpu->ioCtrl->cassetteDevice->openFile(drive, fileName, writeProtect)) {
@@ -272,19 +735,35 @@ void commandWindow::doAttach(std::vector<Param> params) {
       wprintw(innerWin, "Failed to open file %s code %d \n", fileName.c_str(), ret);      
     }    
   } else if (type == "9350") {
-    if ((ret = cpu->ioCtrl->disk9350Device->openFile(drive, fileName, writeProtect))==0) {
-      wprintw(innerWin, "Attaching file %s to 9350 disk drive %d\n", fileName.c_str(), drive );
+    if ((ret = cpu->ioCtrl->disk9350Device->openFile(drive, fileName, writeProtect, overlay))==0) {
+      wprintw(innerWin, "Attaching file %s to 9350 disk drive %d%s\n", fileName.c_str(), drive, overlay ? " copy-on-write" : "");
     } else {
       wprintw(innerWin, "Failed to open file %s code %d \n", fileName.c_str(), ret);
     }
   } else if (type == "9370") {
-    if ((ret = cpu->ioCtrl->disk9370Device->openFile(drive, fileName, writeProtect))==0) {
-      wprintw(innerWin, "Attaching file %s to 9370 disk drive %d\n", fileName.c_str(), drive );
+    if ((ret = cpu->ioCtrl->disk9370Device->openFile(drive, fileName, writeProtect, overlay))==0) {
+      wprintw(innerWin, "Attaching file %s to 9370 disk drive %d%s\n", fileName.c_str(), drive, overlay ? " copy-on-write" : "");
     } else {
       wprintw(innerWin, "Failed to open file %s code %d \n", fileName.c_str(), ret);
     }
   }
 }
+void commandWindow::doCache(std::vector<Param> params) {
+  wprintw(innerWin, "Type Drive       Hits     Misses  Readahead Cached  Dirty\n");
+  for (int drive=0; drive<4; drive++) {
+    if (cpu->ioCtrl->disk9350Device->isOnline(drive)) {
+      SectorCache * c = cpu->ioCtrl->disk9350Device->getCache(drive);
+      wprintw(innerWin, "9350 %5d %10lu %10lu %10lu %6u %6u\n", drive, c->hits.load(), c->misses.load(), c->readAheads.load(), c->size(), c->dirtySectors());
+    }
+  }
+  for (int drive=0; drive<8; drive++) {
+    if (cpu->ioCtrl->disk9370Device->isOnline(drive)) {
+      SectorCache * c = cpu->ioCtrl->disk9370Device->getCache(drive);
+      wprintw(innerWin, "9370 %5d %10lu %10lu %10lu %6u %6u\n", drive, c->hits.load(), c->misses.load(), c->readAheads.load(), c->size(), c->dirtySectors());
+    }
+  }
+}
+
 void commandWindow::processCommand(char ch) {
   std::vector<Cmd> filtered;
   std::vector<std::string> paramStrings;
@@ -411,8 +890,12 @@ void commandWindow::processCommand(char ch) {
         }
         filteredParams.clear();
       }
-      if (!failed)
+      if (!failed) {
+        if (filtered[0].func != &commandWindow::doRecord && filtered[0].func != &commandWindow::doReplay) {
+          session->recorder.recordCommand(cpu->instructions, commandLine);
+        }
         ((*this).*(filtered[0].func))(filtered[0].params);
+      }
     } else if (filtered.size() > 1) {
       wprintw(innerWin, "Ambiguous command given. Did you mean: ");
       for (std::vector<Cmd>::const_iterator it = filtered.begin();
@@ -424,10 +907,11 @@ void commandWindow::processCommand(char ch) {
   }
 }
 
-commandWindow::commandWindow(class dp2200_cpu * c) {
+commandWindow::commandWindow(class Session * s) {
   cursorX = 1;
   cursorY = 0;
-  cpu = c;
+  session = s;
+  cpu = &s->machine.cpu;
   activeWindow = false;
   commandHistoryIndex = -1;
   commands.push_back(
@@ -440,7 +924,9 @@ commandWindow::commandWindow(class dp2200_cpu * c) {
                         {"FILENAME", FILENAME, STRING, {.s = {'\0'}}},
                         {"TYPE", TYPE, STRING, {.s = {'C','A','S','S','E','T','T','E','\0'}}},
                         {"WRITEBACK", WRITEBACK, BOOL, {.b = false } },
-                        {"WRITEPROTECT", WRITEPROTECT, BOOL, {.b = true}}                        
+                        {"WRITEPROTECT", WRITEPROTECT, BOOL, {.b = true}},
+                        {"LATENCY", LATENCY, STRING, {.s = {'\0'}}},
+                        {"OVERLAY", OVERLAY, BOOL, {.b = false}}
                       },
                       &commandWindow::doAttach});
   commands.push_back({"DETACH",
@@ -458,6 +944,20 @@ commandWindow::commandWindow(class dp2200_cpu * c) {
                       "Load the bootstrap from cassette into memory",
                       {},
                       &commandWindow::doLoadBoot});
+  commands.push_back({"LOADFILE",
+                      "Load a program into memory without the bootstrap.\n  FILENAME is a .tap cassette image, Intel hex or raw binary, TYPE=TAP, HEX or RAW\n  overrides the extension. NUMBER is the file on the tape, ADDRESS where RAW is loaded.",
+                      {{"FILENAME", FILENAME, STRING, {.s = {'\0'}}},
+                        {"TYPE", TYPE, STRING, {.s = {'\0'}}},
+                        {"NUMBER", FILENUMBER, NUMBER, {.i = 0}},
+                        {"ADDRESS", ADDRESS, STRING, {.s = {'\0'}}}},
+                      &commandWindow::doLoadFile});
+  commands.push_back({"SAVEFILE",
+                      "Save memory to a file.\n  FILENAME is the file to write, Intel hex or raw binary by extension or TYPE=HEX or RAW.\n  ADDRESS and LENGTH give the memory to save.",
+                      {{"FILENAME", FILENAME, STRING, {.s = {'\0'}}},
+                        {"TYPE", TYPE, STRING, {.s = {'\0'}}},
+                        {"ADDRESS", ADDRESS, STRING, {.s = {'\0'}}},
+                        {"LENGTH", LENGTH, STRING, {.s = {'\0'}}}},
+                      &commandWindow::doSaveFile});
   commands.push_back({"RESTART",
                       "Load bootstrap and restart CPU",
                       {},
@@ -469,19 +969,30 @@ commandWindow::commandWindow(class dp2200_cpu * c) {
   commands.push_back(
       {"CLEAR", "Clear memory", {}, &commandWindow::doClear});   
   commands.push_back(
-      {"BREAK", "Add breakpoint. \n  Parameter ADDRESS is used for specifying the address of the breakpoint.", {{"ADDRESS", ADDRESS, STRING, {.s = {'\0'}}}}, &commandWindow::doAddBreakpoint});
+      {"BREAK", "Add breakpoint. \n  Parameter ADDRESS is used for specifying the address of the breakpoint.\n  IF is a condition that must hold to stop, e.g. IF=A==12&&SET==BETA or IF=HITS==10.", {{"ADDRESS", ADDRESS, STRING, {.s = {'\0'}}}, {"IF", CONDITION, STRING, {.s = {'\0'}}}}, &commandWindow::doAddBreakpoint});
   commands.push_back(
       {"NOBREAK", "Remove breakpoint. \n  Parameter ADDRESS is used for specifying the address of the breakpoint.", {{"ADDRESS", ADDRESS, STRING, {.s = {'\0'}}}}, &commandWindow::doRemoveBreakpoint});  
   commands.push_back(
-      {"WATCH", "Add memory watch. \n  Parameter ADDRESS is used for specifying the address of the memory watch.", {{"ADDRESS", ADDRESS, STRING, {.s = {'\0'}}}}, &commandWindow::doAddWatch});
+      {"WATCH", "Add memory watch. \n  Parameter ADDRESS is used for specifying the address of the memory watch.\n  IF is a condition that must hold to stop. DATA is the byte being written, e.g. IF=DATA==0.", {{"ADDRESS", ADDRESS, STRING, {.s = {'\0'}}}, {"IF", CONDITION, STRING, {.s = {'\0'}}}}, &commandWindow::doAddWatch});
   commands.push_back(
       {"NOWATCH", "Remove memory watch. \n  Parameter ADDRESS is used for specifying the address of the memory watch.", {{"ADDRESS", ADDRESS, STRING, {.s = {'\0'}}}}, &commandWindow::doRemoveWatch});  
   commands.push_back({"TRACE", "Enable trace logging", {}, &commandWindow::doTrace});    
   commands.push_back({"NOTRACE", "Disable trace logging", {}, &commandWindow::doNoTrace}); 
   commands.push_back({"HEXADECIMAL", "Show in hexadecimal notation.\nAlso possible to toggle in the register view by pressing 'o'.", {}, &commandWindow::doHex});  
   commands.push_back({"OCTAL", "Show in Octal notation.\nAlso possible to toggle in the register view by pressing 'o'.", {}, &commandWindow::doOct});  
-  commands.push_back({"SET", "Set various system parameters like cpu type and memory amount.\nCPU=2200 or CPU=5500 specify architecture. MEMORY=nn where nn=2 .. 64 (k) Memory.\n AUTORESTART is a boolean used on the 5500. TRUE or FALSE", {{"CPU", CPU, NUMBER, {.i=2200}}, {"MEMORY", MEMORY, NUMBER, {.i=16}}, {"AUTORESTART", AUTORESTART, BOOL, {.i=2200}}}, &commandWindow::doSet});
-  commands.push_back({"YIELD", "The amount of CPU time consumed byt the simulator. \n  VALUE parameter specify the amount. Value between 0 and 100.", {{"VALUE", VALUE, NUMBER, {.i = 100}}}, &commandWindow::doYield});         
+  commands.push_back({"SET", "Set various system parameters like cpu type and memory amount.\nCPU=2200 or CPU=5500 specify architecture. MEMORY=nn where nn=2 .. 64 (k) Memory.\n AUTORESTART is a boolean used on the 5500. TRUE or FALSE\n LATENCY=FIXED, REALISTIC or INSTANT sets the device timing model. TYPE=FLOPPY, 9350 or 9370 limits it to one device.", {{"CPU", CPU, NUMBER, {.i=2200}}, {"MEMORY", MEMORY, NUMBER, {.i=16}}, {"AUTORESTART", AUTORESTART, BOOL, {.i=2200}}, {"LATENCY", LATENCY, STRING, {.s = {'\0'}}}, {"TYPE", TYPE, STRING, {.s = {'\0'}}}}, &commandWindow::doSet});
+  commands.push_back({"CACHE", "Show sector cache statistics for attached 9350 and 9370 drives.", {}, &commandWindow::doCache});
+  commands.push_back({"YIELD", "The amount of CPU time consumed byt the simulator. \n  VALUE parameter specify the amount. Value between 0 and 100.", {{"VALUE", VALUE, NUMBER, {.i = 100}}}, &commandWindow::doYield});
+  commands.push_back({"SAVESTATE", "Save the complete machine to a file.\n  FILENAME is the file to write. Attached media are saved by name.", {{"FILENAME", FILENAME, STRING, {.s = {'\0'}}}}, &commandWindow::doSaveState});
+  commands.push_back({"LOADSTATE", "Restore the machine from a file written by SAVESTATE.\n  FILENAME is the file to read. The CPU is left stopped.", {{"FILENAME", FILENAME, STRING, {.s = {'\0'}}}}, &commandWindow::doLoadState});
+  commands.push_back({"RECORD", "Record all input to the machine to a file.\n  FILENAME is the file to write. The starting state is saved as FILENAME.state. Without FILENAME the recording is stopped.", {{"FILENAME", FILENAME, STRING, {.s = {'\0'}}}}, &commandWindow::doRecord});
+  commands.push_back({"REPLAY", "Replay a recording made by RECORD.\n  FILENAME is the recording to read. Without FILENAME the replay is stopped.", {{"FILENAME", FILENAME, STRING, {.s = {'\0'}}}}, &commandWindow::doReplay});
+  commands.push_back({"BACKSTEP", "Go back in execution.\n  VALUE is the number of instructions to go back. Needs a checkpoint at or before the target.", {{"VALUE", VALUE, NUMBER, {.i = 1}}}, &commandWindow::doBackstep});
+  commands.push_back({"REVERSE-CONTINUE", "Go back to the last time the CPU stopped at a breakpoint, a memory watch or a halt.", {}, &commandWindow::doReverseContinue});
+  commands.push_back({"CHECKPOINT", "How often a checkpoint for BACKSTEP and REVERSE-CONTINUE is taken. \n  VALUE in thousands of instructions. 0 turns checkpoints off.", {{"VALUE", VALUE, NUMBER, {.i = HISTORY_INTERVAL/1000}}}, &commandWindow::doCheckpoint});
+  commands.push_back({"STATS", "Show performance counters. \n  FILENAME also writes them to a file as JSON lines every VALUE seconds. VALUE=0 stops writing.", {{"FILENAME", FILENAME, STRING, {.s = {'\0'}}}, {"VALUE", VALUE, NUMBER, {.i = STATS_DUMP_INTERVAL}}}, &commandWindow::doStats});
+  commands.push_back({"HLE", "Show the loops of the 5500 firmware that are run natively. \n  TYPE is a loop or ALL, ENABLED=FALSE runs it instruction by instruction again.", {{"TYPE", TYPE, STRING, {.s = {'\0'}}}, {"ENABLED", ENABLED, BOOL, {.b = true}}}, &commandWindow::doHle});
+  commands.push_back({"REFRESH", "How many times per second the register window is updated while the CPU is running. \n  VALUE between 0 and 100. 0 updates it only when the CPU stops.", {{"VALUE", VALUE, NUMBER, {.i = REGISTER_REFRESH_RATE}}}, &commandWindow::doRefresh});         
   win = newwin(LINES - 14, 82, 14, 0);
   innerWin = newwin(LINES - 16, 80, 15, 1);
   normalWindow();
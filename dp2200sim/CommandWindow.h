@@ -6,13 +6,13 @@
 #include <ncurses.h>
 #include <string>
 #include <cstring>
+#include <future>
 #include "dp2200_cpu_sim.h"
 
 typedef enum { STRING, NUMBER, BOOL } Type;
-typedef enum { DRIVE, FILENAME, ADDRESS, ENABLED, VALUE, TYPE, WRITEBACK, WRITEPROTECT, MEMORY, CPU, AUTORESTART } ParamId;
+typedef enum { DRIVE, FILENAME, ADDRESS, ENABLED, VALUE, TYPE, WRITEBACK, WRITEPROTECT, MEMORY, CPU, AUTORESTART, LATENCY, OVERLAY, CONDITION, FILENUMBER, LENGTH } ParamId;
 class commandWindow;
 void printLog(const char *level, const char *fmt, ...);
-extern float yield;
 
 #define PARAM_VALUE_SIZE 256
 
@@ -42,11 +42,14 @@ class commandWindow : public virtual Window {
   WINDOW *win, *innerWin;
   std::string commandLine;
   std::vector<Cmd> commands;
+  class Session * session;
   dp2200_cpu *cpu;
   bool activeWindow;
   std::vector<int> test;
   std::vector<std::string> commandHistory;
   int commandHistoryIndex;
+  std::shared_future<int> pendingSave;
+  std::string pendingSaveFile;
   
   void doHelp(std::vector<Param> params);
 
@@ -56,6 +59,8 @@ class commandWindow : public virtual Window {
 
 
   void doLoadBoot(std::vector<Param> params);
+  void doLoadFile(std::vector<Param> params);
+  void doSaveFile(std::vector<Param> params);
   void doClear(std::vector<Param> params);
   void doRun(std::vector<Param> params);
   void doReset(std::vector<Param> params);
@@ -70,19 +75,36 @@ class commandWindow : public virtual Window {
   void doTrace(std::vector<Param> params);
   void doNoTrace(std::vector<Param> params);
   void doYield(std::vector<Param> params);
+  void doRefresh(std::vector<Param> params);
   void doHex(std::vector<Param> params);
   void doOct(std::vector<Param> params);  
   void doSet(std::vector<Param> params);
   void doContinue(std::vector<Param> params);
+  void doBackstep(std::vector<Param> params);
+  void doReverseContinue(std::vector<Param> params);
+  void doCheckpoint(std::vector<Param> params);
+  void doStats(std::vector<Param> params);
+  void doHle(std::vector<Param> params);
+  void doCache(std::vector<Param> params);
+  void doSaveState(std::vector<Param> params);
+  void doLoadState(std::vector<Param> params);
+  void doRecord(std::vector<Param> params);
+  void doReplay(std::vector<Param> params);
+  void checkPendingSave(bool wait);
+  void setLatency(std::string type, std::string mode);
   void processCommand(char ch);
 
 public:
-  commandWindow(class dp2200_cpu * c);
+  commandWindow(class Session * s);
   void hightlightWindow();
   void normalWindow();
   void handleKey(int ch);
   void resetCursor();
   void resize();
+  // Execute a command line as if it had been typed.
+  void runCommand(std::string line);
+  // Feed the input of a replayed recording that is due.
+  void replayEvents();
 };
 
 
@@ -0,0 +1,197 @@
+#include "Condition.h"
+#include "dp2200_cpu_sim.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+typedef std::function<int(int)> Expression;
+
+// Recursive descent over the condition text. Every rule returns the closure
+// computing its value, so nothing is left to parse when the condition is checked.
+class ConditionParser {
+  class dp2200_cpu * cpu;
+  const unsigned long * hits;
+  std::string text;
+  size_t pos;
+  bool octal;
+  bool watch;
+  bool accept(const char * token);
+  Expression primary();
+  Expression comparison();
+  Expression negation();
+  Expression conjunction();
+  Expression disjunction();
+  public:
+  int error;
+  ConditionParser(class dp2200_cpu * cpu, const unsigned long * hits, std::string text, bool octal, bool watch);
+  Expression parse();
+};
+
+ConditionParser::ConditionParser(class dp2200_cpu * c, const unsigned long * h, std::string t, bool o, bool w) {
+  cpu = c;
+  hits = h;
+  text = t;
+  pos = 0;
+  octal = o;
+  watch = w;
+  error = CONDITION_OK;
+}
+
+bool ConditionParser::accept(const char * token) {
+  size_t length = strlen(token);
+  if (text.compare(pos, length, token) != 0) return false;
+  pos += length;
+  return true;
+}
+
+Expression ConditionParser::primary() {
+  static const char * registerNames = "ABCDEHL";
+  static const int registerIndex[] = {REG_A, REG_B, REG_C, REG_D, REG_E, REG_H, REG_L};
+  class dp2200_cpu * c = cpu;
+  std::string name;
+  if (accept("(")) {
+    Expression e = disjunction();
+    if (!accept(")")) error = CONDITION_SYNTAX_ERROR;
+    return e;
+  }
+  if (accept("[")) {
+    char * end;
+    int address = strtol(text.c_str() + pos, &end, octal ? 8 : 16) & 0xffff;
+    if (end == text.c_str() + pos) error = CONDITION_SYNTAX_ERROR;
+    pos = end - text.c_str();
+    if (!accept("]")) error = CONDITION_SYNTAX_ERROR;
+    return [c, address](int) { return (int) c->memory->physicalMemoryRead(address); };
+  }
+  if (pos < text.size() && isdigit(text[pos])) {
+    char * end;
+    int value = strtol(text.c_str() + pos, &end, octal ? 8 : 16);
+    pos = end - text.c_str();
+    return [value](int) { return value; };
+  }
+  while (pos < text.size() && isalpha(text[pos])) {
+    name += text[pos++];
+  }
+  if (name.size() == 1 && strchr(registerNames, name[0]) != NULL) {
+    int reg = registerIndex[strchr(registerNames, name[0]) - registerNames];
+    return [c, reg](int) { return (int) c->regSets[c->setSel].regs[reg]; };
+  }
+  if (name == "P") return [c](int) { return (int) c->P; };
+  if (name == "SP") return [c](int) { return (int) c->stackptr; };
+  if (name == "SET") return [c](int) { return c->setSel; };
+  if (name == "ALPHA") return [](int) { return 0; };
+  if (name == "BETA") return [](int) { return 1; };
+  if (name == "USER") return [c](int) { return c->userMode ? 1 : 0; };
+  if (name == "CARRY") return [c](int) { return (int) c->flagCarry[c->setSel]; };
+  if (name == "ZERO") return [c](int) { return (int) c->flagZero[c->setSel]; };
+  if (name == "SIGN") return [c](int) { return (int) c->flagSign[c->setSel]; };
+  if (name == "PARITY") return [c](int) { return (int) c->flagParity[c->setSel]; };
+  if (name == "HITS") {
+    const unsigned long * h = hits;
+    return [h](int) { return (int) *h; };
+  }
+  if (name == "DATA") {
+    if (!watch) error = CONDITION_DATA_NOT_ALLOWED;
+    return [](int data) { return data; };
+  }
+  error = name.size() == 0 ? CONDITION_SYNTAX_ERROR : CONDITION_UNKNOWN_NAME;
+  return [](int) { return 0; };
+}
+
+// Longer operators first so that <= is not taken for <.
+Expression ConditionParser::comparison() {
+  Expression l = primary(), r;
+  if (accept("==")) { r = primary(); return [l, r](int d) { return l(d) == r(d); }; }
+  if (accept("!=")) { r = primary(); return [l, r](int d) { return l(d) != r(d); }; }
+  if (accept("<=")) { r = primary(); return [l, r](int d) { return l(d) <= r(d); }; }
+  if (accept(">=")) { r = primary(); return [l, r](int d) { return l(d) >= r(d); }; }
+  if (accept("<")) { r = primary(); return [l, r](int d) { return l(d) < r(d); }; }
+  if (accept(">")) { r = primary(); return [l, r](int d) { return l(d) > r(d); }; }
+  return l;
+}
+
+Expression ConditionParser::negation() {
+  if (accept("!")) {
+    Expression e = negation();
+    return [e](int d) { return !e(d); };
+  }
+  return comparison();
+}
+
+Expression ConditionParser::conjunction() {
+  Expression e = negation();
+  while (accept("&&")) {
+    Expression r = negation();
+    e = [e, r](int d) { return e(d) && r(d); };
+  }
+  return e;
+}
+
+Expression ConditionParser::disjunction() {
+  Expression e = conjunction();
+  while (accept("||")) {
+    Expression r = conjunction();
+    e = [e, r](int d) { return e(d) || r(d); };
+  }
+  return e;
+}
+
+Expression ConditionParser::parse() {
+  Expression e = disjunction();
+  if (error == CONDITION_OK && pos != text.size()) error = CONDITION_SYNTAX_ERROR;
+  return e;
+}
+
+Condition::Condition(class dp2200_cpu * c) {
+  cpu = c;
+  hits = 0;
+}
+
+// An empty text compiles to a condition that always holds.
+int Condition::compile(std::string t, bool octal, bool watch) {
+  std::transform(t.begin(), t.end(), t.begin(), ::toupper);
+  class ConditionParser parser(cpu, &hits, t, octal, watch);
+  Expression e;
+  hits = 0;
+  text = t;
+  if (t.size() == 0) {
+    test = nullptr;
+    return CONDITION_OK;
+  }
+  e = parser.parse();
+  if (parser.error != CONDITION_OK) return parser.error;
+  test = e;
+  return CONDITION_OK;
+}
+
+bool Condition::check(int data, bool count) {
+  if (count) hits++;
+  return !test || test(data);
+}
+
+std::string Condition::getText() {
+  return text;
+}
+
+unsigned long Condition::getHits() {
+  return hits;
+}
+
+void Condition::setHits(unsigned long h) {
+  hits = h;
+}
+
+const char * Condition::errorString(int code) {
+  switch (code) {
+    case CONDITION_OK:
+      return "OK";
+    case CONDITION_SYNTAX_ERROR:
+      return "Syntax error";
+    case CONDITION_UNKNOWN_NAME:
+      return "Unknown register or name";
+    case CONDITION_DATA_NOT_ALLOWED:
+      return "DATA can only be used in a memory watch";
+    default:
+      return "Unknown error";
+  }
+}
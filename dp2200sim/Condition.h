@@ -0,0 +1,43 @@
+#ifndef _CONDITION_
+#define _CONDITION_
+#include <functional>
+#include <string>
+
+#define CONDITION_OK 0
+#define CONDITION_SYNTAX_ERROR -1
+#define CONDITION_UNKNOWN_NAME -2
+#define CONDITION_DATA_NOT_ALLOWED -3
+
+// Stop condition of a breakpoint or a memory watch, e.g. A==12&&SET==BETA.
+// The text is parsed once and compiled into a tree of closures that is only
+// evaluated when the address of the breakpoint or watch is reached.
+//   operands  A B C D E H L  registers of the selected set
+//             P SP           program counter and stack pointer
+//             SET            selected register set, ALPHA (0) or BETA (1)
+//             USER           1 in user mode on a 5500
+//             CARRY ZERO SIGN PARITY  flags of the selected set
+//             HITS           times the address has been reached, this one included
+//             DATA           byte being written, memory watches only
+//             [n]            byte at physical address n
+//             n              number in the current radix, starting with a digit
+//   operators == != < <= > >= ! && || and parentheses
+class Condition {
+  class dp2200_cpu * cpu;
+  std::function<int(int)> test;
+  std::string text;
+  unsigned long hits;
+  public:
+  Condition(class dp2200_cpu * cpu);
+  int compile(std::string text, bool octal, bool watch);
+  // Called each time the address is reached with the byte being written, or
+  // -1 for a breakpoint. Returns true if the CPU shall stop. Without count the
+  // hit is not counted, it tells whether the CPU stopped where it is.
+  bool check(int data, bool count = true);
+  std::string getText();
+  unsigned long getHits();
+  // Used to take the count back with a checkpoint.
+  void setHits(unsigned long hits);
+  static const char * errorString(int code);
+};
+
+#endif
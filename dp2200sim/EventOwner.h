@@ -0,0 +1,14 @@
+#ifndef _EVENT_OWNER_
+#define _EVENT_OWNER_
+
+// Something that has events on the timer queue of a machine, a device or the
+// machine itself. An event is a number telling what is to happen and an
+// argument, so that a pending event can be saved with the state of its owner.
+// fire is called when the simulated time of the event is reached.
+class EventOwner {
+  public:
+  virtual int fire(int event, long arg) = 0;
+  virtual ~EventOwner() {}
+};
+
+#endif
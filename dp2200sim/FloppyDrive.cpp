@@ -1,9 +1,14 @@
 #include "FloppyDrive.h"
+#include "StateFile.h"
 
 void printLog(const char *level, const char *fmt, ...);
 
 FloppyDrive::FloppyDrive() {
   file=NULL;
+  status=false;
+  writeProtect=false;
+  selectedTrack=0;
+  selectedSector=0;
 }
 
 bool FloppyDrive::isWriteProtected() {
@@ -101,7 +106,8 @@ int FloppyDrive::validateTrack(int track) {
   bool hasBadBlocks=false;
   int sectorMap[26];
   int mode = fgetc(file);
-  for (int i=0; i<26; i++) diskImage[track][sectorMap[i]-1].sectorType = 0;
+  // Sectors missing from the track are left marked as unavailable.
+  for (int i=0; i<26; i++) diskImage[track][i].sectorType = 0;
   if (feof(file)) {
     return FILE_PREMATURE_EOF;
   }
@@ -226,6 +232,7 @@ int FloppyDrive::openFile (std::string fileName, bool wp, bool wb) {
   if (file==NULL)  {
     return FILE_NOT_FOUND;
   }
+  this->fileName = fileName;
   while (!feof(file)) {
     int ch;
     ch = fgetc(file);
@@ -322,6 +329,14 @@ void FloppyDrive::setSector(int s) {
   selectedSector = s;
 }
 
+int FloppyDrive::getTrack() {
+  return selectedTrack;
+}
+
+int FloppyDrive::getSector() {
+  return selectedSector;
+}
+
 bool FloppyDrive::online() {
   return status;
 }
@@ -339,4 +354,44 @@ int FloppyDrive::writeSector(char * buffer) {
   diskImage[selectedTrack][sector+1].sectorType = 1;
 
   return FLOPPY_OK;
-}
\ No newline at end of file
+}
+
+void FloppyDrive::saveState(class StateFile * state) {
+  state->putBool(status);
+  state->putString(fileName);
+  state->putBool(writeProtect);
+  state->putBool(writeBack);
+  state->putInt(selectedTrack);
+  state->putInt(selectedSector);
+  if (status) {
+    for (int track=0; track<77; track++) {
+      for (int sector=0; sector<26; sector++) {
+        state->putInt(diskImage[track][sector].sectorType);
+        state->putBytes(diskImage[track][sector].data, 128);
+      }
+    }
+  }
+}
+
+int FloppyDrive::loadState(class StateFile * state) {
+  bool online = state->getBool();
+  std::string name = state->getString();
+  bool wp = state->getBool();
+  bool wb = state->getBool();
+  int ret = FILE_OK;
+  selectedTrack = state->getInt();
+  selectedSector = state->getInt();
+  if (online) {
+    ret = openFile(name, wp, wb);
+    // The saved image replaces the one just read.
+    for (int track=0; track<77; track++) {
+      for (int sector=0; sector<26; sector++) {
+        diskImage[track][sector].sectorType = state->getInt();
+        state->getBytes(diskImage[track][sector].data, 128);
+      }
+    }
+  } else {
+    closeFile();
+  }
+  return ret;
+}
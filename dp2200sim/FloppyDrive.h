@@ -21,6 +21,8 @@
 #define FLOPPY_DELETED_DATA -2
 #define FLOPPY_CRC_ERROR -3
 
+class StateFile;
+
 struct sector {
   int sectorType;
   unsigned char data[128];
@@ -54,12 +56,18 @@ class FloppyDrive {
   int readSector(char * buffer); 
   void setTrack(int t);
   void setSector(int s);
+  int getTrack();
+  int getSector();
   bool online();
   int writeSector(char * buffer);
   int writeBackIMD();
   int writeBackRaw();
   int writeTrackBackIMD(int track);
   bool isWriteProtected();
+  // The image is saved in full since the guest may have changed it without
+  // it being written back to the file.
+  void saveState(class StateFile * state);
+  int loadState(class StateFile * state);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,19 @@
+#include "Headless.h"
+#include "Machine.h"
+#include <cstdarg>
+#include <cstring>
+
+FILE * headlessLog = NULL;
+
+void printLog(const char *level, const char *fmt, ...) {
+  char buffer[256];
+  int charsPrinted;
+  va_list args;
+  FILE * f = (Machine::current != NULL && Machine::current->log != NULL) ? Machine::current->log : headlessLog;
+  if (f == NULL) return;
+  va_start(args, fmt);
+  charsPrinted = snprintf(buffer, sizeof(buffer), "%s ", level);
+  vsnprintf(buffer + charsPrinted, sizeof(buffer) - charsPrinted, fmt, args);
+  fwrite(buffer, strlen(buffer), 1, f);
+  va_end(args);
+}
@@ -0,0 +1,13 @@
+#ifndef _HEADLESS_
+#define _HEADLESS_
+#include <cstdio>
+
+// The log of programs that run the simulator without a terminal, cpubench,
+// corpus and checks. Give each machine a ScreenText of its own as its screen.
+// Link Headless.o instead of main.o and the window objects.
+
+// printLog writes to the log of the machine running on the thread, or here if
+// it has none. Nothing is logged while both are NULL.
+extern FILE * headlessLog;
+
+#endif
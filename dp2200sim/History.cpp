@@ -0,0 +1,187 @@
+#include "History.h"
+#include "Condition.h"
+#include "Machine.h"
+#include "StateFile.h"
+#include <algorithm>
+#include <climits>
+
+History::History(class Machine * m) {
+  machine = m;
+  interval = HISTORY_INTERVAL;
+  nextCheckpoint = 0;
+}
+
+void History::setInterval(unsigned long instructions) {
+  interval = instructions;
+  clear();
+}
+
+unsigned long History::getInterval() {
+  return interval;
+}
+
+void History::update() {
+  std::shared_ptr<class StateFile> state;
+  std::vector<std::pair<std::shared_ptr<class Condition>, unsigned long>> hits;
+  unsigned long now = machine->cpu.instructions;
+  if (interval == 0 || now < nextCheckpoint) return;
+  if (!checkpoints.empty() && checkpoints.back().instruction == now) {
+    nextCheckpoint = now + interval;
+    return;
+  }
+  state = std::make_shared<class StateFile>();
+  machine->capture(state.get());
+  for (auto condition : machine->cpu.getConditions()) {
+    hits.push_back({condition, condition->getHits()});
+  }
+  checkpoints.push_back({now, state, hits});
+  if (checkpoints.size() > HISTORY_DEPTH) {
+    checkpoints.pop_front();
+    while (!inputs.empty() && inputs.front().first < checkpoints.front().instruction) {
+      inputs.pop_front();
+    }
+  }
+  nextCheckpoint = now + interval;
+}
+
+unsigned long History::nextStop() {
+  return interval == 0 ? ULONG_MAX : nextCheckpoint;
+}
+
+void History::recordKey(unsigned long instruction, int key) {
+  if (checkpoints.empty()) return;
+  inputs.push_back({instruction, key});
+}
+
+void History::recordStep(unsigned long instruction) {
+  recordKey(instruction, HISTORY_STEP);
+}
+
+void History::clear() {
+  checkpoints.clear();
+  inputs.clear();
+  nextCheckpoint = machine->cpu.instructions;
+}
+
+int History::size() {
+  return checkpoints.size();
+}
+
+unsigned long History::oldest() {
+  return checkpoints.empty() ? 0 : checkpoints.front().instruction;
+}
+
+// A condition added after the checkpoint starts counting from it.
+int History::restore(int index) {
+  auto & hits = checkpoints[index].hits;
+  if (machine->restore(checkpoints[index].state.get()) != STATE_OK) return HISTORY_RESTORE_FAILED;
+  for (auto condition : machine->cpu.getConditions()) {
+    auto saved = std::find_if(hits.begin(), hits.end(), [&condition](const std::pair<std::shared_ptr<class Condition>, unsigned long> & h) { return h.first == condition; });
+    condition->setHits(saved == hits.end() ? 0 : saved->second);
+  }
+  return HISTORY_OK;
+}
+
+// Execute from the restored checkpoint up to target, feeding the input that was
+// given in between. Breakpoints, watches and halts do not stop it but the last
+// instruction count where one of them stopped the CPU is left in lastStop.
+void History::runTo(unsigned long target, unsigned long * lastStop) {
+  class dp2200_cpu * cpu = &machine->cpu;
+  struct timespec forever = {LONG_MAX, 0};
+  auto key = std::lower_bound(inputs.begin(), inputs.end(), std::make_pair(cpu->instructions, INT_MIN));
+  // The hit at the checkpoint was counted before it was taken.
+  if (lastStop != NULL && cpu->atBreakpoint(false)) {
+    *lastStop = cpu->instructions;
+  }
+  while (cpu->instructions < target) {
+    bool stepped = false;
+    while (key != inputs.end() && key->first <= cpu->instructions) {
+      int input = (key++)->second;
+      if (input == HISTORY_STEP) {
+        // The same as the STEP command.
+        cpu->interruptPending = 0;
+        cpu->execute();
+        stepped = true;
+        break;
+      }
+      if (onKey) onKey(input);
+    }
+    if (stepped) continue;
+    machine->stopAt = target;
+    if (key != inputs.end() && key->first < target) {
+      machine->stopAt = key->first;
+    }
+    machine->running = true;
+    machine->run(&forever);
+    if (!machine->running && lastStop != NULL && cpu->instructions < target) {
+      *lastStop = cpu->instructions;
+    }
+  }
+  machine->running = false;
+  machine->stopAt = ULONG_MAX;
+}
+
+// Land at target from checkpoint index and forget what came after it.
+int History::goTo(int index, unsigned long target) {
+  int ret;
+  if ((ret = restore(index)) != HISTORY_OK) {
+    clear();
+    return ret;
+  }
+  runTo(target, NULL);
+  checkpoints.erase(checkpoints.begin() + index + 1, checkpoints.end());
+  while (!inputs.empty() && inputs.back().first >= target) {
+    inputs.pop_back();
+  }
+  nextCheckpoint = checkpoints.back().instruction + interval;
+  return HISTORY_OK;
+}
+
+int History::stepBack(unsigned long count) {
+  unsigned long now = machine->cpu.instructions;
+  unsigned long target = count > now ? 0 : now - count;
+  for (int i = checkpoints.size() - 1; i >= 0; i--) {
+    if (checkpoints[i].instruction <= target) {
+      return goTo(i, target);
+    }
+  }
+  return HISTORY_NO_CHECKPOINT;
+}
+
+// Search the intervals between checkpoints from the newest one backwards.
+int History::reverseContinue() {
+  unsigned long now = machine->cpu.instructions;
+  unsigned long end = now;
+  int ret;
+  if (checkpoints.empty()) return HISTORY_NO_CHECKPOINT;
+  for (int i = checkpoints.size() - 1; i >= 0; i--) {
+    unsigned long stop = ULONG_MAX;
+    if (checkpoints[i].instruction >= now) continue;
+    if ((ret = restore(i)) != HISTORY_OK) {
+      clear();
+      return ret;
+    }
+    runTo(end, &stop);
+    if (stop != ULONG_MAX) {
+      return goTo(i, stop);
+    }
+    end = checkpoints[i].instruction;
+  }
+  ret = goTo(0, checkpoints.front().instruction);
+  return ret == HISTORY_OK ? HISTORY_NOT_FOUND : ret;
+}
+
+const char * History::errorString(int code) {
+  switch (code) {
+    case HISTORY_OK:
+      return "OK";
+    case HISTORY_NO_CHECKPOINT:
+      return "No checkpoint that far back";
+    case HISTORY_NOT_FOUND:
+      return "The CPU did not stop since the oldest checkpoint";
+    case HISTORY_RESTORE_FAILED:
+      return "Unable to restore the checkpoint";
+    default:
+      return "Unknown error";
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef _HISTORY_
+#define _HISTORY_
+#include <deque>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Instructions between two checkpoints, and how many checkpoints are kept.
+#define HISTORY_INTERVAL 1000000
+#define HISTORY_DEPTH 32
+
+// Input logged for a STEP command instead of a key.
+#define HISTORY_STEP -1
+
+#define HISTORY_OK 0
+#define HISTORY_NO_CHECKPOINT -1
+#define HISTORY_NOT_FOUND -2
+#define HISTORY_RESTORE_FAILED -3
+
+// Checkpoints of a machine taken in memory every interval instructions, and
+// the keys given to the guest and the single steps made in between. Going back
+// restores the nearest earlier checkpoint and executes forward to the target
+// instruction count, feeding the keys again where they were typed and
+// stepping where the user stepped. Since device timing runs on simulated time
+// this ends in the same state the machine was in then. The hit counts of the
+// breakpoint and watch conditions are kept with each checkpoint, so HITS is the
+// same when executing forward again.
+class History {
+  struct checkpoint {
+    unsigned long instruction;
+    std::shared_ptr<class StateFile> state;
+    std::vector<std::pair<std::shared_ptr<class Condition>, unsigned long>> hits;
+  };
+  std::deque<struct checkpoint> checkpoints;
+  std::deque<std::pair<unsigned long, int>> inputs;
+  class Machine * machine;
+  unsigned long interval;
+  unsigned long nextCheckpoint;
+  int restore(int index);
+  void runTo(unsigned long target, unsigned long * lastStop);
+  int goTo(int index, unsigned long target);
+  public:
+  // Delivers a key to the guest when executing forward.
+  std::function<void(int)> onKey;
+  History(class Machine * machine);
+  // 0 turns checkpointing off.
+  void setInterval(unsigned long instructions);
+  unsigned long getInterval();
+  // Take a checkpoint if one is due.
+  void update();
+  // Instruction count at which update should next be called.
+  unsigned long nextStop();
+  void recordKey(unsigned long instruction, int key);
+  // Called before a STEP command executes an instruction. Stepping runs no timers.
+  void recordStep(unsigned long instruction);
+  // Forget everything. Used when the machine is changed from the outside.
+  void clear();
+  int size();
+  unsigned long oldest();
+  int stepBack(unsigned long count);
+  // Go back to the last time the CPU stopped at a breakpoint, a watch or a halt.
+  int reverseContinue();
+  static const char * errorString(int code);
+};
+
+
+#endif
@@ -0,0 +1,98 @@
+#include "IOWorkerPool.h"
+#include "Machine.h"
+
+IOWorkerPool::IOWorkerPool(int threads) {
+  stopping = false;
+  completed = 0;
+  for (int i=0; i<threads; i++) {
+    workers.emplace_back(&IOWorkerPool::worker, this);
+  }
+}
+
+IOWorkerPool::~IOWorkerPool() {
+  // Queued jobs are still run so that pending write backs reach the files.
+  {
+    std::unique_lock<std::mutex> l(lock);
+    stopping = true;
+  }
+  workAvailable.notify_all();
+  for (auto it = workers.begin(); it < workers.end(); it++) {
+    it->join();
+  }
+}
+
+void IOWorkerPool::worker() {
+  std::unique_lock<std::mutex> l(lock);
+  for (;;) {
+    // Pick the oldest job whose key is not already being served by another worker.
+    auto it = queue.begin();
+    while (it != queue.end() && busyKeys.count(it->key)) it++;
+    if (it == queue.end()) {
+      if (stopping && queue.empty()) return;
+      workAvailable.wait(l);
+      continue;
+    }
+    const void * key = it->key;
+    class Machine * machine = it->machine;
+    std::packaged_task<int()> task = std::move(it->task);
+    queue.erase(it);
+    busyKeys.insert(key);
+    busyMachines.insert(machine);
+    l.unlock();
+    Machine::current = machine;
+    task();
+    Machine::current = NULL;
+    l.lock();
+    busyKeys.erase(key);
+    busyMachines.erase(busyMachines.find(machine));
+    completed++;
+    jobDone.notify_all();
+    workAvailable.notify_all();
+  }
+}
+
+std::shared_future<int> IOWorkerPool::submit(const void * key, std::function<int()> func) {
+  std::packaged_task<int()> task(func);
+  std::shared_future<int> result = task.get_future().share();
+  {
+    std::unique_lock<std::mutex> l(lock);
+    queue.push_back({key, Machine::current, std::move(task)});
+  }
+  workAvailable.notify_one();
+  return result;
+}
+
+bool IOWorkerPool::isPending(const void * key) {
+  if (busyKeys.count(key)) return true;
+  for (auto it = queue.begin(); it != queue.end(); it++) {
+    if (it->key == key) return true;
+  }
+  return false;
+}
+
+bool IOWorkerPool::isPending(class Machine * machine) {
+  if (busyMachines.count(machine)) return true;
+  for (auto it = queue.begin(); it != queue.end(); it++) {
+    if (it->machine == machine) return true;
+  }
+  return false;
+}
+
+void IOWorkerPool::drain(const void * key) {
+  std::unique_lock<std::mutex> l(lock);
+  while (isPending(key)) {
+    jobDone.wait(l);
+  }
+}
+
+void IOWorkerPool::drain(class Machine * machine) {
+  std::unique_lock<std::mutex> l(lock);
+  while (isPending(machine)) {
+    jobDone.wait(l);
+  }
+}
+
+unsigned long IOWorkerPool::getCompleted() {
+  std::unique_lock<std::mutex> l(lock);
+  return completed;
+}
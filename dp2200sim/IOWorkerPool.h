@@ -0,0 +1,50 @@
+#ifndef _IO_WORKER_POOL_
+#define _IO_WORKER_POOL_
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#define IO_WORKER_POOL_DEFAULT_THREADS 2
+
+// Small pool of host threads doing blocking file I/O on behalf of the devices.
+// Jobs are submitted with a key, normally the drive object, and jobs with the
+// same key are run one at a time in the order they were submitted. The device
+// keeps its busy status until the simulated completion time and then collects
+// the result from the returned future in its timer callback. A job runs with
+// Machine::current set as it was when the job was submitted, so that it logs to
+// the log of its machine.
+class IOWorkerPool {
+  struct job {
+    const void * key;
+    class Machine * machine;
+    std::packaged_task<int()> task;
+  };
+  std::mutex lock;
+  std::condition_variable workAvailable;
+  std::condition_variable jobDone;
+  std::deque<struct job> queue;
+  std::set<const void *> busyKeys;
+  std::multiset<class Machine *> busyMachines;
+  std::vector<std::thread> workers;
+  bool stopping;
+  unsigned long completed;
+  bool isPending(const void * key);
+  bool isPending(class Machine * machine);
+  void worker();
+  public:
+  IOWorkerPool(int threads = IO_WORKER_POOL_DEFAULT_THREADS);
+  ~IOWorkerPool();
+  std::shared_future<int> submit(const void * key, std::function<int()> func);
+  // Wait until all jobs queued for key have finished.
+  void drain(const void * key);
+  // Wait until all jobs submitted for machine have finished.
+  void drain(class Machine * machine);
+  unsigned long getCompleted();
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include "LatencyModel.h"
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+
+LatencyModel::LatencyModel(long step, long settle, long revolution, int spt) {
+  mode = LATENCY_FIXED;
+  stepTime = step;
+  settleTime = settle;
+  revolutionTime = revolution;
+  sectorsPerTrack = spt;
+  clock = NULL;
+}
+
+void LatencyModel::setClock(const struct timespec * c) {
+  clock = c;
+}
+
+int LatencyModel::setMode(std::string name) {
+  std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+  if (name.size() == 0) {
+    return 1;
+  }
+  if (std::string("FIXED").find(name) == 0) {
+    mode = LATENCY_FIXED;
+  } else if (std::string("REALISTIC").find(name) == 0) {
+    mode = LATENCY_REALISTIC;
+  } else if (std::string("INSTANT").find(name) == 0) {
+    mode = LATENCY_INSTANT;
+  } else {
+    return 1;
+  }
+  return 0;
+}
+
+int LatencyModel::getMode() {
+  return mode;
+}
+
+const char * LatencyModel::getModeName() {
+  switch (mode) {
+    case LATENCY_REALISTIC:
+      return "REALISTIC";
+    case LATENCY_INSTANT:
+      return "INSTANT";
+    default:
+      return "FIXED";
+  }
+}
+
+// Where on the track the heads are right now, in nanoseconds since the index mark.
+long LatencyModel::rotationalPosition() {
+  if (clock == NULL) {
+    return 0;
+  }
+  return (long) ((clock->tv_sec * 1000000000LL + clock->tv_nsec) % revolutionTime);
+}
+
+long LatencyModel::fixed(long nanos) {
+  if (mode == LATENCY_INSTANT) {
+    return 0;
+  }
+  return nanos;
+}
+
+long LatencyModel::seek(int from, int to, long nanos) {
+  switch (mode) {
+    case LATENCY_INSTANT:
+      return 0;
+    case LATENCY_REALISTIC:
+      if (from == to) {
+        return 0;
+      }
+      return settleTime + labs(to - from) * stepTime;
+    default:
+      return nanos;
+  }
+}
+
+long LatencyModel::transfer(int sector, long nanos) {
+  long sectorTime = revolutionTime / sectorsPerTrack;
+  long start;
+  switch (mode) {
+    case LATENCY_INSTANT:
+      return 0;
+    case LATENCY_REALISTIC:
+      start = (sector % sectorsPerTrack) * sectorTime;
+      return (start - rotationalPosition() + revolutionTime) % revolutionTime + sectorTime;
+    default:
+      return nanos;
+  }
+}
+
+long LatencyModel::track(long nanos) {
+  switch (mode) {
+    case LATENCY_INSTANT:
+      return 0;
+    case LATENCY_REALISTIC:
+      return (revolutionTime - rotationalPosition()) % revolutionTime + revolutionTime;
+    default:
+      return nanos;
+  }
+}
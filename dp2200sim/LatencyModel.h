@@ -0,0 +1,41 @@
+#ifndef _LATENCY_MODEL_
+#define _LATENCY_MODEL_
+#include <ctime>
+#include <string>
+
+#define LATENCY_FIXED 0
+#define LATENCY_REALISTIC 1
+#define LATENCY_INSTANT 2
+
+// Decides how long a device operation takes in simulated time.
+// FIXED uses the constant delays the devices always had. REALISTIC derives
+// seek time from the number of cylinders moved and adds rotational latency
+// from the simulated time. INSTANT completes everything at once so that I/O
+// bound programs run at host speed.
+class LatencyModel {
+  int mode;
+  long stepTime;
+  long settleTime;
+  long revolutionTime;
+  int sectorsPerTrack;
+  // Simulated time of the machine the device belongs to.
+  const struct timespec * clock;
+  long rotationalPosition();
+  public:
+  LatencyModel(long stepTime, long settleTime, long revolutionTime, int sectorsPerTrack);
+  void setClock(const struct timespec * clock);
+  // Returns 0 if the mode name is FIXED, REALISTIC or INSTANT (may be shortened), 1 otherwise.
+  int setMode(std::string name);
+  int getMode();
+  const char * getModeName();
+  // Select and controller handshake delays. Not affected by the head position.
+  long fixed(long nanos);
+  // Move the heads from cylinder from to cylinder to.
+  long seek(int from, int to, long nanos);
+  // Wait for sector to come under the head and transfer it.
+  long transfer(int sector, long nanos);
+  // Wait for the index mark and then write a full track.
+  long track(long nanos);
+};
+
+#endif
@@ -0,0 +1,297 @@
+#include "Machine.h"
+#include "IOWorkerPool.h"
+#include "StateFile.h"
+#include <algorithm>
+#include <climits>
+#include <memory>
+
+void printLog(const char *level, const char *fmt, ...);
+
+thread_local class Machine * Machine::current = NULL;
+
+struct timespec subtractTimeSpec (struct timespec a, struct timespec b, bool * negative) {
+  struct timespec diff;
+  if ((b.tv_sec > a.tv_sec) || ((b.tv_sec == a.tv_sec) && (b.tv_nsec > a.tv_nsec) )) {
+    // b is larger do reverse subtracton and return negative tv_sec
+    if (negative!=NULL) *negative=true;
+    diff.tv_nsec = b.tv_nsec - a.tv_nsec;
+    diff.tv_sec = b.tv_sec - a.tv_sec;
+  } else {
+    // a is larger than b
+    if (negative!=NULL) *negative=false;
+    diff.tv_nsec = a.tv_nsec - b.tv_nsec;
+    diff.tv_sec = a.tv_sec - b.tv_sec;
+  }
+  if (diff.tv_nsec < 0) {
+    diff.tv_sec--;
+    diff.tv_nsec +=1000000000;
+  }
+  return diff;
+}
+
+// returns true if a >= b false otherwise
+bool compareTimeSpec (struct timespec a, struct timespec b) {
+
+  if ((b.tv_sec > a.tv_sec) || ((b.tv_sec == a.tv_sec) && (b.tv_nsec > a.tv_nsec) )) {
+    return false;
+  } else {
+    return true;
+  }
+}
+
+void addTimeSpec(struct timespec * after, struct timespec * before, long increment ) {
+  after->tv_nsec = before->tv_nsec + increment;
+  after->tv_sec = before->tv_sec;
+  if (after->tv_nsec>1000000000) {
+    after->tv_sec++;
+    after->tv_nsec -= 1000000000;
+  }
+}
+
+bool nowIsLessThan(struct timespec * after) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return !compareTimeSpec(now, *after);
+}
+
+long nanosSince(struct timespec * start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000000000L + now.tv_nsec - start->tv_nsec;
+}
+
+#define MACHINE_EVENT_INTERRUPT 0
+#define MACHINE_EVENT_FRAME 1
+
+// An event is never saved with more than this many pending.
+#define MAX_SAVED_EVENTS 1000
+
+static bool compareCallbackRecord (const class callbackRecord & a, const class callbackRecord & b) {
+  if (a.deadline.tv_sec != b.deadline.tv_sec || a.deadline.tv_nsec != b.deadline.tv_nsec) {
+    return !compareTimeSpec(a.deadline, b.deadline);
+  }
+  return a.sequence < b.sequence;
+}
+
+Machine::Machine(class IOWorkerPool * workers) : hooks(this) {
+  running = false;
+  stopAt = ULONG_MAX;
+  log = NULL;
+  logNanos = 0;
+  screen = NULL;
+  if (workers == NULL) {
+    ownWorkers.reset(new IOWorkerPool());
+    workers = ownWorkers.get();
+  }
+  ioWorkers = workers;
+  yield = 100.0;
+  timerEvents = 0;
+  callbackNanos = 0;
+  frameNanos = 0;
+  runNanos = 0;
+  sequence = 0;
+  cpu.ioCtrl->attach(this);
+  addEvent(this, MACHINE_EVENT_INTERRUPT, 0, 1000000);
+  addEvent(this, MACHINE_EVENT_FRAME, 0, 16666666);
+}
+
+// The jobs of the machine, a state file being written or a track written
+// back, are finished first. They may log to the machine.
+Machine::~Machine() {
+  ioWorkers->drain(this);
+}
+
+void Machine::addEvent(class EventOwner * owner, int event, long arg, struct timespec deadline, unsigned long sequence) {
+  class callbackRecord c = {owner, event, arg, deadline, sequence};
+  timerqueue.insert(std::upper_bound(timerqueue.begin(), timerqueue.end(), c, compareCallbackRecord), c);
+}
+
+struct timespec Machine::deadlineIn(long nanos) {
+  struct timespec deadline = cpu.totalInstructionTime;
+  deadline.tv_nsec += nanos % 1000000000;
+  deadline.tv_sec += nanos / 1000000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_nsec -= 1000000000;
+    deadline.tv_sec++;
+  }
+  return deadline;
+}
+
+void Machine::addEvent(class EventOwner * owner, int event, long arg, long nanos) {
+  addEvent(owner, event, arg, deadlineIn(nanos), sequence++);
+}
+
+void Machine::removeEvents(class EventOwner * owner) {
+  printLog("INFO", "Removing the events of %p, size of timerQueue: %d\n", owner, timerqueue.size());
+  timerqueue.erase(std::remove_if(timerqueue.begin(), timerqueue.end(), [owner](const class callbackRecord & c) {
+        return c.owner == owner;
+      }), timerqueue.end());
+}
+
+void Machine::saveEvents(class EventOwner * owner, class StateFile * state) {
+  int count = std::count_if(timerqueue.begin(), timerqueue.end(), [owner](const class callbackRecord & c) {
+      return c.owner == owner;
+    });
+  state->putInt(count);
+  for (auto it = timerqueue.begin(); it < timerqueue.end(); it++) {
+    if (it->owner != owner) continue;
+    state->putInt(it->event);
+    state->putLong(it->arg);
+    state->putLong(timerDelay(&*it));
+    state->putLong(it->sequence);
+  }
+}
+
+int Machine::loadEvents(class EventOwner * owner, class StateFile * state) {
+  int count = state->getInt();
+  if (count < 0 || count > MAX_SAVED_EVENTS) return STATE_BAD_FORMAT;
+  for (int i=0; i<count; i++) {
+    int event = state->getInt();
+    long arg = state->getLong();
+    long delay = state->getLong();
+    unsigned long saved = state->getLong();
+    if (state->failed() || delay < 0) return STATE_BAD_FORMAT;
+    addEvent(owner, event, arg, deadlineIn(delay), saved);
+  }
+  return STATE_OK;
+}
+
+struct timespec Machine::nextDeadline() {
+  return timerqueue.size() > 0 ? timerqueue.front().deadline : cpu.totalInstructionTime;
+}
+
+int Machine::timerDepth() {
+  return timerqueue.size();
+}
+
+long Machine::timerDelay(class callbackRecord * c) {
+  struct timespec diff;
+  bool negative;
+  diff = subtractTimeSpec(c->deadline, cpu.totalInstructionTime, &negative);
+  if (negative) return 0;
+  return diff.tv_sec * 1000000000L + diff.tv_nsec;
+}
+
+int Machine::fire(int event, long arg) {
+  struct timespec start;
+  switch (event) {
+    case MACHINE_EVENT_INTERRUPT:
+      printLog("INFO", "1 ms Interrupt timer ENTRY\n");
+      cpu.interruptPending = 1;
+      addEvent(this, MACHINE_EVENT_INTERRUPT, 0, 1000000);
+      printLog("INFO", "1 ms Interrupt timer  EXIT\n");
+      break;
+    case MACHINE_EVENT_FRAME:
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      if (onFrame) onFrame();
+      frameNanos += nanosSince(&start);
+      addEvent(this, MACHINE_EVENT_FRAME, 0, 16666666); // 16 ms
+      break;
+  }
+  return 0;
+}
+
+void Machine::run(struct timespec * until) {
+  class Machine * previous = current;
+  struct timespec entered, started;
+  current = this;
+  // A watch hit by STEP, with the CPU already stopped, is not kept.
+  cpu.memory->watchHit = false;
+  clock_gettime(CLOCK_MONOTONIC, &entered);
+  while (running && cpu.instructions < stopAt && nowIsLessThan(until)) {
+    // Run instructions, or a whole loop of the firmware if it has a hook
+    bool hooked = cpu.P >= ROM_HOOKS_START && hooks.run() > 0;
+    if (!hooked) {
+      if (cpu.execute()) {
+        if (cpu.cpuIs5500()) {
+          if (cpu.isAutorestartEnabled()) {
+            cpu.P=0175724;
+          } else {
+            running = false;
+          }
+        } else {
+          running = false;
+        }
+      }
+    }
+    if (hooked ? hooks.atBreakpoint() : cpu.atBreakpoint()) {
+      running = false;
+    }
+    if (cpu.memory->watchHit) {
+      cpu.memory->watchHit = false;
+      running = false;
+    }
+    if (timerqueue.size()>0 && compareTimeSpec(timerqueue.front().deadline, cpu.totalInstructionTime)) {
+      continue;
+    }
+    if (timerqueue.size() == 0) continue;
+    class callbackRecord timerRecord = timerqueue.front();
+    timerqueue.erase(timerqueue.begin());
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    timerRecord.owner->fire(timerRecord.event, timerRecord.arg);
+    callbackNanos += nanosSince(&started);
+    timerEvents++;
+  }
+  runNanos += nanosSince(&entered);
+  current = previous;
+}
+
+int Machine::capture(class StateFile * state) {
+  cpu.saveState(state);
+  state->beginSection("TIMR");
+  state->putLong(sequence);
+  saveEvents(this, state);
+  return STATE_OK;
+}
+
+int Machine::replace(class StateFile * state) {
+  long interruptDelay, screenDelay;
+  int ret;
+  running = false;
+  // Pending events belong to the state being replaced. The devices load their own.
+  timerqueue.clear();
+  ret = cpu.loadState(state);
+  if (ret != STATE_OK) return ret;
+  if (state->findSection("TIMR") != STATE_OK) return STATE_MISSING_SECTION;
+  if (state->getVersion() >= 3) {
+    sequence = state->getLong();
+    return loadEvents(this, state);
+  }
+  // Before version 3 only the two periodic timers were saved.
+  interruptDelay = state->getLong();
+  screenDelay = state->getLong();
+  if (state->failed()) return STATE_BAD_FORMAT;
+  addEvent(this, MACHINE_EVENT_INTERRUPT, 0, interruptDelay);
+  addEvent(this, MACHINE_EVENT_FRAME, 0, screenDelay);
+  return STATE_OK;
+}
+
+int Machine::restore(class StateFile * state) {
+  class StateFile undo;
+  int ret;
+  capture(&undo);
+  if ((ret = replace(state)) != STATE_OK) {
+    printLog("INFO", "Restoring the state failed with %d, putting the machine back\n", ret);
+    replace(&undo);
+  }
+  return ret;
+}
+
+int Machine::saveState(std::string fileName, std::shared_future<int> * done) {
+  std::shared_ptr<class StateFile> state = std::make_shared<class StateFile>();
+  int ret = capture(state.get());
+  if (ret != STATE_OK) return ret;
+  *done = ioWorkers->submit(&stateFileKey, [state, fileName]() -> int {
+      return state->write(fileName);
+    });
+  return STATE_OK;
+}
+
+int Machine::loadState(std::string fileName) {
+  class StateFile state;
+  int ret;
+  // The file may still be being written.
+  ioWorkers->drain(&stateFileKey);
+  if ((ret = state.read(fileName)) != STATE_OK) return ret;
+  return restore(&state);
+}
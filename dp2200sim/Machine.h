@@ -0,0 +1,114 @@
+#ifndef _MACHINE_
+#define _MACHINE_
+#include <atomic>
+#include <cstdio>
+#include <ctime>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include "dp2200_cpu_sim.h"
+#include "EventOwner.h"
+#include "RomHooks.h"
+
+class callbackRecord {
+  public:
+  class EventOwner * owner;
+  int event;
+  long arg;
+  struct timespec deadline;
+  // Events with the same deadline fire in the order they were added.
+  unsigned long sequence;
+};
+
+struct timespec subtractTimeSpec (struct timespec a, struct timespec b, bool * negative=NULL);
+bool compareTimeSpec (struct timespec a, struct timespec b);
+void addTimeSpec(struct timespec * after, struct timespec * before, long increment);
+bool nowIsLessThan(struct timespec * after);
+// Wall clock nanoseconds elapsed since start.
+long nanosSince(struct timespec * start);
+
+// One simulated computer. It owns the CPU, with its memory and I/O controller,
+// the queue of timers run on simulated time and the file it logs to, and knows
+// the screen it draws on and the I/O workers of its devices. The devices work
+// through the machine they are attached to. printLog finds the machine through
+// Machine::current, which is set by the thread running it and by the I/O
+// workers running a job for it, so any number of machines can run in one
+// process, see MachineHost.h.
+class Machine : public EventOwner {
+  // Sorted on deadline and sequence, the next event first.
+  std::vector<class callbackRecord> timerqueue;
+  unsigned long sequence;
+  // Key for the I/O worker writing state files.
+  char stateFileKey;
+  // The I/O workers of a machine not given any.
+  std::unique_ptr<class IOWorkerPool> ownWorkers;
+  void addEvent(class EventOwner * owner, int event, long arg, struct timespec deadline, unsigned long sequence);
+  // nanos from now in simulated time.
+  struct timespec deadlineIn(long nanos);
+  long timerDelay(class callbackRecord * c);
+  // restore without putting the machine back when the state turns out to be bad.
+  int replace(class StateFile * state);
+  public:
+  class dp2200_cpu cpu;
+  // Loops of the 5500 firmware run natively by run.
+  class RomHooks hooks;
+  bool running;
+  // run returns when the CPU has executed this many instructions.
+  unsigned long stopAt;
+  // With NULL the headless programs log to headlessLog, the simulator not at all.
+  FILE * log;
+  // Host time spent in printLog, also by the I/O workers.
+  std::atomic<long> logNanos;
+  // The screen and keyboard device draws on screen. onLights is called when
+  // the DISPLAY and KEYBOARD lights change. The buttons and lights themselves
+  // are kept in the CPU.
+  class ScreenText * screen;
+  std::function<void()> onLights;
+  // Blocking file I/O of the devices and state files is done here.
+  class IOWorkerPool * ioWorkers;
+  // Percentage of the wall clock the machine may run, 0 to 100.
+  float yield;
+  // Called from the 60 Hz screen timer.
+  std::function<void()> onFrame;
+  // Timer callbacks run, and the host time spent in them and in onFrame.
+  unsigned long timerEvents;
+  long callbackNanos;
+  long frameNanos;
+  // Host time spent in run.
+  long runNanos;
+  static thread_local class Machine * current;
+  // Machines run together can share their I/O workers. Without any the
+  // machine starts workers of its own.
+  Machine(class IOWorkerPool * ioWorkers = NULL);
+  ~Machine();
+  // Fire event of owner nanos from now in simulated time.
+  void addEvent(class EventOwner * owner, int event, long arg, long nanos);
+  // Cancel every event owner has pending.
+  void removeEvents(class EventOwner * owner);
+  // The pending events of owner are saved with it, their deadlines relative to
+  // the CPU time. loadEvents is called once the CPU time has been restored.
+  void saveEvents(class EventOwner * owner, class StateFile * state);
+  int loadEvents(class EventOwner * owner, class StateFile * state);
+  // The 1 ms interrupt and the 60 Hz screen timer.
+  int fire(int event, long arg);
+  int timerDepth();
+  // Simulated time of the first timer, now if there is none.
+  struct timespec nextDeadline();
+  // Execute instructions and expire timers until the CPU stops, the wall clock
+  // reaches until or the instruction count reaches stopAt.
+  void run(struct timespec * until);
+  // Capture the machine in memory, together with the device operations in progress.
+  int capture(class StateFile * state);
+  // Replace the machine with a captured one. The CPU is left stopped. If the
+  // state can not be restored completely the machine is left as it was.
+  int restore(class StateFile * state);
+  // Capture the machine and hand the state over to an I/O worker which compresses
+  // and writes it. done gets the result of the write.
+  int saveState(std::string fileName, std::shared_future<int> * done);
+  // Replace the machine with the one saved in fileName, as restore does.
+  int loadState(std::string fileName);
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include "MachineHost.h"
+#include "Machine.h"
+#include "StateFile.h"
+#include <chrono>
+
+MachineHost::MachineHost(int threads, long s) {
+  active = 0;
+  stopping = false;
+  slice = s;
+  for (int i=0; i<threads; i++) {
+    workers.emplace_back(&MachineHost::worker, this);
+  }
+}
+
+MachineHost::~MachineHost() {
+  // Machines still queued are run until they are done.
+  {
+    std::unique_lock<std::mutex> l(lock);
+    stopping = true;
+  }
+  workAvailable.notify_all();
+  for (auto it = workers.begin(); it < workers.end(); it++) {
+    it->join();
+  }
+}
+
+bool MachineHost::runSlice(struct session * s) {
+  struct timespec started, until;
+  bool more;
+  Machine::current = s->machine;
+  clock_gettime(CLOCK_MONOTONIC, &started);
+  addTimeSpec(&until, &started, (long) (s->machine->yield / 100 * slice));
+  s->machine->run(&until);
+  more = s->step();
+  addTimeSpec(&s->notBefore, &started, slice);
+  Machine::current = NULL;
+  return more;
+}
+
+void MachineHost::worker() {
+  std::unique_lock<std::mutex> l(lock);
+  for (;;) {
+    struct timespec now;
+    // Pick the first machine that is due, or wait for the one due first.
+    auto due = queue.begin(), first = queue.begin();
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (; due != queue.end() && !compareTimeSpec(now, due->notBefore); due++) {
+      if (!compareTimeSpec(due->notBefore, first->notBefore)) first = due;
+    }
+    if (due == queue.end()) {
+      if (queue.empty()) {
+        if (stopping) return;
+        workAvailable.wait(l);
+      } else {
+        struct timespec delay = subtractTimeSpec(first->notBefore, now);
+        workAvailable.wait_for(l, std::chrono::seconds(delay.tv_sec) + std::chrono::nanoseconds(delay.tv_nsec));
+      }
+      continue;
+    }
+    struct session s = std::move(*due);
+    queue.erase(due);
+    l.unlock();
+    bool more = runSlice(&s);
+    l.lock();
+    if (more) {
+      queue.push_back(std::move(s));
+      workAvailable.notify_one();
+    } else {
+      active--;
+      sessionDone.notify_all();
+    }
+  }
+}
+
+void MachineHost::add(class Machine * machine, std::function<bool()> step) {
+  struct session s;
+  s.machine = machine;
+  s.step = step;
+  clock_gettime(CLOCK_MONOTONIC, &s.notBefore);
+  {
+    std::unique_lock<std::mutex> l(lock);
+    queue.push_back(std::move(s));
+    active++;
+  }
+  workAvailable.notify_one();
+}
+
+int MachineHost::fork(class Machine * parent, std::vector<class Machine *> children,
+                      std::function<void(int child)> prepare, std::function<bool(int child)> step) {
+  class Machine * caller = Machine::current;
+  class StateFile state;
+  int ret = STATE_OK;
+  Machine::current = parent;
+  parent->capture(&state);
+  for (size_t i = 0; i < children.size() && ret == STATE_OK; i++) {
+    Machine::current = children[i];
+    ret = children[i]->restore(&state);
+    children[i]->cpu.memory->clearDirty();
+  }
+  for (size_t i = 0; i < children.size() && ret == STATE_OK; i++) {
+    Machine::current = children[i];
+    prepare(i);
+    children[i]->running = true;
+    add(children[i], [step, i]() { return step(i); });
+  }
+  Machine::current = caller;
+  return ret;
+}
+
+void MachineHost::wait() {
+  std::unique_lock<std::mutex> l(lock);
+  while (active > 0) {
+    sessionDone.wait(l);
+  }
+}
@@ -0,0 +1,58 @@
+#ifndef _MACHINE_HOST_
+#define _MACHINE_HOST_
+#include <condition_variable>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Wall clock time in ns a machine runs before the next one gets the thread, the
+// same slice as the main loop of the simulator.
+#define MACHINE_HOST_SLICE 1000000
+
+// Runs any number of machines in one process on a pool of host threads. Each
+// machine runs for yield percent of a slice and then goes to the back of the
+// queue, so a pool of a few threads shares the cores between dozens of
+// machines. After every slice the step function of the machine is called on the
+// thread that ran it, with Machine::current set, and the machine is done when it
+// returns false. A machine is only run by one thread at a time, step may look at
+// its CPU and screen without locking.
+class MachineHost {
+  struct session {
+    class Machine * machine;
+    std::function<bool()> step;
+    // The machine is not run again before this wall clock time.
+    struct timespec notBefore;
+  };
+  std::mutex lock;
+  std::condition_variable workAvailable;
+  std::condition_variable sessionDone;
+  std::deque<struct session> queue;
+  std::vector<std::thread> workers;
+  // Machines added and not done.
+  int active;
+  bool stopping;
+  long slice;
+  bool runSlice(struct session * s);
+  void worker();
+  public:
+  MachineHost(int threads, long slice = MACHINE_HOST_SLICE);
+  ~MachineHost();
+  // The machine is run from now on, set it running first.
+  void add(class Machine * machine, std::function<bool()> step);
+  // Capture parent, which must not be running, and restore it onto every one of
+  // children, new machines with screens of their own that share the I/O workers
+  // of parent. Disks attached with OVERLAY=TRUE are then shared copy-on-write.
+  // prepare is called for each child, by its index, to give it other input or
+  // media, and the children are run like add does with step. The memory of a
+  // child starts with every page clean, see Memory::isDirty. Returns the error
+  // of the first child that can not be restored, no child is run then.
+  int fork(class Machine * parent, std::vector<class Machine *> children,
+           std::function<void(int child)> prepare, std::function<bool(int child)> step);
+  // Wait until every machine added is done.
+  void wait();
+};
+
+#endif
@@ -0,0 +1,237 @@
+#include "ProgramLoader.h"
+#include "cassetteTape.h"
+#include "dp2200_cpu_sim.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+ProgramLoader::ProgramLoader(class dp2200_cpu * c) {
+  cpu = c;
+  records = 0;
+}
+
+std::string ProgramLoader::typeOf(std::string fileName, std::string type) {
+  std::string extension;
+  size_t dot;
+  std::transform(type.begin(), type.end(), type.begin(), ::toupper);
+  if (type.size() > 0) return type;
+  dot = fileName.find_last_of('.');
+  if (dot != std::string::npos) {
+    extension = fileName.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::toupper);
+  }
+  if (extension == "TAP") return "TAP";
+  if (extension == "HEX" || extension == "IHX") return "HEX";
+  return "RAW";
+}
+
+// Everything below the firmware on a 5500, the 16K address space of a 2200.
+int ProgramLoader::loadLimit() {
+  return cpu->is5500 ? 0xF000 : cpu->pMask + 1;
+}
+
+int ProgramLoader::checkRange(int address, int length, int limit) {
+  if (address < 0 || length < 0 || address + length > limit) return LOADER_OUT_OF_MEMORY;
+  return LOADER_OK;
+}
+
+int ProgramLoader::loadTap(std::string fileName, int fileNumber, int * start, int * bytes) {
+  class CassetteTape tape;
+  std::vector<unsigned char> buffer(65536);
+  unsigned char * b = buffer.data();
+  bool inFile = false;
+  int size, address, length, ret = LOADER_NO_SUCH_FILE;
+  *start = -1;
+  *bytes = 0;
+  records = 0;
+  if (!tape.openFile(fileName)) return LOADER_FILE_ERROR;
+  for (;;) {
+    size = buffer.size();
+    if (!tape.readBlock(b, &size)) break;
+    if (size >= 4 && tape.isFileHeader(b)) {
+      if (inFile) break;
+      if (b[2] == fileNumber && b[3] == (0xff & ~b[2])) {
+        inFile = true;
+        ret = LOADER_OK;
+      }
+      continue;
+    }
+    if (!inFile) continue;
+    records++;
+    if (size < 8 || !tape.isNumericRecord(b)) {
+      ret = LOADER_BAD_FORMAT;
+      break;
+    }
+    if (!tape.isChecksumOK(b, size) || b[4] != (0xff & ~b[6]) || b[5] != (0xff & ~b[7])) {
+      ret = LOADER_CHECKSUM_ERROR;
+      break;
+    }
+    address = (b[4] << 8) | b[5];
+    length = size - 8;
+    if (length == 0) {
+      *start = address;
+      continue;
+    }
+    if ((ret = checkRange(address, length, loadLimit())) != LOADER_OK) break;
+    for (int i = 0; i < length; i++) {
+      cpu->memory->physicalMemoryWrite(address + i, b[8 + i]);
+    }
+    *bytes += length;
+  }
+  tape.closeFile();
+  return ret;
+}
+
+int ProgramLoader::loadRaw(std::string fileName, int address, int * bytes) {
+  std::vector<unsigned char> data(65536);
+  FILE * file;
+  int ret;
+  *bytes = 0;
+  file = fopen(fileName.c_str(), "rb");
+  if (file == NULL) return LOADER_FILE_ERROR;
+  data.resize(fread(data.data(), 1, data.size(), file));
+  fclose(file);
+  if ((ret = checkRange(address, data.size(), loadLimit())) != LOADER_OK) return ret;
+  for (size_t i = 0; i < data.size(); i++) {
+    cpu->memory->physicalMemoryWrite(address + i, data[i]);
+  }
+  *bytes = data.size();
+  return LOADER_OK;
+}
+
+// :LLAAAATT followed by LL data bytes and a checksum that makes all bytes of
+// the record sum to zero.
+int ProgramLoader::loadHex(std::string fileName, int * start, int * bytes) {
+  std::vector<unsigned char> record;
+  char line[600];
+  unsigned int byte;
+  unsigned char sum;
+  int base = 0, address, ret = LOADER_OK;
+  bool ended = false;
+  FILE * file;
+  *start = -1;
+  *bytes = 0;
+  records = 0;
+  file = fopen(fileName.c_str(), "r");
+  if (file == NULL) return LOADER_FILE_ERROR;
+  while (!ended && fgets(line, sizeof(line), file) != NULL) {
+    size_t n = strcspn(line, "\r\n");
+    line[n] = 0;
+    if (n == 0) continue;
+    records++;
+    record.clear();
+    sum = 0;
+    if (line[0] != ':' || n % 2 == 0) {
+      ret = LOADER_BAD_FORMAT;
+      break;
+    }
+    for (size_t i = 1; i < n; i += 2) {
+      if (sscanf(&line[i], "%2x", &byte) != 1) break;
+      record.push_back(byte);
+      sum += byte;
+    }
+    if (record.size() < 5 || record.size() != (size_t) record[0] + 5) {
+      ret = LOADER_BAD_FORMAT;
+      break;
+    }
+    if (sum != 0) {
+      ret = LOADER_CHECKSUM_ERROR;
+      break;
+    }
+    address = (record[1] << 8) | record[2];
+    switch (record[3]) {
+      case 0x00:
+        if ((ret = checkRange(base + address, record[0], loadLimit())) != LOADER_OK) break;
+        for (int i = 0; i < record[0]; i++) {
+          cpu->memory->physicalMemoryWrite(base + address + i, record[4 + i]);
+        }
+        *bytes += record[0];
+        break;
+      case 0x01:
+        ended = true;
+        break;
+      case 0x02:
+        base = ((record[4] << 8) | record[5]) << 4;
+        break;
+      case 0x04:
+        base = ((record[4] << 8) | record[5]) << 16;
+        break;
+      case 0x03:
+        *start = (((record[4] << 8) | record[5]) << 4) + ((record[6] << 8) | record[7]);
+        break;
+      case 0x05:
+        *start = (record[4] << 24) | (record[5] << 16) | (record[6] << 8) | record[7];
+        break;
+      default:
+        ret = LOADER_BAD_FORMAT;
+    }
+    if (ret != LOADER_OK) break;
+    if (*start > 0xffff) {
+      ret = LOADER_OUT_OF_MEMORY;
+      break;
+    }
+  }
+  fclose(file);
+  return ret;
+}
+
+int ProgramLoader::saveRaw(std::string fileName, int address, int length) {
+  std::vector<unsigned char> data;
+  FILE * file;
+  int ret;
+  if ((ret = checkRange(address, length, cpu->is5500 ? cpu->memory->size() : cpu->pMask + 1)) != LOADER_OK) return ret;
+  for (int i = 0; i < length; i++) {
+    data.push_back(cpu->memory->physicalMemoryRead(address + i));
+  }
+  file = fopen(fileName.c_str(), "wb");
+  if (file == NULL) return LOADER_FILE_ERROR;
+  ret = fwrite(data.data(), 1, data.size(), file) == data.size() ? LOADER_OK : LOADER_FILE_ERROR;
+  if (fclose(file) != 0) ret = LOADER_FILE_ERROR;
+  return ret;
+}
+
+int ProgramLoader::saveHex(std::string fileName, int address, int length) {
+  FILE * file;
+  unsigned char sum, data;
+  int ret, count;
+  if ((ret = checkRange(address, length, cpu->is5500 ? cpu->memory->size() : cpu->pMask + 1)) != LOADER_OK) return ret;
+  file = fopen(fileName.c_str(), "w");
+  if (file == NULL) return LOADER_FILE_ERROR;
+  for (int at = address; at < address + length; at += LOADER_HEX_RECORD_SIZE) {
+    count = std::min(LOADER_HEX_RECORD_SIZE, address + length - at);
+    fprintf(file, ":%02X%04X00", count, at);
+    sum = count + (at >> 8) + (at & 0xff);
+    for (int i = 0; i < count; i++) {
+      data = cpu->memory->physicalMemoryRead(at + i);
+      fprintf(file, "%02X", data);
+      sum += data;
+    }
+    fprintf(file, "%02X\n", (unsigned char) -sum);
+  }
+  fprintf(file, ":00000001FF\n");
+  if (ferror(file)) ret = LOADER_FILE_ERROR;
+  if (fclose(file) != 0) ret = LOADER_FILE_ERROR;
+  return ret;
+}
+
+int ProgramLoader::getRecords() { return records; }
+
+const char * ProgramLoader::errorString(int code) {
+  switch (code) {
+    case LOADER_OK:
+      return "OK";
+    case LOADER_FILE_ERROR:
+      return "Unable to read or write the file";
+    case LOADER_NO_SUCH_FILE:
+      return "There is no file with that number on the tape";
+    case LOADER_CHECKSUM_ERROR:
+      return "A record has a bad checksum or load address";
+    case LOADER_BAD_FORMAT:
+      return "A record is not a numeric record or not valid Intel hex";
+    case LOADER_OUT_OF_MEMORY:
+      return "The data does not fit in memory";
+    default:
+      return "Unknown error";
+  }
+}
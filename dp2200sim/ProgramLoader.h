@@ -0,0 +1,46 @@
+#ifndef _PROGRAM_LOADER_
+#define _PROGRAM_LOADER_
+#include <string>
+
+#define LOADER_OK 0
+#define LOADER_FILE_ERROR -1
+#define LOADER_NO_SUCH_FILE -2
+#define LOADER_CHECKSUM_ERROR -3
+#define LOADER_BAD_FORMAT -4
+#define LOADER_OUT_OF_MEMORY -5
+
+// Bytes in each data record of a written Intel hex file.
+#define LOADER_HEX_RECORD_SIZE 16
+
+// Loads programs straight into physical memory without running the bootstrap
+// or the tape driver, and saves memory to files.
+//   TAP  a cassette image. The numeric records of one file are placed at their
+//        load addresses. The record without data that ends a file gives the
+//        start address. Every record must pass isChecksumOK and have a valid
+//        complemented load address.
+//   RAW  the bytes as they are, at a given address.
+//   HEX  Intel hex, data records, end of file and the start address records
+//        03 and 05. Extended address records must keep addresses below 64K.
+// Loading never writes to the 5500 firmware or beyond the 16K of a 2200.
+class ProgramLoader {
+  class dp2200_cpu * cpu;
+  int records;
+  int loadLimit();
+  int checkRange(int address, int length, int limit);
+  public:
+  ProgramLoader(class dp2200_cpu * cpu);
+  // The type is guessed from the extension when empty: .tap is TAP, .hex and
+  // .ihx are HEX and anything else RAW.
+  static std::string typeOf(std::string fileName, std::string type);
+  // start is set to the start address, or -1 if the file has none.
+  int loadTap(std::string fileName, int fileNumber, int * start, int * bytes);
+  int loadRaw(std::string fileName, int address, int * bytes);
+  int loadHex(std::string fileName, int * start, int * bytes);
+  int saveRaw(std::string fileName, int address, int length);
+  int saveHex(std::string fileName, int address, int length);
+  // Records read by the last loadTap or loadHex.
+  int getRecords();
+  static const char * errorString(int code);
+};
+
+#endif
@@ -0,0 +1,126 @@
+#include "Recorder.h"
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+Recorder::Recorder() {
+  file = NULL;
+  replaying = false;
+  running = false;
+}
+
+// Writes the header from stateFile, running and latency.
+int Recorder::startRecording(std::string fileName) {
+  stopRecording();
+  file = fopen(fileName.c_str(), "w");
+  if (file == NULL) {
+    return RECORD_FILE_ERROR;
+  }
+  fprintf(file, "%s %d\n", RECORD_FILE_MAGIC, RECORD_FILE_VERSION);
+  fprintf(file, "STATE %s\n", stateFile.c_str());
+  fprintf(file, "RUNNING %d\n", running ? 1 : 0);
+  for (auto it = latency.begin(); it < latency.end(); it++) {
+    fprintf(file, "LATENCY %s %s\n", it->first.c_str(), it->second.c_str());
+  }
+  fflush(file);
+  return RECORD_OK;
+}
+
+void Recorder::stopRecording() {
+  if (file != NULL) {
+    fclose(file);
+    file = NULL;
+  }
+}
+
+bool Recorder::isRecording() {
+  return file != NULL;
+}
+
+// Events are flushed at once so that a recording survives a crash of the simulator.
+void Recorder::recordKey(unsigned long instruction, int key) {
+  if (file == NULL) return;
+  fprintf(file, "%lu %c %d\n", instruction, RECORD_KEY, key);
+  fflush(file);
+}
+
+void Recorder::recordCommand(unsigned long instruction, std::string command) {
+  if (file == NULL) return;
+  fprintf(file, "%lu %c %s\n", instruction, RECORD_COMMAND, command.c_str());
+  fflush(file);
+}
+
+int Recorder::startReplay(std::string fileName) {
+  char line[512];
+  int version;
+  FILE * f = fopen(fileName.c_str(), "r");
+  if (f == NULL) {
+    return RECORD_FILE_ERROR;
+  }
+  events.clear();
+  latency.clear();
+  stateFile.clear();
+  running = false;
+  if (fgets(line, sizeof(line), f) == NULL || sscanf(line, RECORD_FILE_MAGIC " %d", &version) != 1 || version != RECORD_FILE_VERSION) {
+    fclose(f);
+    return RECORD_BAD_FORMAT;
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    char * end;
+    line[strcspn(line, "\n")] = 0;
+    if (strncmp(line, "STATE ", 6) == 0) {
+      stateFile = line + 6;
+    } else if (strncmp(line, "RUNNING ", 8) == 0) {
+      running = atoi(line + 8) != 0;
+    } else if (strncmp(line, "LATENCY ", 8) == 0) {
+      char device[16], model[16];
+      if (sscanf(line + 8, "%15s %15s", device, model) == 2) {
+        latency.push_back({device, model});
+      }
+    } else {
+      struct recordedEvent e;
+      e.instruction = strtoul(line, &end, 10);
+      if (end == line || end[0] != ' ' || (end[1] != RECORD_KEY && end[1] != RECORD_COMMAND) || end[2] != ' ') {
+        fclose(f);
+        events.clear();
+        return RECORD_BAD_FORMAT;
+      }
+      e.type = end[1];
+      e.key = 0;
+      if (e.type == RECORD_KEY) {
+        e.key = atoi(end + 3);
+      } else {
+        e.command = end + 3;
+      }
+      events.push_back(e);
+    }
+  }
+  fclose(f);
+  if (stateFile.size() == 0) {
+    events.clear();
+    return RECORD_BAD_FORMAT;
+  }
+  replaying = true;
+  return RECORD_OK;
+}
+
+void Recorder::stopReplay() {
+  replaying = false;
+  events.clear();
+}
+
+bool Recorder::isReplaying() {
+  return replaying;
+}
+
+unsigned long Recorder::nextInstruction() {
+  if (!replaying || events.empty()) return ULONG_MAX;
+  return events.front().instruction;
+}
+
+bool Recorder::nextEvent(unsigned long instruction, struct recordedEvent * e) {
+  if (!replaying || events.empty() || events.front().instruction > instruction) return false;
+  *e = events.front();
+  events.pop_front();
+  return true;
+}
@@ -0,0 +1,64 @@
+#ifndef _RECORDER_
+#define _RECORDER_
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define RECORD_OK 0
+#define RECORD_FILE_ERROR -1
+#define RECORD_BAD_FORMAT -2
+
+#define RECORD_KEY 'K'
+#define RECORD_COMMAND 'C'
+
+#define RECORD_FILE_MAGIC "DP2200REC"
+#define RECORD_FILE_VERSION 1
+
+struct recordedEvent {
+  unsigned long instruction;
+  char type;
+  int key;
+  std::string command;
+};
+
+// Log of the input given to a machine. A recording starts from a saved state
+// and every key typed in the DATAPOINT window and every command is stamped with
+// the number of instructions executed when it arrived. Since device timing runs
+// on simulated time, feeding the events back at the same instruction counts
+// reproduces the session exactly. The file is text, a header followed by one
+// event per line:
+//   DP2200REC 1
+//   STATE <state file>
+//   RUNNING <0 or 1>
+//   LATENCY <device> <model>
+//   <instructions> K <key code>
+//   <instructions> C <command line>
+class Recorder {
+  FILE * file;
+  bool replaying;
+  std::deque<struct recordedEvent> events;
+  public:
+  // Header of the recording being made or replayed.
+  std::string stateFile;
+  bool running;
+  std::vector<std::pair<std::string, std::string>> latency;
+  Recorder();
+  int startRecording(std::string fileName);
+  void stopRecording();
+  bool isRecording();
+  void recordKey(unsigned long instruction, int key);
+  void recordCommand(unsigned long instruction, std::string command);
+  // Read all events of a recording and fill in the header.
+  int startReplay(std::string fileName);
+  void stopReplay();
+  bool isReplaying();
+  // Instruction count of the next event to replay, or ULONG_MAX if there is none.
+  unsigned long nextInstruction();
+  // Take the next event if it is due at instruction.
+  bool nextEvent(unsigned long instruction, struct recordedEvent * e);
+};
+
+
+#endif
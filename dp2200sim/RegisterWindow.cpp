@@ -1,5 +1,103 @@
 #include "RegisterWindow.h"
 
+void form_hook_proxy(formnode * f) {
+  class hookExecutor * hE;
+  FIELD *field = current_field(f);
+  printLog("INFO", "form_hook_proxy ENTRY\n");
+  hE = (class hookExecutor * ) field_userptr(field);
+  if (hE!= NULL) hE->exec(field);
+}
+
+void registerWindow::Form::hexMemoryAddressHookExecutor::exec(FIELD *field) {
+  char *bufferString = field_buffer(field, 0);
+  int value = strtol(bufferString, NULL, 16);
+  printLog("INFO", "memoryAddressHookExecutor string=%s value=%d\n", bufferString, value);
+  rwf->cpu->startAddress = (value - address * 16) & 0xfff0;
+  rwf->updateForm();
+  wrefresh(rwf->win);
+}
+
+void registerWindow::Form::hexMemoryDataHookExecutor::exec(FIELD *field) {
+  char *bufferString = field_buffer(field, 0);
+  int value = strtol(bufferString, NULL, 16);
+  rwf->cpu->memory->physicalMemoryWrite(rwf->cpu->startAddress + data, value);
+  rwf->updateForm();
+  wrefresh(rwf->win);
+}
+
+
+void registerWindow::Form::octalMemoryAddressHookExecutor::exec(FIELD *field) {
+  char *bufferString = field_buffer(field, 0);
+  int value = strtol(bufferString, NULL, 8);
+  printLog("INFO", "memoryAddressHookExecutor string=%s value=%d\n", bufferString, value);
+  rwf->cpu->startAddress = (value - address * 16) & 0xfff0;
+  rwf->updateForm();
+  wrefresh(rwf->win);
+}
+
+void registerWindow::Form::octalMemoryDataHookExecutor::exec(FIELD *field) {
+  char *bufferString = field_buffer(field, 0);
+  int value = strtol(bufferString, NULL, 8);
+  rwf->cpu->memory->physicalMemoryWrite(rwf->cpu->startAddress + data, value);
+  rwf->updateForm();
+  wrefresh(rwf->win);
+}
+
+void registerWindow::Form::hexCharPointerHookExecutor::exec(FIELD *field) {
+  char *bufferString = field_buffer(field, 0);
+  unsigned char value = strtol(bufferString, NULL, 16);
+  *address = value;
+}
+
+void registerWindow::Form::hexShortPointerHookExecutor::exec(FIELD *field) {
+  char *bufferString = field_buffer(field, 0);
+  unsigned short value = strtol(bufferString, NULL, 16);
+  *address = value;
+}
+
+void registerWindow::Form::octalCharPointerHookExecutor::exec(FIELD *field) {
+  char *bufferString = field_buffer(field, 0);
+  unsigned char value = strtol(bufferString, NULL, 8);
+  *address = value;
+}
+
+void registerWindow::Form::octalShortPointerHookExecutor::exec(FIELD *field) {
+  char *bufferString = field_buffer(field, 0);
+  unsigned short value = strtol(bufferString, NULL, 8);
+  *address = value;
+}
+
+void registerWindow::Form::accessibleHookExecutor::exec(FIELD *field) {
+  char *bufferString = field_buffer(field, 0);
+  switch (bufferString[0]) {
+    case 'U':
+    case 'u':
+      *address=true;
+      break;
+    case 'S':
+    case 's':
+      *address=false;
+  }
+}
+
+void registerWindow::Form::writeableHookExecutor::exec(FIELD *field) {
+  char *bufferString = field_buffer(field, 0);
+  switch (bufferString[0]) {
+    case 'W':
+    case 'w':
+      *address=true;
+      break;
+    case 'R':
+    case 'r':
+      *address=false;
+  }
+}
+
+registerWindow::Form::Form(class dp2200_cpu * c, WINDOW * w) {
+  cpu = c;
+  win = w;
+}
+
 registerWindow::Form::hexMemoryDataHookExecutor::hexMemoryDataHookExecutor(class registerWindow::Form * r, int d) {
   data=d;
   rwf = r;
@@ -123,143 +221,143 @@ void registerWindow::OctalForm::updateForm() {
   int i, k = 0, j;
   char b[7];
   unsigned char t;
-  unsigned short startAddress = cpu.startAddress;
+  unsigned short startAddress = cpu->startAddress;
   char asciiB[24], fieldB[28];
   for (i = 0; i < 16 && startAddress <= 0xFFFF; startAddress += 16, i++) {
     snprintf(b, 7, "%06o", startAddress);
-    set_field_buffer(addressFields[i], 0, b);
+    setFieldBuffer(addressFields[i], b);
     for (j = 0; j < 16; j++) {
-      t = cpu.memory->physicalMemoryRead(startAddress + j);
-      if ((startAddress + j) == cpu.P ) {
-        set_field_back(dataFields[k], A_UNDERLINE);
+      t = cpu->memory->physicalMemoryRead(startAddress + j);
+      if ((startAddress + j) == cpu->P ) {
+        setFieldBack(dataFields[k], A_UNDERLINE);
       } else {
-        set_field_back(dataFields[k], A_NORMAL);
+        setFieldBack(dataFields[k], A_NORMAL);
       }
       snprintf(b, 4, "%03o", t);
-      set_field_buffer(dataFields[k], 0, b);
+      setFieldBuffer(dataFields[k], b);
       k++;
       asciiB[j] = (t >= 0x20 && t < 127) ? t : '.';
     }
     asciiB[j] = 0;
     snprintf(fieldB, 26, "|%s|", asciiB);
-    set_field_buffer(asciiFields[i], 0, fieldB);
+    setFieldBuffer(asciiFields[i], fieldB);
   }
   for (; i < 16; startAddress += 16, i++) {
     snprintf(b, 7, "%05o", startAddress);
-    set_field_buffer(addressFields[i], 0, b);
+    setFieldBuffer(addressFields[i], b);
     for (int j = 0; j < 16; j++) {
-      t = cpu.memory->physicalMemoryRead(startAddress + j);
-      if ((startAddress + j) == cpu.P ) {
-        set_field_back(dataFields[k], A_UNDERLINE);
+      t = cpu->memory->physicalMemoryRead(startAddress + j);
+      if ((startAddress + j) == cpu->P ) {
+        setFieldBack(dataFields[k], A_UNDERLINE);
       } else {
-        set_field_back(dataFields[k], A_NORMAL);
+        setFieldBack(dataFields[k], A_NORMAL);
       }        
       snprintf(b, 4, "%03o", t);
-      set_field_buffer(dataFields[k], 0, b);
+      setFieldBuffer(dataFields[k], b);
       k++;
       asciiB[j] = (t >= 0x20 && t < 127) ? t : '.';
     }
     asciiB[j] = 0;
     snprintf(fieldB, 19, "|%s|", asciiB);
-    set_field_buffer(asciiFields[i], 0, fieldB);
+    setFieldBuffer(asciiFields[i], fieldB);
   }
   // update registers.
   for (auto regset =0; regset<2; regset++) {
     int i;
     for (i=0; i<8; i++) {
       auto f = regs[regset][i];
-      auto r = cpu.regSets[regset].regs[i];
+      auto r = cpu->regSets[regset].regs[i];
       snprintf(b, 5, "%03o", r);
-      set_field_buffer(f, 0, b);
+      setFieldBuffer(f, b);
     }
 
-    snprintf(b, 3, "%01X", cpu.flagCarry[regset]);
-    set_field_buffer(flagCarry[regset], 0, b);
-    snprintf(b, 3, "%01X", cpu.flagZero[regset]);
-    set_field_buffer(flagZero[regset], 0, b);
-    snprintf(b, 3, "%01X", cpu.flagParity[regset]);
-    set_field_buffer(flagParity[regset], 0, b);
-    snprintf(b, 3, "%01X", cpu.flagSign[regset]);
-    set_field_buffer(flagSign[regset], 0, b);                  
+    snprintf(b, 3, "%01X", cpu->flagCarry[regset]);
+    setFieldBuffer(flagCarry[regset], b);
+    snprintf(b, 3, "%01X", cpu->flagZero[regset]);
+    setFieldBuffer(flagZero[regset], b);
+    snprintf(b, 3, "%01X", cpu->flagParity[regset]);
+    setFieldBuffer(flagParity[regset], b);
+    snprintf(b, 3, "%01X", cpu->flagSign[regset]);
+    setFieldBuffer(flagSign[regset], b);                  
   }
 
   // Sector table
 
   for (int i=0; i<16; i++) {
-    snprintf(b, 4, "%02o", cpu.memory->sectorTable[i].physicalPage);
-    set_field_buffer(sectorTableFields[i].physicalSector, 0, b);
-    snprintf(b, 2, "%c", cpu.memory->sectorTable[i].accessEnable?'U':'S');
-    set_field_buffer(sectorTableFields[i].accessible, 0, b);
-    snprintf(b, 2, "%c", cpu.memory->sectorTable[i].writeEnable?'W':'R');
-    set_field_buffer(sectorTableFields[i].writeable, 0, b);    
+    snprintf(b, 4, "%02o", cpu->memory->sectorTable[i].physicalPage);
+    setFieldBuffer(sectorTableFields[i].physicalSector, b);
+    snprintf(b, 2, "%c", cpu->memory->sectorTable[i].accessEnable?'U':'S');
+    setFieldBuffer(sectorTableFields[i].accessible, b);
+    snprintf(b, 2, "%c", cpu->memory->sectorTable[i].writeEnable?'W':'R');
+    setFieldBuffer(sectorTableFields[i].writeable, b);    
   }
   
   // Base register
-  snprintf(b, 4, "%03o", cpu.memory->baseRegister);
-  set_field_buffer(base, 0, b);
+  snprintf(b, 4, "%03o", cpu->memory->baseRegister);
+  setFieldBuffer(base, b);
 
-  snprintf(b, 7, "%06o", cpu.P);
-  set_field_buffer(pc, 0, b);
+  snprintf(b, 7, "%06o", cpu->P);
+  setFieldBuffer(pc, b);
 
   for (auto i = 0; i<16; i++) {
-    snprintf(b, 7, "%06o", cpu.stack.stk[i]);
-    set_field_buffer(stack[i], 0, b);
-    if (i == cpu.stackptr ) {
-      set_field_back(stack[i], A_UNDERLINE);
+    snprintf(b, 7, "%06o", cpu->stack.stk[i]);
+    setFieldBuffer(stack[i], b);
+    if (i == cpu->stackptr ) {
+      setFieldBack(stack[i], A_UNDERLINE);
     } else {
-      set_field_back(stack[i], A_NORMAL);
+      setFieldBack(stack[i], A_NORMAL);
     }   
   }
 
-  if (cpu.setSel==0) {
-    set_field_back(mode[0], A_UNDERLINE);
-    set_field_back(mode[1], A_NORMAL);  
+  if (cpu->setSel==0) {
+    setFieldBack(mode[0], A_UNDERLINE);
+    setFieldBack(mode[1], A_NORMAL);  
   } else {
-    set_field_back(mode[1], A_UNDERLINE);
-    set_field_back(mode[0], A_NORMAL);   
+    setFieldBack(mode[1], A_UNDERLINE);
+    setFieldBack(mode[0], A_NORMAL);   
   }
 
   // update mnemonic
 
-  set_field_buffer(mnemonic, 0, cpu.disassembleLine(asciiB, 23, true, cpu.P)); 
+  setFieldBuffer(mnemonic, cpu->disassembleLine(asciiB, 23, true, cpu->P)); 
   i=0;
 
   // update trace
-  for (auto it=cpu.instructionTrace.begin(); it<cpu.instructionTrace.end(); it++, i++) {
-    snprintf(fieldB, 27, "%06o %03o %s", it->address, it->data[0], cpu.disassembleLine(asciiB, 27, true, it->data));
-    set_field_buffer(instructionTrace[i], 0, fieldB); 
+  for (auto it=cpu->instructionTrace.begin(); it<cpu->instructionTrace.end(); it++, i++) {
+    snprintf(fieldB, 27, "%06o %03o %s", it->address, it->data[0], cpu->disassembleLine(asciiB, 27, true, it->data));
+    setFieldBuffer(instructionTrace[i], fieldB); 
   }
   i=0;
-  for (auto it=cpu.breakpoints.begin(); it<cpu.breakpoints.end(); it++, i++) {
+  for (auto it=cpu->breakpoints.begin(); it<cpu->breakpoints.end(); it++, i++) {
     snprintf(fieldB, 7, "%06o", *it);
-    set_field_buffer(breakpoints[i], 0, fieldB); 
+    setFieldBuffer(breakpoints[i], fieldB); 
   }
   for (; i<8; i++) {
-    set_field_buffer(breakpoints[i], 0, "");  
+    setFieldBuffer(breakpoints[i], "");  
   }
 
-  if (cpu.keyboardLightStatus) {
-    set_field_back(keyboardLightField, A_STANDOUT);
+  if (cpu->keyboardLightStatus) {
+    setFieldBack(keyboardLightField, A_STANDOUT);
   } else {
-    set_field_back(keyboardLightField, A_NORMAL);
+    setFieldBack(keyboardLightField, A_NORMAL);
   }
 
-  if (cpu.displayLightStatus) {
-    set_field_back(displayLightField, A_STANDOUT);
+  if (cpu->displayLightStatus) {
+    setFieldBack(displayLightField, A_STANDOUT);
   } else {
-    set_field_back(displayLightField, A_NORMAL);
+    setFieldBack(displayLightField, A_NORMAL);
   }
 
-  if (cpu.keyboardButtonStatus) {
-    set_field_back(keyboardButtonField, A_STANDOUT);
+  if (cpu->keyboardButtonStatus) {
+    setFieldBack(keyboardButtonField, A_STANDOUT);
   } else {
-    set_field_back(keyboardButtonField, A_NORMAL);
+    setFieldBack(keyboardButtonField, A_NORMAL);
   }  
 
-  if (cpu.displayButtonStatus) {
-    set_field_back(displayButtonField, A_STANDOUT);
+  if (cpu->displayButtonStatus) {
+    setFieldBack(displayButtonField, A_STANDOUT);
   } else {
-    set_field_back(displayButtonField, A_NORMAL);
+    setFieldBack(displayButtonField, A_NORMAL);
   }    
    
 }
@@ -268,149 +366,179 @@ void registerWindow::HexForm::updateForm() {
   int i, k = 0, j;
   char b[5];
   unsigned char t;
-  unsigned short startAddress = cpu.startAddress;
+  unsigned short startAddress = cpu->startAddress;
   char asciiB[24], fieldB[27];
   for (i = 0; i < 16 && startAddress <= 0xFFFF; startAddress += 16, i++) {
     snprintf(b, 5, "%04X", startAddress);
-    set_field_buffer(addressFields[i], 0, b);
+    setFieldBuffer(addressFields[i], b);
     for (j = 0; j < 16; j++) {
-      t = cpu.memory->physicalMemoryRead(startAddress + j);
-      if ((startAddress + j) == cpu.P ) {
-        set_field_back(dataFields[k], A_UNDERLINE);
+      t = cpu->memory->physicalMemoryRead(startAddress + j);
+      if ((startAddress + j) == cpu->P ) {
+        setFieldBack(dataFields[k], A_UNDERLINE);
       } else {
-        set_field_back(dataFields[k], A_NORMAL);
+        setFieldBack(dataFields[k], A_NORMAL);
       }
       snprintf(b, 3, "%02X", t);
-      set_field_buffer(dataFields[k], 0, b);
+      setFieldBuffer(dataFields[k], b);
       k++;
       asciiB[j] = (t >= 0x20 && t < 127) ? t : '.';
     }
     asciiB[j] = 0;
     snprintf(fieldB, 26, "|%s|", asciiB);
-    set_field_buffer(asciiFields[i], 0, fieldB);
+    setFieldBuffer(asciiFields[i], fieldB);
   }
   for (; i < 16; startAddress += 16, i++) {
     snprintf(b, 5, "%04X", startAddress);
-    set_field_buffer(addressFields[i], 0, b);
+    setFieldBuffer(addressFields[i], b);
     for (int j = 0; j < 16; j++) {
-      t = cpu.memory->physicalMemoryRead(startAddress + j);
-      if ((startAddress + j) == cpu.P ) {
-        set_field_back(dataFields[k], A_UNDERLINE);
+      t = cpu->memory->physicalMemoryRead(startAddress + j);
+      if ((startAddress + j) == cpu->P ) {
+        setFieldBack(dataFields[k], A_UNDERLINE);
       } else {
-        set_field_back(dataFields[k], A_NORMAL);
+        setFieldBack(dataFields[k], A_NORMAL);
       }        
       snprintf(b, 3, "%02X", t);
-      set_field_buffer(dataFields[k], 0, b);
+      setFieldBuffer(dataFields[k], b);
       k++;
       asciiB[j] = (t >= 0x20 && t < 127) ? t : '.';
     }
     asciiB[j] = 0;
     snprintf(fieldB, 19, "|%s|", asciiB);
-    set_field_buffer(asciiFields[i], 0, fieldB);
+    setFieldBuffer(asciiFields[i], fieldB);
   }
   // update registers.
   for (auto regset =0; regset<2; regset++) {
     int i;
     for (i=0; i<8; i++) {
       auto f = regs[regset][i];
-      auto r = cpu.regSets[regset].regs[i];
+      auto r = cpu->regSets[regset].regs[i];
       snprintf(b, 3, "%02X", r);
-      set_field_buffer(f, 0, b);
+      setFieldBuffer(f, b);
     }
-    snprintf(b, 3, "%01X", cpu.flagCarry[regset]);
-    set_field_buffer(flagCarry[regset], 0, b);
-    snprintf(b, 3, "%01X", cpu.flagZero[regset]);
-    set_field_buffer(flagZero[regset], 0, b);
-    snprintf(b, 3, "%01X", cpu.flagParity[regset]);
-    set_field_buffer(flagParity[regset], 0, b);
-    snprintf(b, 3, "%01X", cpu.flagSign[regset]);
-    set_field_buffer(flagSign[regset], 0, b);                  
+    snprintf(b, 3, "%01X", cpu->flagCarry[regset]);
+    setFieldBuffer(flagCarry[regset], b);
+    snprintf(b, 3, "%01X", cpu->flagZero[regset]);
+    setFieldBuffer(flagZero[regset], b);
+    snprintf(b, 3, "%01X", cpu->flagParity[regset]);
+    setFieldBuffer(flagParity[regset], b);
+    snprintf(b, 3, "%01X", cpu->flagSign[regset]);
+    setFieldBuffer(flagSign[regset], b);                  
   }
 
   // Sector table
 
   for (int i=0; i<16; i++) {
-    snprintf(b, 4, "%02X", cpu.memory->sectorTable[i].physicalPage);
-    set_field_buffer(sectorTableFields[i].physicalSector, 0, b);
-    snprintf(b, 2, "%c", cpu.memory->sectorTable[i].accessEnable?'U':'S');
-    set_field_buffer(sectorTableFields[i].accessible, 0, b);
-    snprintf(b, 2, "%c", cpu.memory->sectorTable[i].writeEnable?'W':'R');
-    set_field_buffer(sectorTableFields[i].writeable, 0, b);    
+    snprintf(b, 4, "%02X", cpu->memory->sectorTable[i].physicalPage);
+    setFieldBuffer(sectorTableFields[i].physicalSector, b);
+    snprintf(b, 2, "%c", cpu->memory->sectorTable[i].accessEnable?'U':'S');
+    setFieldBuffer(sectorTableFields[i].accessible, b);
+    snprintf(b, 2, "%c", cpu->memory->sectorTable[i].writeEnable?'W':'R');
+    setFieldBuffer(sectorTableFields[i].writeable, b);    
   }
   
   // Base register
-  snprintf(b, 4, "%02X", cpu.memory->baseRegister);
-  set_field_buffer(base, 0, b);
+  snprintf(b, 4, "%02X", cpu->memory->baseRegister);
+  setFieldBuffer(base, b);
 
 
-  snprintf(b, 5, "%04X", cpu.P);
-  set_field_buffer(pc, 0, b);
+  snprintf(b, 5, "%04X", cpu->P);
+  setFieldBuffer(pc, b);
 
   for (auto i = 0; i<16; i++) {
-    snprintf(b, 5, "%04X", cpu.stack.stk[i]);
-    set_field_buffer(stack[i], 0, b);
-    if (i == cpu.stackptr ) {
-      set_field_back(stack[i], A_UNDERLINE);
+    snprintf(b, 5, "%04X", cpu->stack.stk[i]);
+    setFieldBuffer(stack[i], b);
+    if (i == cpu->stackptr ) {
+      setFieldBack(stack[i], A_UNDERLINE);
     } else {
-      set_field_back(stack[i], A_NORMAL);
+      setFieldBack(stack[i], A_NORMAL);
     }   
   }
 
-  if (cpu.setSel==0) {
-    set_field_back(mode[0], A_UNDERLINE);
-    set_field_back(mode[1], A_NORMAL);  
+  if (cpu->setSel==0) {
+    setFieldBack(mode[0], A_UNDERLINE);
+    setFieldBack(mode[1], A_NORMAL);  
   } else {
-    set_field_back(mode[1], A_UNDERLINE);
-    set_field_back(mode[0], A_NORMAL);   
+    setFieldBack(mode[1], A_UNDERLINE);
+    setFieldBack(mode[0], A_NORMAL);   
   }
 
   // update mnemonic
 
-  set_field_buffer(mnemonic, 0, cpu.disassembleLine(asciiB, 23, false, cpu.P)); 
+  setFieldBuffer(mnemonic, cpu->disassembleLine(asciiB, 23, false, cpu->P)); 
   i=0;
 
   // update trace
-  for (auto it=cpu.instructionTrace.begin(); it<cpu.instructionTrace.end(); it++, i++) {
-    snprintf(fieldB, 23, "%04X %02X %s", it->address, it->data[0], cpu.disassembleLine(asciiB, 23, false, it->data));
-    set_field_buffer(instructionTrace[i], 0, fieldB); 
+  for (auto it=cpu->instructionTrace.begin(); it<cpu->instructionTrace.end(); it++, i++) {
+    snprintf(fieldB, 23, "%04X %02X %s", it->address, it->data[0], cpu->disassembleLine(asciiB, 23, false, it->data));
+    setFieldBuffer(instructionTrace[i], fieldB); 
   }
   i=0;
-  for (auto it=cpu.breakpoints.begin(); it<cpu.breakpoints.end(); it++, i++) {
+  for (auto it=cpu->breakpoints.begin(); it<cpu->breakpoints.end(); it++, i++) {
     snprintf(fieldB, 5, "%04X", *it);
-    set_field_buffer(breakpoints[i], 0, fieldB); 
+    setFieldBuffer(breakpoints[i], fieldB); 
   }
   for (; i<8; i++) {
-    set_field_buffer(breakpoints[i], 0, "");  
+    setFieldBuffer(breakpoints[i], "");  
   }
 
-  if (cpu.keyboardLightStatus) {
-    set_field_back(keyboardLightField, A_STANDOUT);
+  if (cpu->keyboardLightStatus) {
+    setFieldBack(keyboardLightField, A_STANDOUT);
   } else {
-    set_field_back(keyboardLightField, A_NORMAL);
+    setFieldBack(keyboardLightField, A_NORMAL);
   }
 
-  if (cpu.displayLightStatus) {
-    set_field_back(displayLightField, A_STANDOUT);
+  if (cpu->displayLightStatus) {
+    setFieldBack(displayLightField, A_STANDOUT);
   } else {
-    set_field_back(displayLightField, A_NORMAL);
+    setFieldBack(displayLightField, A_NORMAL);
   }
 
-  if (cpu.keyboardButtonStatus) {
-    set_field_back(keyboardButtonField, A_STANDOUT);
+  if (cpu->keyboardButtonStatus) {
+    setFieldBack(keyboardButtonField, A_STANDOUT);
   } else {
-    set_field_back(keyboardButtonField, A_NORMAL);
+    setFieldBack(keyboardButtonField, A_NORMAL);
   }  
 
-  if (cpu.displayButtonStatus) {
-    set_field_back(displayButtonField, A_STANDOUT);
+  if (cpu->displayButtonStatus) {
+    setFieldBack(displayButtonField, A_STANDOUT);
   } else {
-    set_field_back(displayButtonField, A_NORMAL);
+    setFieldBack(displayButtonField, A_NORMAL);
   }     
 }
 
 
 
 
+// set_field_buffer makes the form redraw the field even if the text is the same,
+// so only call it when the contents actually differ.
+void registerWindow::Form::setFieldBuffer(FIELD * field, const char * str) {
+  const char * current = field_buffer(field, 0);
+  int i;
+  if (current == NULL) {
+    set_field_buffer(field, 0, str);
+    return;
+  }
+  for (i = 0; current[i] && str[i]; i++) {
+    if (current[i] != str[i]) {
+      set_field_buffer(field, 0, str);
+      return;
+    }
+  }
+  // The field buffer is padded with blanks.
+  for (; current[i]; i++) {
+    if (current[i] != ' ') {
+      set_field_buffer(field, 0, str);
+      return;
+    }
+  }
+}
+
+void registerWindow::Form::setFieldBack(FIELD * field, chtype attr) {
+  if (field_back(field) != attr) {
+    set_field_back(field, attr);
+  }
+}
+
 FIELD * registerWindow::Form::createAField(std::vector<FIELD *> * fields, int length, int y, int x, const char * str) {
   FIELD * t;
   t = new_field(1, length, y, x, 0, 0); // HEADER - REGISTERS TEXT
@@ -428,7 +556,7 @@ FIELD * registerWindow::Form::createAField(std::vector<FIELD *> * fields, int le
   return t;
 }
 
-registerWindow::OctalForm::OctalForm () {
+registerWindow::OctalForm::OctalForm (class dp2200_cpu * c, WINDOW * w) : Form(c, w) {
   const char * rName[]={"A:","B:","C:","D:","E:","H:","L:","X:"};
   FIELD **f;
   int i;
@@ -443,25 +571,25 @@ registerWindow::OctalForm::OctalForm () {
   for (auto regset=0;regset < 2; regset++) {
     for (auto reg=0; reg<8; reg++) {
       regsIdents[regset][reg] = createAField(&registerViewFields,2,4+reg, 3+15*regset,rName[reg]);
-      regs[regset][reg]=createAField(&registerViewFields,3,4+reg, 5+15*regset, "000", O_EDIT | O_ACTIVE, "[0-3][0-7][0-7]", JUSTIFY_LEFT, (char *) new octalCharPointerHookExecutor(this, &cpu.regSets[regset].regs[reg]));
+      regs[regset][reg]=createAField(&registerViewFields,3,4+reg, 5+15*regset, "000", O_EDIT | O_ACTIVE, "[0-3][0-7][0-7]", JUSTIFY_LEFT, (char *) new octalCharPointerHookExecutor(this, &cpu->regSets[regset].regs[reg]));
     }
     // flags
     createAField(&registerViewFields,2, 13,3+15*regset, "P:" );
-    flagParity[regset]=createAField(&registerViewFields,1,13,5+15*regset, "0", O_EDIT | O_ACTIVE, "[0-1]", NO_JUSTIFICATION, (char *) new octalCharPointerHookExecutor(this, &cpu.flagParity[regset]));
+    flagParity[regset]=createAField(&registerViewFields,1,13,5+15*regset, "0", O_EDIT | O_ACTIVE, "[0-1]", NO_JUSTIFICATION, (char *) new octalCharPointerHookExecutor(this, &cpu->flagParity[regset]));
     createAField(&registerViewFields,2, 13,8+15*regset, "S:" );
-    flagSign[regset]=createAField(&registerViewFields,1,13,10+15*regset, "0", O_EDIT | O_ACTIVE, "[0-1]", NO_JUSTIFICATION, (char *) new octalCharPointerHookExecutor(this, &cpu.flagSign[regset]));
+    flagSign[regset]=createAField(&registerViewFields,1,13,10+15*regset, "0", O_EDIT | O_ACTIVE, "[0-1]", NO_JUSTIFICATION, (char *) new octalCharPointerHookExecutor(this, &cpu->flagSign[regset]));
     createAField(&registerViewFields,2, 14,3+15*regset, "C:" );
-    flagCarry[regset]=createAField(&registerViewFields,1,14,5+15*regset, "0", O_EDIT | O_ACTIVE, "[0-1]", NO_JUSTIFICATION, (char *) new octalCharPointerHookExecutor(this, &cpu.flagCarry[regset]));
+    flagCarry[regset]=createAField(&registerViewFields,1,14,5+15*regset, "0", O_EDIT | O_ACTIVE, "[0-1]", NO_JUSTIFICATION, (char *) new octalCharPointerHookExecutor(this, &cpu->flagCarry[regset]));
     createAField(&registerViewFields,2, 14,8+15*regset, "Z:" );
-    flagZero[regset]=createAField(&registerViewFields,1,14,10+15*regset, "0", O_EDIT | O_ACTIVE, "[0-1]", NO_JUSTIFICATION, (char *) new octalCharPointerHookExecutor(this, &cpu.flagZero[regset]));
+    flagZero[regset]=createAField(&registerViewFields,1,14,10+15*regset, "0", O_EDIT | O_ACTIVE, "[0-1]", NO_JUSTIFICATION, (char *) new octalCharPointerHookExecutor(this, &cpu->flagZero[regset]));
   }
 
   createAField(&registerViewFields,2, 16,3, "P:" );
-  pc=createAField(&registerViewFields,6,16,5, "000000", O_EDIT | O_ACTIVE, "[0-1][0-7][0-7][0-7][0-7][0-7]", JUSTIFY_LEFT, (char *) new octalShortPointerHookExecutor(this, &cpu.P));
+  pc=createAField(&registerViewFields,6,16,5, "000000", O_EDIT | O_ACTIVE, "[0-1][0-7][0-7][0-7][0-7][0-7]", JUSTIFY_LEFT, (char *) new octalShortPointerHookExecutor(this, &cpu->P));
   mnemonic = createAField(&registerViewFields,12, 16,12, "" );
   // BASE REGISTER
   baseIdents = createAField(&registerViewFields,5, 17,3, "BASE:" );
-  base=createAField(&registerViewFields,3,17,8, "000", O_EDIT | O_ACTIVE, "[0-3][0-7][0-7]", JUSTIFY_LEFT, (char *) new octalCharPointerHookExecutor(this, &(cpu.memory->baseRegister)));
+  base=createAField(&registerViewFields,3,17,8, "000", O_EDIT | O_ACTIVE, "[0-3][0-7][0-7]", JUSTIFY_LEFT, (char *) new octalCharPointerHookExecutor(this, &(cpu->memory->baseRegister)));
   // SECTOR TABLE
   sectorTableHeader = createAField(&registerViewFields,13, 20,3, "SECTOR TABLE:" );
   for (int i=0; i<4; i++) {
@@ -469,14 +597,14 @@ registerWindow::OctalForm::OctalForm () {
       char buffer[32];
       snprintf(buffer, 32, "%02o:", i*4+j);
       sectorTableFields[i*4+j].ident = createAField(&registerViewFields,3, 21+i,3+j*8, buffer);
-      sectorTableFields[i*4+j].accessible = createAField(&registerViewFields,1,21+i,6+j*8, "S", O_EDIT | O_ACTIVE, "[US]", JUSTIFY_LEFT, (char *) new accessibleHookExecutor(this, &(cpu.memory->sectorTable[i*4+j].accessEnable)));
-      sectorTableFields[i*4+j].writeable = createAField(&registerViewFields,1,21+i,7+j*8, "R", O_EDIT | O_ACTIVE, "[RW]", JUSTIFY_LEFT, (char *) new writeableHookExecutor(this, &(cpu.memory->sectorTable[i*4+j].writeEnable)));
-      sectorTableFields[i*4+j].physicalSector = createAField(&registerViewFields,2,21+i,8+j*8, "00", O_EDIT | O_ACTIVE, "[0-7][0-7]", JUSTIFY_LEFT, (char *) new octalCharPointerHookExecutor(this, &(cpu.memory->sectorTable[i*4+j].physicalPage)));
+      sectorTableFields[i*4+j].accessible = createAField(&registerViewFields,1,21+i,6+j*8, "S", O_EDIT | O_ACTIVE, "[US]", JUSTIFY_LEFT, (char *) new accessibleHookExecutor(this, &(cpu->memory->sectorTable[i*4+j].accessEnable)));
+      sectorTableFields[i*4+j].writeable = createAField(&registerViewFields,1,21+i,7+j*8, "R", O_EDIT | O_ACTIVE, "[RW]", JUSTIFY_LEFT, (char *) new writeableHookExecutor(this, &(cpu->memory->sectorTable[i*4+j].writeEnable)));
+      sectorTableFields[i*4+j].physicalSector = createAField(&registerViewFields,2,21+i,8+j*8, "00", O_EDIT | O_ACTIVE, "[0-7][0-7]", JUSTIFY_LEFT, (char *) new octalCharPointerHookExecutor(this, &(cpu->memory->sectorTable[i*4+j].physicalPage)));
     }
   }
   // STACK
   for (auto i=0; i<16; i++) {
-    stack[i] = createAField(&registerViewFields,6,4+i,31, "000000", O_EDIT | O_ACTIVE, "[0-1][0-7][0-7][0-7][0-7][0-7]", JUSTIFY_LEFT, (char *) new octalShortPointerHookExecutor(this, &cpu.stack.stk[i]));
+    stack[i] = createAField(&registerViewFields,6,4+i,31, "000000", O_EDIT | O_ACTIVE, "[0-1][0-7][0-7][0-7][0-7][0-7]", JUSTIFY_LEFT, (char *) new octalShortPointerHookExecutor(this, &cpu->stack.stk[i]));
   }
   
   for (auto line = 0; line < 16; line++) {
@@ -524,7 +652,7 @@ registerWindow::OctalForm::OctalForm () {
 }
 
 
-registerWindow::HexForm::HexForm () {
+registerWindow::HexForm::HexForm (class dp2200_cpu * c, WINDOW * w) : Form(c, w) {
   const char * rName[]={"A:","B:","C:","D:","E:","H:","L:","X:"};
   FIELD **f;
   int i;
@@ -540,26 +668,26 @@ registerWindow::HexForm::HexForm () {
   for (auto regset=0;regset < 2; regset++) {
     for (auto reg=0; reg<8; reg++) {
       regsIdents[regset][reg] = createAField(&registerViewFields,2,4+reg, 3+15*regset,rName[reg]);
-      regs[regset][reg]=createAField(&registerViewFields,2,4+reg, 5+15*regset, "00", O_EDIT | O_ACTIVE, "[0-9A-Fa-f][0-9A-Fa-f]", JUSTIFY_LEFT, (char *) new hexCharPointerHookExecutor(this, &cpu.regSets[regset].regs[reg]));
+      regs[regset][reg]=createAField(&registerViewFields,2,4+reg, 5+15*regset, "00", O_EDIT | O_ACTIVE, "[0-9A-Fa-f][0-9A-Fa-f]", JUSTIFY_LEFT, (char *) new hexCharPointerHookExecutor(this, &cpu->regSets[regset].regs[reg]));
     }
     // flags
     createAField(&registerViewFields,2, 13,3+15*regset, "P:" );
-    flagParity[regset]=createAField(&registerViewFields,1,13,5+15*regset, "0", O_EDIT | O_ACTIVE, "[0-1]", NO_JUSTIFICATION, (char *) new hexCharPointerHookExecutor(this, &cpu.flagParity[regset]));
+    flagParity[regset]=createAField(&registerViewFields,1,13,5+15*regset, "0", O_EDIT | O_ACTIVE, "[0-1]", NO_JUSTIFICATION, (char *) new hexCharPointerHookExecutor(this, &cpu->flagParity[regset]));
     createAField(&registerViewFields,2, 13,8+15*regset, "S:" );
-    flagSign[regset]=createAField(&registerViewFields,1,13,10+15*regset, "0", O_EDIT | O_ACTIVE, "[0-1]", NO_JUSTIFICATION, (char *) new hexCharPointerHookExecutor(this, &cpu.flagSign[regset]));
+    flagSign[regset]=createAField(&registerViewFields,1,13,10+15*regset, "0", O_EDIT | O_ACTIVE, "[0-1]", NO_JUSTIFICATION, (char *) new hexCharPointerHookExecutor(this, &cpu->flagSign[regset]));
     createAField(&registerViewFields,2, 14,3+15*regset, "C:" );
-    flagCarry[regset]=createAField(&registerViewFields,1,14,5+15*regset, "0", O_EDIT | O_ACTIVE, "[0-1]", NO_JUSTIFICATION, (char *) new hexCharPointerHookExecutor(this, &cpu.flagCarry[regset]));
+    flagCarry[regset]=createAField(&registerViewFields,1,14,5+15*regset, "0", O_EDIT | O_ACTIVE, "[0-1]", NO_JUSTIFICATION, (char *) new hexCharPointerHookExecutor(this, &cpu->flagCarry[regset]));
     createAField(&registerViewFields,2, 14,8+15*regset, "Z:" );
-    flagZero[regset]=createAField(&registerViewFields,1,14,10+15*regset, "0", O_EDIT | O_ACTIVE, "[0-1]", NO_JUSTIFICATION, (char *) new hexCharPointerHookExecutor(this, &cpu.flagZero[regset]));
+    flagZero[regset]=createAField(&registerViewFields,1,14,10+15*regset, "0", O_EDIT | O_ACTIVE, "[0-1]", NO_JUSTIFICATION, (char *) new hexCharPointerHookExecutor(this, &cpu->flagZero[regset]));
   }
 
   createAField(&registerViewFields,2, 16,3, "P:" );
-  pc=createAField(&registerViewFields,4,16,5, "0000", O_EDIT | O_ACTIVE, "[0-9A-Fa-f][0-9A-Fa-f][0-9A-Fa-f][0-9A-Fa-f]", JUSTIFY_LEFT, (char *) new hexShortPointerHookExecutor(this, &cpu.P));
+  pc=createAField(&registerViewFields,4,16,5, "0000", O_EDIT | O_ACTIVE, "[0-9A-Fa-f][0-9A-Fa-f][0-9A-Fa-f][0-9A-Fa-f]", JUSTIFY_LEFT, (char *) new hexShortPointerHookExecutor(this, &cpu->P));
   mnemonic = createAField(&registerViewFields,10, 16,10, "" );
 
   // BASE REGISTER
   baseIdents = createAField(&registerViewFields,5, 17,3, "BASE:" );
-  base=createAField(&registerViewFields,2,17,8, "00", O_EDIT | O_ACTIVE, "[0-9A-Fa-f][0-9A-Fa-f]", JUSTIFY_LEFT, (char *) new hexCharPointerHookExecutor(this, &(cpu.memory->baseRegister)));
+  base=createAField(&registerViewFields,2,17,8, "00", O_EDIT | O_ACTIVE, "[0-9A-Fa-f][0-9A-Fa-f]", JUSTIFY_LEFT, (char *) new hexCharPointerHookExecutor(this, &(cpu->memory->baseRegister)));
   // SECTOR TABLE
   sectorTableHeader = createAField(&registerViewFields,13, 20,3, "SECTOR TABLE:" );
   for (int i=0; i<4; i++) {
@@ -567,14 +695,14 @@ registerWindow::HexForm::HexForm () {
       char buffer[32];
       snprintf(buffer, 32, "%01X:", i*4+j);
       sectorTableFields[i*4+j].ident = createAField(&registerViewFields,3, 21+i,3+j*7, buffer);
-      sectorTableFields[i*4+j].accessible = createAField(&registerViewFields,1,21+i,5+j*7, "S", O_EDIT | O_ACTIVE, "[US]", JUSTIFY_LEFT, (char *) new accessibleHookExecutor(this, &(cpu.memory->sectorTable[i*4+j].accessEnable)));
-      sectorTableFields[i*4+j].writeable = createAField(&registerViewFields,1,21+i,6+j*7, "R", O_EDIT | O_ACTIVE, "[RW]", JUSTIFY_LEFT, (char *) new writeableHookExecutor(this, &(cpu.memory->sectorTable[i*4+j].writeEnable)));
-      sectorTableFields[i*4+j].physicalSector = createAField(&registerViewFields,2,21+i,7+j*7, "00", O_EDIT | O_ACTIVE, "[0-3][0-9A-Fa-f]", JUSTIFY_LEFT, (char *) new hexCharPointerHookExecutor(this, &(cpu.memory->sectorTable[i*4+j].physicalPage)));
+      sectorTableFields[i*4+j].accessible = createAField(&registerViewFields,1,21+i,5+j*7, "S", O_EDIT | O_ACTIVE, "[US]", JUSTIFY_LEFT, (char *) new accessibleHookExecutor(this, &(cpu->memory->sectorTable[i*4+j].accessEnable)));
+      sectorTableFields[i*4+j].writeable = createAField(&registerViewFields,1,21+i,6+j*7, "R", O_EDIT | O_ACTIVE, "[RW]", JUSTIFY_LEFT, (char *) new writeableHookExecutor(this, &(cpu->memory->sectorTable[i*4+j].writeEnable)));
+      sectorTableFields[i*4+j].physicalSector = createAField(&registerViewFields,2,21+i,7+j*7, "00", O_EDIT | O_ACTIVE, "[0-3][0-9A-Fa-f]", JUSTIFY_LEFT, (char *) new hexCharPointerHookExecutor(this, &(cpu->memory->sectorTable[i*4+j].physicalPage)));
     }
   }
 
   for (auto i=0; i<16; i++) {
-    stack[i] = createAField(&registerViewFields,4,4+i,31, "0000", O_EDIT | O_ACTIVE, "[0-3][0-9A-Fa-f][0-9A-Fa-f][0-9A-Fa-f]", JUSTIFY_LEFT, (char *) new hexShortPointerHookExecutor(this, &cpu.stack.stk[i]));
+    stack[i] = createAField(&registerViewFields,4,4+i,31, "0000", O_EDIT | O_ACTIVE, "[0-3][0-9A-Fa-f][0-9A-Fa-f][0-9A-Fa-f]", JUSTIFY_LEFT, (char *) new hexShortPointerHookExecutor(this, &cpu->stack.stk[i]));
   }
   
   for (auto line = 0; line < 16; line++) {
@@ -633,15 +761,15 @@ FORM * registerWindow::OctalForm::getForm() {
 }
 
 registerWindow::HexForm * registerWindow::createHexForm () {
-  return new registerWindow::HexForm();
+  return new registerWindow::HexForm(cpu, win);
 }
 
 registerWindow::OctalForm * registerWindow::createOctalForm () {
-  return new registerWindow::OctalForm();
+  return new registerWindow::OctalForm(cpu, win);
 }
 
 registerWindow::registerWindow(class dp2200_cpu *c) {
-
+  cpu = c;
   cursorX = 4;  
   cursorY = 1;
   win = newwin(LINES, COLS - 82, 0, 82);
@@ -649,6 +777,11 @@ registerWindow::registerWindow(class dp2200_cpu *c) {
   wrefresh(win);
   octal = true;
   activeWindow = false;
+  changeCount = 0;
+  shownChangeCount = 0;
+  wasRunning = false;
+  refreshRate = REGISTER_REFRESH_RATE;
+  lastRefresh = 0;
   
   formHex = createHexForm ();
   formOctal = createOctalForm ();
@@ -677,13 +810,50 @@ registerWindow::~registerWindow() {
 
 }
 
-void registerWindow::updateWindow() {
-  if (!activeWindow)  {
+// Called every turn of the event loop. While the CPU is running the form is
+// rebuilt refreshRate times per second (never if it is 0). When it stops it is
+// rebuilt at once and after that only when stateChanged() has been called.
+void registerWindow::updateWindow(bool running) {
+  struct timespec now;
+  unsigned long nowMs;
+  bool due = false;
+  if (activeWindow) {
+    return;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  nowMs = now.tv_sec * 1000UL + now.tv_nsec / 1000000;
+  if (wasRunning != running) {
+    due = true;
+  } else if (running) {
+    due = refreshRate > 0 && (nowMs - lastRefresh) >= (unsigned long) (1000 / refreshRate);
+  } else {
+    due = changeCount != shownChangeCount;
+  }
+  if (due) {
+    shownChangeCount = changeCount;
+    wasRunning = running;
+    lastRefresh = nowMs;
     currentForm->updateForm();
     wrefresh(win);
   }
 }
 
+void registerWindow::stateChanged() {
+  changeCount++;
+}
+
+int registerWindow::setRefreshRate(int hz) {
+  if (hz < 0 || hz > 100) {
+    return 1;
+  }
+  refreshRate = hz;
+  return 0;
+}
+
+int registerWindow::getRefreshRate() {
+  return refreshRate;
+}
+
 void registerWindow::hightlightWindow() {
   curs_set(2);
 
@@ -789,30 +959,42 @@ void registerWindow::handleKey(int key) {
 }
 
 int registerWindow::setDisplayLight(bool value) {
-  cpu.displayLightStatus=value;
+  if (cpu->displayLightStatus != value) {
+    cpu->displayLightStatus = value;
+    stateChanged();
+  }
   return 0; 
 }
 int registerWindow::setKeyboardLight(bool value) {
-  cpu.keyboardLightStatus=value;
+  if (cpu->keyboardLightStatus != value) {
+    cpu->keyboardLightStatus = value;
+    stateChanged();
+  }
   return 0;
 }
 
 int registerWindow::setKeyboardButton(bool value) {
-  cpu.keyboardButtonStatus = value;
+  if (cpu->keyboardButtonStatus != value) {
+    cpu->keyboardButtonStatus = value;
+    stateChanged();
+  }
   return 0;
 }
 
 int registerWindow::setDisplayButton(bool value) {
-  cpu.displayButtonStatus = value;
+  if (cpu->displayButtonStatus != value) {
+    cpu->displayButtonStatus = value;
+    stateChanged();
+  }
   return 0;
 }
 
 bool registerWindow::getDisplayButton() {
-  return cpu.displayButtonStatus;
+  return cpu->displayButtonStatus;
 }
 
 bool registerWindow::getKeyboardButton() {
-  return cpu.keyboardButtonStatus;
+  return cpu->keyboardButtonStatus;
 }
 
 void registerWindow::setOctal(bool octal) {
@@ -7,13 +7,15 @@
 #include "dp2200_cpu_sim.h"
 #include <cassert>
 #include <cstring>
+#include <ctime>
+
+// How many times per second the register window is redrawn while the CPU runs.
+#define REGISTER_REFRESH_RATE 10
 
 
 void form_hook_proxy(formnode *);
 void printLog(const char *level, const char *fmt, ...);
 
-extern class dp2200_cpu cpu;
-
 class hookExecutor {
   public:
   virtual void exec(FIELD *field) = 0;  
@@ -110,9 +112,15 @@ class registerWindow : public virtual Window {
     };
 
 
+    // The CPU shown and the window the form is drawn in.
+    class dp2200_cpu * cpu;
+    WINDOW * win;
     FIELD * createAField(std::vector<FIELD *> * fields, int length, int y, int x, const char * str);
     FIELD * createAField(std::vector<FIELD *> * fields, int length, int y, int x, const char * str, Field_Options f, const char * regexp, int just, char * h);
+    void setFieldBuffer(FIELD * field, const char * str);
+    void setFieldBack(FIELD * field, chtype attr);
     public:
+    Form(class dp2200_cpu * c, WINDOW * w);
     virtual void set2200Mode(bool) = 0;
     virtual void updateForm() = 0;
     virtual FORM *  getForm() = 0;
@@ -158,7 +166,7 @@ class registerWindow : public virtual Window {
     void set2200Mode(bool);
     void updateForm();
     FORM * getForm();
-    HexForm();
+    HexForm(class dp2200_cpu * c, WINDOW * w);
     ~HexForm();
   };
 
@@ -201,16 +209,22 @@ class registerWindow : public virtual Window {
     void set2200Mode(bool);
     void updateForm();
     FORM * getForm();
-    OctalForm();
+    OctalForm(class dp2200_cpu * c, WINDOW * w);
     ~OctalForm();
   };
 
   int cursorX, cursorY;
+  class dp2200_cpu * cpu;
   WINDOW *win;
   WINDOW *dwinhex;
   WINDOW *dwinoctal;
 
   bool activeWindow;
+  unsigned long changeCount;
+  unsigned long shownChangeCount;
+  bool wasRunning;
+  int refreshRate;
+  unsigned long lastRefresh;
   registerWindow::HexForm * formHex;
   registerWindow::Form * currentForm;
   registerWindow::OctalForm * formOctal;
@@ -234,7 +248,10 @@ public:
   registerWindow(class dp2200_cpu *c);
   ~registerWindow();
 
-  void updateWindow();
+  void updateWindow(bool running);
+  void stateChanged();
+  int setRefreshRate(int hz);
+  int getRefreshRate();
   void set2200Mode (bool);
   void hightlightWindow();
   void normalWindow();
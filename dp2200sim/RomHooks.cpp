@@ -0,0 +1,263 @@
+#include "RomHooks.h"
+#include "Machine.h"
+#include <algorithm>
+
+RomHooks::RomHooks(class Machine * m) {
+  machine = m;
+  cpu = &m->cpu;
+  breakpointChecked = false;
+  breakpoint = false;
+  add(0170062, "CLEAR", "Power-up memory clear", {0027, 0117, 0035, 0100, 0062, 0360}, &RomHooks::clearMemory);
+  add(0176067, "CASSETTE", "Cassette record read",
+      {0006, 0360, 0121, 0101, 0044, 0103, 0054, 0100, 0013, 0101, 0044, 0020, 0150, 0122, 0374, 0006,
+       0341, 0121, 0101, 0044, 0010, 0110, 0075, 0363, 0104, 0000, 0000, 0101, 0044, 0004, 0150, 0067,
+       0374, 0125, 0101, 0370, 0015, 0104, 0067, 0374}, &RomHooks::readCassette);
+  add(0177241, "BUFFER", "Disk buffer to memory", {0101, 0370, 0015, 0062, 0024, 0001, 0110, 0241, 0376}, &RomHooks::readBuffer);
+  add(0176616, "TRANSFER9370", "9370 transfer wait", {0304, 0121, 0101, 0044, 0002, 0110, 0216, 0375}, &RomHooks::waitTransfer);
+  add(0176627, "READY9370", "9370 drive wait", {0304, 0121, 0101, 0054, 0001, 0012, 0043, 0044, 0003, 0110, 0227, 0375}, &RomHooks::waitReady);
+  add(0176765, "READY9350", "9350 drive wait", {0304, 0121, 0101, 0054, 0001, 0012, 0043, 0044, 0003, 0054, 0003, 0110, 0365, 0375}, &RomHooks::waitReady);
+  add(0177147, "TRANSFERFLOPPY", "Floppy transfer wait", {0304, 0121, 0101, 0044, 0002, 0110, 0147, 0376}, &RomHooks::waitTransfer);
+  add(0177160, "READYFLOPPY", "Floppy drive wait", {0304, 0121, 0101, 0054, 0001, 0012, 0043, 0044, 0003, 0054, 0002, 0110, 0160, 0376}, &RomHooks::waitReady);
+}
+
+void RomHooks::add(unsigned short address, std::string name, std::string description, std::vector<unsigned char> code, void (RomHooks::*routine)(unsigned short)) {
+  hooks[address] = {name, description, code, routine, true, 0, 0};
+}
+
+bool RomHooks::matches(unsigned short address, struct hook * h) {
+  for (size_t i = 0; i < h->code.size(); i++) {
+    if (cpu->memory->physicalMemoryRead(address + i) != h->code[i]) return false;
+  }
+  return true;
+}
+
+unsigned long RomHooks::run() {
+  auto it = hooks.find(cpu->P);
+  if (it == hooks.end() || !it->second.enabled) return 0;
+  // Anything execute() would do before the instruction is left to it.
+  if (!cpu->is5500 || cpu->userMode || cpu->traceEnabled || cpu->interruptEnabledToBeEnabled ||
+      (cpu->interruptEnabled && cpu->interruptPending) || cpu->accessViolation || cpu->writeViolation ||
+      cpu->privilegeViolation || cpu->inputParityFailure) {
+    return 0;
+  }
+  if (cpu->memory->sectorTable[017].physicalPage != 017 || !matches(it->first, &it->second)) return 0;
+  retired = 0;
+  breakpointChecked = false;
+  (this->*(it->second.routine))(it->first);
+  if (retired > 0) {
+    it->second.calls++;
+    it->second.instructions += retired;
+  }
+  return retired;
+}
+
+bool RomHooks::atBreakpoint() {
+  if (!breakpointChecked) {
+    breakpointChecked = true;
+    breakpoint = cpu->atBreakpoint();
+  }
+  return breakpoint;
+}
+
+bool RomHooks::retire(unsigned short address, int length, unsigned short next) {
+  unsigned char opcode = cpu->memory->physicalMemoryRead(address);
+  switch (opcode) {
+    case 0022:
+    case 0062:
+    case 0111:
+    case 0113:
+    case 0115:
+    case 0117:
+    case 0174:
+    case 0176:
+      cpu->implicit = opcode;
+      opcode = cpu->memory->physicalMemoryRead(address + 1);
+      break;
+    default:
+      cpu->implicit = 0;
+  }
+  cpu->instructions++;
+  cpu->fetches += length;
+  cpu->opcodeGroups[cpu->implicit != 0 ? 4 : opcode >> 6]++;
+  cpu->previousP = address;
+  cpu->P = next;
+  cpu->totalInstructionTime.tv_nsec += cpu->instTimeInNsNotTkn[opcode];
+  if (cpu->totalInstructionTime.tv_nsec >= 1000000000) {
+    cpu->totalInstructionTime.tv_nsec -= 1000000000;
+    cpu->totalInstructionTime.tv_sec++;
+  }
+  retired++;
+  breakpointChecked = false;
+  // Machine::run fires a timer once its deadline has passed. A device may just
+  // have added one.
+  if (!machine->running || cpu->instructions >= machine->stopAt || !compareTimeSpec(machine->nextDeadline(), cpu->totalInstructionTime) ||
+      cpu->accessViolation || cpu->writeViolation || cpu->privilegeViolation || cpu->inputParityFailure) {
+    return false;
+  }
+  return !atBreakpoint();
+}
+
+bool RomHooks::retire(unsigned short address, int length) {
+  return retire(address, length, address + length);
+}
+
+// INPUT to A. A device that is not there gives an access violation.
+bool RomHooks::input(unsigned short address) {
+  int value;
+  cpu->ioCtrl->countOperation();
+  value = cpu->ioCtrl->input();
+  if (value == -1) {
+    cpu->accessViolation = true;
+  } else {
+    cpu->regSets[cpu->setSel].r.regA = value;
+  }
+  return retire(address, 1);
+}
+
+// 170062 DS DE,HL  DECP HL,2  JFC 170062
+void RomHooks::clearMemory(unsigned short address) {
+  auto & r = cpu->regSets[cpu->setSel].r;
+  unsigned short hl;
+  do {
+    hl = ((r.regH << 8) | r.regL) & cpu->pMask;
+    cpu->memory->write(hl, r.regE, address);
+    cpu->memory->write(hl + 1, r.regD, address);
+    if (!retire(address, 1)) return;
+    cpu->incrementRegisterPair(REG_H, REG_L, -2);
+    if (!retire(address + 1, 2)) return;
+  } while (retire(address + 3, 3, cpu->flagCarry[cpu->setSel] ? address + 6 : address) && cpu->P == address);
+}
+
+// 176067 LA 360  EX_ADR  INPUT  ND 103  XR 100  RFZ  INPUT  ND 020  JTZ 176122
+// 176122 INPUT  ND 004  JTZ 176067  EX_DATA  INPUT  LMA  INCP HL  JMP 176067
+// Leaves the return at a missing cassette or end of tape and the jump at the
+// gap after the record to the interpreter.
+void RomHooks::readCassette(unsigned short address) {
+  auto & r = cpu->regSets[cpu->setSel].r;
+  for (;;) {
+    r.regA = 0360;
+    if (!retire(0176067, 2)) return;
+    cpu->ioCtrl->exAdr(r.regA);
+    if (!retire(0176071, 1)) return;
+    if (!input(0176072)) return;
+    r.regA &= 0103;
+    cpu->setflags(r.regA, 1);
+    if (!retire(0176073, 2)) return;
+    r.regA ^= 0100;
+    cpu->setflags(r.regA, 1);
+    if (!retire(0176075, 2)) return;
+    if (!cpu->flagZero[cpu->setSel]) return;
+    if (!retire(0176077, 1)) return;
+    if (!input(0176100)) return;
+    r.regA &= 0020;
+    cpu->setflags(r.regA, 1);
+    if (!retire(0176101, 2)) return;
+    if (!retire(0176103, 3, cpu->flagZero[cpu->setSel] ? 0176122 : 0176106) || cpu->P != 0176122) return;
+    if (!input(0176122)) return;
+    r.regA &= 0004;
+    cpu->setflags(r.regA, 1);
+    if (!retire(0176123, 2)) return;
+    if (cpu->flagZero[cpu->setSel]) {
+      if (!retire(0176125, 3, 0176067)) return;
+      continue;
+    }
+    if (!retire(0176125, 3)) return;
+    cpu->ioCtrl->exData();
+    if (!retire(0176130, 1)) return;
+    if (!input(0176131)) return;
+    cpu->memory->write(((r.regH & cpu->hMask) << 8) + r.regL, r.regA, 0176132);
+    if (!retire(0176132, 1)) return;
+    cpu->incrementRegisterPair(REG_H, REG_L, 1);
+    if (!retire(0176133, 1)) return;
+    if (!retire(0176134, 3, 0176067)) return;
+  }
+}
+
+// 177241 INPUT  LMA  INCP HL  SU C,1  JFZ 177241
+void RomHooks::readBuffer(unsigned short address) {
+  auto & r = cpu->regSets[cpu->setSel].r;
+  int result;
+  do {
+    if (!input(address)) return;
+    cpu->memory->write(((r.regH & cpu->hMask) << 8) + r.regL, r.regA, address + 1);
+    if (!retire(address + 1, 1)) return;
+    cpu->incrementRegisterPair(REG_H, REG_L, 1);
+    if (!retire(address + 2, 1)) return;
+    result = r.regC - 1;
+    r.regC = (unsigned char) result;
+    cpu->setflags(result, 0);
+    if (!retire(address + 3, 3)) return;
+  } while (retire(address + 6, 3, cpu->flagZero[cpu->setSel] ? address + 9 : address) && cpu->P == address);
+}
+
+// LAE  EX_ADR  INPUT  ND 002  JFZ back, while a transfer is in progress.
+void RomHooks::waitTransfer(unsigned short address) {
+  auto & r = cpu->regSets[cpu->setSel].r;
+  do {
+    r.regA = r.regE;
+    if (!retire(address, 1)) return;
+    cpu->ioCtrl->exAdr(r.regA);
+    if (!retire(address + 1, 1)) return;
+    if (!input(address + 2)) return;
+    r.regA &= 0002;
+    cpu->setflags(r.regA, 1);
+    if (!retire(address + 3, 2)) return;
+  } while (retire(address + 5, 3, cpu->flagZero[cpu->setSel] ? address + 8 : address) && cpu->P == address);
+}
+
+// LAE  EX_ADR  INPUT  XR 001  SRC  RTC  ND 003  [XR n]  JFZ back, while the
+// drive is busy. The 9350 and floppy loops have the XR, the 9370 loop does not.
+// The return when the drive is off line is left to the interpreter.
+void RomHooks::waitReady(unsigned short address) {
+  auto & r = cpu->regSets[cpu->setSel].r;
+  bool compare = cpu->memory->physicalMemoryRead(address + 011) == 0054;
+  unsigned short jump = compare ? address + 013 : address + 011;
+  do {
+    r.regA = r.regE;
+    if (!retire(address, 1)) return;
+    cpu->ioCtrl->exAdr(r.regA);
+    if (!retire(address + 1, 1)) return;
+    if (!input(address + 2)) return;
+    r.regA ^= 0001;
+    cpu->setflags(r.regA, 1);
+    if (!retire(address + 3, 2)) return;
+    cpu->flagCarry[cpu->setSel] = r.regA & 1;
+    r.regA = (unsigned char) ((r.regA << 7) | (r.regA >> 1));
+    if (!retire(address + 5, 1)) return;
+    if (cpu->flagCarry[cpu->setSel]) return;
+    if (!retire(address + 6, 1)) return;
+    r.regA &= 0003;
+    cpu->setflags(r.regA, 1);
+    if (!retire(address + 7, 2)) return;
+    if (compare) {
+      r.regA ^= cpu->memory->physicalMemoryRead(address + 012);
+      cpu->setflags(r.regA, 1);
+      if (!retire(address + 011, 2)) return;
+    }
+  } while (retire(jump, 3, cpu->flagZero[cpu->setSel] ? jump + 3 : address) && cpu->P == address);
+}
+
+int RomHooks::enable(std::string name, bool enabled) {
+  int ret = ROM_HOOKS_UNKNOWN;
+  std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+  for (auto it = hooks.begin(); it != hooks.end(); it++) {
+    if (name == "ALL" || name == it->second.name) {
+      it->second.enabled = enabled;
+      ret = ROM_HOOKS_OK;
+    }
+  }
+  return ret;
+}
+
+std::vector<std::string> RomHooks::report() {
+  std::vector<std::string> lines;
+  char buffer[160];
+  snprintf(buffer, sizeof(buffer), "%-14s %-6s %-3s %10s %12s  %s", "hook", "at", "on", "calls", "instructions", "routine");
+  lines.push_back(buffer);
+  for (auto it = hooks.begin(); it != hooks.end(); it++) {
+    snprintf(buffer, sizeof(buffer), "%-14s %06o %-3s %10lu %12lu  %s", it->second.name.c_str(), it->first,
+             it->second.enabled ? "yes" : "no", it->second.calls, it->second.instructions, it->second.description.c_str());
+    lines.push_back(buffer);
+  }
+  return lines;
+}
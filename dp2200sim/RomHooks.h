@@ -0,0 +1,65 @@
+#ifndef _ROM_HOOKS_
+#define _ROM_HOOKS_
+#include <map>
+#include <string>
+#include <vector>
+
+#define ROM_HOOKS_OK 0
+#define ROM_HOOKS_UNKNOWN -1
+
+// Hooks are only looked up for P at or above this address, the 5500 firmware.
+#define ROM_HOOKS_START 0170000
+
+// High level emulation of loops in the 5500 firmware. A hook is keyed on the
+// ROM address where a loop starts and runs the loop in C++ instead of one
+// instruction at a time. Registers, flags, memory and devices are changed by
+// the same calls the instructions make, and every instruction is counted in
+// the instruction count, fetches and simulated time as execute() counts it, so
+// timers fire after the same instruction as when interpreted. A hook hands back
+// to the interpreter at the exits of its loop, when a timer is due, at
+// stopAt, at a breakpoint or a memory watch and on any violation. It does not
+// run unless the firmware holds the code it was written for, or while tracing.
+class RomHooks {
+  struct hook {
+    std::string name;
+    std::string description;
+    // The code of the loop in the firmware, starting at the hook address.
+    std::vector<unsigned char> code;
+    void (RomHooks::*routine)(unsigned short address);
+    bool enabled;
+    unsigned long calls;
+    unsigned long instructions;
+  };
+  std::map<unsigned short, struct hook> hooks;
+  class Machine * machine;
+  class dp2200_cpu * cpu;
+  unsigned long retired;
+  // Whether retire has looked for a breakpoint at P, and found one.
+  bool breakpointChecked;
+  bool breakpoint;
+  void add(unsigned short address, std::string name, std::string description, std::vector<unsigned char> code, void (RomHooks::*routine)(unsigned short));
+  bool matches(unsigned short address, struct hook * h);
+  // Account for the instruction at address and continue at next. False if the
+  // interpreter has to run the next instruction.
+  bool retire(unsigned short address, int length, unsigned short next);
+  bool retire(unsigned short address, int length);
+  bool input(unsigned short address);
+  void clearMemory(unsigned short address);
+  void readCassette(unsigned short address);
+  void readBuffer(unsigned short address);
+  void waitTransfer(unsigned short address);
+  void waitReady(unsigned short address);
+  public:
+  RomHooks(class Machine * machine);
+  // Run the hook at P, if there is an enabled one. Returns the number of
+  // instructions run, 0 if the interpreter has to run the next instruction.
+  unsigned long run();
+  // True if the CPU is at a breakpoint after run. A condition is only checked,
+  // and its hit counted, if retire did not already do it at P.
+  bool atBreakpoint();
+  // name is a hook name or ALL.
+  int enable(std::string name, bool enabled);
+  std::vector<std::string> report();
+};
+
+#endif
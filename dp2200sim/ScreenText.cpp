@@ -0,0 +1,162 @@
+#include "ScreenText.h"
+#include "StateFile.h"
+#include <cstring>
+
+void printLog(const char *level, const char *fmt, ...);
+
+ScreenText::ScreenText() {
+  cursorX = 0;
+  cursorY = 0;
+  cursorEnabled = false;
+  lastCharGenChar = 0;
+  charGenIndex = 0;
+  memset(font5x7, 0, sizeof(font5x7));
+  memset(screen, ' ', sizeof(screen));
+}
+
+int ScreenText::eraseFromCursorToEndOfFrame() {
+  printLog("INFO", "Erasing from X=%d, Y=%d to end of frame\n", cursorX, cursorY);
+  for (int i=cursorX; i<80;i++) {
+    screen[i][cursorY]=' ';
+  }
+  for (int i=cursorY+1; i <12; i++) {
+    for (int j=0; j<80; j++) {
+      screen[j][i]=' ';
+    }
+  }
+  textChanged();
+  return 0;
+}
+
+int ScreenText::eraseFromCursorToEndOfLine() {
+  printLog("INFO", "Erasing from X=%d, Y=%d to end of line\n", cursorX, cursorY);
+  for (int i=cursorX; i<80;i++) {
+    screen[i][cursorY]=' ';
+  }
+  textChanged();
+  return 0;
+}
+
+int ScreenText::rollScreenOneLine() {
+  printLog("INFO", "Roll one line\n");
+  return scrollUp();
+}
+
+int ScreenText::showCursor(bool value) {
+  bool changed = value != cursorEnabled;
+  cursorEnabled=value;
+  printLog("INFO", "Setting cursor status = %d \n", cursorEnabled);
+  if (changed) cursorChanged();
+  return 0;
+}
+
+int ScreenText::setCursorX(int value) {
+  if (value >= 80 || value < 0) {
+    printLog("INFO", "setCursorX: Value is outside limits : %d\n", value);
+    return 0;
+  }
+  if (value == cursorX) return 0;
+  cursorX = value;
+  printLog("INFO", "Setting Cursor X X=%d Y=%d\n", cursorX, cursorY);
+  cursorChanged();
+  return 0;
+}
+
+int ScreenText::setCursorY(int value) {
+  if (value >= 12 || value < 0) {
+    printLog("INFO", "setCursorY: Value is outside limits : %d\n", value);
+    return 0;
+  }
+  if (value == cursorY) return 0;
+  cursorY = value;
+  printLog("INFO", "Setting Cursor Y X=%d Y=%d\n", cursorX, cursorY);
+  cursorChanged();
+  return 0;
+}
+
+// With auto increment the cursor may have moved past the last column, the
+// character is then not shown.
+int ScreenText::writeCharacter(int value) {
+  printLog("INFO", "Writing char=%c to screen\n", value);
+  if (cursorX >= 80) return 0;
+  screen[cursorX][cursorY]=value;
+  textChanged();
+  return 0;
+}
+
+int ScreenText::scrollDown() {
+  int i,j;
+  for (j=11; j > 0; j--) {
+    for (i=0; i < 80; i++) {
+      screen[i][j] = screen[i][j-1];
+    }
+  }
+  for (i=0; i < 80; i++) screen[i][0] = ' ';
+  textChanged();
+  return 0;
+}
+
+int ScreenText::scrollUp() {
+  int i,j;
+  for (j=0; j < 11; j++) {
+    for (i=0; i < 80; i++) {
+      screen[i][j] = screen[i][j+1];
+    }
+  }
+  for (i=0; i < 80; i++) screen[i][11] = ' ';
+  textChanged();
+  return 0;
+}
+
+void ScreenText::incrementXPos() {
+  cursorX++;
+}
+
+void ScreenText::setCharGenChar(int data) {
+  lastCharGenChar=data & 0177;
+  charGenIndex=0;
+}
+
+void ScreenText::updateCharGen(int data) {
+  font5x7[lastCharGenChar][charGenIndex] = 0177 & data;
+  printLog("INFO", "CHARGEN:  %04o %01o: %04o \n", lastCharGenChar, charGenIndex, 0177 & data);
+  charGenIndex++;
+  if (charGenIndex==5) {
+    charGenIndex = 0;
+    lastCharGenChar = 0177 & (lastCharGenChar+1);
+  }
+  fontChanged();
+}
+
+// Screen contents, cursor and the character generator loaded by the guest.
+void ScreenText::saveState(class StateFile * state) {
+  state->putBytes(screen, sizeof(screen));
+  state->putInt(cursorX);
+  state->putInt(cursorY);
+  state->putBool(cursorEnabled);
+  state->putBytes(font5x7, sizeof(font5x7));
+  state->putInt(lastCharGenChar);
+  state->putInt(charGenIndex);
+}
+
+int ScreenText::loadState(class StateFile * state) {
+  state->getBytes(screen, sizeof(screen));
+  cursorX = state->getInt();
+  cursorY = state->getInt();
+  cursorEnabled = state->getBool();
+  state->getBytes(font5x7, sizeof(font5x7));
+  lastCharGenChar = state->getInt();
+  charGenIndex = state->getInt();
+  fontChanged();
+  textChanged();
+  cursorChanged();
+  return 0;
+}
+
+std::string ScreenText::screenLine(int row) {
+  std::string line;
+  for (int i = 0; i < 80; i++) {
+    line += screen[i][row];
+  }
+  return line;
+}
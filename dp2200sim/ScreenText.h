@@ -0,0 +1,48 @@
+#ifndef _SCREEN_TEXT_
+#define _SCREEN_TEXT_
+#include <string>
+
+// Size of screen
+const int CHARS_W = 80;
+const int CHARS_H = 12;
+
+// What the screen and keyboard device shows: 12 rows of 80 characters, the
+// cursor and the character generator loaded by the guest. Programs without a
+// terminal use it as it is. dp2200Window draws it, and is told through the
+// changed functions what it has to draw again.
+class ScreenText {
+  protected:
+  int cursorX, cursorY;
+  bool cursorEnabled;
+  int lastCharGenChar;
+  int charGenIndex;
+  unsigned char font5x7[128][5];
+  char screen[80][12];
+  // Called after the characters, the cursor or the font have changed.
+  virtual void textChanged() {}
+  virtual void cursorChanged() {}
+  virtual void fontChanged() {}
+
+  public:
+  ScreenText();
+  virtual ~ScreenText() {}
+  int eraseFromCursorToEndOfFrame();
+  int eraseFromCursorToEndOfLine();
+  int rollScreenOneLine();
+  int showCursor(bool);
+  int setCursorX(int);
+  int setCursorY(int);
+  int writeCharacter(int);
+  int scrollUp();
+  int scrollDown();
+  void incrementXPos();
+  void setCharGenChar(int);
+  void updateCharGen(int);
+  virtual void beep() {}
+  void saveState(class StateFile * state);
+  int loadState(class StateFile * state);
+  // Text of one row of the screen.
+  std::string screenLine(int row);
+};
+
+#endif
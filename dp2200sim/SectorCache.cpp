@@ -0,0 +1,156 @@
+#include "SectorCache.h"
+#include "StateFile.h"
+#include <cstring>
+
+void printLog(const char *level, const char *fmt, ...);
+
+SectorCache::SectorCache(int spt, unsigned int c) {
+  sectorsPerTrack = spt;
+  capacity = c;
+  file = NULL;
+  cached = 0;
+  lastSector = -2;
+  copyOnWrite = false;
+  dirtyCount = 0;
+  trackBuffer.resize(spt * SECTOR_CACHE_SECTOR_SIZE);
+  resetStatistics();
+}
+
+void SectorCache::setFile(FILE * f) {
+  invalidate();
+  file = f;
+  copyOnWrite = false;
+  dirty.clear();
+  dirtyCount = 0;
+}
+
+void SectorCache::invalidate() {
+  lru.clear();
+  index.clear();
+  cached = 0;
+  lastSector = -2;
+}
+
+void SectorCache::resetStatistics() {
+  hits = 0;
+  misses = 0;
+  readAheads = 0;
+}
+
+unsigned int SectorCache::size() {
+  return cached;
+}
+
+// Put a new sector first in the LRU list. Evict the least recently used one if full.
+struct SectorCache::entry * SectorCache::insert(long sector) {
+  if (lru.size() >= capacity) {
+    index.erase(lru.back().sector);
+    lru.pop_back();
+  }
+  lru.emplace_front();
+  lru.front().sector = sector;
+  index[sector] = lru.begin();
+  cached = lru.size();
+  return &lru.front();
+}
+
+int SectorCache::readSector(char * buffer, long address) {
+  long sector = address / SECTOR_CACHE_SECTOR_SIZE;
+  if (!dirty.empty()) {
+    auto d = dirty.find(sector);
+    if (d != dirty.end()) {
+      hits++;
+      memcpy(buffer, d->second.data(), SECTOR_CACHE_SECTOR_SIZE);
+      lastSector = sector;
+      return 0;
+    }
+  }
+  auto it = index.find(sector);
+  if (it != index.end()) {
+    hits++;
+    lru.splice(lru.begin(), lru, it->second);
+    memcpy(buffer, lru.front().data, SECTOR_CACHE_SECTOR_SIZE);
+    lastSector = sector;
+    return 0;
+  }
+  misses++;
+  if (file == NULL) return 1;
+  int count = 1;
+  if ((sector == lastSector + 1) && ((sector % sectorsPerTrack) != 0)) {
+    // Guest is walking the track in order. Fetch the remainder of the track.
+    count = sectorsPerTrack - (sector % sectorsPerTrack);
+  }
+  char * track = trackBuffer.data();
+  fseek(file, address, SEEK_SET);
+  size_t bytes = fread(track, 1, count * SECTOR_CACHE_SECTOR_SIZE, file);
+  int n = bytes / SECTOR_CACHE_SECTOR_SIZE;
+  lastSector = sector;
+  if (n == 0) {
+    // Beyond end of image, or a last sector cut short. Whatever is there is read
+    // and the rest is zeros. Do not cache anything.
+    memcpy(buffer, track, bytes);
+    memset(buffer + bytes, 0, SECTOR_CACHE_SECTOR_SIZE - bytes);
+    if (bytes > 0) {
+      printLog("INFO", "Sector %ld is only %d bytes in the image, the rest reads as zeros\n", sector, (int) bytes);
+    }
+    return 0;
+  }
+  // Insert backwards so that the requested sector ends up most recently used.
+  for (int i = n - 1; i >= 0; i--) {
+    if (i > 0 && index.find(sector + i) != index.end()) continue;
+    memcpy(insert(sector + i)->data, track + i * SECTOR_CACHE_SECTOR_SIZE, SECTOR_CACHE_SECTOR_SIZE);
+  }
+  if (n > 1) {
+    readAheads += n - 1;
+  }
+  memcpy(buffer, track, SECTOR_CACHE_SECTOR_SIZE);
+  return 0;
+}
+
+void SectorCache::updateSector(char * buffer, long address) {
+  long sector = address / SECTOR_CACHE_SECTOR_SIZE;
+  auto it = index.find(sector);
+  if (it != index.end()) {
+    lru.splice(lru.begin(), lru, it->second);
+    memcpy(lru.front().data, buffer, SECTOR_CACHE_SECTOR_SIZE);
+  } else {
+    memcpy(insert(sector)->data, buffer, SECTOR_CACHE_SECTOR_SIZE);
+  }
+}
+
+void SectorCache::setCopyOnWrite(bool cow) {
+  copyOnWrite = cow;
+}
+
+bool SectorCache::isCopyOnWrite() {
+  return copyOnWrite;
+}
+
+// The cache itself only ever holds sectors from the file. Reads look in the dirty map first.
+void SectorCache::writeDirtySector(char * buffer, long address) {
+  memcpy(dirty[address / SECTOR_CACHE_SECTOR_SIZE].data(), buffer, SECTOR_CACHE_SECTOR_SIZE);
+  dirtyCount = dirty.size();
+}
+
+unsigned int SectorCache::dirtySectors() {
+  return dirtyCount;
+}
+
+void SectorCache::saveDirtySectors(class StateFile * state) {
+  state->putInt(dirty.size());
+  for (auto it = dirty.begin(); it != dirty.end(); it++) {
+    state->putLong(it->first);
+    state->putBytes(it->second.data(), SECTOR_CACHE_SECTOR_SIZE);
+  }
+}
+
+void SectorCache::loadDirtySectors(class StateFile * state) {
+  int count = state->getInt();
+  dirty.clear();
+  for (int i=0; i<count && !state->failed(); i++) {
+    long sector = state->getLong();
+    state->getBytes(dirty[sector].data(), SECTOR_CACHE_SECTOR_SIZE);
+  }
+  if (!copyOnWrite) dirty.clear();
+  dirtyCount = dirty.size();
+}
@@ -0,0 +1,61 @@
+#ifndef _SECTOR_CACHE_
+#define _SECTOR_CACHE_
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#define SECTOR_CACHE_SECTOR_SIZE 256
+#define SECTOR_CACHE_DEFAULT_SIZE 1024
+
+// LRU cache of 256 byte sectors sitting in front of a disk image file.
+// When sectors of a track are read in ascending order the rest of the track
+// is read ahead with a single fread.
+// In copy-on-write mode written sectors are kept in a dirty sector map in
+// front of the cache and the file is only read. Any number of simulators can
+// then share one image, each carrying only the sectors it has changed.
+class SectorCache {
+  struct entry {
+    long sector;
+    char data[SECTOR_CACHE_SECTOR_SIZE];
+  };
+  std::list<struct entry> lru;
+  std::unordered_map<long, std::list<struct entry>::iterator> index;
+  unsigned int capacity;
+  int sectorsPerTrack;
+  long lastSector;
+  FILE * file;
+  std::vector<char> trackBuffer;
+  std::atomic<unsigned int> cached;
+  bool copyOnWrite;
+  std::map<long, std::array<char, SECTOR_CACHE_SECTOR_SIZE>> dirty;
+  std::atomic<unsigned int> dirtyCount;
+  struct entry * insert(long sector);
+  public:
+  // Updated from the I/O worker threads, read from the command window.
+  std::atomic<unsigned long> hits;
+  std::atomic<unsigned long> misses;
+  std::atomic<unsigned long> readAheads;
+  SectorCache(int sectorsPerTrack, unsigned int capacity = SECTOR_CACHE_DEFAULT_SIZE);
+  void setFile(FILE * f);
+  void invalidate();
+  void resetStatistics();
+  unsigned int size();
+  // read sector at byte address from the cache, or the file if not cached.
+  int readSector(char * buffer, long address);
+  // keep the cache coherent with a sector that has been written to the file.
+  void updateSector(char * buffer, long address);
+  // setFile turns copy-on-write off and drops all dirty sectors.
+  void setCopyOnWrite(bool cow);
+  bool isCopyOnWrite();
+  // keep a written sector in the dirty map instead of the file.
+  void writeDirtySector(char * buffer, long address);
+  unsigned int dirtySectors();
+  void saveDirtySectors(class StateFile * state);
+  void loadDirtySectors(class StateFile * state);
+};
+
+#endif
@@ -0,0 +1,19 @@
+#include "Session.h"
+#include "RegisterWindow.h"
+
+Session::Session() : history(&machine), stats(&machine) {
+  screen = NULL;
+  panel = NULL;
+  command = NULL;
+}
+
+int Session::saveState(std::string fileName, std::shared_future<int> * done) {
+  return machine.saveState(fileName, done);
+}
+
+int Session::loadState(std::string fileName) {
+  int ret = machine.loadState(fileName);
+  panel->set2200Mode(machine.cpu.cpuIs2200());
+  panel->stateChanged();
+  return ret;
+}
@@ -0,0 +1,30 @@
+#ifndef _SESSION_
+#define _SESSION_
+#include <future>
+#include <string>
+#include "Machine.h"
+#include "Recorder.h"
+#include "History.h"
+#include "Stats.h"
+
+// The machine shown by the simulator and what the user interface keeps about
+// it: the windows, the recording or replay, the checkpoints for BACKSTEP and
+// the performance counters. main creates the one session and hands it to the
+// command window.
+class Session {
+  public:
+  class Machine machine;
+  class Recorder recorder;
+  class History history;
+  class Stats stats;
+  class dp2200Window * screen;
+  class registerWindow * panel;
+  class commandWindow * command;
+  Session();
+  // Save and load the machine, see Machine::saveState. After a load the
+  // register window shows the CPU type of the loaded machine.
+  int saveState(std::string fileName, std::shared_future<int> * done);
+  int loadState(std::string fileName);
+};
+
+#endif
@@ -0,0 +1,269 @@
+#include "StateFile.h"
+#include <cstdio>
+#include <cstring>
+
+StateFile::StateFile() {
+  version = STATE_FILE_VERSION;
+  currentSection = -1;
+  readPosition = 0;
+  underflow = false;
+}
+
+void StateFile::beginSection(const char * tag, bool compressed) {
+  sections.push_back({std::string(tag, 4), compressed, {}});
+  currentSection = sections.size() - 1;
+}
+
+void StateFile::putBytes(const void * data, size_t length) {
+  const unsigned char * p = (const unsigned char *) data;
+  sections[currentSection].data.insert(sections[currentSection].data.end(), p, p + length);
+}
+
+void StateFile::putByte(unsigned char value) {
+  sections[currentSection].data.push_back(value);
+}
+
+void StateFile::putBool(bool value) {
+  putByte(value ? 1 : 0);
+}
+
+void StateFile::putInt(int value) {
+  for (int i=0; i<4; i++) {
+    putByte((unsigned int) value >> (8 * i));
+  }
+}
+
+void StateFile::putLong(long value) {
+  for (int i=0; i<8; i++) {
+    putByte((unsigned long long) value >> (8 * i));
+  }
+}
+
+void StateFile::putString(std::string value) {
+  putInt(value.size());
+  putBytes(value.data(), value.size());
+}
+
+int StateFile::findSection(const char * tag) {
+  for (size_t i=0; i<sections.size(); i++) {
+    if (sections[i].tag.compare(0, 4, tag, 4) == 0) {
+      currentSection = i;
+      readPosition = 0;
+      return STATE_OK;
+    }
+  }
+  return STATE_MISSING_SECTION;
+}
+
+void StateFile::getBytes(void * data, size_t length) {
+  std::vector<unsigned char> & d = sections[currentSection].data;
+  if (readPosition + length > d.size()) {
+    underflow = true;
+    memset(data, 0, length);
+    readPosition = d.size();
+    return;
+  }
+  memcpy(data, d.data() + readPosition, length);
+  readPosition += length;
+}
+
+unsigned char StateFile::getByte() {
+  unsigned char value;
+  getBytes(&value, 1);
+  return value;
+}
+
+bool StateFile::getBool() {
+  return getByte() != 0;
+}
+
+int StateFile::getInt() {
+  unsigned int value = 0;
+  for (int i=0; i<4; i++) {
+    value |= (unsigned int) getByte() << (8 * i);
+  }
+  return (int) value;
+}
+
+long StateFile::getLong() {
+  unsigned long long value = 0;
+  for (int i=0; i<8; i++) {
+    value |= (unsigned long long) getByte() << (8 * i);
+  }
+  return (long) value;
+}
+
+std::string StateFile::getString() {
+  int length = getInt();
+  std::string value;
+  if (length < 0 || readPosition + length > sections[currentSection].data.size()) {
+    underflow = true;
+    return value;
+  }
+  value.assign((const char *) sections[currentSection].data.data() + readPosition, length);
+  readPosition += length;
+  return value;
+}
+
+bool StateFile::failed() {
+  return underflow;
+}
+
+int StateFile::getVersion() {
+  return version;
+}
+
+// PackBits. A control byte n of 0..127 is followed by n+1 literal bytes and a
+// control byte of -1..-127 by a single byte that is repeated 1-n times.
+void StateFile::compress(const std::vector<unsigned char> & in, std::vector<unsigned char> * out) {
+  size_t i = 0, size = in.size();
+  while (i < size) {
+    size_t run = 1;
+    while (i + run < size && run < 128 && in[i + run] == in[i]) run++;
+    if (run >= 3) {
+      out->push_back((unsigned char) (1 - (int) run));
+      out->push_back(in[i]);
+      i += run;
+      continue;
+    }
+    // Collect literals up to the start of the next run of three.
+    size_t start = i;
+    while (i < size && i - start < 128) {
+      if (i + 2 < size && in[i] == in[i + 1] && in[i] == in[i + 2]) break;
+      i++;
+    }
+    out->push_back(i - start - 1);
+    out->insert(out->end(), in.begin() + start, in.begin() + i);
+  }
+}
+
+int StateFile::expand(const unsigned char * in, size_t length, std::vector<unsigned char> * out, size_t expectedLength) {
+  size_t i = 0;
+  out->reserve(expectedLength);
+  while (i < length) {
+    int n = (signed char) in[i++];
+    if (n >= 0) {
+      if (i + n + 1 > length) return STATE_BAD_FORMAT;
+      out->insert(out->end(), in + i, in + i + n + 1);
+      i += n + 1;
+    } else if (n != -128) {
+      if (i >= length) return STATE_BAD_FORMAT;
+      out->insert(out->end(), 1 - n, in[i++]);
+    }
+  }
+  return out->size() == expectedLength ? STATE_OK : STATE_BAD_FORMAT;
+}
+
+static void putFileInt(std::vector<unsigned char> * out, unsigned int value) {
+  for (int i=0; i<4; i++) {
+    out->push_back(value >> (8 * i));
+  }
+}
+
+static unsigned int getFileInt(const unsigned char * in) {
+  return in[0] | in[1] << 8 | in[2] << 16 | (unsigned int) in[3] << 24;
+}
+
+int StateFile::write(std::string fileName) {
+  std::vector<unsigned char> out;
+  FILE * file;
+  out.insert(out.end(), STATE_FILE_MAGIC, STATE_FILE_MAGIC + 8);
+  putFileInt(&out, STATE_FILE_VERSION);
+  putFileInt(&out, sections.size());
+  for (auto it = sections.begin(); it < sections.end(); it++) {
+    std::vector<unsigned char> packed;
+    const std::vector<unsigned char> * stored = &it->data;
+    if (it->compressed) {
+      compress(it->data, &packed);
+      stored = &packed;
+    }
+    out.insert(out.end(), it->tag.begin(), it->tag.begin() + 4);
+    out.push_back(it->compressed ? 1 : 0);
+    putFileInt(&out, it->data.size());
+    putFileInt(&out, stored->size());
+    out.insert(out.end(), stored->begin(), stored->end());
+  }
+  // Write to a temporary file and rename so that a crash never leaves half a state behind.
+  std::string tmpName = fileName + ".tmp";
+  file = fopen(tmpName.c_str(), "wb");
+  if (file == NULL) {
+    return STATE_FILE_ERROR;
+  }
+  if (fwrite(out.data(), 1, out.size(), file) != out.size()) {
+    fclose(file);
+    remove(tmpName.c_str());
+    return STATE_FILE_ERROR;
+  }
+  if (fclose(file) != 0 || rename(tmpName.c_str(), fileName.c_str()) != 0) {
+    remove(tmpName.c_str());
+    return STATE_FILE_ERROR;
+  }
+  return STATE_OK;
+}
+
+int StateFile::read(std::string fileName) {
+  std::vector<unsigned char> in;
+  unsigned char buffer[65536];
+  size_t count, position;
+  unsigned int fileVersion, numSections;
+  FILE * file = fopen(fileName.c_str(), "rb");
+  if (file == NULL) {
+    return STATE_FILE_ERROR;
+  }
+  while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    in.insert(in.end(), buffer, buffer + count);
+  }
+  fclose(file);
+  if (in.size() < 16 || memcmp(in.data(), STATE_FILE_MAGIC, 8) != 0) {
+    return STATE_BAD_FORMAT;
+  }
+  fileVersion = getFileInt(&in[8]);
+  if (fileVersion == 0 || fileVersion > STATE_FILE_VERSION) {
+    return STATE_WRONG_VERSION;
+  }
+  numSections = getFileInt(&in[12]);
+  position = 16;
+  sections.clear();
+  for (unsigned int i=0; i<numSections; i++) {
+    struct section s;
+    unsigned int rawLength, storedLength;
+    if (position + 13 > in.size()) return STATE_BAD_FORMAT;
+    s.tag.assign((const char *) &in[position], 4);
+    s.compressed = in[position + 4] != 0;
+    rawLength = getFileInt(&in[position + 5]);
+    storedLength = getFileInt(&in[position + 9]);
+    position += 13;
+    if (position + storedLength > in.size()) return STATE_BAD_FORMAT;
+    if (s.compressed) {
+      if (expand(&in[position], storedLength, &s.data, rawLength) != STATE_OK) return STATE_BAD_FORMAT;
+    } else {
+      if (storedLength != rawLength) return STATE_BAD_FORMAT;
+      s.data.assign(in.begin() + position, in.begin() + position + storedLength);
+    }
+    position += storedLength;
+    sections.push_back(std::move(s));
+  }
+  currentSection = -1;
+  underflow = false;
+  version = fileVersion;
+  return STATE_OK;
+}
+
+const char * StateFile::errorString(int code) {
+  switch (code) {
+    case STATE_OK:
+      return "OK";
+    case STATE_FILE_ERROR:
+      return "Unable to read or write the file";
+    case STATE_BAD_FORMAT:
+      return "Not a state file or the file is damaged";
+    case STATE_WRONG_VERSION:
+      return "The state file is from a newer version of the simulator";
+    case STATE_MISSING_SECTION:
+      return "The state file is incomplete";
+    case STATE_MEDIA_ERROR:
+      return "Unable to attach the media the state refers to";
+    default:
+      return "Unknown error";
+  }
+}
@@ -0,0 +1,62 @@
+#ifndef _STATE_FILE_
+#define _STATE_FILE_
+#include <string>
+#include <vector>
+
+#define STATE_FILE_MAGIC "DP2200ST"
+#define STATE_FILE_VERSION 3
+
+#define STATE_OK 0
+#define STATE_FILE_ERROR -1
+#define STATE_BAD_FORMAT -2
+#define STATE_WRONG_VERSION -3
+#define STATE_MISSING_SECTION -4
+#define STATE_MEDIA_ERROR -6
+
+// A saved machine. The file starts with STATE_FILE_MAGIC and STATE_FILE_VERSION
+// followed by tagged sections, one for the CPU, the memory and each device.
+// Sections marked for compression (memory, disk buffers and images) are run
+// length encoded by write(), which is meant to be run on an I/O worker thread
+// once the machine has been captured. All numbers are stored little endian.
+class StateFile {
+  struct section {
+    std::string tag;
+    bool compressed;
+    std::vector<unsigned char> data;
+  };
+  std::vector<struct section> sections;
+  int version;
+  int currentSection;
+  size_t readPosition;
+  bool underflow;
+  static void compress(const std::vector<unsigned char> & in, std::vector<unsigned char> * out);
+  static int expand(const unsigned char * in, size_t length, std::vector<unsigned char> * out, size_t expectedLength);
+  public:
+  StateFile();
+  // Tags are four characters.
+  void beginSection(const char * tag, bool compressed = false);
+  void putBytes(const void * data, size_t length);
+  void putByte(unsigned char value);
+  void putBool(bool value);
+  void putInt(int value);
+  void putLong(long value);
+  void putString(std::string value);
+  // Returns STATE_OK and starts reading from the section, or STATE_MISSING_SECTION.
+  int findSection(const char * tag);
+  void getBytes(void * data, size_t length);
+  unsigned char getByte();
+  bool getBool();
+  int getInt();
+  long getLong();
+  std::string getString();
+  // True if a get read past the end of the current section.
+  bool failed();
+  // Version of a file that has been read. Version 2 added copy-on-write disk
+  // sectors, version 3 the device operations in progress.
+  int getVersion();
+  int write(std::string fileName);
+  int read(std::string fileName);
+  static const char * errorString(int code);
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include "Stats.h"
+#include "Machine.h"
+
+const char * Stats::groupNames[STATS_GROUPS] = {"immediate", "jump/call/io", "alu", "load", "prefixed"};
+
+static double seconds(struct timespec t) {
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static double secondsBetween(struct timespec from, struct timespec to) {
+  return seconds(to) - seconds(from);
+}
+
+Stats::Stats(class Machine * m) {
+  machine = m;
+  dumpFile = NULL;
+  dumpInterval = STATS_DUMP_INTERVAL;
+  uiNanos = 0;
+  started = lastReport = lastDump = take();
+}
+
+struct Stats::sample Stats::take() {
+  struct sample s;
+  clock_gettime(CLOCK_MONOTONIC, &s.wall);
+  s.simulated = machine->cpu.totalInstructionTime;
+  s.instructions = machine->cpu.instructions;
+  s.timerEvents = machine->timerEvents;
+  return s;
+}
+
+std::vector<std::string> Stats::report() {
+  std::vector<std::string> lines;
+  struct sample now = take();
+  class dp2200_cpu * cpu = &machine->cpu;
+  double wall = secondsBetween(lastReport.wall, now.wall);
+  unsigned long total = 0;
+  char line[256];
+  int length;
+  if (wall <= 0) wall = 1e-9;
+  snprintf(line, sizeof(line), "Instructions %lu in %.3f s simulated, %.3f s wall", now.instructions, seconds(now.simulated), secondsBetween(started.wall, now.wall));
+  lines.push_back(line);
+  snprintf(line, sizeof(line), "Since last STATS: %.3f MIPS, simulated/wall %.3f, %.0f events/s, %d timers",
+           (now.instructions - lastReport.instructions) / wall / 1e6,
+           secondsBetween(lastReport.simulated, now.simulated) / wall,
+           (now.timerEvents - lastReport.timerEvents) / wall, machine->timerDepth());
+  lines.push_back(line);
+  for (int i = 0; i < STATS_GROUPS; i++) total += cpu->opcodeGroups[i];
+  length = snprintf(line, sizeof(line), "Groups:");
+  for (int i = 0; i < STATS_GROUPS; i++) {
+    length += snprintf(line + length, sizeof(line) - length, " %s %.1f%%", groupNames[i], total == 0 ? 0.0 : 100.0 * cpu->opcodeGroups[i] / total);
+  }
+  lines.push_back(line);
+  length = snprintf(line, sizeof(line), "I/O per address:");
+  for (int i = 0; i < 256; i++) {
+    if (cpu->ioCtrl->operations[i] == 0) continue;
+    if (length > 64) {
+      lines.push_back(line);
+      length = snprintf(line, sizeof(line), " ");
+    }
+    length += snprintf(line + length, sizeof(line) - length, " %02X:%lu", i, cpu->ioCtrl->operations[i]);
+  }
+  lines.push_back(line);
+  snprintf(line, sizeof(line), "Host time: UI %.3f s, logging %.3f s, device callbacks %.3f s",
+           (uiNanos + machine->frameNanos) / 1e9, machine->logNanos / 1e9, (machine->callbackNanos - machine->frameNanos) / 1e9);
+  lines.push_back(line);
+  lastReport = now;
+  return lines;
+}
+
+int Stats::startDump(std::string fileName, int interval) {
+  stopDump();
+  dumpFile = fopen(fileName.c_str(), "w");
+  if (dumpFile == NULL) {
+    return STATS_FILE_ERROR;
+  }
+  dumpInterval = interval;
+  lastDump = take();
+  return STATS_OK;
+}
+
+void Stats::stopDump() {
+  if (dumpFile != NULL) {
+    fclose(dumpFile);
+    dumpFile = NULL;
+  }
+}
+
+void Stats::update() {
+  struct sample now;
+  class dp2200_cpu * cpu;
+  double wall;
+  const char * separator = "";
+  if (dumpFile == NULL) return;
+  now = take();
+  wall = secondsBetween(lastDump.wall, now.wall);
+  if (wall < dumpInterval) return;
+  cpu = &machine->cpu;
+  fprintf(dumpFile, "{\"wall\":%.3f,\"instructions\":%lu,\"simulated\":%.6f,\"mips\":%.3f,\"ratio\":%.3f,\"groups\":{",
+          secondsBetween(started.wall, now.wall), now.instructions, seconds(now.simulated),
+          (now.instructions - lastDump.instructions) / wall / 1e6,
+          secondsBetween(lastDump.simulated, now.simulated) / wall);
+  for (int i = 0; i < STATS_GROUPS; i++) {
+    fprintf(dumpFile, "%s\"%s\":%lu", i == 0 ? "" : ",", groupNames[i], cpu->opcodeGroups[i]);
+  }
+  fprintf(dumpFile, "},\"timerDepth\":%d,\"eventsPerSecond\":%.1f,\"io\":{", machine->timerDepth(), (now.timerEvents - lastDump.timerEvents) / wall);
+  for (int i = 0; i < 256; i++) {
+    if (cpu->ioCtrl->operations[i] == 0) continue;
+    fprintf(dumpFile, "%s\"%02X\":%lu", separator, i, cpu->ioCtrl->operations[i]);
+    separator = ",";
+  }
+  fprintf(dumpFile, "},\"host\":{\"ui\":%.3f,\"log\":%.3f,\"device\":%.3f}}\n",
+          (uiNanos + machine->frameNanos) / 1e9, machine->logNanos / 1e9, (machine->callbackNanos - machine->frameNanos) / 1e9);
+  fflush(dumpFile);
+  lastDump = now;
+}
@@ -0,0 +1,48 @@
+#ifndef _STATS_
+#define _STATS_
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#define STATS_OK 0
+#define STATS_FILE_ERROR -1
+
+#define STATS_GROUPS 5
+#define STATS_DUMP_INTERVAL 10
+
+// Performance counters of a machine. The counters themselves live where they
+// are counted, in the CPU, the I/O controller and the machine. This keeps the
+// host time spent in the user interface and in logging, and turns the counters
+// into rates between two samples. report is shown by the STATS command. A dump
+// file gets one JSON object per line every interval seconds:
+//   {"wall":..,"instructions":..,"simulated":..,"mips":..,"ratio":..,
+//    "groups":{..},"timerDepth":..,"eventsPerSecond":..,"io":{"E1":..},
+//    "host":{"ui":..,"log":..,"device":..}}
+class Stats {
+  struct sample {
+    struct timespec wall;
+    struct timespec simulated;
+    unsigned long instructions;
+    unsigned long timerEvents;
+  };
+  class Machine * machine;
+  struct sample started, lastReport, lastDump;
+  FILE * dumpFile;
+  int dumpInterval;
+  struct sample take();
+  public:
+  // Host time spent in the user interface. The time spent in printLog is
+  // counted by the machine.
+  long uiNanos;
+  static const char * groupNames[STATS_GROUPS];
+  Stats(class Machine * machine);
+  // Counters since start and rates since the previous report.
+  std::vector<std::string> report();
+  int startDump(std::string fileName, int interval);
+  void stopDump();
+  // Write a dump line if one is due. Called from the main loop.
+  void update();
+};
+
+#endif
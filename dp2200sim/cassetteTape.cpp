@@ -1,6 +1,8 @@
 #include <cstdio>
 #include <stdlib.h>
 #include "cassetteTape.h"
+#include "StateFile.h"
+#include <unistd.h>
 
 void printLog(const char *level, const char *fmt, ...);
 
@@ -8,6 +10,10 @@ void printLog(const char *level, const char *fmt, ...);
 
 CassetteTape::CassetteTape() {
   state=TAPE_GAP;
+  file=NULL;
+  writeProtect=false;
+  currentBlockSize=0;
+  readBytes=0;
 }
 
 bool CassetteTape::isOpen() {
@@ -19,6 +25,7 @@ bool CassetteTape::openFile(std::string fileName) {
     fclose(file);
   }
   file = fopen(fileName.c_str(), "r");
+  this->fileName = fileName;
   return file != NULL;
 }
 
@@ -144,6 +151,23 @@ bool CassetteTape::isTapeOverGap() {
   return state ==  TAPE_GAP; 
 }
 
+long CassetteTape::getPosition() {
+  if (file==NULL) return 0;
+  return ftell(file);
+}
+
+// Read the part of the file the tape is moving towards directly from the file
+// descriptor, leaving the stdio stream alone. This is run on an I/O worker
+// thread just to get the data into the host cache before readByte needs it.
+int CassetteTape::readAhead(long position, bool forward) {
+  char buffer[CASSETTE_READ_AHEAD_SIZE];
+  if (file==NULL) return -1;
+  if (!forward) {
+    position = position > CASSETTE_READ_AHEAD_SIZE ? position - CASSETTE_READ_AHEAD_SIZE : 0;
+  }
+  return pread(fileno(file), buffer, CASSETTE_READ_AHEAD_SIZE, position);
+}
+
 int CassetteTape::readByte(bool forward, unsigned char * data) {
   bool ret=0;
   if (file==NULL) return 2;
@@ -203,3 +227,32 @@ int CassetteTape::readByte(bool forward, unsigned char * data) {
   }  
   return ret;
 }
+
+void CassetteTape::saveState(class StateFile * state) {
+  state->putBool(file != NULL);
+  state->putString(fileName);
+  state->putBool(writeProtect);
+  state->putLong(getPosition());
+  state->putBool(this->state == TAPE_DATA);
+  state->putInt(currentBlockSize);
+  state->putInt(readBytes);
+}
+
+int CassetteTape::loadState(class StateFile * state) {
+  bool open = state->getBool();
+  std::string name = state->getString();
+  writeProtect = state->getBool();
+  long position = state->getLong();
+  bool data = state->getBool();
+  currentBlockSize = state->getInt();
+  readBytes = state->getInt();
+  if (file != NULL) {
+    closeFile();
+  }
+  if (open) {
+    if (!openFile(name)) return -1;
+    fseek(file, position, SEEK_SET);
+  }
+  this->state = data ? TAPE_DATA : TAPE_GAP;
+  return 0;
+}
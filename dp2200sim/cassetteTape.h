@@ -4,6 +4,10 @@
 #include <functional>
 #include <vector>
 
+#define CASSETTE_READ_AHEAD_SIZE 16384
+
+class StateFile;
+
 
 
 
@@ -47,6 +51,11 @@ class CassetteTape {
   int readByte(bool direction, unsigned char * data);
 
   bool isTapeOverGap();
+  long getPosition();
+  int readAhead(long position, bool forward);
+  // The attached file is saved by name together with the tape position.
+  void saveState(class StateFile * state);
+  int loadState(class StateFile * state);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,299 @@
+//
+// Checks of device and debugger behaviour that booting the corpus does not
+// reach. Each check sets up a machine without the user interface and tells
+// what differs from the expected result. Build and run with make check, or
+// ./checks [check...]
+//
+
+#include <climits>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "dp2200_cpu_sim.h"
+#include "dp2200_io_sim.h"
+#include "Condition.h"
+#include "Headless.h"
+#include "Machine.h"
+#include "MachineHost.h"
+#include "ScreenText.h"
+#include "StateFile.h"
+
+struct check {
+  const char * name;
+  const char * description;
+  // Returns what went wrong, or an empty string.
+  std::function<std::string(class Machine *)> run;
+};
+
+static std::string format(const char * fmt, ...) {
+  char buffer[128];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(buffer, sizeof buffer, fmt, args);
+  va_end(args);
+  return buffer;
+}
+
+// A status read through the controller has to give what the device itself gives.
+static std::string statusReads(class Machine * machine) {
+  class IOController * io = machine->cpu.ioCtrl;
+  std::vector<std::pair<unsigned char, std::function<unsigned char()>>> devices = {
+    {0x3c, [io]() { return io->floppyDevice->input(); }},
+    {0x96, [io]() { return io->parallellInterfaceAdaptorDevice->input(); }},
+    {0x5a, [io]() { return io->servoPrinterDevice->input(); }},
+    {0x78, [io]() { return io->disk9350Device->input(); }},
+    {0x4b, [io]() { return io->disk9370Device->input(); }},
+    {0x71, [io]() { return io->disk9390Device->input(); }}};
+  for (auto d : devices) {
+    io->exAdr(d.first);
+    int got = io->input();
+    int expected = d.second();
+    if (got != expected) return format("status of device %03o is %03o, the device gives %03o", d.first, got, expected);
+  }
+  return "";
+}
+
+// Verify drive type, command 7, makes the 9370 answer 001 until the next EX STATUS.
+static std::string driveType9370(class Machine * machine) {
+  class IOController * io = machine->cpu.ioCtrl;
+  int type;
+  io->exAdr(0x4b);
+  io->exCom1(7);
+  if ((type = io->input()) != 001) return format("drive type read %03o, expected %03o", type, 001);
+  io->exStatus();
+  if ((type = io->input()) != io->disk9370Device->input()) return format("status read %03o after EX STATUS, expected %03o", type, io->disk9370Device->input());
+  return "";
+}
+
+// Reset a 5500 and run it to a breakpoint on the memory clear loop of the
+// firmware, which has a hook, with a condition on HITS. The hook has to count
+// every time the loop starts over, and only once.
+static std::string clearLoopHits(class Machine * machine, bool hooks, unsigned long * instructions) {
+  class dp2200_cpu * cpu = &machine->cpu;
+  struct timespec forever = {LONG_MAX, 0};
+  auto condition = std::make_shared<class Condition>(cpu);
+  condition->compile("HITS==3", false, false);
+  machine->hooks.enable("ALL", hooks);
+  cpu->setCPUtype5500();
+  cpu->reset();
+  cpu->addBreakpoint(0170062, condition);
+  machine->stopAt = 2000000;
+  machine->running = true;
+  machine->run(&forever);
+  *instructions = cpu->instructions;
+  if (machine->running || cpu->P != 0170062 || condition->getHits() != 3) {
+    return format("hooks %s: ran %lu instructions to P=%06o with %lu hits, expected a stop at 170062 with 3",
+                  hooks ? "on" : "off", cpu->instructions, cpu->P, condition->getHits());
+  }
+  return "";
+}
+
+static std::string hookHits(class Machine * machine) {
+  class Machine interpreted;
+  class ScreenText screen;
+  unsigned long hooked, instructions;
+  std::string result;
+  interpreted.screen = &screen;
+  Machine::current = &interpreted;
+  result = clearLoopHits(&interpreted, false, &instructions);
+  Machine::current = machine;
+  if (result.empty()) result = clearLoopHits(machine, true, &hooked);
+  if (result.empty() && hooked != instructions) {
+    result = format("stopped after %lu instructions with hooks and %lu without", hooked, instructions);
+  }
+  return result;
+}
+
+// Run a machine idling in a jump to itself, one instruction at a time, until
+// the status of the selected device has bits set. Returns the instruction count.
+static unsigned long runUntilStatus(class Machine * machine, unsigned char bits) {
+  struct timespec forever = {LONG_MAX, 0};
+  class IOController * io = machine->cpu.ioCtrl;
+  io->exStatus();
+  while ((io->input() & bits) != bits && machine->cpu.instructions < 1000000) {
+    machine->stopAt = machine->cpu.instructions + 1;
+    machine->running = true;
+    machine->run(&forever);
+  }
+  return machine->cpu.instructions;
+}
+
+// Save a 9350 in the middle of a sector read, and restore it on another
+// machine. The read has to end after the same instruction on both with the
+// same data. A damaged state must leave the machine as it was.
+static std::string savedRead(class Machine * machine) {
+  class Machine restored;
+  class ScreenText screen;
+  class StateFile state, damaged;
+  class IOController * io = machine->cpu.ioCtrl;
+  char name[] = "/tmp/checks9350XXXXXX";
+  unsigned char sector[256], expected[256], got[256];
+  unsigned long done, restoredDone;
+  int depth, fd = mkstemp(name);
+  std::string result;
+  if (fd < 0) return "can not create a disk image";
+  for (int i=0; i<256; i++) sector[i] = i * 7;
+  for (int i=0; i<48; i++) {
+    if (write(fd, sector, sizeof sector) != sizeof sector) result = "can not write the disk image";
+  }
+  close(fd);
+  if (result.empty() && io->disk9350Device->openFile(0, name, false, true) != 0) result = "can not attach the disk image";
+  if (!result.empty()) {
+    unlink(name);
+    return result;
+  }
+  machine->cpu.memory->write(0, 0104);
+  machine->cpu.memory->write(1, 0);
+  machine->cpu.memory->write(2, 0);
+  machine->cpu.P = 0;
+  io->exAdr(0x78);
+  io->exCom1(0);
+  io->exCom3(0);
+  runUntilStatus(machine, DISK9350_STATUS_DRIVE_READY | DISK9350_STATUS_CONTROLLER_READY);
+  io->exCom1(5);
+  machine->capture(&state);
+  depth = machine->timerDepth();
+  done = runUntilStatus(machine, DISK9350_STATUS_CONTROLLER_READY);
+  io->exData();
+  io->exCom4(0);
+  io->readBlock(expected, sizeof expected);
+
+  restored.screen = &screen;
+  Machine::current = &restored;
+  damaged.beginSection("CPU ");
+  damaged.putBool(true);
+  if (restored.restore(&state) != STATE_OK) {
+    result = "the state saved during the read can not be restored";
+  } else if (restored.timerDepth() != depth) {
+    result = format("%d events pending after restore, %d when saved", restored.timerDepth(), depth);
+  } else if (restored.restore(&damaged) == STATE_OK) {
+    result = "a damaged state was restored";
+  } else if (restored.timerDepth() != depth || restored.cpu.P != 0) {
+    result = format("a damaged state left P=%06o with %d events pending", restored.cpu.P, restored.timerDepth());
+  } else {
+    io = restored.cpu.ioCtrl;
+    restoredDone = runUntilStatus(&restored, DISK9350_STATUS_CONTROLLER_READY);
+    io->exData();
+    io->exCom4(0);
+    io->readBlock(got, sizeof got);
+    if (restoredDone != done) {
+      result = format("the restored read ended after %lu instructions, the saved one after %lu", restoredDone, done);
+    } else if (memcmp(got, expected, sizeof got) != 0 || memcmp(got, sector, sizeof got) != 0) {
+      result = "the restored read gave other data";
+    }
+  }
+  Machine::current = machine;
+  unlink(name);
+  return result;
+}
+
+// Fork a 5500 waiting for a boot device into three machines run on host
+// threads while the machine itself runs on. They have to end as it does. A
+// byte written into the first one only has to show there, as its one dirty page.
+static std::string forkedRuns(class Machine * machine) {
+  struct timespec forever = {LONG_MAX, 0};
+  const unsigned long forkAt = 200000, runTo = 600000;
+  const int marked = 0x5000;
+  class dp2200_cpu * cpu = &machine->cpu;
+  std::vector<std::unique_ptr<class Machine>> children;
+  std::vector<std::unique_ptr<class ScreenText>> screens;
+  std::vector<class Machine *> forks;
+  unsigned char original;
+  int ret;
+  cpu->setCPUtype5500();
+  cpu->reset();
+  machine->stopAt = forkAt;
+  machine->running = true;
+  machine->run(&forever);
+  original = cpu->memory->physicalMemoryRead(marked);
+  for (int i = 0; i < 3; i++) {
+    children.emplace_back(new Machine(machine->ioWorkers));
+    screens.emplace_back(new ScreenText());
+    children.back()->screen = screens.back().get();
+    forks.push_back(children.back().get());
+  }
+  {
+    class MachineHost host(forks.size());
+    ret = host.fork(machine, forks, [&](int child) {
+        forks[child]->stopAt = runTo;
+        if (child == 0) forks[child]->cpu.memory->physicalMemoryWrite(marked, ~original);
+      }, [&](int child) {
+        return forks[child]->running && forks[child]->cpu.instructions < runTo;
+      });
+    if (ret == STATE_OK) {
+      cpu->memory->clearDirty();
+      machine->stopAt = runTo;
+      machine->run(&forever);
+    }
+    host.wait();
+  }
+  if (ret != STATE_OK) return format("forking failed with %d", ret);
+  for (size_t i = 0; i < forks.size(); i++) {
+    class dp2200_cpu * child = &forks[i]->cpu;
+    int dirty = i == 0 ? 1 : 0;
+    if (child->instructions != cpu->instructions || child->P != cpu->P ||
+        child->totalInstructionTime.tv_sec != cpu->totalInstructionTime.tv_sec ||
+        child->totalInstructionTime.tv_nsec != cpu->totalInstructionTime.tv_nsec) {
+      return format("fork %zu stopped at P=%06o after %lu instructions, the machine at P=%06o after %lu",
+                    i, child->P, child->instructions, cpu->P, cpu->instructions);
+    }
+    for (int address = 0; address < 0x10000; address++) {
+      unsigned char expected = i == 0 && address == marked ? ~original : cpu->memory->physicalMemoryRead(address);
+      if (child->memory->physicalMemoryRead(address) != expected) {
+        return format("fork %zu has %03o at %06o, expected %03o", i, child->memory->physicalMemoryRead(address), address, expected);
+      }
+    }
+    if (child->memory->dirtyPages() != cpu->memory->dirtyPages() + dirty ||
+        child->memory->isDirty(marked / MEMORY_PAGE_SIZE) != (i == 0 || cpu->memory->isDirty(marked / MEMORY_PAGE_SIZE))) {
+      return format("fork %zu has %d dirty pages, the machine %d", i, child->memory->dirtyPages(), cpu->memory->dirtyPages());
+    }
+  }
+  if (cpu->memory->physicalMemoryRead(marked) != original) return "a byte written in a fork changed the machine";
+  return "";
+}
+
+static std::vector<struct check> checks() {
+  return {
+    {"status", "status reads answered by the I/O controller", statusReads},
+    {"9370type", "9370 verify drive type through IOController::input", driveType9370},
+    {"hookhits", "breakpoint hits counted once in a firmware loop run by a hook", hookHits},
+    {"savedread", "9350 read in progress saved, restored and a damaged state refused", savedRead},
+    {"fork", "machine forked onto three others on host threads, memory kept apart", forkedRuns},
+  };
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<std::string> selected;
+  int failed = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-l") == 0) {
+      headlessLog = stderr;
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "Usage: %s [-l] [check...]\n", argv[0]);
+      return 1;
+    } else {
+      selected.push_back(argv[i]);
+    }
+  }
+  auto all = checks();
+  for (auto c = all.begin(); c < all.end(); c++) {
+    if (selected.size() > 0 && std::find(selected.begin(), selected.end(), c->name) == selected.end()) continue;
+    class Machine machine;
+    class ScreenText screen;
+    machine.screen = &screen;
+    Machine::current = &machine;
+    std::string result = c->run(&machine);
+    Machine::current = NULL;
+    printf("%-10s %-6s %s\n", c->name, result.empty() ? "OK" : "FAILED", result.empty() ? c->description : result.c_str());
+    if (!result.empty()) failed++;
+  }
+  printf("%d checks failed\n", failed);
+  return failed > 0;
+}
@@ -0,0 +1,492 @@
+//
+// Boots every entry of a corpus file without the user interface and reports,
+// as one scoreboard, whether it reached its success condition and how long it
+// took in simulated time, wall time and instructions. Each entry runs in a
+// worker process of its own, several at a time, so an entry that crashes the
+// simulator only fails its own row. Build and run with make corpus, or
+// ./corpus [-j workers] [-t wall seconds] [-o scoreboard.csv] [-v] [-i] [-n copies] [-s] [-c corpus.txt] [name...]
+// -i runs the 5500 firmware without hooks, see RomHooks.h. Simulated time and
+// instructions must come out the same as with them. -n runs every entry on that
+// many machines at the same time in its worker and fails the entry unless they
+// all end in the same state. -s runs all entries at once in this process
+// instead, each on a machine of its own on -j threads, see MachineHost.h; make
+// hosttest does this with -n. Wall time is from the start of an entry to its
+// end, with -s it includes the time the machine waited for a thread.
+//
+// A corpus file has one entry per line, # starts a comment:
+//   name cpu seconds condition... media...
+// cpu is 2200 or 5500 and seconds is the limit in simulated time. Conditions,
+// all of which must hold, are
+//   TEXT="..."  the text is shown somewhere on the screen
+//   AT=n        the CPU reaches octal address n
+//   HALT=n      the CPU halts with the halt instruction at octal address n
+// PRESS=DISPLAY and PRESS=KEYBOARD hold the button down for the whole run.
+// Media are attached as TYPE[:drive]=file with TYPE one of CASSETTE, FLOPPY,
+// 9350 and 9370, relative to the directory of the corpus file. A 2200 is
+// started from the bootstrap of cassette 0, a 5500 from its firmware.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "Headless.h"
+#include "IOWorkerPool.h"
+#include "Machine.h"
+#include "MachineHost.h"
+#include "ScreenText.h"
+
+#define CORPUS_DEFAULT_FILE "corpus.txt"
+#define CORPUS_WALL_LIMIT 300
+
+#define CORPUS_OK 0
+#define CORPUS_FAILED 1
+#define CORPUS_ERROR 2
+
+struct medium {
+  std::string type;
+  int drive;
+  std::string fileName;
+};
+
+struct entry {
+  std::string name;
+  int cpuType;
+  double seconds;
+  std::string text;
+  int at, halt;
+  bool display, keyboard;
+  std::vector<struct medium> media;
+};
+
+struct result {
+  int status;
+  double simulated;
+  double wall;
+  unsigned long instructions;
+  unsigned short p;
+  std::string message;
+  std::vector<std::string> screen;
+};
+
+// One entry running on a machine of its own.
+struct run {
+  struct entry * e;
+  class Machine machine;
+  class ScreenText screen;
+  // False if the entry could not be started.
+  bool ran;
+  bool textShown;
+  struct timespec started;
+  struct result r;
+  run(struct entry * entry, class IOWorkerPool * ioWorkers) : e(entry), machine(ioWorkers) {}
+};
+
+static const char * statusNames[] = {"OK", "FAILED", "ERROR"};
+
+// Splits on blanks, double quotes keep blanks within a word.
+static std::vector<std::string> split(std::string line) {
+  std::vector<std::string> words;
+  std::string word;
+  bool quoted = false, inWord = false;
+  for (size_t i = 0; i < line.size(); i++) {
+    char c = line[i];
+    if (c == '"') {
+      quoted = !quoted;
+      inWord = true;
+    } else if (!quoted && (c == ' ' || c == '\t')) {
+      if (inWord) words.push_back(word);
+      word.clear();
+      inWord = false;
+    } else {
+      word += c;
+      inWord = true;
+    }
+  }
+  if (inWord) words.push_back(word);
+  return words;
+}
+
+static std::string directoryOf(std::string fileName) {
+  size_t slash = fileName.rfind('/');
+  return slash == std::string::npos ? "" : fileName.substr(0, slash + 1);
+}
+
+// Returns an empty string or the reason the line is not a valid entry.
+static std::string parseEntry(std::string line, std::string directory, struct entry * e) {
+  std::vector<std::string> words = split(line);
+  if (words.size() < 4) return "need name, cpu, seconds and a condition";
+  e->name = words[0];
+  e->cpuType = atoi(words[1].c_str());
+  e->seconds = atof(words[2].c_str());
+  e->at = e->halt = -1;
+  e->display = e->keyboard = false;
+  if (e->cpuType != 2200 && e->cpuType != 5500) return "cpu must be 2200 or 5500";
+  if (e->seconds <= 0) return "seconds must be positive";
+  for (size_t i = 3; i < words.size(); i++) {
+    size_t equals = words[i].find('=');
+    std::string key = words[i].substr(0, equals), value;
+    if (equals == std::string::npos) return "expected KEY=value: " + words[i];
+    value = words[i].substr(equals + 1);
+    std::transform(key.begin(), key.end(), key.begin(), ::toupper);
+    if (key == "TEXT") {
+      e->text = value;
+    } else if (key == "AT") {
+      e->at = strtol(value.c_str(), NULL, 8) & 0xffff;
+    } else if (key == "HALT") {
+      e->halt = strtol(value.c_str(), NULL, 8) & 0xffff;
+    } else if (key == "PRESS") {
+      std::transform(value.begin(), value.end(), value.begin(), ::toupper);
+      if (value == "DISPLAY") {
+        e->display = true;
+      } else if (value == "KEYBOARD") {
+        e->keyboard = true;
+      } else {
+        return "unknown button: " + value;
+      }
+    } else {
+      struct medium m;
+      size_t colon = key.find(':');
+      m.type = key.substr(0, colon);
+      m.drive = colon == std::string::npos ? 0 : atoi(key.c_str() + colon + 1);
+      m.fileName = value[0] == '/' ? value : directory + value;
+      if (m.type != "CASSETTE" && m.type != "FLOPPY" && m.type != "9350" && m.type != "9370") {
+        return "unknown medium or condition: " + key;
+      }
+      e->media.push_back(m);
+    }
+  }
+  if (e->text.empty() && e->at < 0 && e->halt < 0) return "no condition";
+  return "";
+}
+
+static int readCorpus(std::string fileName, std::vector<struct entry> * entries) {
+  std::ifstream in(fileName);
+  std::string line, error;
+  int lineNumber = 0;
+  if (!in) {
+    fprintf(stderr, "Unable to open %s\n", fileName.c_str());
+    return 1;
+  }
+  while (std::getline(in, line)) {
+    struct entry e;
+    lineNumber++;
+    line = line.substr(0, line.find('#'));
+    if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+    if ((error = parseEntry(line, directoryOf(fileName), &e)) != "") {
+      fprintf(stderr, "%s:%d: %s\n", fileName.c_str(), lineNumber, error.c_str());
+      return 1;
+    }
+    entries->push_back(e);
+  }
+  return 0;
+}
+
+static int attach(class dp2200_cpu * cpu, struct medium * m) {
+  if (m->type == "CASSETTE") {
+    return cpu->ioCtrl->cassetteDevice->openFile(m->drive, m->fileName, true) ? 0 : 1;
+  } else if (m->type == "FLOPPY") {
+    int ret = cpu->ioCtrl->floppyDevice->openFile(m->drive, m->fileName, true, false);
+    return ret == FILE_HAS_BAD_BLOCKS ? 0 : ret;
+  } else if (m->type == "9350") {
+    return cpu->ioCtrl->disk9350Device->openFile(m->drive, m->fileName, true, true);
+  } else {
+    return cpu->ioCtrl->disk9370Device->openFile(m->drive, m->fileName, true, true);
+  }
+}
+
+static bool screenShows(class ScreenText * screen, std::string text) {
+  for (int row = 0; row < CHARS_H; row++) {
+    if (screen->screenLine(row).find(text) != std::string::npos) return true;
+  }
+  return false;
+}
+
+static double seconds(struct timespec t) {
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Set up the machine of an entry and start it. Returns false, with the reason in
+// the result, if it can not be started.
+static bool startEntry(struct run * run, bool interpret) {
+  struct entry * e = run->e;
+  class Machine * machine = &run->machine;
+  class dp2200_cpu * cpu = &machine->cpu;
+  run->r = {CORPUS_ERROR, 0, 0, 0, 0, "", {}};
+  run->textShown = e->text.empty();
+  Machine::current = machine;
+  machine->screen = &run->screen;
+  if (interpret) machine->hooks.enable("ALL", false);
+  cpu->displayButtonStatus = e->display;
+  cpu->keyboardButtonStatus = e->keyboard;
+  if (e->cpuType == 5500) {
+    cpu->setCPUtype5500();
+  } else {
+    cpu->setCPUtype2200();
+  }
+  for (auto m = e->media.begin(); m < e->media.end(); m++) {
+    if (attach(cpu, &*m)) {
+      run->r.message = "unable to attach " + m->fileName;
+      return false;
+    }
+  }
+  cpu->reset();
+  if (cpu->cpuIs2200() && !cpu->ioCtrl->cassetteDevice->loadBoot([memory=cpu->memory](int address, unsigned char data)->void { memory->physicalMemoryWrite(address, data);})) {
+    run->r.message = "unable to load bootstrap from cassette 0";
+    return false;
+  }
+  if (e->at >= 0) cpu->addBreakpoint(e->at);
+  machine->onFrame = [run]() {
+    if (!run->textShown && screenShows(&run->screen, run->e->text)) {
+      run->textShown = true;
+      if (run->e->at < 0 && run->e->halt < 0) run->machine.running = false;
+    }
+  };
+  cpu->totalInstructionTime.tv_sec = 0;
+  cpu->totalInstructionTime.tv_nsec = 0;
+  machine->running = true;
+  clock_gettime(CLOCK_MONOTONIC, &run->started);
+  Machine::current = NULL;
+  return true;
+}
+
+// Called by the host after every slice of the entry. The wall time is taken
+// when the entry ends, not when the last of them has.
+static bool stepEntry(struct run * run, int wallLimit) {
+  long elapsed = nanosSince(&run->started);
+  bool more = run->machine.running && seconds(run->machine.cpu.totalInstructionTime) < run->e->seconds &&
+              elapsed < wallLimit * 1000000000L;
+  if (!more) run->r.wall = elapsed / 1e9;
+  return more;
+}
+
+static void finishEntry(struct run * run) {
+  struct entry * e = run->e;
+  struct result * r = &run->r;
+  class dp2200_cpu * cpu = &run->machine.cpu;
+  r->simulated = seconds(cpu->totalInstructionTime);
+  r->instructions = cpu->instructions;
+  r->p = cpu->P;
+  run->textShown = run->textShown || screenShows(&run->screen, e->text);
+  r->status = CORPUS_FAILED;
+  if (!run->textShown) {
+    r->message = "text not shown";
+  } else if (e->at >= 0 && !cpu->atBreakpoint()) {
+    r->message = "address not reached";
+  } else if (e->halt >= 0 && (run->machine.running || cpu->atBreakpoint() || cpu->previousP != e->halt)) {
+    r->message = "no halt at address";
+  } else {
+    r->status = CORPUS_OK;
+  }
+  if (r->status != CORPUS_OK && (run->machine.running || r->simulated >= e->seconds)) {
+    r->message += ", time limit reached";
+  }
+  for (int row = 0; row < CHARS_H; row++) {
+    r->screen.push_back(run->screen.screenLine(row));
+  }
+}
+
+// The copies of an entry have to end in the same state, or machines running at
+// the same time disturb each other.
+static void compareCopies(struct result * first, struct result * copy) {
+  if (first->status == CORPUS_ERROR) return;
+  if (copy->status != first->status || copy->simulated != first->simulated || copy->instructions != first->instructions ||
+      copy->p != first->p || copy->screen != first->screen) {
+    first->status = CORPUS_ERROR;
+    first->message += first->message.empty() ? "copies differ" : ", copies differ";
+  }
+}
+
+// Run the selected entries, every one on copies machines, on a host with this
+// many threads. Results are stored by entry index.
+static void runEntries(std::vector<struct entry> * entries, std::vector<int> * indexes, std::vector<struct result> * results,
+                       int threads, int copies, int wallLimit, bool interpret, bool verbose) {
+  // Shared by all machines, jobs of different drives do not wait for each other.
+  class IOWorkerPool ioWorkers;
+  // Copy c of entry indexes[i] is runs[i * copies + c].
+  std::vector<std::unique_ptr<struct run>> runs;
+  {
+    class MachineHost host(threads);
+    for (auto i = indexes->begin(); i < indexes->end(); i++) {
+      for (int c = 0; c < copies; c++) {
+        struct run * run = new struct run(&(*entries)[*i], &ioWorkers);
+        runs.emplace_back(run);
+        run->ran = startEntry(run, interpret);
+        if (run->ran) {
+          host.add(&run->machine, [run, wallLimit]() { return stepEntry(run, wallLimit); });
+        }
+      }
+    }
+    host.wait();
+  }
+  for (size_t i = 0; i < indexes->size(); i++) {
+    struct result * r = &(*results)[(*indexes)[i]];
+    for (int c = 0; c < copies; c++) {
+      struct run * run = runs[i * copies + c].get();
+      if (run->ran) finishEntry(run);
+      if (c == 0) {
+        *r = run->r;
+      } else {
+        compareCopies(r, &run->r);
+      }
+    }
+    if (verbose) {
+      for (auto line = r->screen.begin(); line < r->screen.end(); line++) {
+        fprintf(stderr, "%s|%s|\n", (*entries)[(*indexes)[i]].name.c_str(), line->c_str());
+      }
+    }
+  }
+}
+
+// Start a worker running entry index. Its result comes back on the returned file descriptor.
+static pid_t startWorker(const char * self, std::string corpusFile, int index, int wallLimit, int copies,
+                         bool interpret, bool verbose, int * fd) {
+  std::string i = std::to_string(index), t = std::to_string(wallLimit), n = std::to_string(copies);
+  std::vector<const char *> args = {self, "-w", i.c_str(), "-t", t.c_str(), "-n", n.c_str(), "-c", corpusFile.c_str()};
+  int fds[2];
+  pid_t pid;
+  if (verbose) args.push_back("-v");
+  if (interpret) args.push_back("-i");
+  args.push_back(NULL);
+  if (pipe(fds)) return -1;
+  pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    dup2(fds[1], STDOUT_FILENO);
+    // A fresh image, the I/O worker threads of this one are not inherited by fork.
+    execvp(self, (char * const *) args.data());
+    _exit(127);
+  }
+  close(fds[1]);
+  *fd = fds[0];
+  return pid;
+}
+
+// The result line of a worker, or an error telling how the worker ended.
+static struct result collect(int fd, int waitStatus) {
+  struct result r = {CORPUS_ERROR, 0, 0, 0, 0, "worker failed", {}};
+  std::string text;
+  char buffer[512];
+  ssize_t n;
+  int status;
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+    text.append(buffer, n);
+  }
+  close(fd);
+  std::istringstream in(text);
+  if (in >> status >> r.simulated >> r.wall >> r.instructions >> r.p) {
+    r.status = status;
+    std::getline(in, r.message);
+    if (!r.message.empty() && r.message[0] == ' ') r.message.erase(0, 1);
+  } else if (WIFSIGNALED(waitStatus)) {
+    r.message = std::string("worker killed by ") + strsignal(WTERMSIG(waitStatus));
+  } else if (WIFEXITED(waitStatus)) {
+    r.message = "worker failed with exit status " + std::to_string(WEXITSTATUS(waitStatus));
+  }
+  return r;
+}
+
+int main(int argc, char *argv[]) {
+  std::string corpusFile = CORPUS_DEFAULT_FILE, csvFile;
+  std::vector<std::string> selected;
+  std::vector<struct entry> entries;
+  int workers = std::thread::hardware_concurrency(), wallLimit = CORPUS_WALL_LIMIT, copies = 1, worker = -1, failures = 0;
+  bool verbose = false, interpret = false, sameProcess = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      workers = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      wallLimit = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      csvFile = argv[++i];
+    } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      corpusFile = argv[++i];
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      copies = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+      worker = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-v") == 0) {
+      verbose = true;
+    } else if (strcmp(argv[i], "-i") == 0) {
+      interpret = true;
+    } else if (strcmp(argv[i], "-s") == 0) {
+      sameProcess = true;
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "Usage: %s [-j workers] [-t wall seconds] [-o scoreboard.csv] [-v] [-i] [-n copies] [-s] [-c corpus.txt] [name...]\n", argv[0]);
+      return CORPUS_ERROR;
+    } else {
+      selected.push_back(argv[i]);
+    }
+  }
+  if (readCorpus(corpusFile, &entries)) return CORPUS_ERROR;
+  if (workers < 1) workers = 1;
+  if (copies < 1) copies = 1;
+  std::vector<struct result> results(entries.size());
+  if (worker >= 0) {
+    if (worker >= (int) entries.size()) return CORPUS_ERROR;
+    std::vector<int> one = {worker};
+    runEntries(&entries, &one, &results, copies, copies, wallLimit, interpret, verbose);
+    struct result * r = &results[worker];
+    printf("%d %.6f %.6f %lu %u %s\n", r->status, r->simulated, r->wall, r->instructions, r->p, r->message.c_str());
+    return 0;
+  }
+  std::vector<int> indexes;
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (selected.empty() || std::find(selected.begin(), selected.end(), entries[i].name) != selected.end()) {
+      indexes.push_back(i);
+    }
+  }
+  if (sameProcess) {
+    runEntries(&entries, &indexes, &results, workers, copies, wallLimit, interpret, verbose);
+  } else {
+    std::map<pid_t, std::pair<int, int>> running;
+    size_t next = 0;
+    while (next < indexes.size() || !running.empty()) {
+      while (next < indexes.size() && (int) running.size() < workers) {
+        int fd = -1;
+        pid_t pid = startWorker(argv[0], corpusFile, indexes[next], wallLimit, copies, interpret, verbose, &fd);
+        if (pid < 0) {
+          perror("fork");
+          return CORPUS_ERROR;
+        }
+        running[pid] = {indexes[next++], fd};
+      }
+      // A result is one short line, it fits in the pipe of a finished worker.
+      int status;
+      pid_t pid = wait(&status);
+      if (running.count(pid) == 0) continue;
+      results[running[pid].first] = collect(running[pid].second, status);
+      running.erase(pid);
+    }
+  }
+  printf("%-12s %-6s %10s %9s %12s %8s  %s\n", "entry", "status", "simulated", "wall", "instructions", "MIPS", "notes");
+  FILE * csv = csvFile.empty() ? NULL : fopen(csvFile.c_str(), "w");
+  if (!csvFile.empty() && csv == NULL) {
+    fprintf(stderr, "Unable to write %s\n", csvFile.c_str());
+  }
+  if (csv != NULL) fprintf(csv, "entry,status,simulated,wall,instructions,mips,p,notes\n");
+  for (auto i = indexes.begin(); i < indexes.end(); i++) {
+    struct result * r = &results[*i];
+    double mips = r->wall > 0 ? r->instructions / r->wall / 1e6 : 0;
+    if (r->status != CORPUS_OK) failures++;
+    printf("%-12s %-6s %9.3fs %8.3fs %12lu %8.2f  %s%sP=%06o\n", entries[*i].name.c_str(), statusNames[r->status],
+           r->simulated, r->wall, r->instructions, mips, r->message.c_str(), r->message.empty() ? "" : ", ", r->p);
+    if (csv != NULL) {
+      fprintf(csv, "%s,%s,%.6f,%.6f,%lu,%.3f,%06o,\"%s\"\n", entries[*i].name.c_str(), statusNames[r->status],
+              r->simulated, r->wall, r->instructions, mips, r->p, r->message.c_str());
+    }
+  }
+  if (csv != NULL) fclose(csv);
+  printf("%zu entries, %d failed\n", indexes.size(), failures);
+  return failures > 0 ? CORPUS_FAILED : CORPUS_OK;
+}
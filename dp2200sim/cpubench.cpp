@@ -0,0 +1,188 @@
+//
+// Microbenchmarks of the CPU core and the memory subsystem. Synthetic
+// instruction streams are placed in memory and timed through
+// dp2200_cpu::execute() without the user interface. Build and run with
+// make bench, or ./cpubench [-n instructions] [-r repetitions] [-l] [stream...]
+//
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+#include "dp2200_cpu_sim.h"
+#include "Headless.h"
+#include "Machine.h"
+
+#define CODE 0x0100
+#define SUBROUTINE 0x0200
+#define DATA 0x1000
+// Logical address of base relative accesses on a 5500.
+#define BASED 0x8000
+#define JMP 0104
+#define CALL 0106
+#define RET 0007
+
+struct stream {
+  const char * name;
+  const char * description;
+  bool is5500;
+  // Body of the loop. A jump back to its start is added after it.
+  std::vector<unsigned char> body;
+  // Executed before the body is loaded.
+  std::function<void(class dp2200_cpu *)> setup;
+  // An interrupt is raised every this many instructions, 0 for none.
+  int interruptEvery;
+};
+
+static std::vector<unsigned char> repeat(std::vector<unsigned char> block, int times) {
+  std::vector<unsigned char> body;
+  for (int i = 0; i < times; i++) {
+    body.insert(body.end(), block.begin(), block.end());
+  }
+  return body;
+}
+
+static void setHL(class dp2200_cpu * cpu, int address) {
+  cpu->regSets[0].r.regH = address >> 8;
+  cpu->regSets[0].r.regL = address & 0xff;
+}
+
+static std::vector<struct stream> streams() {
+  return {
+    {"load", "register to register loads, opcode group 3", false,
+     repeat({0301, 0312, 0323, 0334, 0340}, 40), NULL, 0},
+    {"alu", "register arithmetic and logic, opcode group 2", false,
+     repeat({0201, 0212, 0223, 0234, 0241, 0252, 0263, 0274}, 25), NULL, 0},
+    {"immediate", "immediate arithmetic and loads, opcode group 0", false,
+     repeat({0004, 1, 0024, 1, 0044, 0xff, 0054, 0x55, 0006, 0x12}, 20), NULL, 0},
+    {"jump", "jumps, calls and returns, opcode group 1", false,
+     repeat({JMP, 0x00, 0x00, CALL, SUBROUTINE & 0xff, SUBROUTINE >> 8}, 20),
+     [](class dp2200_cpu * cpu) { cpu->memory->write(SUBROUTINE, RET); }, 0},
+    {"memory", "loads and stores through HL", false,
+     repeat({0307, 0370, 0317, 0371}, 40),
+     [](class dp2200_cpu * cpu) { setHL(cpu, DATA); }, 0},
+    {"prefixed", "5500 prefixed loads, stores, push and pop", true,
+     repeat({0062, 0307, 0174, 0370, 0062, 0070, 0062, 0060}, 20),
+     [](class dp2200_cpu * cpu) {
+       cpu->regSets[0].r.regB = DATA >> 8;
+       cpu->regSets[0].r.regD = (DATA >> 8) + 1;
+     }, 0},
+    {"block", "5500 block transfers of 16 bytes", true,
+     repeat({0006, 0, 0016, 0, 0026, 16, 0036, (DATA >> 8) + 1, 0046, 0, 0056, DATA >> 8, 0066, 0, 0021}, 8), NULL, 0},
+    {"mmu", "5500 user mode base relative loads and stores through mapped pages", true,
+     repeat({0056, BASED >> 8, 0066, 0x10, 0307, 0066, 0x20, 0370}, 20),
+     [](class dp2200_cpu * cpu) {
+       for (int i = 0; i < 12; i++) {
+         cpu->memory->sectorTable[i].physicalPage = 11 - i;
+         cpu->memory->sectorTable[i].accessEnable = true;
+         cpu->memory->sectorTable[i].writeEnable = true;
+       }
+       cpu->memory->baseRegister = 0x30;
+       cpu->userMode = true;
+     }, 0},
+    {"interrupt", "2200 interrupts every 8 instructions", false,
+     repeat({0300}, 200),
+     [](class dp2200_cpu * cpu) {
+       cpu->memory->write(0, RET);
+       cpu->interruptEnabled = 1;
+     }, 8},
+  };
+}
+
+static void load(class dp2200_cpu * cpu, const struct stream * s) {
+  std::vector<unsigned char> code = s->body;
+  cpu->reset();
+  if (s->is5500) {
+    cpu->setCPUtype5500();
+    // Until the firmware loads the sector table every page maps to page 0.
+    for (int i = 0; i < 15; i++) {
+      cpu->memory->sectorTable[i].physicalPage = i;
+    }
+  } else {
+    cpu->setCPUtype2200();
+  }
+  if (s->setup) s->setup(cpu);
+  // Jumps in the body go to the next instruction.
+  for (size_t i = 0; i + 2 < code.size(); i++) {
+    if (code[i] == JMP && code[i + 1] == 0 && code[i + 2] == 0) {
+      code[i + 1] = (CODE + i + 3) & 0xff;
+      code[i + 2] = (CODE + i + 3) >> 8;
+      i += 2;
+    }
+  }
+  code.insert(code.end(), {JMP, CODE & 0xff, CODE >> 8});
+  for (size_t i = 0; i < code.size(); i++) {
+    cpu->memory->write(CODE + i, code[i]);
+  }
+  cpu->P = CODE;
+}
+
+// Nanoseconds per instruction for count instructions.
+static double run(class dp2200_cpu * cpu, const struct stream * s, unsigned long count) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (unsigned long i = 0; i < count; i++) {
+    if (s->interruptEvery != 0 && i % s->interruptEvery == 0) {
+      cpu->interruptPending = 1;
+    }
+    if (cpu->execute()) {
+      fprintf(stderr, "%s: halted at %04X\n", s->name, cpu->previousP);
+      exit(1);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return ((end.tv_sec - start.tv_sec) * 1e9 + end.tv_nsec - start.tv_nsec) / count;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long count = 1000000;
+  int repetitions = 10;
+  std::vector<std::string> selected;
+  class Machine machine;
+  class dp2200_cpu * cpu = &machine.cpu;
+  Machine::current = &machine;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      count = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      repetitions = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-l") == 0) {
+      headlessLog = fopen("/dev/null", "w");
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "Usage: %s [-n instructions] [-r repetitions] [-l] [stream...]\n", argv[0]);
+      return 1;
+    } else {
+      selected.push_back(argv[i]);
+    }
+  }
+  if (count == 0 || repetitions < 1) {
+    fprintf(stderr, "Need at least one instruction and one repetition.\n");
+    return 1;
+  }
+  printf("%-10s %10s %10s %10s %10s  %s\n", "stream", "ns/instr", "median", "min", "stddev", "description");
+  auto all = streams();
+  for (auto s = all.begin(); s < all.end(); s++) {
+    std::vector<double> samples;
+    double mean = 0, variance = 0;
+    if (selected.size() > 0 && std::find(selected.begin(), selected.end(), s->name) == selected.end()) continue;
+    load(cpu, &*s);
+    run(cpu, &*s, count / 10 + 1);
+    for (int r = 0; r < repetitions; r++) {
+      samples.push_back(run(cpu, &*s, count));
+      mean += samples.back();
+    }
+    mean /= repetitions;
+    for (auto it = samples.begin(); it < samples.end(); it++) {
+      variance += (*it - mean) * (*it - mean);
+    }
+    variance /= repetitions;
+    std::sort(samples.begin(), samples.end());
+    printf("%-10s %10.2f %10.2f %10.2f %10.2f  %s\n", s->name, mean, samples[repetitions / 2], samples[0], sqrt(variance), s->description);
+  }
+  return 0;
+}
@@ -1,11 +1,15 @@
 #include <stdio.h>
 
+// The bytes are read one at a time. Reading them as arguments of one printf
+// leaves their order to the compiler.
 int main () {
-  int i,j;
+  int i, c;
   printf("unsigned char firmware[] = {\n");
-  for (j = 0; j < 240; j++) {
-    printf("             0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o,\n", getchar(), getchar(), getchar(), getchar(), getchar(), getchar(), getchar(), getchar(), getchar(), getchar(), getchar(), getchar(), getchar(), getchar(), getchar(), getchar());
+  for (i = 0; i < 4096; i++) {
+    c = getchar();
+    if (c == EOF) c = 0;
+    if (i % 16 == 0) printf("             ");
+    printf("0%03o%s", c, i == 4095 ? "\n" : (i % 16 == 15 ? ",\n" : ", "));
   }
-  printf("             0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o, 0%03o\n", getchar(), getchar(), getchar(), getchar(), getchar(), getchar(), getchar(), getchar(), getchar(), getchar(), getchar(), getchar(), getchar(), getchar(), getchar(), getchar());
   printf("};\n");
-}
\ No newline at end of file
+}
@@ -1,12 +1,12 @@
 #include "dp2200Window.h"
 #include <form.h>
 #include <ncurses.h>
+#include <cstring>
 
 
-dp2200Window::dp2200Window(class dp2200_cpu * c) {
+dp2200Window::dp2200Window(class dp2200_cpu * c, class registerWindow * p) {
   cpu = c;
-  cursorX = 0;
-  cursorY = 0;
+  panel = p;
   win = newwin(14, 82, 0, 0);
   innerWin = newwin(12, 80, 1, 1);
   normalWindow();
@@ -14,7 +14,12 @@ dp2200Window::dp2200Window(class dp2200_cpu * c) {
   activeWindow = false;
   SDL_Event evt;
   screenDirty = false;
-  scrollok(innerWin, TRUE);
+  atlas = NULL;
+  frame = NULL;
+  atlasDirty = true;
+  lastPresent = 0;
+  cursesDirty = true;
+  lastCursesFlush = 0;
   if (SDL_Init(SDL_INIT_VIDEO) != 0)
   {
     SDL_Log("SDL_Init fel: %s", SDL_GetError());
@@ -30,8 +35,8 @@ dp2200Window::dp2200Window(class dp2200_cpu * c) {
     exit(1);
   }
   printLog("INFO", "SDL_CreateWindow\n");
-  // Skapa renderer
-  ren = SDL_CreateRenderer(sdlwin, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+  // Skapa renderer. No vsync, a present must not stall the CPU. updateScreen paces the frames instead.
+  ren = SDL_CreateRenderer(sdlwin, -1, SDL_RENDERER_ACCELERATED);
   if (!ren)
   {
     SDL_Log("SDL_CreateRenderer fel: %s", SDL_GetError());
@@ -39,11 +44,25 @@ dp2200Window::dp2200Window(class dp2200_cpu * c) {
     SDL_Quit();
     exit(1);
   }
+  atlas = SDL_CreateTexture(ren, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, ATLAS_COLS * CELL_W, ATLAS_ROWS * CELL_H);
+  // If render targets are not supported every cell is drawn on each frame.
+  if (SDL_RenderTargetSupported(ren)) {
+    frame = SDL_CreateTexture(ren, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, WINDOW_W, WINDOW_H);
+  }
+  if (!atlas) {
+    SDL_Log("SDL_CreateTexture fel: %s", SDL_GetError());
+    SDL_DestroyRenderer(ren);
+    SDL_DestroyWindow(sdlwin);
+    SDL_Quit();
+    exit(1);
+  }
   while (SDL_PollEvent(&evt));
   printLog("INFO", "SDL_CreateRenderer\n");
 }
 
 dp2200Window::~dp2200Window() {
+  if (frame) SDL_DestroyTexture(frame);
+  SDL_DestroyTexture(atlas);
   SDL_DestroyRenderer(ren);
   SDL_DestroyWindow(sdlwin);
   SDL_Quit();
@@ -85,10 +104,10 @@ void dp2200Window::normalWindow() {
 void dp2200Window::handleKey(int key) {
   switch (key) {
   case KEY_F(5):
-    rw->setKeyboardButton(!rw->getKeyboardButton());
+    panel->setKeyboardButton(!panel->getKeyboardButton());
     break;
   case KEY_F(6):
-    rw->setDisplayButton(!rw->getDisplayButton());
+    panel->setDisplayButton(!panel->getDisplayButton());
     break;
   case 0x0a:
     cpu->ioCtrl->screenKeyboardDevice->updateKbd(0x0d);
@@ -210,6 +229,8 @@ void dp2200Window::handleKey(int key) {
 
 
 }
+// Put the terminal cursor back after the other windows have been drawn. Only
+// the cursor moves, nothing is redrawn.
 void dp2200Window::resetCursor() {
   if (activeWindow) {
     if (cursorEnabled) curs_set(2);
@@ -217,165 +238,142 @@ void dp2200Window::resetCursor() {
     wrefresh(innerWin);
   }
 }
-int dp2200Window::eraseFromCursorToEndOfFrame() {
-  printLog("INFO", "Erasing from X=%d, Y=%d to end of frame\n", cursorX, cursorY);
-  for (int i=cursorX; i<80;i++) {
-    waddch(innerWin, ' ');
-    screen[i][cursorY]=' ';
-  }
-  for (int i=cursorY+1; i <12; i++) {
-    wmove(innerWin, i, 1);
-    for (int j=0; j<80; j++) {
-      waddch(innerWin, ' ');
-      screen[j][i]=' ';
+
+// Copy the screen model to the ncurses window. Called from the main loop; the
+// guest may update the screen thousands of times between two flushes.
+void dp2200Window::flushScreen() {
+  chtype line[CHARS_W];
+  Uint32 now;
+  if (!cursesDirty) return;
+  now = SDL_GetTicks();
+  if (now - lastCursesFlush < CURSES_FRAME_INTERVAL) return;
+  lastCursesFlush = now;
+  for (int row = 0; row < CHARS_H; row++) {
+    for (int col = 0; col < CHARS_W; col++) {
+      unsigned char c = screen[col][row];
+      line[col] = (c >= 040 && c < 0177) ? c : ' ';
     }
+    mvwaddchnstr(innerWin, row, 0, line, CHARS_W);
   }
+  // Only the active window may move the terminal cursor.
+  leaveok(innerWin, !activeWindow);
+  if (activeWindow) curs_set(cursorEnabled ? 2 : 0);
   wmove(innerWin, cursorY, cursorX);
-  wrefresh(innerWin);
-  screenDirty = true;
-  return 0;
-}
-int dp2200Window::eraseFromCursorToEndOfLine() {
-  printLog("INFO", "Erasing from X=%d, Y=%d to end of line\n", cursorX, cursorY);
-  for (int i=cursorX; i<80;i++) {
-    waddch(innerWin, ' ');
-    screen[i][cursorY]=' ';
-  }
-  wmove(innerWin, cursorY, cursorX);
-  wrefresh(innerWin);
-  screenDirty = true;
-  return 0;
-}
-int dp2200Window::rollScreenOneLine() {
-  printLog("INFO", "Roll one line\n");
-  wmove(innerWin, 12, 0);
-  waddch(innerWin, '\n');
-  wmove(innerWin, cursorY, cursorX);
-  wrefresh(innerWin);
-  screenDirty = true;
-  return 0;
-}
-int dp2200Window::showCursor(bool value) {
-  cursorEnabled=value;
-  printLog("INFO", "Setting cursor status = %d \n", cursorEnabled);
-  return 0;
-}
-int dp2200Window::setCursorX(int value) {
-  if (value >= 80 || value < 0) {
-    printLog("INFO", "setCursorX: Value is outside limits : %d\n", value);
-    return 0;
-  }
-  cursorX = value;
-  printLog("INFO", "Setting Cursor X X=%d Y=%d\n", cursorX, cursorY);
-  screenDirty = true;
-  return 0;
+  wnoutrefresh(innerWin);
+  doupdate();
+  cursesDirty = false;
 }
 
-int dp2200Window::setCursorY(int value) {
-  if (value >= 12 || value < 0) {
-    printLog("INFO", "setCursorY: Value is outside limits : %d\n", value);
-    return 0;
-  }
-  cursorY = value;
-  printLog("INFO", "Setting Cursor Y X=%d Y=%d\n", cursorX, cursorY);
+void dp2200Window::textChanged() {
   screenDirty = true;
-  return 0;
+  cursesDirty = true;
 }
 
-int dp2200Window::writeCharacter(int value) {
-  printLog("INFO", "Writing char=%c to screen\n", value);
-  wmove(innerWin, cursorY, cursorX);
-  screen[cursorX][cursorY]=value;
-  waddch(innerWin, value);
-  wrefresh(innerWin);
-  screenDirty = true;
-  return 0;
-}
-
-int dp2200Window::scrollDown() {
-  int i,j;
-  wscrl(innerWin, -1);
-  for (i=0; i < 80; i++) screen[i][0] = ' ';
-  for (j=1; j < 12; j++) {
-    for (i=0; i < 80; i++) {
-      screen[i][j] = screen[i][j-1];
-    }
-  }  
-  screenDirty = true;
-  return 0;
+// The SDL window has no cursor.
+void dp2200Window::cursorChanged() {
+  cursesDirty = true;
 }
 
-int dp2200Window::scrollUp() {
-  int i,j;
-  wscrl(innerWin, 1);
-  for (i=0; i < 80; i++) screen[i][11] = ' ';
-  for (j=0; j < 11; j++) {
-    for (i=0; i < 80; i++) {
-      screen[i][j] = screen[i][j+1];
-    }
-  }  
+void dp2200Window::fontChanged() {
+  atlasDirty = true;
   screenDirty = true;
-  return 0;
-}
-
-void dp2200Window::incrementXPos() {
-  cursorX++; 
 }
 
-
-void dp2200Window::setCharGenChar(int data) {
-  lastCharGenChar=data & 0177;
-  charGenIndex=0;
+void dp2200Window::beep() {
+  ::beep();
 }
 
-void dp2200Window::updateCharGen(int data) {
-  font5x7[lastCharGenChar][charGenIndex] = 0177 & data;
-  printLog("INFO", "CHARGEN:  %04o %01o: %04o \n", lastCharGenChar, charGenIndex, 0177 & data);
-  charGenIndex++;
-  if (charGenIndex==5) {
-    charGenIndex = 0;
-    lastCharGenChar = 0177 & (lastCharGenChar+1);
+// Rasterize all 128 glyphs of font5x7 into the atlas texture. Each glyph gets a
+// CELL_W x CELL_H cell including the black padding so a copy clears the cell too.
+void dp2200Window::buildAtlas() {
+  static Uint32 pixels[ATLAS_ROWS * CELL_H][ATLAS_COLS * CELL_W];
+  memset(pixels, 0, sizeof(pixels));
+  for (int c = 0; c < 128; c++) {
+    int x0 = (c % ATLAS_COLS) * CELL_W + 1;
+    int y0 = (c / ATLAS_COLS) * CELL_H + 1;
+    for (int row = 0; row < 5; ++row) {
+      uint8_t bits = font5x7[c][row];
+      for (int col = 0; col < 7; ++col) {
+        if (bits & (1 << (6 - col))) {
+          pixels[y0 + col][x0 + row] = 0xff00ff00;
+        }
+      }
+    }
   }
+  SDL_UpdateTexture(atlas, NULL, pixels, sizeof(pixels[0]));
+  atlasDirty = false;
 }
 
 void dp2200Window::drawChar(int c, int cx, int cy) {
-  // pixel-offset för övre vänstra hörnet (global padding + 1px per-cell padding)
-  int x0 = PADDING + cx * CELL_W + 1;
-  int y0 = PADDING + cy * CELL_H + 1;
-
-  for (int row = 0; row < 5; ++row)
-  {
-    uint8_t bits = font5x7[c][row];
-    for (int col = 0; col < 7; ++col) {
-      if (bits & (1 << (6 - col))) {
-        // Draw a pixel
-        SDL_RenderDrawPoint(ren, x0 + row, y0 + col);
-      }
-    }
-  }
+  c &= 0177;
+  SDL_Rect src = {(c % ATLAS_COLS) * CELL_W, (c / ATLAS_COLS) * CELL_H, CELL_W, CELL_H};
+  SDL_Rect dst = {PADDING + cx * CELL_W, PADDING + cy * CELL_H, CELL_W, CELL_H};
+  SDL_RenderCopy(ren, atlas, &src, &dst);
 }
 
 void dp2200Window::updateScreen() {
   //printLog("INFO", "updateScreen ENTRY\n");
   SDL_Event evt;
+  bool redrawAll = false;
+  Uint32 now;
   if (!screenDirty) return;
-  // pump the event queue so the window actually appears
-
-  SDL_SetRenderDrawColor(ren, 0, 0, 0, SDL_ALPHA_OPAQUE);
-  SDL_RenderClear(ren);
-
-  // Set render color (green)
-  SDL_SetRenderDrawColor(ren, 0, 255, 0, SDL_ALPHA_OPAQUE);
-  // Draw the screen
+  // Frame pacing. Leave screenDirty set so the change is shown by a later call.
+  now = SDL_GetTicks();
+  if (now - lastPresent < FRAME_INTERVAL) return;
+  lastPresent = now;
+  if (atlasDirty) {
+    buildAtlas();
+    redrawAll = true;
+  }
+  if (frame) {
+    SDL_SetRenderTarget(ren, frame);
+  } else {
+    // Without a frame texture the back buffer has to be drawn from scratch.
+    redrawAll = true;
+  }
+  if (redrawAll) {
+    SDL_SetRenderDrawColor(ren, 0, 0, 0, SDL_ALPHA_OPAQUE);
+    SDL_RenderClear(ren);
+  }
   for (int row = 0; row < CHARS_H; ++row) {
     for (int col = 0; col < CHARS_W; ++col) {
-      drawChar(screen[col][row], col, row);
+      if (redrawAll || screen[col][row] != shown[col][row]) {
+        drawChar(screen[col][row], col, row);
+        shown[col][row] = screen[col][row];
+      }
     }
   }
-
+  if (frame) {
+    SDL_SetRenderTarget(ren, NULL);
+    SDL_RenderCopy(ren, frame, NULL, NULL);
+  }
   // Paint
   SDL_RenderPresent(ren);
   while (SDL_PollEvent(&evt));
   screenDirty = false;
   //printLog("INFO", "updateScreen EXIT\n");
-}
\ No newline at end of file
+}
+
+// Handle SDL window events. updateScreen does this as well but it is only called
+// while there is something to draw.
+void dp2200Window::pumpEvents() {
+  SDL_Event evt;
+  while (SDL_PollEvent(&evt));
+}
+
+// Milliseconds until flushScreen or updateScreen has something to draw, or -1 if
+// the screen is up to date.
+int dp2200Window::pendingOutputDelay() {
+  Uint32 now = SDL_GetTicks();
+  int delay = -1;
+  if (cursesDirty) {
+    delay = (now - lastCursesFlush >= CURSES_FRAME_INTERVAL) ? 0 : CURSES_FRAME_INTERVAL - (now - lastCursesFlush);
+  }
+  if (screenDirty) {
+    int frameDelay = (now - lastPresent >= FRAME_INTERVAL) ? 0 : FRAME_INTERVAL - (now - lastPresent);
+    if (delay < 0 || frameDelay < delay) {
+      delay = frameDelay;
+    }
+  }
+  return delay;
+}
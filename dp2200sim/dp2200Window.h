@@ -4,64 +4,72 @@
 #include "Window.h"
 #include <ncurses.h>
 #include <functional>
+#include <string>
 #include "RegisterWindow.h"
+#include "ScreenText.h"
 #include <SDL.h>
 
-// Size of screen
-const int CHARS_W = 80;
-const int CHARS_H = 12;
-
 // Char size 2 pixel padding around each char
 const int CELL_W = 5 + 2;
 const int CELL_H = 7 + 2;
 
 // Extra padding
 const int PADDING = 10;
+// Glyph atlas layout, 16 x 8 cells of CELL_W x CELL_H pixels.
+const int ATLAS_COLS = 16;
+const int ATLAS_ROWS = 8;
+// Minimum time between two presents in ms.
+const Uint32 FRAME_INTERVAL = 16;
+// Minimum time between two flushes of the ncurses copy of the screen in ms.
+const Uint32 CURSES_FRAME_INTERVAL = 33;
 // Window size
 const int WINDOW_W = CHARS_W * CELL_W + 2 * PADDING; // 560 + 20 = 580
 const int WINDOW_H = CHARS_H * CELL_H + 2 * PADDING; // 108 + 20 = 128
 
 
-extern class registerWindow * rw;
-
 
-class dp2200Window : public virtual Window {
-  int cursorX, cursorY;
-  bool cursorEnabled=false;
+// The screen drawn in an ncurses window and an SDL window. The text itself is
+// kept by ScreenText. F5 and F6 press the buttons shown on panel.
+class dp2200Window : public virtual Window, public ScreenText {
   WINDOW *win, *innerWin;
   bool activeWindow;
   class dp2200_cpu * cpu;
-  int lastCharGenChar;
-  unsigned char font5x7[128][5];
-  char screen[80][12];
+  class registerWindow * panel;
   bool screenDirty;
-  int charGenIndex;
   SDL_Window* sdlwin;
   SDL_Renderer* ren;
+  // Pre-rasterized font and the composed frame. Only cells where screen differs
+  // from shown are copied into the frame.
+  SDL_Texture* atlas;
+  SDL_Texture* frame;
+  char shown[80][12];
+  bool atlasDirty;
+  Uint32 lastPresent;
+  void buildAtlas();
+  // The ncurses window is redrawn from screen at most every CURSES_FRAME_INTERVAL.
+  bool cursesDirty;
+  Uint32 lastCursesFlush;
+
+protected:
+  void textChanged();
+  void cursorChanged();
+  void fontChanged();
 
 public:
-  dp2200Window(class dp2200_cpu *);
+  dp2200Window(class dp2200_cpu *, class registerWindow * panel);
   ~dp2200Window();
   void hightlightWindow();
   void normalWindow();
   void handleKey(int key);
   void resetCursor();
-  int eraseFromCursorToEndOfFrame ();
-  int eraseFromCursorToEndOfLine();
-  int rollScreenOneLine();
-  int showCursor(bool);
-  int setCursorX(int);
-  int setCursorY(int);
-  int writeCharacter(int);
   void setHandleKeyCallback(std::function<void(unsigned char)>);
   void resize();
-  int scrollUp();
-  int scrollDown();
-  void incrementXPos();
-  void setCharGenChar(int);
-  void updateCharGen(int);
+  void beep();
   void updateScreen();
+  void flushScreen();
+  void pumpEvents();
+  int pendingOutputDelay();
   void drawChar(int, int, int);
 };
 
-#endif
\ No newline at end of file
+#endif
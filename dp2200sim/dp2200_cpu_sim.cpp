@@ -12,8 +12,8 @@
 #include <functional>
 #include <algorithm>
 #include "5500firmware.h"
-
-extern bool running; 
+#include "Machine.h"
+#include "Condition.h"
 
 void printLog(const char *level, const char *fmt, ...);
 
@@ -50,13 +50,17 @@ void dp2200_cpu::Memory::physicalMemoryWrite(int physicalAddress, unsigned char
       memory[physicalAddress]=data; 
     } else if ((physicalAddress >= 0xF000) && ( physicalAddress<= 0xFFFF)) {
       firmware[physicalAddress & 0xFFF]=data;
+    } else {
+      return;
     }
   } else {
     if (physicalAddress < 0x4000) {
       memory[physicalAddress] = data;
+    } else {
+      return;
     }
   }
-
+  dirty[physicalAddress / MEMORY_PAGE_SIZE] = true;
 }
 
 unsigned char inline dp2200_cpu::Memory::read(unsigned short virtualAddress, bool performChecks, bool fetch, int from) {
@@ -119,9 +123,12 @@ void inline dp2200_cpu::Memory::write(unsigned short virtualAddress, unsigned ch
     physicalAddress = virtualAddress;
   } 
   if (memoryWatch[physicalAddress]) {
-    printLog("INFO", "Writing to address %06o - halting\n", physicalAddress);
-    running=false;
-    return;
+    auto condition = watchConditions.find(physicalAddress);
+    if (condition == watchConditions.end() || condition->second->check(data)) {
+      printLog("INFO", "Writing to address %06o - halting\n", physicalAddress);
+      watchHit = true;
+      return;
+    }
   }
   if (*is5500 & ((physicalAddress & 0xf000) == 0xf000)) return; // This is ROM. We cannot change the ROM...  
   physicalMemoryWrite(physicalAddress, data);
@@ -132,6 +139,9 @@ dp2200_cpu::Memory::Memory(bool * is, bool * av, bool * wv, bool * um) {
   for (int address=0;address <=65535; address++) {
     memoryWatch[address]=false;
   }
+  watchHit = false;
+  memcpy(firmware, ::firmware, sizeof(firmware));
+  clearDirty();
   baseRegister = 0;
   for (int i=0; i<15; i++) { 
     sectorTable[i].physicalPage=0; 
@@ -147,20 +157,43 @@ dp2200_cpu::Memory::Memory(bool * is, bool * av, bool * wv, bool * um) {
   userMode = um;
 }
 
+void dp2200_cpu::Memory::clearDirty() {
+  memset(dirty, 0, sizeof(dirty));
+}
+
+bool dp2200_cpu::Memory::isDirty(int page) {
+  return dirty[page];
+}
+
+int dp2200_cpu::Memory::dirtyPages() {
+  return std::count(dirty, dirty + sizeof(dirty), true);
+}
+
 int dp2200_cpu::Memory::size() {
   return sizeof(memory);
 }
 
-bool dp2200_cpu::Memory::addWatch(unsigned short address) {
+bool dp2200_cpu::Memory::addWatch(unsigned short address, std::shared_ptr<class Condition> condition) {
   memoryWatch[address]=true;
+  watchConditions.erase(address);
+  if (condition) {
+    watchConditions[address] = condition;
+  }
   return false;
 }
 
 bool dp2200_cpu::Memory::removeWatch(unsigned short address) {
   memoryWatch[address]=false;  
+  watchConditions.erase(address);
   return false;
 }
 
+void dp2200_cpu::Memory::getConditions(std::vector<std::shared_ptr<class Condition>> * conditions) {
+  for (auto it = watchConditions.begin(); it != watchConditions.end(); it++) {
+    conditions->push_back(it->second);
+  }
+}
+
 
   /***************************************************************************
 
@@ -341,13 +374,18 @@ char *  dp2200_cpu::disassembleLine(char * outputBuf, int size, bool octal, unsi
   return disassembleLine(outputBuf, size, octal,  0 , [buffer=buffer](int address)->unsigned char { return *(buffer+address);});
 }
 
-int dp2200_cpu::addBreakpoint(unsigned short address) {
-  if (breakpoints.size()>8) {
-    return 1;
-  }
+// Adding a breakpoint again replaces its condition.
+int dp2200_cpu::addBreakpoint(unsigned short address, std::shared_ptr<class Condition> condition) {
   if ( std::find(breakpoints.begin(), breakpoints.end(), address) == breakpoints.end() ) {
+    if (breakpoints.size()>8) {
+      return 1;
+    }
     breakpoints.push_back(address);
   }
+  breakpointConditions.erase(address);
+  if (condition) {
+    breakpointConditions[address] = condition;
+  }
   return 0;
 }
 int dp2200_cpu::removeBreakpoint(unsigned short address) {
@@ -355,9 +393,28 @@ int dp2200_cpu::removeBreakpoint(unsigned short address) {
   if ( found != breakpoints.end() ) {
     breakpoints.erase(found);
   }
+  breakpointConditions.erase(address);
   return 0; 
 }
 
+// The condition is only looked up once the address matches.
+bool dp2200_cpu::atBreakpoint(bool count) {
+  if (std::find(breakpoints.begin(), breakpoints.end(), P) == breakpoints.end()) {
+    return false;
+  }
+  auto condition = breakpointConditions.find(P);
+  return condition == breakpointConditions.end() || condition->second->check(-1, count);
+}
+
+std::vector<std::shared_ptr<class Condition>> dp2200_cpu::getConditions() {
+  std::vector<std::shared_ptr<class Condition>> conditions;
+  for (auto it = breakpointConditions.begin(); it != breakpointConditions.end(); it++) {
+    conditions.push_back(it->second);
+  }
+  memory->getConditions(&conditions);
+  return conditions;
+}
+
 void dp2200_cpu::setCPUtype2200() {
   pMask = 0x3fff;
   hMask = 0x3f;
@@ -458,6 +515,7 @@ int dp2200_cpu::execute() {
   int halted, j;
   struct inst i;
   unsigned char instructionData;
+  instructions++;
   /* Handle interrupt*/
 
   if ((interruptEnabled && interruptPending) || accessViolation || writeViolation || privilegeViolation || inputParityFailure) {
@@ -525,6 +583,7 @@ int dp2200_cpu::execute() {
     default:
       implicit = 0;
   }
+  opcodeGroups[implicit != 0 ? 4 : inst >> 6]++;
   j=0;
   if (implicit !=0) {
     i.data[j++]=implicit;  
@@ -1027,11 +1086,14 @@ int dp2200_cpu::immediateplus(unsigned char inst) {
           int dstAddress = ((regSets[setSel].r.regH << 8) | regSets[setSel].r.regL ) & pMask;
           int count = ((regSets[setSel].r.regC & 0xf) == 0)?16:(regSets[setSel].r.regC & 0xf);
           int iterations = ((regSets[setSel].r.regC & 0xf0) == 0)?256:(regSets[setSel].r.regC & 0xf0);
-          do {
-            memory->write(dstAddress, ioCtrl->input(), previousP);
+          unsigned char block[16];
+          ioCtrl->countOperation();
+          ioCtrl->readBlock(block, count);
+          for (int i=0; i<count; i++) {
+            memory->write(dstAddress, block[i], previousP);
             dstAddress++;
-            count--;
-          } while (count > 0);
+          }
+          count = 0;
           iterations -= 16;
           if (iterations == 0) {
             flagZero[setSel] = 1;
@@ -1586,6 +1648,7 @@ int dp2200_cpu::immediateplus(unsigned char inst) {
       break;
     case 1:
       op = (inst & 0x38) >> 3;
+      if (op != 2) ioCtrl->countOperation();
       
       switch (op) {
       case 0:
@@ -2223,6 +2286,107 @@ int dp2200_cpu::immediateplus(unsigned char inst) {
     return (cc);
   }  
 
+// The memory including the writable 5500 firmware area and the sector table.
+void dp2200_cpu::Memory::saveState(class StateFile * state) {
+  state->beginSection("MEM ", true);
+  state->putBytes(memory, sizeof(memory));
+  state->putBytes(firmware, sizeof(firmware));
+  for (int i=0; i<16; i++) {
+    state->putBool(sectorTable[i].writeEnable);
+    state->putBool(sectorTable[i].accessEnable);
+    state->putByte(sectorTable[i].physicalPage);
+  }
+  state->putByte(baseRegister);
+}
+
+int dp2200_cpu::Memory::loadState(class StateFile * state) {
+  if (state->findSection("MEM ") != STATE_OK) return STATE_MISSING_SECTION;
+  state->getBytes(memory, sizeof(memory));
+  state->getBytes(firmware, sizeof(firmware));
+  memset(dirty, true, sizeof(dirty));
+  for (int i=0; i<16; i++) {
+    sectorTable[i].writeEnable = state->getBool();
+    sectorTable[i].accessEnable = state->getBool();
+    sectorTable[i].physicalPage = state->getByte();
+  }
+  baseRegister = state->getByte();
+  return state->failed() ? STATE_BAD_FORMAT : STATE_OK;
+}
+
+void dp2200_cpu::saveState(class StateFile * state) {
+  state->beginSection("CPU ");
+  state->putBool(is5500);
+  state->putInt(memorySize);
+  state->putBool(autorestartEnabled);
+  state->putInt(setSel);
+  state->putBytes(regSets, sizeof(regSets));
+  for (int i=0; i<16; i++) {
+    state->putInt(stack.stk[i]);
+  }
+  state->putByte(stackptr);
+  state->putBytes(flagParity, 2);
+  state->putBytes(flagSign, 2);
+  state->putBytes(flagCarry, 2);
+  state->putBytes(flagZero, 2);
+  state->putBool(userMode);
+  state->putBool(accessViolation);
+  state->putBool(inputParityFailure);
+  state->putBool(writeViolation);
+  state->putBool(privilegeViolation);
+  state->putInt(interruptPending);
+  state->putInt(interruptEnabled);
+  state->putInt(interruptEnabledToBeEnabled);
+  state->putInt(P);
+  state->putInt(previousP);
+  state->putByte(implicit);
+  state->putLong(instructions);
+  state->putLong(fetches);
+  state->putLong(totalInstructionTime.tv_sec);
+  state->putLong(totalInstructionTime.tv_nsec);
+  memory->saveState(state);
+  ioCtrl->saveState(state);
+}
+
+int dp2200_cpu::loadState(class StateFile * state) {
+  int ret;
+  if (state->findSection("CPU ") != STATE_OK) return STATE_MISSING_SECTION;
+  if (state->getBool()) {
+    setCPUtype5500();
+  } else {
+    setCPUtype2200();
+  }
+  memorySize = state->getInt();
+  autorestartEnabled = state->getBool();
+  setSel = state->getInt();
+  state->getBytes(regSets, sizeof(regSets));
+  for (int i=0; i<16; i++) {
+    stack.stk[i] = state->getInt();
+  }
+  stackptr = state->getByte();
+  state->getBytes(flagParity, 2);
+  state->getBytes(flagSign, 2);
+  state->getBytes(flagCarry, 2);
+  state->getBytes(flagZero, 2);
+  userMode = state->getBool();
+  accessViolation = state->getBool();
+  inputParityFailure = state->getBool();
+  writeViolation = state->getBool();
+  privilegeViolation = state->getBool();
+  interruptPending = state->getInt();
+  interruptEnabled = state->getInt();
+  interruptEnabledToBeEnabled = state->getInt();
+  P = state->getInt();
+  previousP = state->getInt();
+  implicit = state->getByte();
+  instructions = state->getLong();
+  fetches = state->getLong();
+  totalInstructionTime.tv_sec = state->getLong();
+  totalInstructionTime.tv_nsec = state->getLong();
+  if (state->failed()) return STATE_BAD_FORMAT;
+  if ((ret = memory->loadState(state)) != STATE_OK) return ret;
+  return ioCtrl->loadState(state);
+}
+
 dp2200_cpu::dp2200_cpu() {
   is5500=false;
   is2200=true;
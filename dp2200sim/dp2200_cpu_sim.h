@@ -2,10 +2,18 @@
 #define _DP2200_CPU_
 #include "cassetteTape.h"
 #include "dp2200_io_sim.h"
+#include "StateFile.h"
 #include <cstdio>
+#include <map>
+#include <memory>
 #include <string>
 
+// Bytes of physical memory per page tracked by Memory::isDirty.
+#define MEMORY_PAGE_SIZE 256
+
 class dp2200_cpu {
+  // Runs loops of the 5500 firmware with the helpers of the instructions.
+  friend class RomHooks;
   int blockTransfer(bool);
 public:
   // Define Registerset
@@ -103,16 +111,33 @@ public:
     bool * writeViolation;
     bool * userMode;
     bool memoryWatch[65536];
+    std::map<unsigned short, std::shared_ptr<class Condition>> watchConditions;
 
     unsigned char memory[65536];
+    // The writable 5500 firmware area, loaded from the ROM image, so that
+    // machines in one process each have their own.
+    unsigned char firmware[4096];
+    // Pages of physical memory written since clearDirty.
+    bool dirty[65536 / MEMORY_PAGE_SIZE];
     public:
     struct SectorEntry sectorTable[16];
     unsigned char baseRegister;
+    // Set by a write to a watched address, Machine::run stops the CPU then.
+    bool watchHit;
     unsigned char physicalMemoryRead(int address);
     int size();
     void physicalMemoryWrite(int address, unsigned char data);
-    bool addWatch(unsigned short address);
+    bool addWatch(unsigned short address, std::shared_ptr<class Condition> condition = nullptr);
     bool removeWatch (unsigned short address);
+    void getConditions(std::vector<std::shared_ptr<class Condition>> * conditions);
+    // A machine forked from another starts with every page clean and tells
+    // which pages it has changed since, see MachineHost::fork. Loading a state
+    // makes every page dirty.
+    void clearDirty();
+    bool isDirty(int page);
+    int dirtyPages();
+    void saveState(class StateFile * state);
+    int loadState(class StateFile * state);
     unsigned char read(unsigned short address, bool performChecks=true, bool fetch=false, int from=0);
     void write(unsigned short address, unsigned char data, int from=0);
     Memory(bool * is5500, bool * accessViolation, bool * writeViolation, bool * userMode); 
@@ -123,6 +148,8 @@ public:
   class Memory *  memory;
   unsigned long instructions = 0;
   unsigned long fetches = 0;
+  // Instructions executed per major group, opcode bits 7-6, and 5500 prefixed instructions last.
+  unsigned long opcodeGroups[5] = {};
   unsigned int outbitcnt = 0;
   unsigned int inbitcnt = 0;
   int timeForInstruction;
@@ -136,6 +163,7 @@ public:
 
   std::vector<struct inst> instructionTrace;
   std::vector<unsigned short> breakpoints;
+  std::map<unsigned short, std::shared_ptr<class Condition>> breakpointConditions;
 
   class IOController * ioCtrl;
   bool traceEnabled = false;
@@ -240,8 +268,15 @@ public:
   char *  disassembleLine(char * outputBuf, int size, bool octal, unsigned char * address, int imp);
   char *  disassembleLine(char * outputBuf, int size, bool octal, int address);
   char *  disassembleLine(char * outputBuf, int size, bool octal, unsigned char * address);  
-  int addBreakpoint(unsigned short address);
+  int addBreakpoint(unsigned short address, std::shared_ptr<class Condition> condition = nullptr);
+  // True if P is at a breakpoint whose condition holds. Without count the hit is
+  // not counted.
+  bool atBreakpoint(bool count = true);
+  // Every breakpoint and watch condition.
+  std::vector<std::shared_ptr<class Condition>> getConditions();
   int removeBreakpoint(unsigned short address);
+  void saveState(class StateFile * state);
+  int loadState(class StateFile * state);
   dp2200_cpu();
   private:
   bool autorestartEnabled = true;
@@ -1,14 +1,14 @@
 
 
 #include "dp2200_io_sim.h"
-#include "dp2200Window.h"
-#include "RegisterWindow.h"
+#include "Machine.h"
+#include "ScreenText.h"
 #include <algorithm>
+#include <array>
+#include <cstring>
+#include <memory>
 #include <sys/stat.h>
 
-extern class dp2200Window * dpw;
-extern class registerWindow * rw;
-
 
 
 void printLog(const char *level, const char *fmt, ...);
@@ -19,122 +19,301 @@ void printBuffer(char * buffer) {
   }  
 }
 
+template <class D> unsigned char IOController::inputThunk(void * d) {
+  return ((D *) d)->D::input();
+}
+template <class D> int IOController::readBlockThunk(void * d, unsigned char * data, int length) {
+  return ((D *) d)->D::readBlock(data, length);
+}
+template <class D> int IOController::exWriteThunk(void * d, unsigned char data) {
+  return ((D *) d)->D::exWrite(data);
+}
+template <class D> int IOController::exCom1Thunk(void * d, unsigned char data) {
+  return ((D *) d)->D::exCom1(data);
+}
+template <class D> int IOController::exCom2Thunk(void * d, unsigned char data) {
+  return ((D *) d)->D::exCom2(data);
+}
+template <class D> int IOController::exCom3Thunk(void * d, unsigned char data) {
+  return ((D *) d)->D::exCom3(data);
+}
+template <class D> int IOController::exCom4Thunk(void * d, unsigned char data) {
+  return ((D *) d)->D::exCom4(data);
+}
+
+template <class D> void IOController::addDevice(unsigned char address, D * device, bool inlineStatus) {
+  struct dispatchRecord * r = &dispatch[address];
+  r->supported = true;
+  r->inlineStatus = inlineStatus;
+  r->device = device;
+  r->object = device;
+  r->input = inputThunk<D>;
+  r->readBlock = readBlockThunk<D>;
+  r->exWrite = exWriteThunk<D>;
+  r->exCom1 = exCom1Thunk<D>;
+  r->exCom2 = exCom2Thunk<D>;
+  r->exCom3 = exCom3Thunk<D>;
+  r->exCom4 = exCom4Thunk<D>;
+}
+
 IOController::IOController () {
-  dev[0xf0] = cassetteDevice = new CassetteDevice();
-  dev[0xe1] = screenKeyboardDevice = new ScreenKeyboardDevice();
-  dev[0x3c] = floppyDevice = new FloppyDevice();
-  dev[0x96] = parallellInterfaceAdaptorDevice = new ParallellInterfaceAdaptorDevice();
-  dev[0x5a] = servoPrinterDevice = new ServoPrinterDevice();
-  dev[0xc3] = localPrinterDevice = new LocalPrinterDevice();
-  dev[0x78] = disk9350Device = new Disk9350Device();
-  dev[0x4b] = disk9370Device = new Disk9370Device();
-  dev[0x71] = disk9390Device = new Disk9390Device();
-  supportedDevices.push_back(0xf0);
-  supportedDevices.push_back(0xe1);
-  supportedDevices.push_back(0x3c);
-  supportedDevices.push_back(0x96);
-  supportedDevices.push_back(0x5a);
-  supportedDevices.push_back(0xc3);
-  supportedDevices.push_back(0x78);
-  supportedDevices.push_back(0x4b);  
-  supportedDevices.push_back(0x71);
-}
-bool IOController::isDeviceSupported(unsigned char address) {
-  if (std::find(supportedDevices.begin(), supportedDevices.end(), address)==supportedDevices.end()) {
-    return false;
+  for (int i=0; i<256; i++) {
+    dispatch[i] = {false, false, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+    operations[i] = 0;
   }
-  return true;
+  // Cassette, screen and local printer compute their status when it is read.
+  addDevice(0xf0, cassetteDevice = new CassetteDevice(), false);
+  addDevice(0xe1, screenKeyboardDevice = new ScreenKeyboardDevice(), false);
+  addDevice(0x3c, floppyDevice = new FloppyDevice(), true);
+  addDevice(0x96, parallellInterfaceAdaptorDevice = new ParallellInterfaceAdaptorDevice(), true);
+  addDevice(0x5a, servoPrinterDevice = new ServoPrinterDevice(), true);
+  addDevice(0xc3, localPrinterDevice = new LocalPrinterDevice(), false);
+  addDevice(0x78, disk9350Device = new Disk9350Device(), true);
+  addDevice(0x4b, disk9370Device = new Disk9370Device(), true);
+  addDevice(0x71, disk9390Device = new Disk9390Device(), true);
+  ioAddress = 0;
+  current = &dispatch[0];
+}
+
+void IOController::countOperation() {
+  operations[ioAddress & 0xff]++;
 }
 
 int IOController::exAdr (unsigned char address) {
   ioAddress = address;
+  operations[address]++;
+  current = &dispatch[address];
   exStatus();
   return 0;
 }
 
 int IOController::exStatus () {
-  if (!isDeviceSupported(ioAddress)) return -1;
-  dev[ioAddress]->exStatus();
+  if (!current->supported) return -1;
+  current->device->status = 1;
   return 0;
 }
 
 int IOController::exData () {
-  if (!isDeviceSupported(ioAddress)) return -1;
-  dev[ioAddress]->exData();
+  if (!current->supported) return -1;
+  current->device->status = 0;
   return 0;
 }
 
 int IOController::exWrite(unsigned char data) {
-  if (!isDeviceSupported(ioAddress)) return -1;
-  return dev[ioAddress]->exWrite(data);
+  if (!current->supported) return -1;
+  return current->exWrite(current->object, data);
 }
 
 int IOController::exCom1(unsigned char data) {
-  if (!isDeviceSupported(ioAddress)) return -1;
-  return dev[ioAddress]->exCom1(data);
+  if (!current->supported) return -1;
+  return current->exCom1(current->object, data);
 }
 int IOController::exCom2(unsigned char data) {
-  if (!isDeviceSupported(ioAddress)) return -1;
-  return dev[ioAddress]->exCom2(data);
+  if (!current->supported) return -1;
+  return current->exCom2(current->object, data);
 }
 int IOController::exCom3(unsigned char data) {
-  if (!isDeviceSupported(ioAddress)) return -1;
-  return dev[ioAddress]->exCom3(data);
+  if (!current->supported) return -1;
+  return current->exCom3(current->object, data);
 }
 int IOController::exCom4(unsigned char data) {
-  if (!isDeviceSupported(ioAddress)) return -1;
-  return dev[ioAddress]->exCom4(data);
+  if (!current->supported) return -1;
+  return current->exCom4(current->object, data);
 }
 int IOController::exBeep() {
-  if (!isDeviceSupported(ioAddress)) return -1;
-  return screenKeyboardDevice->exBeep();
+  if (!current->supported) return -1;
+  return screenKeyboardDevice->ScreenKeyboardDevice::exBeep();
 }
 int IOController::exClick() {
-  if (!isDeviceSupported(ioAddress)) return -1;
-  return screenKeyboardDevice->exClick();
+  if (!current->supported) return -1;
+  return screenKeyboardDevice->ScreenKeyboardDevice::exClick();
 }
 int IOController::exDeck1() {
-  if (!isDeviceSupported(ioAddress)) return -1;
-  return cassetteDevice->exDeck1();
+  if (!current->supported) return -1;
+  return cassetteDevice->CassetteDevice::exDeck1();
 }
 int IOController::exDeck2() {
-  if (!isDeviceSupported(ioAddress)) return -1;
-  return cassetteDevice->exDeck2();
+  if (!current->supported) return -1;
+  return cassetteDevice->CassetteDevice::exDeck2();
 }
 int IOController::exRBK() {
-  if (!isDeviceSupported(ioAddress)) return -1;
-  return cassetteDevice->exRBK();
+  if (!current->supported) return -1;
+  return cassetteDevice->CassetteDevice::exRBK();
 }
 int IOController::exWBK() {
-  if (!isDeviceSupported(ioAddress)) return -1;
-  return cassetteDevice->exWBK();
+  if (!current->supported) return -1;
+  return cassetteDevice->CassetteDevice::exWBK();
 }
 int IOController::exBSP() {
-  if (!isDeviceSupported(ioAddress)) return -1;
-  return cassetteDevice->exBSP();
+  if (!current->supported) return -1;
+  return cassetteDevice->CassetteDevice::exBSP();
 }
 int IOController::exSF() {
-  if (!isDeviceSupported(ioAddress)) return -1;
-  return cassetteDevice->exSF();
+  if (!current->supported) return -1;
+  return cassetteDevice->CassetteDevice::exSF();
 }
 int IOController::exSB() {
-  if (!isDeviceSupported(ioAddress)) return -1;
-  return cassetteDevice->exSB();
+  if (!current->supported) return -1;
+  return cassetteDevice->CassetteDevice::exSB();
 }
 int IOController::exRewind() {
-  if (!isDeviceSupported(ioAddress)) return -1;
-  return cassetteDevice->exRewind();
+  if (!current->supported) return -1;
+  return cassetteDevice->CassetteDevice::exRewind();
 }
 int IOController::exTStop() {
-  if (!isDeviceSupported(ioAddress)) return -1;
-  return cassetteDevice->exTStop();
+  if (!current->supported) return -1;
+  return cassetteDevice->CassetteDevice::exTStop();
 }
 
 int IOController::input () {
-  if (!isDeviceSupported(ioAddress)) return -1;
-  return dev[ioAddress]->input();
+  if (!current->supported) return -1;
+  if (current->inlineStatus && current->device->status == 1) {
+    return current->device->statusByte();
+  }
+  return current->input(current->object);
 }
 
+int IOController::readBlock(unsigned char * data, int length) {
+  if (!current->supported) {
+    memset(data, 0xff, length);
+    return -1;
+  }
+  return current->readBlock(current->object, data, length);
+}
+
+int IOController::writeBlock(const unsigned char * data, int length) {
+  if (!current->supported) return -1;
+  return current->device->writeBlock(data, length);
+}
+
+std::vector<struct IOController::stateRecord> IOController::stateDevices() {
+  return {{"CASS", cassetteDevice, false},
+          {"SCRN", screenKeyboardDevice, true},
+          {"FLPY", floppyDevice, true},
+          {"PIA ", parallellInterfaceAdaptorDevice, false},
+          {"SERV", servoPrinterDevice, false},
+          {"LPRT", localPrinterDevice, false},
+          {"9350", disk9350Device, true},
+          {"9370", disk9370Device, true},
+          {"9390", disk9390Device, false}};
+}
+
+void IOController::attach(class Machine * machine) {
+  for (auto d : stateDevices()) {
+    d.device->machine = machine;
+  }
+  floppyDevice->latency.setClock(&machine->cpu.totalInstructionTime);
+  disk9350Device->latency.setClock(&machine->cpu.totalInstructionTime);
+  disk9370Device->latency.setClock(&machine->cpu.totalInstructionTime);
+}
+
+void IOController::saveState(class StateFile * state) {
+  state->beginSection("IO  ");
+  state->putInt(ioAddress);
+  for (auto d : stateDevices()) {
+    state->beginSection(d.tag, d.compressed);
+    d.device->saveState(state);
+  }
+}
+
+int IOController::loadState(class StateFile * state) {
+  int ret;
+  if (state->findSection("IO  ") != STATE_OK) return STATE_MISSING_SECTION;
+  ioAddress = state->getInt() & 0xff;
+  current = &dispatch[ioAddress];
+  for (auto d : stateDevices()) {
+    if (state->findSection(d.tag) != STATE_OK) return STATE_MISSING_SECTION;
+    if ((ret = d.device->loadState(state)) != STATE_OK) return ret;
+  }
+  return STATE_OK;
+}
+
+
+IOController::IODevice::IODevice() {
+  machine = NULL;
+  status = 0;
+  driveStatus = 0;
+  driveStatusMask = 0;
+}
+
+unsigned char IOController::IODevice::statusByte () {
+  return (statusRegister & ~driveStatusMask) | driveStatus;
+}
+
+void IOController::IODevice::saveState(class StateFile * state) {
+  state->putByte(statusRegister);
+  state->putByte(dataRegister);
+  state->putByte(driveStatus);
+  state->putByte(driveStatusMask);
+  state->putInt(status);
+}
+
+int IOController::IODevice::loadState(class StateFile * state) {
+  statusRegister = state->getByte();
+  dataRegister = state->getByte();
+  driveStatus = state->getByte();
+  driveStatusMask = state->getByte();
+  status = state->getInt();
+  return state->failed() ? STATE_BAD_FORMAT : STATE_OK;
+}
+
+int IOController::IODevice::fire(int event, long arg) {
+  return 1;
+}
+
+IOController::Transfers::Transfers() {
+  next = 0;
+}
+
+long IOController::Transfers::submit(class IOWorkerPool * workers, const void * key, const char * data, std::function<int(char *)> work) {
+  auto sector = std::make_shared<std::array<char, 256>>();
+  if (data != NULL) memcpy(sector->data(), data, 256);
+  pending[next] = {workers->submit(key, [sector, work]() -> int {
+        return work(sector->data());
+      }), sector};
+  return next++;
+}
+
+int IOController::Transfers::finish(long number, char * data) {
+  int ret;
+  auto it = pending.find(number);
+  if (it == pending.end()) return -1;
+  ret = it->second.done.get();
+  if (data != NULL) memcpy(data, it->second.data->data(), 256);
+  pending.erase(it);
+  return ret;
+}
+
+void IOController::Transfers::clear() {
+  pending.clear();
+}
+
+void IOController::Transfers::saveState(class StateFile * state) {
+  state->putLong(next);
+  state->putInt(pending.size());
+  for (auto it = pending.begin(); it != pending.end(); it++) {
+    state->putLong(it->first);
+    state->putInt(it->second.done.get());
+    state->putBytes(it->second.data->data(), 256);
+  }
+}
+
+// A loaded transfer is already done, finish gives its result at once.
+int IOController::Transfers::loadState(class StateFile * state) {
+  int count;
+  next = state->getLong();
+  count = state->getInt();
+  if (count < 0 || count > 256) return STATE_BAD_FORMAT;
+  for (int i=0; i<count; i++) {
+    std::promise<int> result;
+    long number = state->getLong();
+    auto sector = std::make_shared<std::array<char, 256>>();
+    result.set_value(state->getInt());
+    state->getBytes(sector->data(), 256);
+    pending[number] = {result.get_future().share(), sector};
+  }
+  return state->failed() ? STATE_BAD_FORMAT : STATE_OK;
+}
 
 void IOController::IODevice::exStatus () {
   status = 1;
@@ -144,6 +323,56 @@ void IOController::IODevice::exData () {
   status = 0;
 }
 
+int IOController::IODevice::readBlock(unsigned char * data, int length) {
+  for (int i=0; i<length; i++) {
+    data[i] = input();
+  }
+  return 0;
+}
+
+int IOController::IODevice::writeBlock(const unsigned char * data, int length) {
+  int ret = 0;
+  for (int i=0; i<length && ret==0; i++) {
+    ret = exWrite(data[i]);
+  }
+  return ret;
+}
+
+// Copy length bytes out of a 256 byte buffer page starting at address, wrapping
+// around at the end of the page like the byte at a time input does. Returns true
+// if the last byte of the page was passed.
+static bool readFromBufferPage(unsigned char * data, int length, char * page, int * address) {
+  bool wrapped = false;
+  while (length > 0) {
+    int n = std::min(length, 256 - *address);
+    memcpy(data, page + *address, n);
+    data += n;
+    length -= n;
+    *address += n;
+    if (*address == 256) {
+      *address = 0;
+      wrapped = true;
+    }
+  }
+  return wrapped;
+}
+
+static bool writeToBufferPage(const unsigned char * data, int length, char * page, int * address) {
+  bool wrapped = false;
+  while (length > 0) {
+    int n = std::min(length, 256 - *address);
+    memcpy(page + *address, data, n);
+    data += n;
+    length -= n;
+    *address += n;
+    if (*address == 256) {
+      *address = 0;
+      wrapped = true;
+    }
+  }
+  return wrapped;
+}
+
 void IOController::CassetteDevice::printStatus (const char * str) {
   char buffer[256];
   buffer[0]=0;
@@ -193,6 +422,19 @@ int IOController::CassetteDevice::exWrite(unsigned char data) {
   return 0;
 }
 
+int IOController::CassetteDevice::readBlock(unsigned char * data, int length) {
+  // The tape delivers one byte per timer tick so every byte of the block is the same.
+  if (length > 0) {
+    memset(data, input(), length);
+  }
+  return 0;
+}
+
+int IOController::CassetteDevice::writeBlock(const unsigned char * data, int length) {
+  printLog("INFO", "Writing to Cassette is not really supported yet.\n");
+  return 0;
+}
+
 int IOController::CassetteDevice::exCom1(unsigned char data) {
   printLog("INFO", "EX_COM_1 is a noop for the cassette device - why is it executed?.\n");
   return 0;
@@ -224,126 +466,117 @@ int IOController::CassetteDevice::exDeck2() {
 }
 
 
-void IOController::CassetteDevice::removeAllCallbacks() {
-  printLog("INFO", "RemoveAllCallbacks: Number of outstanding timers to clear = %d \n", outStandingCallbacks.size());
-  for (auto it=outStandingCallbacks.begin(); it < outStandingCallbacks.end(); it++) {
-    removeTimerCallback(*it);
-    outStandingCallbacks.erase(it);
+// The events of a tape in motion. The tape stops, and every event pending is
+// removed, when it reaches a gap it is to stop at, the end of the tape or the
+// cassette is taken out.
+#define CASSETTE_EVENT_GAP_PASSED 0
+#define CASSETTE_EVENT_READ_AFTER_GAP 1
+#define CASSETTE_EVENT_READ 2
+#define CASSETTE_EVENT_GAP 3
+#define CASSETTE_EVENT_STOP_AT_GAP 4
+#define CASSETTE_EVENT_LAST_GAP 5
+#define CASSETTE_EVENT_END_OF_TAPE 6
+#define CASSETTE_EVENT_REWOUND 7
+
+bool IOController::CassetteDevice::readNextByte(const char * when, int * endOfTape) {
+  unsigned char data;
+  *endOfTape = tapeDrive[tapeDeckSelected]->readByte(forward,  &data);
+  printLog("INFO", "Read one byte when %s tape gap %03o from tape which is now %s\n", when, data, endOfTapeStrings[*endOfTape]);
+  if (*endOfTape==2) {
+    statusRegister &= ~(CASSETTE_STATUS_CASSETTE_IN_PLACE); 
+    machine->removeEvents(this); 
+    return false;
   }
+  statusRegister |= (CASSETTE_STATUS_READ_READY);
+  dataRegister = data;
+  return true;
 }
 
-void IOController::CassetteDevice::removeFromOutstandCallbacks(class callbackRecord * c) {
-  printLog("INFO", "removeFromOutstandCallbacks %p Number of outstanding timers to clear = %d \n",c, outStandingCallbacks.size());
-  auto it = std::find(outStandingCallbacks.begin(), outStandingCallbacks.end(), c);
-  if (it != outStandingCallbacks.end()) {
-    printLog("INFO", "Removing one outstanding callback.\n");
-    outStandingCallbacks.erase(it);
-  }
-}
 void IOController::CassetteDevice::readFromTape() {
-  struct timespec then;
   if (tapeDrive[tapeDeckSelected]->isTapeOverGap()) { 
+    // Warm the host cache with the records ahead while the tape passes the gap.
+    machine->ioWorkers->submit(tapeDrive[tapeDeckSelected], [tape=tapeDrive[tapeDeckSelected], position=tapeDrive[tapeDeckSelected]->getPosition(), forward=forward]() -> int {
+        return tape->readAhead(position, forward);
+      });
     printLog("INFO", "Tape is over gap - Setting a 70 ms timeout for the gap.\n");
-    timeoutInNanosecs(&then, 70000000); // 70 ms timeout
-    outStandingCallbacks.push_back( addToTimerQueue([cd=this](class callbackRecord * c)->int {
-      struct timespec then;
-      printLog("INFO", "70ms timeout. Clearing GAP status ENTRY\n");
-      cd->removeFromOutstandCallbacks(c);
-      cd->statusRegister &= ~(CASSETTE_STATUS_INTER_RECORD_GAP);
-      timeoutInNanosecs(&then, 2800000); 
-      cd->outStandingCallbacks.push_back( addToTimerQueue([cd=cd](class callbackRecord * c)->int {
-        unsigned char data; 
-        int endOfTape;
-        printLog("INFO", "2.8ms timeout to read the actual data after a gap. Setting data ready ENTRY\n");
-        cd->removeFromOutstandCallbacks(c);
-        endOfTape = cd->tapeDrive[cd->tapeDeckSelected]->readByte(cd->forward,  &data);
-        printLog("INFO", "Read one byte when in tape gap %03o from tape which is now %s\n", data, cd->endOfTapeStrings[endOfTape]);
-        if (endOfTape==2) {
-          cd->statusRegister &= ~(CASSETTE_STATUS_CASSETTE_IN_PLACE); 
-          cd->removeAllCallbacks(); 
-          return 0;
-        }        
-        cd->statusRegister |= (CASSETTE_STATUS_READ_READY);
-        cd->dataRegister = data;      
-        cd->readFromTape();
-        printLog("INFO", "2.8ms timeout after gap. Data=%03o Setting data READY Status. Initiating another read. EXIT\n", data);
-        return 0;
-      }, then));
-      printLog("INFO", "70ms timeout - a new 2.8 ms timer to start read after the gap.EXIT\n");
-      return 0;
-    }, then));
+    machine->addEvent(this, CASSETTE_EVENT_GAP_PASSED, 0, 70000000); // 70 ms timeout
   } else {
     printLog("INFO", "Tape is not over gap \n");
-    timeoutInNanosecs(&then, 2800000); // 2.8 ms timeout
-    outStandingCallbacks.push_back( addToTimerQueue([cd=this](class callbackRecord * c)->int {
-      unsigned char data; 
-      int endOfTape;
+    machine->addEvent(this, CASSETTE_EVENT_READ, 0, 2800000); // 2.8 ms timeout
+  }
+}
+
+int IOController::CassetteDevice::fire(int event, long arg) {
+  int endOfTape;
+  switch (event) {
+    case CASSETTE_EVENT_GAP_PASSED:
+      printLog("INFO", "70ms timeout. Clearing GAP status ENTRY\n");
+      statusRegister &= ~(CASSETTE_STATUS_INTER_RECORD_GAP);
+      machine->addEvent(this, CASSETTE_EVENT_READ_AFTER_GAP, 0, 2800000);
+      printLog("INFO", "70ms timeout - a new 2.8 ms timer to start read after the gap.EXIT\n");
+      break;
+    case CASSETTE_EVENT_READ_AFTER_GAP:
+      printLog("INFO", "2.8ms timeout to read the actual data after a gap. Setting data ready ENTRY\n");
+      if (!readNextByte("in", &endOfTape)) break;
+      readFromTape();
+      printLog("INFO", "2.8ms timeout after gap. Data=%03o Setting data READY Status. Initiating another read. EXIT\n", dataRegister);
+      break;
+    case CASSETTE_EVENT_READ:
       printLog("INFO", "2.8ms timeout ENTRY\n");
-      cd->removeFromOutstandCallbacks(c); 
-      endOfTape = cd->tapeDrive[cd->tapeDeckSelected]->readByte(cd->forward,  &data);
-      printLog("INFO", "Read one byte when outside tape gap %03o from tape which is now %s\n", data, cd->endOfTapeStrings[endOfTape]);
-      if (endOfTape==2) {
-        cd->statusRegister &= ~(CASSETTE_STATUS_CASSETTE_IN_PLACE); 
-        cd->removeAllCallbacks(); 
-        return 0;
-      }
-      
-      cd->statusRegister |= (CASSETTE_STATUS_READ_READY);
-      cd->dataRegister = data;
-      if (cd->tapeDrive[cd->tapeDeckSelected]->isTapeOverGap()) {
+      if (!readNextByte("outside", &endOfTape)) break;
+      if (tapeDrive[tapeDeckSelected]->isTapeOverGap()) {
         printLog("INFO", "2.8 ms timeout - tape is over gap. \n");
-        // Now we are over a gap
-        struct timespec then;
-        timeoutInNanosecs(&then, 2800000);  // we have read the last byte of the record, waited 2.8 ms and then we let it wait another 1 ms until we stop the tape and report gap.
-        cd->outStandingCallbacks.push_back( addToTimerQueue([cd=cd, endOfTape=endOfTape](class callbackRecord * c)->int {
-          struct timespec then;
-          timeoutInNanosecs(&then, 1000000);
-          printLog("INFO", "2.8ms timeout to set tape gap and stop if necessary ENTRY\n");
-          cd->removeFromOutstandCallbacks(c);
-          if (cd->stopAtGap) {
-            cd->outStandingCallbacks.push_back( addToTimerQueue([cd=cd](class callbackRecord * c)->int {
-              printLog("INFO", "1.0ms timeout to set DECK READY and stop if necessary ENTRY\n");
-              cd->statusRegister |= (CASSETTE_STATUS_DECK_READY);
-              cd->removeAllCallbacks();
-              return 0;
-            }, then));
-          }  
-          cd->statusRegister |= (CASSETTE_STATUS_INTER_RECORD_GAP);
-          if (!cd->stopAtGap && (endOfTape!=1)) {
-            printLog("INFO", "Initiating read of another byte from tape after the gap.\n");
-            cd->readFromTape(); 
-          }
-          printLog("INFO", "2.8ms timeout to set tape gap and stop if necessary EXIT\n");
-          return 0;
-        }, then));
-
+        // Now we are over a gap. We have read the last byte of the record, wait 2.8 ms and
+        // then we let it wait another 1 ms until we stop the tape and report gap.
+        machine->addEvent(this, CASSETTE_EVENT_GAP, endOfTape, 2800000);
         if (endOfTape==1) {
-          timeoutInNanosecs(&then, 2800000);  // we have read the last byte of the tape, waited 70 ms and then we report end of tape
-          cd->outStandingCallbacks.push_back( addToTimerQueue([cd=cd](class callbackRecord * c)->int {
-            struct timespec then;
-            printLog("INFO", "2.8 ms timeout to set inter-record gap at end of tape ENTRY\n");
-            cd->removeFromOutstandCallbacks(c);
-            cd->statusRegister |= (CASSETTE_STATUS_INTER_RECORD_GAP);
-            timeoutInNanosecs(&then, 70000000);  // we have read the last byte of the tape, waited 70 ms and then we report end of tape
-            cd->outStandingCallbacks.push_back( addToTimerQueue([cd=cd](class callbackRecord * c)->int {
-              printLog("INFO", "70 ms timeout to set tape end of tape ENTRY\n");
-              cd->removeFromOutstandCallbacks(c);
-              cd->statusRegister |= (CASSETTE_STATUS_END_OF_TAPE | CASSETTE_STATUS_DECK_READY);
-              cd->removeAllCallbacks();
-              printLog("INFO", "70 ms timeout to set tape end of tape EXIT\n");
-              return 0;
-            }, then));            
-            printLog("INFO", "2.8 ms timeout to set inter-record gap at end of tape EXIT\n");
-            return 0;
-          }, then));
+          // We have read the last byte of the tape, wait 2.8 ms and another 70 ms and then we report end of tape.
+          machine->addEvent(this, CASSETTE_EVENT_LAST_GAP, 0, 2800000);
         }
       } else {
-        cd->readFromTape();
+        readFromTape();
       }
       printLog("INFO", "2.8ms timeout EXIT\n");
-      return 0;
-    }, then));  
+      break;
+    case CASSETTE_EVENT_GAP:
+      printLog("INFO", "2.8ms timeout to set tape gap and stop if necessary ENTRY\n");
+      if (stopAtGap) {
+        machine->addEvent(this, CASSETTE_EVENT_STOP_AT_GAP, 0, 1000000);
+      }
+      statusRegister |= (CASSETTE_STATUS_INTER_RECORD_GAP);
+      if (!stopAtGap && (arg!=1)) {
+        printLog("INFO", "Initiating read of another byte from tape after the gap.\n");
+        readFromTape(); 
+      }
+      printLog("INFO", "2.8ms timeout to set tape gap and stop if necessary EXIT\n");
+      break;
+    case CASSETTE_EVENT_STOP_AT_GAP:
+      printLog("INFO", "1.0ms timeout to set DECK READY and stop if necessary ENTRY\n");
+      statusRegister |= (CASSETTE_STATUS_DECK_READY);
+      machine->removeEvents(this);
+      break;
+    case CASSETTE_EVENT_LAST_GAP:
+      printLog("INFO", "2.8 ms timeout to set inter-record gap at end of tape ENTRY\n");
+      statusRegister |= (CASSETTE_STATUS_INTER_RECORD_GAP);
+      machine->addEvent(this, CASSETTE_EVENT_END_OF_TAPE, 0, 70000000);
+      printLog("INFO", "2.8 ms timeout to set inter-record gap at end of tape EXIT\n");
+      break;
+    case CASSETTE_EVENT_END_OF_TAPE:
+      printLog("INFO", "70 ms timeout to set tape end of tape ENTRY\n");
+      statusRegister |= (CASSETTE_STATUS_END_OF_TAPE | CASSETTE_STATUS_DECK_READY);
+      machine->removeEvents(this);
+      printLog("INFO", "70 ms timeout to set tape end of tape EXIT\n");
+      break;
+    case CASSETTE_EVENT_REWOUND:
+      printLog("INFO", "1 ms timeout rewind ENTRY\n");
+      statusRegister |= (CASSETTE_STATUS_END_OF_TAPE | CASSETTE_STATUS_DECK_READY);
+      machine->removeEvents(this);
+      printLog("INFO", "1 ms timeout rewind EXIT\n");
+      break;
+    default:
+      return 1;
   }
+  return 0;
 }
 
 int IOController::CassetteDevice::exRBK() {
@@ -352,7 +585,7 @@ int IOController::CassetteDevice::exRBK() {
   forward = true;
   stopAtGap = true; 
   printStatus("exRBK Forward read one block");
-  removeAllCallbacks();
+  machine->removeEvents(this);
   statusRegister &= ~(CASSETTE_STATUS_DECK_READY | CASSETTE_STATUS_READ_READY | CASSETTE_STATUS_INTER_RECORD_GAP | CASSETTE_STATUS_END_OF_TAPE ); // Clear ready bit
   readFromTape();
   return 0;
@@ -369,7 +602,7 @@ int IOController::CassetteDevice::exBSP() {
   forward = false;
   stopAtGap = true; 
   printStatus("exBSP Backwards read one block");
-  removeAllCallbacks();
+  machine->removeEvents(this);
   statusRegister &= ~(CASSETTE_STATUS_DECK_READY | CASSETTE_STATUS_READ_READY | CASSETTE_STATUS_INTER_RECORD_GAP | CASSETTE_STATUS_END_OF_TAPE ); // Clear ready bit
   readFromTape();
 
@@ -381,7 +614,7 @@ int IOController::CassetteDevice::exSF() {
   forward = true;
   stopAtGap = false; 
   printStatus("exSF Read Forward");
-  removeAllCallbacks();
+  machine->removeEvents(this);
   statusRegister &= ~(CASSETTE_STATUS_DECK_READY | CASSETTE_STATUS_READ_READY | CASSETTE_STATUS_INTER_RECORD_GAP | CASSETTE_STATUS_END_OF_TAPE ); // Clear ready bit
   readFromTape();
   return 0;
@@ -392,32 +625,23 @@ int IOController::CassetteDevice::exSB() {
   forward = false;
   stopAtGap = false; 
   printStatus("exSB Read Backwards");
-  removeAllCallbacks();
+  machine->removeEvents(this);
   statusRegister &= ~(CASSETTE_STATUS_DECK_READY | CASSETTE_STATUS_READ_READY | CASSETTE_STATUS_INTER_RECORD_GAP | CASSETTE_STATUS_END_OF_TAPE ); // Clear ready bit
   readFromTape();
   return 0;
 }
 int IOController::CassetteDevice::exRewind() {
-  struct timespec then;
   if (!(statusRegister & CASSETTE_STATUS_DECK_READY)) return 0;
   if (!tapeDrive[tapeDeckSelected]->isOpen()) return 0;
   printStatus("exrewind Rewind");
   statusRegister &= ~(CASSETTE_STATUS_DECK_READY | CASSETTE_STATUS_INTER_RECORD_GAP | CASSETTE_STATUS_END_OF_TAPE | CASSETTE_STATUS_READ_READY | CASSETTE_STATUS_WRITE_READY);
   tapeDrive[tapeDeckSelected]->rewind();
-  timeoutInNanosecs(&then, 1000000);  
-  outStandingCallbacks.push_back( addToTimerQueue([cd=this](class callbackRecord * c)->int {
-    printLog("INFO", "1 ms timeout rewind ENTRY\n");
-    cd->removeFromOutstandCallbacks(c);
-    cd->statusRegister |= (CASSETTE_STATUS_END_OF_TAPE | CASSETTE_STATUS_DECK_READY);
-    cd->removeAllCallbacks();
-    printLog("INFO", "1 ms timeout rewind EXIT\n");
-    return 0;
-  }, then));  
+  machine->addEvent(this, CASSETTE_EVENT_REWOUND, 0, 1000000);
   return 0;
 }
 int IOController::CassetteDevice::exTStop() {
   printStatus("exTStop");
-  removeAllCallbacks();
+  machine->removeEvents(this);
   if (tapeDrive[tapeDeckSelected]->isOpen()) {
     statusRegister |= (CASSETTE_STATUS_DECK_READY);
   } else {
@@ -436,11 +660,13 @@ IOController::CassetteDevice::CassetteDevice () {
 
 
 bool IOController::CassetteDevice::openFile (int drive, std::string fileName, bool wp) {
+  machine->ioWorkers->drain(tapeDrive[drive]);
 
   tapeDrive[drive]->setWriteProtected(wp);
   return tapeDrive[drive]->openFile(fileName);
 }
 void IOController::CassetteDevice::closeFile (int drive) {
+  machine->ioWorkers->drain(tapeDrive[drive]);
   tapeDrive[drive]->closeFile();
 }
 std::string IOController::CassetteDevice::getFileName (int drive) {
@@ -450,6 +676,34 @@ bool IOController::CassetteDevice::loadBoot (std::function<void(int address, uns
   return tapeDrive[0]->loadBoot(writeMem);
 }
 
+// A tape in motion is saved with the events it has pending.
+void IOController::CassetteDevice::saveState(class StateFile * state) {
+  IODevice::saveState(state);
+  state->putBool(tapeRunning);
+  state->putInt(tapeDeckSelected);
+  state->putBool(forward);
+  state->putBool(stopAtGap);
+  for (int i=0; i<2; i++) {
+    machine->ioWorkers->drain(tapeDrive[i]);
+    tapeDrive[i]->saveState(state);
+  }
+  machine->saveEvents(this, state);
+}
+
+int IOController::CassetteDevice::loadState(class StateFile * state) {
+  int ret = IODevice::loadState(state);
+  tapeRunning = state->getBool();
+  tapeDeckSelected = state->getInt() & 1;
+  forward = state->getBool();
+  stopAtGap = state->getBool();
+  for (int i=0; i<2; i++) {
+    machine->ioWorkers->drain(tapeDrive[i]);
+    if (tapeDrive[i]->loadState(state)) ret = STATE_MEDIA_ERROR;
+  }
+  if (state->getVersion() >= 3 && machine->loadEvents(this, state) != STATE_OK) return STATE_BAD_FORMAT;
+  return state->failed() ? STATE_BAD_FORMAT : ret;
+}
+
 void IOController::CassetteDevice::updateTapGapFlag(bool gap) {
   printLog("INFO", "Setting tap gap to %d\n", gap);
   if (gap) {
@@ -472,12 +726,12 @@ void IOController::CassetteDevice::updateReadyFlag(bool gap) {
 
 unsigned char IOController::ScreenKeyboardDevice::input () {
   if (status) {
-    if (rw->getDisplayButton()) {
+    if (machine->cpu.displayButtonStatus) {
       statusRegister |= 0010;
     } else {
       statusRegister &= ~0010;
     }
-    if (rw->getKeyboardButton()) {
+    if (machine->cpu.keyboardButtonStatus) {
       statusRegister |= 0004;
     } else {
       statusRegister &= ~0004;
@@ -490,13 +744,13 @@ unsigned char IOController::ScreenKeyboardDevice::input () {
 }
 int IOController::ScreenKeyboardDevice::exWrite(unsigned char data) {
   if (!loadingFont) {
-    int ret = dpw->writeCharacter(data);
+    int ret = machine->screen->writeCharacter(data);
     if (incrementXOnWrite) {
-      dpw->incrementXPos();
+      machine->screen->incrementXPos();
     } 
     return ret;    
   } else {
-      dpw->updateCharGen(data);
+      machine->screen->updateCharGen(data);
       return 0;
   }
 } 
@@ -504,33 +758,24 @@ int IOController::ScreenKeyboardDevice::exCom1(unsigned char data){
   //
   loadingFont = false;
   if (data & SCRNKBD_COM1_ROLL_DOWN) { // roll down
-    dpw->scrollDown();
+    machine->screen->scrollDown();
   } 
   if (data & SCRNKBD_COM1_ERASE_EOF) {
-    dpw->eraseFromCursorToEndOfFrame();  
+    machine->screen->eraseFromCursorToEndOfFrame();  
   }
   if (data & SCRNKBD_COM1_ERASE_EOL) {
-    dpw->eraseFromCursorToEndOfLine(); 
+    machine->screen->eraseFromCursorToEndOfLine(); 
   }
   if (data & SCRNKBD_COM1_ROLL) { // roll up 
     //dpw->rollScreenOneLine();
-    dpw->scrollUp();
+    machine->screen->scrollUp();
   }
   if (data & SCRNKBD_COM1_CURSOR_ONOFF) {
-    dpw->showCursor(true);
+    machine->screen->showCursor(true);
   } else {
-    dpw->showCursor(false);
-  }
-  if (data & SCRNKBD_COM1_KDB_LIGHT) {
-    rw->setKeyboardLight(true);
-  } else {
-    rw->setKeyboardLight(false);
-  }
-  if (data & SCRNKBD_COM1_DISP_LIGHT) {
-    rw->setDisplayLight(true);
-  } else {
-    rw->setDisplayLight(false);
+    machine->screen->showCursor(false);
   }
+  setLights((data & SCRNKBD_COM1_KDB_LIGHT) != 0, (data & SCRNKBD_COM1_DISP_LIGHT) != 0);
   if (data & SCRNKBD_COM1_AUTO_INCREMENT) { 
     incrementXOnWrite=true;
   } else {
@@ -539,18 +784,18 @@ int IOController::ScreenKeyboardDevice::exCom1(unsigned char data){
   return 0;
 }
 int IOController::ScreenKeyboardDevice::exCom2(unsigned char data){
-  return dpw->setCursorX(data);
+  return machine->screen->setCursorX(data);
 }
 int IOController::ScreenKeyboardDevice::exCom3(unsigned char data){
-  return dpw->setCursorY(data);
+  return machine->screen->setCursorY(data);
 }
 int IOController::ScreenKeyboardDevice::exCom4(unsigned char data){
   loadingFont=true;
-  dpw->setCharGenChar(data);
+  machine->screen->setCharGenChar(data);
   return 0; 
 }
 int IOController::ScreenKeyboardDevice::exBeep(){
-  beep();
+  machine->screen->beep();
   return 0;
 }
 int IOController::ScreenKeyboardDevice::exClick(){
@@ -584,6 +829,13 @@ int IOController::ScreenKeyboardDevice::exTStop(){
   return 1;
 }
 
+void IOController::ScreenKeyboardDevice::setLights(bool keyboard, bool display) {
+  if (machine->cpu.keyboardLightStatus == keyboard && machine->cpu.displayLightStatus == display) return;
+  machine->cpu.keyboardLightStatus = keyboard;
+  machine->cpu.displayLightStatus = display;
+  if (machine->onLights) machine->onLights();
+}
+
 void IOController::ScreenKeyboardDevice::updateKbd(int key) {
   dataRegister = key;
   statusRegister |= (SCRNKBD_STATUS_KBD_READY);
@@ -595,6 +847,21 @@ IOController::ScreenKeyboardDevice::ScreenKeyboardDevice() {
   loadingFont = false;
 }
 
+void IOController::ScreenKeyboardDevice::saveState(class StateFile * state) {
+  IODevice::saveState(state);
+  state->putBool(incrementXOnWrite);
+  state->putBool(loadingFont);
+  machine->screen->saveState(state);
+}
+
+int IOController::ScreenKeyboardDevice::loadState(class StateFile * state) {
+  int ret = IODevice::loadState(state);
+  incrementXOnWrite = state->getBool();
+  loadingFont = state->getBool();
+  machine->screen->loadState(state);
+  return state->failed() ? STATE_BAD_FORMAT : ret;
+}
+
 
 unsigned char IOController::ParallellInterfaceAdaptorDevice::input () {
   if (status) {
@@ -800,19 +1067,20 @@ IOController::LocalPrinterDevice::LocalPrinterDevice() {
 
 }
 
+void IOController::FloppyDevice::updateDriveStatus () {
+  driveStatusMask = FLOPPY_STATUS_DRIVE_ONLINE | FLOPPY_STATUS_WRITE_PROTECT;
+  driveStatus = 0;
+  if (floppyDrives[selectedDrive]->online()) {
+    driveStatus |= FLOPPY_STATUS_DRIVE_ONLINE;
+  }
+  if (floppyDrives[selectedDrive]->isWriteProtected()) {
+    driveStatus |= FLOPPY_STATUS_WRITE_PROTECT;
+  }
+}
+
 unsigned char IOController::FloppyDevice::input () {
   if (status) {
-    if (floppyDrives[selectedDrive]->online()) {
-      statusRegister |= FLOPPY_STATUS_DRIVE_ONLINE;
-    } else {
-      statusRegister &= ~FLOPPY_STATUS_DRIVE_ONLINE;
-    }
-    if (floppyDrives[selectedDrive]->isWriteProtected()) {
-      statusRegister |= FLOPPY_STATUS_WRITE_PROTECT; 
-    } else {
-      statusRegister &= ~FLOPPY_STATUS_WRITE_PROTECT;
-    }
-    printLog("INFO", "Returning floppy status = %02X\n", statusRegister);
+    statusRegister = statusByte();
     return statusRegister;
   } else {
     char tmp;
@@ -824,6 +1092,22 @@ unsigned char IOController::FloppyDevice::input () {
 
   }
 }
+int IOController::FloppyDevice::readBlock(unsigned char * data, int length) {
+  if (status) {
+    memset(data, input(), length);
+  } else {
+    printLog("INFO", "Reading %d bytes of floppy data from buffer address (%03o) in selectedBufferPage=%d\n", length, 0xff & bufferAddress, selectedBufferPage);
+    readFromBufferPage(data, length, buffer[selectedBufferPage], &bufferAddress);
+  }
+  return 0;
+}
+
+int IOController::FloppyDevice::writeBlock(const unsigned char * data, int length) {
+  printLog("INFO", "Floppy writing %d bytes to address %03o in bufferPage %d\n", length, bufferAddress, selectedBufferPage);
+  writeToBufferPage(data, length, buffer[selectedBufferPage], &bufferAddress);
+  return 0;
+}
+
 int IOController::FloppyDevice::exWrite(unsigned char data) {
   printLog("INFO", "Floppy writing data %03o to address %03o in bufferPage %d\n", data&0xff, bufferAddress, selectedBufferPage);
   buffer[selectedBufferPage][bufferAddress]=data;
@@ -832,24 +1116,24 @@ int IOController::FloppyDevice::exWrite(unsigned char data) {
   return 0;
 
 } 
+// Events of the floppy controller. The sector is read or written when the
+// transfer ends.
+#define FLOPPY_EVENT_READY 0
+#define FLOPPY_EVENT_READ 1
+#define FLOPPY_EVENT_WRITE 2
+#define FLOPPY_EVENT_SEEK 3
+
 int IOController::FloppyDevice::exCom1(unsigned char data){
-  struct timespec then;
   switch (data & 0xf) {
     case 0:
     case 1:
     case 2:
     case 3:
       selectedDrive = 0x3 & data;
+      updateDriveStatus();
       printLog("INFO", "Selecting drive %d\n", 0x3&data);
       statusRegister &= ~FLOPPY_STATUS_DRIVE_READY;
-      timeoutInNanosecs(&then, 10000);
-      addToTimerQueue([t = this](class callbackRecord *c) -> int {
-          printLog("INFO", "10us timeout floppy select drive is ready\n");
-          t->statusRegister |= FLOPPY_STATUS_DRIVE_READY;
-          return 0;
-        },
-        then);
-
+      machine->addEvent(this, FLOPPY_EVENT_READY, 0, latency.fixed(10000));
       break;
     case 4: // Clear Buffer Parity Error
       return 0;
@@ -857,67 +1141,19 @@ int IOController::FloppyDevice::exCom1(unsigned char data){
       printLog("INFO", "Reading from drive\n");
       statusRegister |= FLOPPY_STATUS_DATA_XFER_IN_PROGRESS;
       statusRegister &= ~(FLOPPY_STATUS_SECTOR_NOT_FOUND | FLOPPY_STATUS_DELETED_DATA_MARK | FLOPPY_STATUS_CRC_ERROR | FLOPPY_STATUS_DRIVE_READY);
-      timeoutInNanosecs(&then, 1000000);
-      addToTimerQueue([t = this](class callbackRecord *c) -> int {
-          int ret;
-          printLog("INFO", "10ms timeout floppy read is ready\n");
-          t->statusRegister &= ~FLOPPY_STATUS_DATA_XFER_IN_PROGRESS;
-          ret = t->floppyDrives[t->selectedDrive]->readSector(t->buffer[t->selectedBufferPage]);
-          switch (ret) {
-          case FLOPPY_SECTOR_NOT_FOUND:
-            t->statusRegister |= FLOPPY_STATUS_SECTOR_NOT_FOUND;
-            break;
-          case FLOPPY_DELETED_DATA:
-            t->statusRegister |= FLOPPY_STATUS_DELETED_DATA_MARK;
-            break;
-          case FLOPPY_CRC_ERROR:
-            t->statusRegister |= FLOPPY_STATUS_CRC_ERROR;
-            break;
-          case FLOPPY_OK:
-            t->statusRegister |= FLOPPY_STATUS_DRIVE_READY;
-            break;
-          }
-          return 0;
-        }, then);
+      machine->addEvent(this, FLOPPY_EVENT_READ, 0, latency.transfer(floppyDrives[selectedDrive]->getSector(), 1000000));
       break;
     case 6: // Write Selected Buffer Page onto Selected Sector
     case 7: // Same as 6 plus read check of CRC
      printLog("INFO", "Writing to drive\n");
       statusRegister |= FLOPPY_STATUS_DATA_XFER_IN_PROGRESS;
       statusRegister &= ~(FLOPPY_STATUS_SECTOR_NOT_FOUND | FLOPPY_STATUS_DELETED_DATA_MARK | FLOPPY_STATUS_CRC_ERROR | FLOPPY_STATUS_DRIVE_READY); 
-      timeoutInNanosecs(&then, 1000000); 
-      addToTimerQueue([t = this](class callbackRecord *c) -> int {
-          int ret;
-          printLog("INFO", "10ms timeout floppy read is ready\n");
-          t->statusRegister &= ~FLOPPY_STATUS_DATA_XFER_IN_PROGRESS;
-          ret = t->floppyDrives[t->selectedDrive]->writeSector(t->buffer[t->selectedBufferPage]);
-          switch (ret) {
-          case FLOPPY_SECTOR_NOT_FOUND:
-            t->statusRegister |= FLOPPY_STATUS_SECTOR_NOT_FOUND;
-            break;
-          case FLOPPY_DELETED_DATA:
-            t->statusRegister |= FLOPPY_STATUS_DELETED_DATA_MARK;
-            break;
-          case FLOPPY_CRC_ERROR:
-            t->statusRegister |= FLOPPY_STATUS_CRC_ERROR;
-            break;
-          case FLOPPY_OK:
-            t->statusRegister |= FLOPPY_STATUS_DRIVE_READY;
-            break;
-          }
-          return 0;
-        }, then);                
+      machine->addEvent(this, FLOPPY_EVENT_WRITE, 0, latency.transfer(floppyDrives[selectedDrive]->getSector(), 1000000));
       break;
     case 8: // Restore Selected Drive (seek to track 0)
       printLog("INFO", "Doing a restore to track 0.\n");
       statusRegister &= ~FLOPPY_STATUS_DRIVE_READY;
-      timeoutInNanosecs(&then, 100000000);
-      addToTimerQueue([t = this](class callbackRecord *c) -> int {
-          printLog("INFO", "100ms timeout floppy restore is ready\n");
-          t->floppyDrives[t->selectedDrive]->setTrack(0);
-          t->statusRegister |= FLOPPY_STATUS_DRIVE_READY;
-          return 0;
-        }, then);     
+      machine->addEvent(this, FLOPPY_EVENT_SEEK, 0, latency.seek(floppyDrives[selectedDrive]->getTrack(), 0, 100000000));
       break;
     case 9:
       printLog("INFO", "Select buffer page = %d\n", 0x3 & (data>>6));
@@ -932,33 +1168,62 @@ int IOController::FloppyDevice::exCom1(unsigned char data){
   return 0;
 }
 int IOController::FloppyDevice::exCom2(unsigned char data){
-  struct timespec then;
   statusRegister &= ~FLOPPY_STATUS_DRIVE_READY;
   printLog("INFO","Seek to track %d\n", data);
   if (data>76) {
     data = 76;
   }
-  timeoutInNanosecs(&then, 10000000);
-  addToTimerQueue([t = this, tr=data](class callbackRecord *c) -> int {
-        printLog("INFO", "10ms timeout floppy seek is ready\n");
-        t->floppyDrives[t->selectedDrive]->setTrack(tr);
-        t->statusRegister |= FLOPPY_STATUS_DRIVE_READY;
-        return 0;
-      }, then);   
+  machine->addEvent(this, FLOPPY_EVENT_SEEK, data, latency.seek(floppyDrives[selectedDrive]->getTrack(), data, 10000000));
   return 0;
 }
 
 int IOController::FloppyDevice::exCom3(unsigned char data){
-  struct timespec then;
   printLog("INFO","COmmand word %02x, Select sector %d\n", data & 0xff, data & 0xf );
   floppyDrives[selectedDrive]->setSector(data & 0xf);
   statusRegister &= ~FLOPPY_STATUS_DRIVE_READY;
-  timeoutInNanosecs(&then, 10000);
-  addToTimerQueue([t = this](class callbackRecord *c) -> int {
-        printLog("INFO", "10us timeout floppy select sector is ready\n");
-        t->statusRegister |= FLOPPY_STATUS_DRIVE_READY;
-        return 0;
-      }, then);   
+  machine->addEvent(this, FLOPPY_EVENT_READY, 0, latency.fixed(10000));
+  return 0;
+}
+
+int IOController::FloppyDevice::fire(int event, long arg) {
+  int ret;
+  switch (event) {
+    case FLOPPY_EVENT_READY:
+      printLog("INFO", "10us timeout floppy select is ready\n");
+      statusRegister |= FLOPPY_STATUS_DRIVE_READY;
+      return 0;
+    case FLOPPY_EVENT_SEEK:
+      printLog("INFO", "Floppy seek to track %ld is ready\n", arg);
+      floppyDrives[selectedDrive]->setTrack(arg);
+      statusRegister |= FLOPPY_STATUS_DRIVE_READY;
+      return 0;
+    case FLOPPY_EVENT_READ:
+      printLog("INFO", "10ms timeout floppy read is ready\n");
+      statusRegister &= ~FLOPPY_STATUS_DATA_XFER_IN_PROGRESS;
+      ret = floppyDrives[selectedDrive]->readSector(buffer[selectedBufferPage]);
+      break;
+    case FLOPPY_EVENT_WRITE:
+      printLog("INFO", "10ms timeout floppy write is ready\n");
+      statusRegister &= ~FLOPPY_STATUS_DATA_XFER_IN_PROGRESS;
+      ret = floppyDrives[selectedDrive]->writeSector(buffer[selectedBufferPage]);
+      break;
+    default:
+      return 1;
+  }
+  switch (ret) {
+  case FLOPPY_SECTOR_NOT_FOUND:
+    statusRegister |= FLOPPY_STATUS_SECTOR_NOT_FOUND;
+    break;
+  case FLOPPY_DELETED_DATA:
+    statusRegister |= FLOPPY_STATUS_DELETED_DATA_MARK;
+    break;
+  case FLOPPY_CRC_ERROR:
+    statusRegister |= FLOPPY_STATUS_CRC_ERROR;
+    break;
+  case FLOPPY_OK:
+    statusRegister |= FLOPPY_STATUS_DRIVE_READY;
+    break;
+  }
   return 0;
 }
 int IOController::FloppyDevice::exCom4(unsigned char data){
@@ -1001,35 +1266,83 @@ int IOController::FloppyDevice::exTStop(){
 }
 
 int IOController::FloppyDevice::openFile(int drive, std::string fileName, bool writeProtect,  bool writeBack){
-  return floppyDrives[drive]->openFile(fileName, writeProtect, writeBack);
+  // The image may be one that is still being written back from an earlier detach.
+  for (int i=0; i<4; i++) {
+    if (pendingWriteBack[i].valid()) pendingWriteBack[i].wait();
+  }
+  int ret = floppyDrives[drive]->openFile(fileName, writeProtect, writeBack);
+  updateDriveStatus();
+  return ret;
 }
 
 void IOController::FloppyDevice::closeFile(int drive){
-  floppyDrives[drive]->closeFile();
+  // Hand the old drive with its image over to an I/O worker which does the
+  // write back and close. The guest immediately sees an empty drive.
+  class FloppyDrive * old = floppyDrives[drive];
+  floppyDrives[drive] = new FloppyDrive();
+  pendingWriteBack[drive] = machine->ioWorkers->submit(old, [old]() -> int {
+      old->closeFile();
+      delete old;
+      return 0;
+    });
+  updateDriveStatus();
 }
 
-IOController::FloppyDevice::FloppyDevice() {
+IOController::FloppyDevice::FloppyDevice() : latency(8000000, 8000000, 166666666, 13) {
   statusRegister = 0;
+  selectedDrive = 0;
   for (int i=0; i<4; i++) {
     floppyDrives[i] = new FloppyDrive();
   }
+  updateDriveStatus();
 }
 
+void IOController::FloppyDevice::saveState(class StateFile * state) {
+  IODevice::saveState(state);
+  state->putInt(selectedDrive);
+  state->putInt(selectedBufferPage);
+  state->putBytes(buffer, sizeof(buffer));
+  state->putInt(bufferAddress);
+  for (int i=0; i<4; i++) {
+    floppyDrives[i]->saveState(state);
+  }
+  machine->saveEvents(this, state);
+}
+
+int IOController::FloppyDevice::loadState(class StateFile * state) {
+  int ret = IODevice::loadState(state);
+  selectedDrive = state->getInt() & 3;
+  selectedBufferPage = state->getInt() & 3;
+  state->getBytes(buffer, sizeof(buffer));
+  bufferAddress = state->getInt();
+  for (int i=0; i<4; i++) {
+    if (pendingWriteBack[i].valid()) pendingWriteBack[i].wait();
+  }
+  for (int i=0; i<4; i++) {
+    if (floppyDrives[i]->loadState(state) != FILE_OK) ret = STATE_MEDIA_ERROR;
+  }
+  updateDriveStatus();
+  if (state->getVersion() >= 3 && machine->loadEvents(this, state) != STATE_OK) return STATE_BAD_FORMAT;
+  return state->failed() ? STATE_BAD_FORMAT : ret;
+}
+
+
 
 
+void IOController::Disk9350Device::updateDriveStatus () {
+  driveStatusMask = DISK9350_STATUS_DRIVE_ONLINE | DISK9350_STATUS_WRITE_PROTECT_ENABLE;
+  driveStatus = 0;
+  if (drives[selectedDrive]->isOnline()) {
+    driveStatus |= DISK9350_STATUS_DRIVE_ONLINE;
+  }
+  if (drives[selectedDrive]->isWriteProtected()) {
+    driveStatus |= DISK9350_STATUS_WRITE_PROTECT_ENABLE;
+  }
+}
 
 unsigned char IOController::Disk9350Device::input () {
   if (status) {
-    if (drives[selectedDrive]->isOnline()) {
-      statusRegister |= DISK9350_STATUS_DRIVE_ONLINE;
-    } else {
-      statusRegister &= ~DISK9350_STATUS_DRIVE_ONLINE;
-    }
-    if (drives[selectedDrive]->isWriteProtected()) {
-      statusRegister |= DISK9350_STATUS_WRITE_PROTECT_ENABLE; 
-    } else {
-      statusRegister &= ~DISK9350_STATUS_WRITE_PROTECT_ENABLE;
-    }    
+    statusRegister = statusByte();
     return statusRegister;
   } else {
     char tmp;
@@ -1044,6 +1357,25 @@ unsigned char IOController::Disk9350Device::input () {
     return tmp;
   }
 }
+int IOController::Disk9350Device::readBlock(unsigned char * data, int length) {
+  if (status) {
+    memset(data, input(), length);
+  } else {
+    printLog("INFO", "Reading %d bytes from 9350 bufferPage %d address %d\n", length, selectedBufferPage, bufferAddress);
+    if (readFromBufferPage(data, length, buffer[selectedBufferPage], &bufferAddress)) {
+      statusRegister |= DISK9350_STATUS_OVERFLOW;
+    }
+  }
+  return 0;
+}
+
+int IOController::Disk9350Device::writeBlock(const unsigned char * data, int length) {
+  if (writeToBufferPage(data, length, buffer[selectedBufferPage], &bufferAddress)) {
+    statusRegister |= DISK9350_STATUS_OVERFLOW;
+  }
+  return 0;
+}
+
 int IOController::Disk9350Device::exWrite(unsigned char data) {
   //printLog("INFO", "9350 Writing data %02X to address %d in bufferPage %d\n", data&0xff, bufferAddress, selectedBufferPage);
   buffer[selectedBufferPage][bufferAddress]=data;
@@ -1055,8 +1387,16 @@ int IOController::Disk9350Device::exWrite(unsigned char data) {
     }  
   return 0;
 } 
+// Events of the 9350 controller. A read or write ends with the transfer
+// given as argument, a seek with the new cylinder.
+#define DISK9350_EVENT_DRIVE_READY 0
+#define DISK9350_EVENT_CLEARED 1
+#define DISK9350_EVENT_READ 2
+#define DISK9350_EVENT_WRITE 3
+#define DISK9350_EVENT_SEEK 4
+#define DISK9350_EVENT_SEEK_CONTROLLER 5
+
 int IOController::Disk9350Device::exCom1(unsigned char data) {
-  struct timespec then;
   long address; 
   switch (0xf & data) {
     case 0:
@@ -1065,16 +1405,10 @@ int IOController::Disk9350Device::exCom1(unsigned char data) {
     case 3:
       // Select drive 0..3
       selectedDrive = 0x3 & data;
+      updateDriveStatus();
       printLog("INFO", "Selecting drive %d\n", 0x3&data);
       statusRegister &= ~(DISK9350_STATUS_DRIVE_READY | DISK9350_STATUS_CONTROLLER_READY);
-      timeoutInNanosecs(&then, 10000);
-      addToTimerQueue([t = this](class callbackRecord *c) -> int {
-          printLog("INFO", "10us timeout 9350 drive select drive is ready\n");
-          t->statusRegister |= DISK9350_STATUS_DRIVE_READY | DISK9350_STATUS_CONTROLLER_READY;
-          return 0;
-        },
-        then);
-
+      machine->addEvent(this, DISK9350_EVENT_DRIVE_READY, 0, latency.fixed(10000));
       return 0;
     case 4:
       // Clear selected buffer page to all zeros. Set page byte address to zero.
@@ -1084,31 +1418,16 @@ int IOController::Disk9350Device::exCom1(unsigned char data) {
       bufferAddress = 0;
       printLog("INFO", "Clear buffer page %d from 9350 drive\n", selectedBufferPage);
       statusRegister &= ~(DISK9350_STATUS_CONTROLLER_READY | DISK9350_STATUS_CRC_ERROR | DISK9350_STATUS_INVALID_SECTOR_ADDRESS);
-      address = (cylinder * 24 * 2 + head * 24 + sector) * 256;
-      timeoutInNanosecs(&then, 500000);
-      addToTimerQueue([t = this](class callbackRecord *c) -> int {
-          printLog("INFO", "500us timeout 9350 disk read is ready\n");
-          t->statusRegister |= (DISK9350_STATUS_CONTROLLER_READY);
-          t->statusRegister &= ~(DISK9350_STATUS_OVERFLOW);
-          for (int i=0; i<256; i++) {
-            t->buffer[t->selectedBufferPage][i]=0;
-          }
-          t->bufferAddress = 0;
-          return 0;
-        }, then);      
+      machine->addEvent(this, DISK9350_EVENT_CLEARED, 0, latency.fixed(500000));
       return 0;
     case 5:
       // Read selected sector onto selected buffer page.
       printLog("INFO", "Reading from 9350 drive\n");
       statusRegister &= ~(DISK9350_STATUS_CONTROLLER_READY | DISK9350_STATUS_CRC_ERROR | DISK9350_STATUS_INVALID_SECTOR_ADDRESS);
       address = (cylinder * 24 * 2 + head * 24 + sector) * 256;
-      timeoutInNanosecs(&then, 1000000);
-      addToTimerQueue([t = this, address=address](class callbackRecord *c) -> int {
-          printLog("INFO", "10ms timeout 9350 disk read is ready\n");
-          t->statusRegister |= DISK9350_STATUS_CONTROLLER_READY;
-          t->drives[t->selectedDrive]->readSector(t->buffer[t->selectedBufferPage], address);
-          return 0;
-        }, then);      
+      machine->addEvent(this, DISK9350_EVENT_READ, transfers.submit(machine->ioWorkers, drives[selectedDrive], NULL, [d = drives[selectedDrive], address](char * data) -> int {
+            return d->readSector(data, address);
+          }), latency.transfer(sector, 1000000));
       return 0;
       // Write selected buffer page onto selected sector.
     case 6:
@@ -1117,38 +1436,16 @@ int IOController::Disk9350Device::exCom1(unsigned char data) {
       printLog("INFO", "Writing to 9350 drive\n");
       statusRegister &= ~(DISK9350_STATUS_CONTROLLER_READY | DISK9350_STATUS_CRC_ERROR | DISK9350_STATUS_INVALID_SECTOR_ADDRESS | DISK9350_STATUS_DRIVE_READY);
       address = (cylinder * 24 * 2 + head * 24 + sector) * 256;
-      timeoutInNanosecs(&then, 1000000);
-      addToTimerQueue([t = this, address=address](class callbackRecord *c) -> int {
-          int ret;
-          printLog("INFO", "10ms timeout 9350 disk write is ready\n"); 
-          ret = t->drives[t->selectedDrive]->writeSector(t->buffer[t->selectedBufferPage], address);
-          if (ret!=0) {
-            t->statusRegister |= DISK9350_STATUS_WRITE_PROTECT_ENABLE; 
-          }
-          t->statusRegister |= (DISK9350_STATUS_CONTROLLER_READY | DISK9350_STATUS_DRIVE_READY);
-          return 0;
-        }, then);      
+      machine->addEvent(this, DISK9350_EVENT_WRITE, transfers.submit(machine->ioWorkers, drives[selectedDrive], buffer[selectedBufferPage], [d = drives[selectedDrive], address](char * data) -> int {
+            return d->writeSector(data, address);
+          }), latency.transfer(sector, 1000000));
       return 0;
       // Restore selected drive.
     case 8:
       printLog("INFO", "Restoring drive %d\n", selectedDrive);
       statusRegister &= ~(DISK9350_STATUS_DRIVE_READY | DISK9350_STATUS_CONTROLLER_READY);
-      timeoutInNanosecs(&then, 10000000);
-      addToTimerQueue([t = this](class callbackRecord *c) -> int {
-          printLog("INFO", "10ms timeout 9350 restore drive is ready\n");
-          t->cylinder = 0;
-          t->statusRegister |= DISK9350_STATUS_DRIVE_READY;
-          return 0;
-        },
-        then);
-      timeoutInNanosecs(&then, 50000);
-      addToTimerQueue([t = this](class callbackRecord *c) -> int {
-          printLog("INFO", "50us controller timeout 9350 restore drive is ready\n");
-          t->cylinder = 0;
-          t->statusRegister |= DISK9350_STATUS_CONTROLLER_READY;
-          return 0;
-        },
-        then);      
+      machine->addEvent(this, DISK9350_EVENT_SEEK, 0, latency.seek(cylinder, 0, 10000000));
+      machine->addEvent(this, DISK9350_EVENT_SEEK_CONTROLLER, 0, latency.fixed(50000));
       return 0;
       // Select buffer page specified by bits 6,7.
     case 9:
@@ -1161,27 +1458,55 @@ int IOController::Disk9350Device::exCom1(unsigned char data) {
 }
 int IOController::Disk9350Device::exCom2(unsigned char data){
   // Select Cylinder number (0..312 octal)
-  struct timespec then;
   if (data > 0312) {
     statusRegister |= DISK9350_STATUS_COMMAND_ERROR;
     return 0; 
   }
   statusRegister &= ~(DISK9350_STATUS_DRIVE_READY | DISK9350_STATUS_CRC_ERROR | DISK9350_STATUS_INVALID_SECTOR_ADDRESS | DISK9350_STATUS_CONTROLLER_READY);
-  timeoutInNanosecs(&then, 1000000);
-  addToTimerQueue([t = this, data=data](class callbackRecord *c) -> int {
-      printLog("INFO", "10ms timeout 9350 disk seek, drive is ready new track is %d\n", t->cylinder); 
-      t->statusRegister |= DISK9350_STATUS_DRIVE_READY;
-      t->cylinder = data;
+  machine->addEvent(this, DISK9350_EVENT_SEEK, data, latency.seek(cylinder, data, 1000000));
+  machine->addEvent(this, DISK9350_EVENT_SEEK_CONTROLLER, data, latency.fixed(50000));
+  return 0;
+}
+
+int IOController::Disk9350Device::fire(int event, long arg) {
+  switch (event) {
+    case DISK9350_EVENT_DRIVE_READY:
+      printLog("INFO", "10us timeout 9350 drive select drive is ready\n");
+      statusRegister |= DISK9350_STATUS_DRIVE_READY | DISK9350_STATUS_CONTROLLER_READY;
       return 0;
-    }, then);  
-  timeoutInNanosecs(&then, 50000);
-  addToTimerQueue([t = this, data=data](class callbackRecord *c) -> int {
-      printLog("INFO", "50us timeout 9350 disk seek, controller is ready new track is %d\n", t->cylinder); 
-      t->statusRegister |= DISK9350_STATUS_CONTROLLER_READY;
-      t->cylinder = data;
+    case DISK9350_EVENT_CLEARED:
+      printLog("INFO", "500us timeout 9350 disk read is ready\n");
+      statusRegister |= (DISK9350_STATUS_CONTROLLER_READY);
+      statusRegister &= ~(DISK9350_STATUS_OVERFLOW);
+      for (int i=0; i<256; i++) {
+        buffer[selectedBufferPage][i]=0;
+      }
+      bufferAddress = 0;
       return 0;
-    }, then);       
-  return 0;
+    case DISK9350_EVENT_READ:
+      printLog("INFO", "10ms timeout 9350 disk read is ready\n");
+      transfers.finish(arg, buffer[selectedBufferPage]);
+      statusRegister |= DISK9350_STATUS_CONTROLLER_READY;
+      return 0;
+    case DISK9350_EVENT_WRITE:
+      printLog("INFO", "10ms timeout 9350 disk write is ready\n"); 
+      if (transfers.finish(arg, NULL)!=0) {
+        statusRegister |= DISK9350_STATUS_WRITE_PROTECT_ENABLE; 
+      }
+      statusRegister |= (DISK9350_STATUS_CONTROLLER_READY | DISK9350_STATUS_DRIVE_READY);
+      return 0;
+    case DISK9350_EVENT_SEEK:
+      cylinder = arg;
+      printLog("INFO", "10ms timeout 9350 disk seek, drive is ready new track is %d\n", cylinder); 
+      statusRegister |= DISK9350_STATUS_DRIVE_READY;
+      return 0;
+    case DISK9350_EVENT_SEEK_CONTROLLER:
+      cylinder = arg;
+      printLog("INFO", "50us timeout 9350 disk seek, controller is ready new track is %d\n", cylinder); 
+      statusRegister |= DISK9350_STATUS_CONTROLLER_READY;
+      return 0;
+  }
+  return 1;
 }
 int IOController::Disk9350Device::exCom3(unsigned char data){
   // Select Sector number bits 0..4. Select track bit 5.
@@ -1232,29 +1557,123 @@ int IOController::Disk9350Device::exTStop(){
   return 1;
 }
 
-int IOController::Disk9350Device::openFile (int drive, std::string fileName, bool wp) {
-  return drives[drive]->openFile(fileName, wp);
+int IOController::Disk9350Device::openFile (int drive, std::string fileName, bool wp, bool cow) {
+  int ret;
+  machine->ioWorkers->drain(drives[drive]);
+  ret = drives[drive]->openFile(fileName, wp, cow);
+  updateDriveStatus();
+  return ret;
 }
 
 void IOController::Disk9350Device::closeFile (int drive) {
+  machine->ioWorkers->drain(drives[drive]);
   drives[drive]->closeFile();
+  updateDriveStatus();
+}
+
+bool IOController::Disk9350Device::isOnline (int drive) {
+  return drives[drive]->isOnline();
+}
+
+SectorCache * IOController::Disk9350Device::getCache (int drive) {
+  return &drives[drive]->cache;
+}
+
+// The disk contents stay in the attached files, only their names and any
+// copy-on-write sectors are saved. A sector read in progress is saved with
+// the data read, a write has reached the drive when the state is saved.
+void IOController::Disk9350Device::saveState(class StateFile * state) {
+  IODevice::saveState(state);
+  state->putInt(selectedDrive);
+  state->putInt(selectedBufferPage);
+  state->putBytes(buffer, sizeof(buffer));
+  state->putInt(bufferAddress);
+  state->putInt(head);
+  state->putInt(sector);
+  state->putInt(cylinder);
+  for (int i=0; i<4; i++) {
+    machine->ioWorkers->drain(drives[i]);
+    state->putBool(drives[i]->isOnline());
+    state->putString(drives[i]->getFileName());
+    state->putBool(drives[i]->isWriteProtected());
+    state->putBool(drives[i]->cache.isCopyOnWrite());
+    drives[i]->cache.saveDirtySectors(state);
+  }
+  transfers.saveState(state);
+  machine->saveEvents(this, state);
+}
+
+int IOController::Disk9350Device::loadState(class StateFile * state) {
+  int ret = IODevice::loadState(state);
+  selectedDrive = state->getInt() & 3;
+  selectedBufferPage = state->getInt() & 15;
+  state->getBytes(buffer, sizeof(buffer));
+  bufferAddress = state->getInt();
+  head = state->getInt();
+  sector = state->getInt();
+  cylinder = state->getInt();
+  for (int i=0; i<4; i++) {
+    bool online = state->getBool();
+    std::string name = state->getString();
+    bool wp = state->getBool();
+    bool cow = state->getVersion() >= 2 ? state->getBool() : false;
+    if (state->failed()) break;
+    if (online) {
+      // Leave the drive alone if the same file is already attached.
+      if (!drives[i]->isOnline() || drives[i]->getFileName() != name || drives[i]->isWriteProtected() != wp || drives[i]->cache.isCopyOnWrite() != cow) {
+        if (openFile(i, name, wp, cow) || !drives[i]->isOnline()) ret = STATE_MEDIA_ERROR;
+      }
+    } else if (drives[i]->isOnline()) {
+      closeFile(i);
+    }
+    if (state->getVersion() >= 2) {
+      drives[i]->cache.loadDirtySectors(state);
+    }
+  }
+  updateDriveStatus();
+  transfers.clear();
+  if (state->getVersion() >= 3 && (transfers.loadState(state) != STATE_OK || machine->loadEvents(this, state) != STATE_OK)) return STATE_BAD_FORMAT;
+  return state->failed() ? STATE_BAD_FORMAT : ret;
 }
 
-IOController::Disk9350Device::Disk9350Device() {
+IOController::Disk9350Device::Disk9350Device() : latency(270000, 15000000, 25000000, 24) {
   statusRegister = 0;
   drives[0] = new Disk9350Drive();
   drives[1] = new Disk9350Drive();
   drives[2] = new Disk9350Drive();
   drives[3] = new Disk9350Drive();
+  selectedDrive = 0;
+  selectedBufferPage = 0;
+  bufferAddress = 0;
+  head = 0;
+  sector = 0;
+  cylinder = 0;
+  updateDriveStatus();
 }
 
-int IOController::Disk9350Device::Disk9350Drive::openFile (std::string fileName, bool wp) {
+IOController::Disk9350Device::Disk9350Drive::Disk9350Drive() : cache(24) {
+  file = NULL;
+  writeProtected = false;
+}
+
+int IOController::Disk9350Device::Disk9350Drive::openFile (std::string fileName, bool wp, bool cow) {
   // try to open file. If it fails to open create an empty file and attach it insted.
   struct stat buffer;
   if (file != NULL) {
     closeFile();
   }
-  writeProtected = wp;
+  // Writes to an overlay never reach the image, so it is always writable.
+  writeProtected = wp && !cow;
+  this->fileName = fileName;
+  if (cow) {
+    // The image is shared, it is never written and has to exist.
+    file = fopen (fileName.c_str(), "r");
+    if (file == NULL) return 1;
+    printLog("INFO", "Open file %s copy-on-write.\n", fileName.c_str());
+    cache.setFile(file);
+    cache.setCopyOnWrite(true);
+    return 0;
+  }
   if (stat (fileName.c_str(), &buffer) == 0) {
     printLog("INFO", "Open old file %s.\n", fileName.c_str());
     file = fopen (fileName.c_str(), "w");
@@ -1268,24 +1687,29 @@ int IOController::Disk9350Device::Disk9350Drive::openFile (std::string fileName,
     }
     rewind(file);
   }
+  cache.setFile(file);
   return 0;
 }
 
 void  IOController::Disk9350Device::Disk9350Drive::closeFile() {
+  cache.setFile(NULL);
   fclose(file);
   file = NULL;
 }
 
 int IOController::Disk9350Device::Disk9350Drive::readSector(char * buffer, long address) {
-  fseek(file, address, SEEK_SET);
-  fread(buffer, 1, 256, file);
-  return 0;
+  return cache.readSector(buffer, address);
 }
 
 int IOController::Disk9350Device::Disk9350Drive::writeSector(char * buffer, long address) {
   if (writeProtected) return 1;
+  if (cache.isCopyOnWrite()) {
+    cache.writeDirtySector(buffer, address);
+    return 0;
+  }
   fseek(file, address, SEEK_SET);
   fwrite(buffer, 1, 256, file);  
+  cache.updateSector(buffer, address);
   return 0;
 }
 
@@ -1297,18 +1721,24 @@ bool IOController::Disk9350Device::Disk9350Drive::isWriteProtected() {
   return writeProtected;
 }
 
+std::string IOController::Disk9350Device::Disk9350Drive::getFileName() {
+  return fileName;
+}
+
+void IOController::Disk9370Device::updateDriveStatus () {
+  driveStatusMask = DISK9370_STATUS_DRIVE_ONLINE | DISK9370_STATUS_WRITE_PROTECT_ENABLE;
+  driveStatus = 0;
+  if (drives[selectedDrive]->isOnline()) {
+    driveStatus |= DISK9370_STATUS_DRIVE_ONLINE;
+  }
+  if (drives[selectedDrive]->isWriteProtected()) {
+    driveStatus |= DISK9370_STATUS_WRITE_PROTECT_ENABLE;
+  }
+}
+
 unsigned char IOController::Disk9370Device::input () {
   if (status==1) {
-    if (drives[selectedDrive]->isOnline()) {
-      statusRegister |= DISK9370_STATUS_DRIVE_ONLINE;
-    } else {
-      statusRegister &= ~DISK9370_STATUS_DRIVE_ONLINE;
-    }
-    if (drives[selectedDrive]->isWriteProtected()) {
-      statusRegister |= DISK9370_STATUS_WRITE_PROTECT_ENABLE; 
-    } else {
-      statusRegister &= ~DISK9370_STATUS_WRITE_PROTECT_ENABLE;
-    }     
+    statusRegister = statusByte();
     return statusRegister;
   } else if (status == 0) {
     char tmp;
@@ -1321,6 +1751,22 @@ unsigned char IOController::Disk9370Device::input () {
     return 001;
   }
 }
+int IOController::Disk9370Device::readBlock(unsigned char * data, int length) {
+  if (status == 0) {
+    printLog("INFO", "Reading %d bytes from buffer address (%d) in selectedBufferPage=%d\n", length, bufferAddress, selectedBufferPage);
+    readFromBufferPage(data, length, buffer[selectedBufferPage], &bufferAddress);
+  } else {
+    memset(data, input(), length);
+  }
+  return 0;
+}
+
+int IOController::Disk9370Device::writeBlock(const unsigned char * data, int length) {
+  printLog("INFO", "9370 Writing %d bytes to address %03o in bufferPage %d\n", length, bufferAddress, selectedBufferPage);
+  writeToBufferPage(data, length, buffer[selectedBufferPage], &bufferAddress);
+  return 0;
+}
+
 int IOController::Disk9370Device::exWrite(unsigned char data) {
   printLog("INFO", "9370 Writing data %03o to address %03o in bufferPage %d\n", data&0xff, bufferAddress, selectedBufferPage);
   buffer[selectedBufferPage][bufferAddress]=data;
@@ -1328,8 +1774,14 @@ int IOController::Disk9370Device::exWrite(unsigned char data) {
   if (bufferAddress==256) bufferAddress=0;  
   return 0;
 } 
+// Events of the 9370 controller. A read, write or format ends with the
+// transfer given as argument.
+#define DISK9370_EVENT_READY 0
+#define DISK9370_EVENT_READ 1
+#define DISK9370_EVENT_WRITE 2
+#define DISK9370_EVENT_FORMAT 3
+
 int IOController::Disk9370Device::exCom1(unsigned char data){
-  struct timespec then;
   long address; 
   switch (data & 0xf) {
     case 0: // Master clear
@@ -1344,14 +1796,9 @@ int IOController::Disk9370Device::exCom1(unsigned char data){
       statusRegister &= ~(DISK9370_STATUS_SECTOR_NOT_FOUND | DISK9370_STATUS_SECTOR_NOT_FOUND);
       statusRegister |= (DISK9370_STATUS_DRIVE_BUSY | DISK9370_STATUS_DATA_XFER_IN_PROGRESS);
       address = (cylinder * 24 * 20 + head * 24 + sector) * 256;
-      timeoutInNanosecs(&then, 1000000);
-      addToTimerQueue([t = this, address=address](class callbackRecord *c) -> int {
-          printLog("INFO", "10ms timeout 9370 disk read is ready on drive %d\n", t->selectedDrive);
-          t->statusRegister &= ~(DISK9370_STATUS_DRIVE_BUSY | DISK9370_STATUS_DATA_XFER_IN_PROGRESS);
-          t->drives[t->selectedDrive]->readSector(t->buffer[t->selectedBufferPage], address);
-          printBuffer(t->buffer[t->selectedBufferPage]);
-          return 0;
-        }, then);      
+      machine->addEvent(this, DISK9370_EVENT_READ, transfers.submit(machine->ioWorkers, drives[selectedDrive], NULL, [d = drives[selectedDrive], address](char * data) -> int {
+            return d->readSector(data, address);
+          }), latency.transfer(sector, 1000000));
       return 0;
     case 2: // Disk write
     case 3: // Disk write verify. Same as 2 since we are not checking CRC in the simulator.
@@ -1359,56 +1806,31 @@ int IOController::Disk9370Device::exCom1(unsigned char data){
       statusRegister &= ~(DISK9370_STATUS_SECTOR_NOT_FOUND | DISK9370_STATUS_SECTOR_NOT_FOUND);
       statusRegister |= (DISK9370_STATUS_DRIVE_BUSY | DISK9370_STATUS_DATA_XFER_IN_PROGRESS);
       address = (cylinder * 24 * 20 + head * 24 + sector) * 256;
-      timeoutInNanosecs(&then, 1000000);
-      addToTimerQueue([t = this, address=address](class callbackRecord *c) -> int {
-          int ret;
-          printLog("INFO", "10ms timeout 9370 disk write is ready on drive %d\n", t->selectedDrive); 
-          printBuffer(t->buffer[t->selectedBufferPage]);
-          ret = t->drives[t->selectedDrive]->writeSector(t->buffer[t->selectedBufferPage], address);
-          if (ret!=0) {
-            t->statusRegister |= DISK9370_STATUS_WRITE_PROTECT_ENABLE; 
-          }
-        t->statusRegister &= ~(DISK9370_STATUS_DRIVE_BUSY | DISK9370_STATUS_DATA_XFER_IN_PROGRESS);
-          return 0;
-        }, then);      
+      printBuffer(buffer[selectedBufferPage]);
+      machine->addEvent(this, DISK9370_EVENT_WRITE, transfers.submit(machine->ioWorkers, drives[selectedDrive], buffer[selectedBufferPage], [d = drives[selectedDrive], address](char * data) -> int {
+            return d->writeSector(data, address);
+          }), latency.transfer(sector, 1000000));
       return 0;
     case 4: // Restore selected drive
-      cylinder = 0;
       printLog("INFO", "Restoring drive %d\n", selectedDrive);
       statusRegister |= DISK9370_STATUS_DRIVE_BUSY;
-      timeoutInNanosecs(&then, 1000000);
-      addToTimerQueue([t = this](class callbackRecord *c) -> int {
-          printLog("INFO", "1ms timeout 9350 restore drive is ready\n");
-          t->statusRegister &= ~DISK9370_STATUS_DRIVE_BUSY;
-          return 0;
-        },
-        then);
-
+      machine->addEvent(this, DISK9370_EVENT_READY, 0, latency.seek(cylinder, 0, 1000000));
+      cylinder = 0;
       return 0;
     case 5: // Select Physical Drive as per contents of the EX COM2 register 0-7
       selectedDrive = tmp & 0x7;
+      updateDriveStatus();
       printLog("INFO", "Selecting drive %d\n", 0x7&tmp);
       statusRegister |= DISK9370_STATUS_DRIVE_BUSY;
-      timeoutInNanosecs(&then, 10000);
-      addToTimerQueue([t = this](class callbackRecord *c) -> int {
-          printLog("INFO", "10us timeout 9370 drive select drive is ready\n");
-          t->statusRegister &= ~DISK9370_STATUS_DRIVE_BUSY;
-          return 0;
-        },
-        then);
+      machine->addEvent(this, DISK9370_EVENT_READY, 0, latency.fixed(10000));
       return 0;
     case 6: // Select cylinder as per contents of EX COM2 Register 0-312 octal (9374 - Sets upper 8 bits of cylinder address)
     // Need to simulate seek time here.
+      machine->addEvent(this, DISK9370_EVENT_READY, 0, latency.seek(cylinder, tmp, 10000000));
       cylinder = tmp;
       printLog("INFO", "9370: Selecting cylinder %d\n", cylinder);
       statusRegister &= ~(DISK9370_STATUS_SECTOR_NOT_FOUND | DISK9370_STATUS_SECTOR_NOT_FOUND);
       statusRegister |= (DISK9370_STATUS_DRIVE_BUSY);
-      timeoutInNanosecs(&then, 10000000);
-      addToTimerQueue([t = this](class callbackRecord *c) -> int {
-          printLog("INFO", "10ms timeout 9370 disk cylinder select %d\n", t->selectedDrive); 
-          t->statusRegister &= ~(DISK9370_STATUS_DRIVE_BUSY);
-          return 0;
-        }, then);       
       return 0;
     case 7: // Verify Drive type 001 -> Datapoint 9370, 020 -> Datapoint 9374 ???? What is this??
       status=2;
@@ -1417,25 +1839,18 @@ int IOController::Disk9370Device::exCom1(unsigned char data){
       printLog("INFO", "Formatting a track on a 9370 drive %d cylinder=%d head=%d sector=%d\n", selectedDrive, cylinder, head, sector);
       statusRegister &= ~(DISK9370_STATUS_SECTOR_NOT_FOUND);
       statusRegister |= (DISK9370_STATUS_DRIVE_BUSY | DISK9370_STATUS_DATA_XFER_IN_PROGRESS);
-      timeoutInNanosecs(&then, 3000000);
       address = (cylinder * 24 * 20 + head * 24) * 256;
       printLog("INFO", "To format cylinder=%d head=%d address=%08X\n", cylinder, head, address);
-      addToTimerQueue([t = this, a=address](class callbackRecord *c) -> int {
-        int ret;
-        long address=a;
-        printLog("INFO", "3ms timeout 9370 disk track format is ready on drive %d address %08X\n", t->selectedDrive,address);
-        memset(t->buffer[t->selectedBufferPage],0377,256);   
-        for (auto i=0; i<24; i++) {  
-          printLog("INFO", "Formatting address=%08X\n",address);
-          ret = t->drives[t->selectedDrive]->writeSector(t->buffer[t->selectedBufferPage], address);
-          address+=256;
-        }
-        if (ret!=0) {
-          t->statusRegister |= DISK9370_STATUS_WRITE_PROTECT_ENABLE; 
-        }
-        t->statusRegister &= ~(DISK9370_STATUS_DRIVE_BUSY | DISK9370_STATUS_DATA_XFER_IN_PROGRESS);
-          return 0;
-        }, then);      
+      machine->addEvent(this, DISK9370_EVENT_FORMAT, transfers.submit(machine->ioWorkers, drives[selectedDrive], NULL, [d = drives[selectedDrive], a=address](char * formatted) -> int {
+            int ret = 0;
+            long address=a;
+            memset(formatted, 0377, 256);
+            for (auto i=0; i<24; i++) {  
+              ret = d->writeSector(formatted, address);
+              address+=256;
+            }
+            return ret;
+          }), latency.track(3000000));
       return 0;
     case 9: // Select head as per contents of EX COM2 Register 0-19 decimal 0.-23 octal (9364 - 0-17 octal)
       if (tmp > 19) {
@@ -1469,6 +1884,33 @@ int IOController::Disk9370Device::exCom1(unsigned char data){
       return 1; 
   }
 }
+int IOController::Disk9370Device::fire(int event, long arg) {
+  switch (event) {
+    case DISK9370_EVENT_READY:
+      printLog("INFO", "9370 drive %d is ready\n", selectedDrive);
+      statusRegister &= ~DISK9370_STATUS_DRIVE_BUSY;
+      return 0;
+    case DISK9370_EVENT_READ:
+      printLog("INFO", "10ms timeout 9370 disk read is ready on drive %d\n", selectedDrive);
+      transfers.finish(arg, buffer[selectedBufferPage]);
+      statusRegister &= ~(DISK9370_STATUS_DRIVE_BUSY | DISK9370_STATUS_DATA_XFER_IN_PROGRESS);
+      printBuffer(buffer[selectedBufferPage]);
+      return 0;
+    case DISK9370_EVENT_WRITE:
+    case DISK9370_EVENT_FORMAT:
+      printLog("INFO", "9370 disk %s is ready on drive %d\n", event == DISK9370_EVENT_WRITE ? "write" : "track format", selectedDrive); 
+      if (event == DISK9370_EVENT_FORMAT) {
+        memset(buffer[selectedBufferPage],0377,256);   
+      }
+      if (transfers.finish(arg, NULL)!=0) {
+        statusRegister |= DISK9370_STATUS_WRITE_PROTECT_ENABLE; 
+      }
+      statusRegister &= ~(DISK9370_STATUS_DRIVE_BUSY | DISK9370_STATUS_DATA_XFER_IN_PROGRESS);
+      return 0;
+  }
+  return 1;
+}
+
 int IOController::Disk9370Device::exCom2(unsigned char data){
   printLog("INFO", "Disk 9370 ExCom2 storing %03o data into tmp\n", data);
   tmp = data;
@@ -1520,16 +1962,89 @@ int IOController::Disk9370Device::exTStop(){
   return 1;
 }
 
-int IOController::Disk9370Device::openFile (int drive, std::string fileName, bool wp) {
-  return drives[drive]->openFile(fileName, wp);
+int IOController::Disk9370Device::openFile (int drive, std::string fileName, bool wp, bool cow) {
+  int ret;
+  machine->ioWorkers->drain(drives[drive]);
+  ret = drives[drive]->openFile(fileName, wp, cow);
+  updateDriveStatus();
+  return ret;
 }
 
 void IOController::Disk9370Device::closeFile (int drive) {
+  machine->ioWorkers->drain(drives[drive]);
   drives[drive]->closeFile();
+  updateDriveStatus();
+}
+
+bool IOController::Disk9370Device::isOnline (int drive) {
+  return drives[drive]->isOnline();
+}
+
+SectorCache * IOController::Disk9370Device::getCache (int drive) {
+  return &drives[drive]->cache;
+}
+
+// The disk contents stay in the attached files, only their names and any
+// copy-on-write sectors are saved. A sector read in progress is saved with
+// the data read, a write has reached the drive when the state is saved.
+void IOController::Disk9370Device::saveState(class StateFile * state) {
+  IODevice::saveState(state);
+  state->putInt(selectedDrive);
+  state->putInt(selectedBufferPage);
+  state->putBytes(buffer, sizeof(buffer));
+  state->putInt(bufferAddress);
+  state->putInt(head);
+  state->putInt(sector);
+  state->putInt(cylinder);
+  state->putInt(tmp);
+  for (int i=0; i<8; i++) {
+    machine->ioWorkers->drain(drives[i]);
+    state->putBool(drives[i]->isOnline());
+    state->putString(drives[i]->getFileName());
+    state->putBool(drives[i]->isWriteProtected());
+    state->putBool(drives[i]->cache.isCopyOnWrite());
+    drives[i]->cache.saveDirtySectors(state);
+  }
+  transfers.saveState(state);
+  machine->saveEvents(this, state);
+}
+
+int IOController::Disk9370Device::loadState(class StateFile * state) {
+  int ret = IODevice::loadState(state);
+  selectedDrive = state->getInt() & 7;
+  selectedBufferPage = state->getInt() & 15;
+  state->getBytes(buffer, sizeof(buffer));
+  bufferAddress = state->getInt();
+  head = state->getInt();
+  sector = state->getInt();
+  cylinder = state->getInt();
+  tmp = state->getInt();
+  for (int i=0; i<8; i++) {
+    bool online = state->getBool();
+    std::string name = state->getString();
+    bool wp = state->getBool();
+    bool cow = state->getVersion() >= 2 ? state->getBool() : false;
+    if (state->failed()) break;
+    if (online) {
+      // Leave the drive alone if the same file is already attached.
+      if (!drives[i]->isOnline() || drives[i]->getFileName() != name || drives[i]->isWriteProtected() != wp || drives[i]->cache.isCopyOnWrite() != cow) {
+        if (openFile(i, name, wp, cow) || !drives[i]->isOnline()) ret = STATE_MEDIA_ERROR;
+      }
+    } else if (drives[i]->isOnline()) {
+      closeFile(i);
+    }
+    if (state->getVersion() >= 2) {
+      drives[i]->cache.loadDirtySectors(state);
+    }
+  }
+  updateDriveStatus();
+  transfers.clear();
+  if (state->getVersion() >= 3 && (transfers.loadState(state) != STATE_OK || machine->loadEvents(this, state) != STATE_OK)) return STATE_BAD_FORMAT;
+  return state->failed() ? STATE_BAD_FORMAT : ret;
 }
 
 
-IOController::Disk9370Device::Disk9370Device() {
+IOController::Disk9370Device::Disk9370Device() : latency(240000, 6000000, 16666666, 24) {
   statusRegister = 0;
   drives[0] = new Disk9370Drive();
   drives[1] = new Disk9370Drive();
@@ -1539,16 +2054,34 @@ IOController::Disk9370Device::Disk9370Device() {
   drives[5] = new Disk9370Drive();
   drives[6] = new Disk9370Drive();
   drives[7] = new Disk9370Drive();  
+  selectedDrive = 0;
+  updateDriveStatus();
 }
 
 
-int IOController::Disk9370Device::Disk9370Drive::openFile (std::string fileName, bool wp) {
+IOController::Disk9370Device::Disk9370Drive::Disk9370Drive() : cache(24) {
+  file = NULL;
+  writeProtected = false;
+}
+
+int IOController::Disk9370Device::Disk9370Drive::openFile (std::string fileName, bool wp, bool cow) {
   // try to open file. If it fails to open create an empty file and attach it insted.
   struct stat buffer;
   if (file != NULL) {
     closeFile();
   }
-  writeProtected = wp;
+  // Writes to an overlay never reach the image, so it is always writable.
+  writeProtected = wp && !cow;
+  this->fileName = fileName;
+  if (cow) {
+    // The image is shared, it is never written and has to exist.
+    file = fopen (fileName.c_str(), "r");
+    if (file == NULL) return 1;
+    printLog("INFO", "Open file %s copy-on-write.\n", fileName.c_str());
+    cache.setFile(file);
+    cache.setCopyOnWrite(true);
+    return 0;
+  }
   if (stat (fileName.c_str(), &buffer) == 0) {
     printLog("INFO", "Open old file %s.\n", fileName.c_str());
     file = fopen (fileName.c_str(), "r+");
@@ -1565,6 +2098,7 @@ int IOController::Disk9370Device::Disk9370Drive::openFile (std::string fileName,
     //fclose(file);
     //file = fopen (fileName.c_str(), "r+");
   }
+  cache.setFile(file);
   return 0;
 }
 
@@ -1572,22 +2106,24 @@ void  IOController::Disk9370Device::Disk9370Drive::closeFile() {
   /*for (int i=0; i < 203*20*24; i++) {
     fwrite(diskBuffer+i*256, 1, 256, file); 
   }*/
+  cache.setFile(NULL);
   fclose(file);
   file = NULL;
 }
 
 int IOController::Disk9370Device::Disk9370Drive::readSector(char * buffer, long address) {
-  fseek(file, address, SEEK_SET);
-  fread(buffer, 1, 256, file);
-  //memcpy(buffer, diskBuffer+address, 256);
-  return 0;
+  return cache.readSector(buffer, address);
 }
 
 int IOController::Disk9370Device::Disk9370Drive::writeSector(char * buffer, long address) {
   if (writeProtected) return 1;
+  if (cache.isCopyOnWrite()) {
+    cache.writeDirtySector(buffer, address);
+    return 0;
+  }
   fseek(file, address, SEEK_SET);
   fwrite(buffer, 1, 256, file); 
-  //memcpy(diskBuffer+address, buffer, 256);
+  cache.updateSector(buffer, address);
   return 0;
 }
 
@@ -1599,6 +2135,10 @@ bool IOController::Disk9370Device::Disk9370Drive::isWriteProtected() {
   return writeProtected;
 }
 
+std::string IOController::Disk9370Device::Disk9370Drive::getFileName() {
+  return fileName;
+}
+
 
 unsigned char IOController::Disk9390Device::input () {
   if (status) {
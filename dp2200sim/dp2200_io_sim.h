@@ -2,15 +2,17 @@
 #ifndef _DP2200_IO_SIM_
 #define _DP2200_IO_SIM_
 
+#include <array>
+#include <map>
+#include <memory>
 #include <vector>
 #include "cassetteTape.h"
+#include "EventOwner.h"
 #include "FloppyDrive.h"
-#include "dp2200Window.h"
-
-class callbackRecord * addToTimerQueue(std::function<int(class callbackRecord *)>, struct timespec);
-void timeoutInNanosecs (struct timespec *, long);
-void removeTimerCallback(class callbackRecord * c);
-
+#include "SectorCache.h"
+#include "IOWorkerPool.h"
+#include "LatencyModel.h"
+#include "StateFile.h"
 
 
 #define CASSETTE_STATUS_DECK_READY (1 << 0)
@@ -62,18 +64,29 @@ void removeTimerCallback(class callbackRecord * c);
 #define DISK9370_STATUS_SECTOR_NOT_FOUND (1 << 6)
 #define DISK9370_STATUS_BUFFER_PARITY_ERROR (1 << 7)
 
-extern class dp2200Window * dpw;
-
 class IOController {
-  class IODevice {
+  class IODevice : public EventOwner {
+    friend class IOController;
     protected:
+    // The machine the device schedules its events on.
+    class Machine * machine;
     unsigned char statusRegister, dataRegister;
+    // Status bits that follow the selected drive (online, write protect). They are
+    // kept up to date when the drive selection or the attached media changes so
+    // that a status poll does not have to ask the drive.
+    unsigned char driveStatus, driveStatusMask;
     int status;
+    unsigned char statusByte ();
     public:
+    IODevice();
     virtual unsigned char input () = 0;
     void exStatus ();
     void exData ();
     virtual int exWrite(unsigned char data) = 0; 
+    // Transfer length bytes as if input() or exWrite() was called length times.
+    // Devices with buffer pages override these to copy whole spans at once.
+    virtual int readBlock(unsigned char * data, int length);
+    virtual int writeBlock(const unsigned char * data, int length);
     virtual int exCom1(unsigned char data) = 0;
     virtual int exCom2(unsigned char data) = 0;
     virtual int exCom3(unsigned char data) = 0;
@@ -89,6 +102,36 @@ class IOController {
     virtual int exSB() = 0;
     virtual int exRewind() = 0;
     virtual int exTStop() = 0;
+    // Devices with timed operations override this.
+    virtual int fire(int event, long arg);
+    // The registers every device has. Devices with more state override these
+    // and call them first.
+    virtual void saveState(class StateFile * state);
+    virtual int loadState(class StateFile * state);
+  };
+
+  // Sectors read or written by an I/O worker while a disk device waits for the
+  // operation to end in simulated time. The event ending the operation has the
+  // number of its transfer as argument.
+  class Transfers {
+    struct transfer {
+      std::shared_future<int> done;
+      std::shared_ptr<std::array<char, 256>> data;
+    };
+    std::map<long, struct transfer> pending;
+    long next;
+    public:
+    Transfers();
+    // Run work on workers, as a job for key, with a sector buffer holding a copy
+    // of data, if not NULL. Returns the number of the transfer.
+    long submit(class IOWorkerPool * workers, const void * key, const char * data, std::function<int(char *)> work);
+    // Wait for the transfer and forget it. data, if not NULL, gets the sector
+    // buffer. Returns what work returned.
+    int finish(long number, char * data);
+    void clear();
+    // Transfers in progress are waited for and saved with their results.
+    void saveState(class StateFile * state);
+    int loadState(class StateFile * state);
   };
 
   class CassetteDevice : public virtual IODevice  {
@@ -99,14 +142,15 @@ class IOController {
     bool forward;
     bool stopAtGap;
     void readFromTape ();
-    std::vector<class callbackRecord *>outStandingCallbacks;
-    void removeFromOutstandCallbacks (class callbackRecord *);
-    void removeAllCallbacks();
+    // Read the next byte as the head reaches it. Returns false when the cassette is gone.
+    bool readNextByte (const char * when, int * endOfTape);
     void printStatus(const char *);
     const char * endOfTapeStrings[3]={"Normal", "End of tape", "Cassette not in place"};
     public:
     CassetteTape * tapeDrive[2];
     unsigned char input ();
+    int readBlock(unsigned char * data, int length);
+    int writeBlock(const unsigned char * data, int length);
     int exWrite(unsigned char data); 
     int exCom1(unsigned char data);
     int exCom2(unsigned char data);
@@ -123,16 +167,21 @@ class IOController {
     int exSB();
     int exRewind();
     int exTStop();
+    int fire(int event, long arg);
     bool openFile (int, std::string fileName, bool writeProtect);
     void closeFile (int);
     std::string getFileName (int);
     bool loadBoot (std::function<void(int address, unsigned char)> writeMem);
+    void saveState(class StateFile * state);
+    int loadState(class StateFile * state);
     CassetteDevice();
   };
 
     class ScreenKeyboardDevice : public virtual IODevice  {
     bool incrementXOnWrite;
     bool loadingFont;  
+    // Updates the lights kept in the CPU and calls onLights of the machine if they changed.
+    void setLights(bool keyboard, bool display);
     public:
     unsigned char input ();
     int exWrite(unsigned char data); 
@@ -153,6 +202,8 @@ class IOController {
     int exTStop();
     ScreenKeyboardDevice();
     void updateKbd(int);
+    void saveState(class StateFile * state);
+    int loadState(class StateFile * state);
   };
 
 
@@ -232,8 +283,13 @@ class IOController {
     char buffer[4][256];
     int bufferAddress;
     class FloppyDrive * floppyDrives[4];
+    std::shared_future<int> pendingWriteBack[4];
+    void updateDriveStatus();
     public:
+    LatencyModel latency;
     unsigned char input ();
+    int readBlock(unsigned char * data, int length);
+    int writeBlock(const unsigned char * data, int length);
     int exWrite(unsigned char data); 
     int exCom1(unsigned char data);
     int exCom2(unsigned char data);
@@ -250,8 +306,11 @@ class IOController {
     int exSB();
     int exRewind();
     int exTStop();
+    int fire(int event, long arg);
     int openFile (int, std::string fileName, bool, bool);
     void closeFile (int);    
+    void saveState(class StateFile * state);
+    int loadState(class StateFile * state);
     FloppyDevice();
   };
 
@@ -262,12 +321,15 @@ class IOController {
       FILE * file;
       bool writeProtected;
       public:
-      int openFile (std::string fileName, bool writeProtected);
+      SectorCache cache;
+      Disk9350Drive();
+      int openFile (std::string fileName, bool writeProtected, bool copyOnWrite);
       void closeFile();
       int readSector(char * buffer, long address);
       int writeSector(char * buffer, long address); 
       bool isWriteProtected();
       bool isOnline();
+      std::string getFileName();
     };
 
     int selectedDrive;
@@ -278,11 +340,18 @@ class IOController {
     int sector;
     int cylinder;
     class Disk9350Drive * drives[4];
+    class Transfers transfers;
+    void updateDriveStatus();
 
     public:
+    LatencyModel latency;
     unsigned char input ();
-    int openFile(int drive, std::string fileName, bool wp);
+    int readBlock(unsigned char * data, int length);
+    int writeBlock(const unsigned char * data, int length);
+    int openFile(int drive, std::string fileName, bool wp, bool cow);
     void closeFile (int drive);
+    bool isOnline (int drive);
+    SectorCache * getCache (int drive);
     int exWrite(unsigned char data); 
     int exCom1(unsigned char data);
     int exCom2(unsigned char data);
@@ -299,6 +368,9 @@ class IOController {
     int exSB();
     int exRewind();
     int exTStop();
+    int fire(int event, long arg);
+    void saveState(class StateFile * state);
+    int loadState(class StateFile * state);
     Disk9350Device();
   };
 
@@ -310,12 +382,15 @@ class IOController {
       bool writeProtected;
       //unsigned char diskBuffer [203*20*24*256];
       public:
-      int openFile (std::string fileName, bool writeProtected);
+      SectorCache cache;
+      Disk9370Drive();
+      int openFile (std::string fileName, bool writeProtected, bool copyOnWrite);
       void closeFile();
       int readSector(char * buffer, long address);
       int writeSector(char * buffer, long address);
       bool isWriteProtected();
       bool isOnline();       
+      std::string getFileName();
     };
     int tmp;
     int selectedDrive;
@@ -326,10 +401,17 @@ class IOController {
     int sector;
     int cylinder;
     class Disk9370Drive * drives[8];    
+    class Transfers transfers;
+    void updateDriveStatus();
     public:
-    int openFile(int drive, std::string fileName, bool wp);
+    LatencyModel latency;
+    int openFile(int drive, std::string fileName, bool wp, bool cow);
     void closeFile (int drive);    
+    bool isOnline (int drive);
+    SectorCache * getCache (int drive);
     unsigned char input ();
+    int readBlock(unsigned char * data, int length);
+    int writeBlock(const unsigned char * data, int length);
     int exWrite(unsigned char data); 
     int exCom1(unsigned char data);
     int exCom2(unsigned char data);
@@ -346,6 +428,9 @@ class IOController {
     int exSB();
     int exRewind();
     int exTStop();
+    int fire(int event, long arg);
+    void saveState(class StateFile * state);
+    int loadState(class StateFile * state);
     Disk9370Device();
   };  
 
@@ -372,10 +457,42 @@ class IOController {
   };
 
 
-  class IODevice * dev[256];
+  // One record per I/O address with direct pointers to the member functions of the
+  // device living there. exAdr selects the record used by the following
+  // instructions. Status reads of devices with inlineStatus set are answered from
+  // the status byte without calling the device. Only status 1 is answered so,
+  // other modes, like the 9370 drive type, are left to the device.
+  struct dispatchRecord {
+    bool supported;
+    bool inlineStatus;
+    class IODevice * device;
+    void * object;
+    unsigned char (*input)(void *);
+    int (*readBlock)(void *, unsigned char *, int);
+    int (*exWrite)(void *, unsigned char);
+    int (*exCom1)(void *, unsigned char);
+    int (*exCom2)(void *, unsigned char);
+    int (*exCom3)(void *, unsigned char);
+    int (*exCom4)(void *, unsigned char);
+  };
+  struct dispatchRecord dispatch[256];
+  struct dispatchRecord * current;
   int ioAddress; 
-  std::vector<unsigned char> supportedDevices;
-  bool isDeviceSupported(unsigned char address);
+  template <class D> void addDevice(unsigned char address, D * device, bool inlineStatus);
+  template <class D> static unsigned char inputThunk(void * d);
+  template <class D> static int readBlockThunk(void * d, unsigned char * data, int length);
+  template <class D> static int exWriteThunk(void * d, unsigned char data);
+  template <class D> static int exCom1Thunk(void * d, unsigned char data);
+  template <class D> static int exCom2Thunk(void * d, unsigned char data);
+  template <class D> static int exCom3Thunk(void * d, unsigned char data);
+  template <class D> static int exCom4Thunk(void * d, unsigned char data);
+  // The section each device is saved in. Memory buffers and disk images are compressed.
+  struct stateRecord {
+    const char * tag;
+    class IODevice * device;
+    bool compressed;
+  };
+  std::vector<struct stateRecord> stateDevices();
   public:
   class CassetteDevice * cassetteDevice;
   class ScreenKeyboardDevice * screenKeyboardDevice;
@@ -386,8 +503,13 @@ class IOController {
   class Disk9350Device * disk9350Device;
   class Disk9370Device * disk9370Device;
   class Disk9390Device * disk9390Device;
+  // I/O instructions executed per device address. EX ADR counts at the address it selects.
+  unsigned long operations[256];
+  void countOperation();
   IOController ();
   int input ();
+  int readBlock(unsigned char * data, int length);
+  int writeBlock(const unsigned char * data, int length);
   int exAdr (unsigned char address);
   int exStatus ();
   int exData ();
@@ -407,6 +529,11 @@ class IOController {
   int exSB();
   int exRewind();
   int exTStop();
+  // Give the devices the machine they schedule their events on.
+  void attach(class Machine * machine);
+  // Each device is saved in a section of its own after the controller.
+  void saveState(class StateFile * state);
+  int loadState(class StateFile * state);
 }; 
 
   
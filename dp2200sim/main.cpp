@@ -19,148 +19,28 @@
 #include "Window.h"
 #include "CommandWindow.h"
 #include "RegisterWindow.h"
+#include "StateFile.h"
+#include "Machine.h"
+#include "Session.h"
+#include <memory>
 #include <sys/ioctl.h>
 #include <unistd.h>
+#include <poll.h>
 
-void printLog(const char *level, const char *fmt, ...);
-float yield=100.0;
-FILE *logfile;
-
-bool running=false;
-
-class dp2200_cpu cpu;
-
-class dp2200Window *dpw;
-class registerWindow *rw;
-class registerWindow *r;
-class commandWindow *cw;
-
-int pollKeyboard(void);
-int cpuRunner();
-
-class commandWindow;
-
-
-
-void form_hook_proxy(formnode * f) {
-  class hookExecutor * hE;
-  FIELD *field = current_field(f);
-  printLog("INFO", "form_hook_proxy ENTRY\n");
-  hE = (class hookExecutor * ) field_userptr(field);
-  if (hE!= NULL) hE->exec(field);
-}
+// Longest time in ms the main loop blocks when the CPU is stopped. Bounds how
+// long SDL window events wait to be handled.
+#define IDLE_TIMEOUT 100
 
-void registerWindow::Form::hexMemoryAddressHookExecutor::exec(FIELD *field) {
-  char *bufferString = field_buffer(field, 0);
-  int value = strtol(bufferString, NULL, 16);
-  printLog("INFO", "memoryAddressHookExecutor string=%s value=%d\n", bufferString, value);
-  cpu.startAddress = (value - address * 16) & 0xfff0;
-  rwf->updateForm();
-  wrefresh(r->win);
-}
-
-void registerWindow::Form::hexMemoryDataHookExecutor::exec(FIELD *field) {
-  char *bufferString = field_buffer(field, 0);
-  int value = strtol(bufferString, NULL, 16);
-  cpu.memory->physicalMemoryWrite(cpu.startAddress + data, value);
-  rwf->updateForm();
-  wrefresh(r->getWin());
-}
-
-
-void registerWindow::Form::octalMemoryAddressHookExecutor::exec(FIELD *field) {
-  char *bufferString = field_buffer(field, 0);
-  int value = strtol(bufferString, NULL, 8);
-  printLog("INFO", "memoryAddressHookExecutor string=%s value=%d\n", bufferString, value);
-  cpu.startAddress = (value - address * 16) & 0xfff0;
-  rwf->updateForm();
-  wrefresh(r->win);
-}
-
-void registerWindow::Form::octalMemoryDataHookExecutor::exec(FIELD *field) {
-  char *bufferString = field_buffer(field, 0);
-  int value = strtol(bufferString, NULL, 8);
-  cpu.memory->physicalMemoryWrite(cpu.startAddress + data, value);
-  rwf->updateForm();
-  wrefresh(r->getWin());
-}
-
-void registerWindow::Form::hexCharPointerHookExecutor::exec(FIELD *field) {
-  char *bufferString = field_buffer(field, 0);
-  unsigned char value = strtol(bufferString, NULL, 16);
-  *address = value;
-}
-
-void registerWindow::Form::hexShortPointerHookExecutor::exec(FIELD *field) {
-  char *bufferString = field_buffer(field, 0);
-  unsigned short value = strtol(bufferString, NULL, 16);
-  *address = value;
-}
-
-void registerWindow::Form::octalCharPointerHookExecutor::exec(FIELD *field) {
-  char *bufferString = field_buffer(field, 0);
-  unsigned char value = strtol(bufferString, NULL, 8);
-  *address = value;
-}
-
-void registerWindow::Form::octalShortPointerHookExecutor::exec(FIELD *field) {
-  char *bufferString = field_buffer(field, 0);
-  unsigned short value = strtol(bufferString, NULL, 8);
-  *address = value;
-}
-
-void registerWindow::Form::accessibleHookExecutor::exec(FIELD *field) {
-  char *bufferString = field_buffer(field, 0);
-  switch (bufferString[0]) {
-    case 'U':
-    case 'u':
-      *address=true;
-      break;
-    case 'S':
-    case 's':
-      *address=false;
-  }
-}
-
-void registerWindow::Form::writeableHookExecutor::exec(FIELD *field) {
-  char *bufferString = field_buffer(field, 0);
-  switch (bufferString[0]) {
-    case 'W':
-    case 'w':
-      *address=true;
-      break;
-    case 'R':
-    case 'r':
-      *address=false;
-  }
-}
-
-class callbackRecord {
-  public:
-  std::function<int(class callbackRecord *)> cb;
-  struct timespec deadline;
-};
-class Window *windows[3];
-int activeWindow = 0;
-
-std::vector<callbackRecord *> timerqueue;
-
-
-
-void timeoutInNanosecs (struct timespec * t, long nanos) {
-  *t = cpu.totalInstructionTime;
-  t->tv_nsec += nanos;
-  if (t->tv_nsec >= 1000000000) {
-    t->tv_nsec -= 1000000000;
-    t->tv_sec++;
-  }
-}
+void printLog(const char *level, const char *fmt, ...);
 
+static class Window *windows[3];
+static int activeWindow = 0;
 
-int pollKeyboard() {
+int pollKeyboard(class Session * session) {
   int ch;
   struct winsize w;
-  rw->updateWindow();
+  session->panel->updateWindow(session->machine.running);
+  session->screen->flushScreen();
   windows[activeWindow]->resetCursor();
   ch = getch();
   switch (ch) {
@@ -184,141 +64,84 @@ int pollKeyboard() {
     for (int i=0; i<3; i++) windows[i]->resize();
     break;
   case ERR:
-    break;
+    return 0;
   default:
+    if (windows[activeWindow] == session->screen) {
+      // Typing into the guest during a replay would make it diverge.
+      if (session->recorder.isReplaying()) break;
+      session->recorder.recordKey(session->machine.cpu.instructions, ch);
+      session->history.recordKey(session->machine.cpu.instructions, ch);
+    } else if (windows[activeWindow] == session->panel && ch < 0x80 && (isxdigit(ch) || strchr("rRwWuUsS", ch) != NULL)) {
+      // An edit of registers or memory can not be executed again.
+      session->history.clear();
+    }
     windows[activeWindow]->handleKey(ch);
+    // A command or an edit in the register window may have changed the machine state.
+    session->panel->stateChanged();
     break;
   }
-  return 0;
-}
-
-
-struct timespec subtractTimeSpec (struct timespec a, struct timespec b, bool * negative=NULL) {
-  struct timespec diff; 
-  if ((b.tv_sec > a.tv_sec) || ((b.tv_sec == a.tv_sec) && (b.tv_nsec > a.tv_nsec) )) {
-    // b is larger do reverse subtracton and return negative tv_sec
-    if (negative!=NULL) *negative=true;
-    diff.tv_nsec = b.tv_nsec - a.tv_nsec;
-    diff.tv_sec = b.tv_sec - a.tv_sec;
-  } else {
-    // a is larger than b 
-    if (negative!=NULL) *negative=false;
-    diff.tv_nsec = a.tv_nsec - b.tv_nsec;
-    diff.tv_sec = a.tv_sec - b.tv_sec;
-  }
-  if (diff.tv_nsec < 0) {
-    diff.tv_sec--;
-    diff.tv_nsec +=1000000000;
+  return 1;
+}
+
+// Used when the CPU is stopped. Simulated time stands still then so nothing in
+// the timer queue can expire. Sleep until a key is pressed or the screen has
+// output that is due to be drawn.
+void waitForInput(class dp2200Window * screen) {
+  struct pollfd pfd;
+  int timeout = IDLE_TIMEOUT;
+  int pending = screen->pendingOutputDelay();
+  if (pending >= 0 && pending < timeout) {
+    timeout = pending;
   }
-  return diff;
+  pfd.fd = STDIN_FILENO;
+  pfd.events = POLLIN;
+  poll(&pfd, 1, timeout);
 }
 
-// returns true if a >= b false otherwise
-bool compareTimeSpec (struct timespec a, struct timespec b) {
-  
-  if ((b.tv_sec > a.tv_sec) || ((b.tv_sec == a.tv_sec) && (b.tv_nsec > a.tv_nsec) )) {
-    return false;
-  } else {
-    return true;
-  }
-}
-
-bool compareCallbackRecord (class callbackRecord * a,class callbackRecord * b) {
-  return !compareTimeSpec(a->deadline, b->deadline);
-}
-
-class callbackRecord * addToTimerQueue(std::function<int(class callbackRecord *)> cb, struct timespec t) {
-  class callbackRecord * c = new callbackRecord;
-  c->cb = cb;
-  c->deadline = t;
-  timerqueue.push_back(c);
-  std::sort (timerqueue.begin(), timerqueue.end(), compareCallbackRecord); 
-  return c;
-}
 
-char timeBuf[sizeof "2011-10-08T07:07:09.000Z"];
-
-void updateTimeBuf() {
+void updateTimeBuf(char * timeBuf, size_t size) {
   timeval curTime;
   gettimeofday(&curTime, NULL);
   int milli = curTime.tv_usec / 1000;
   char *p = timeBuf +
-            strftime(timeBuf, sizeof timeBuf, "%FT%T", gmtime(&curTime.tv_sec));
+            strftime(timeBuf, size, "%FT%T", gmtime(&curTime.tv_sec));
   snprintf(p, 6, ".%03dZ", milli);
 }
 
+// Writes to the log of the machine running on this thread. Nothing is logged
+// without one.
 void printLog(const char *level, const char *fmt, ...) {
   char buffer[256];
+  char timeBuf[sizeof "2011-10-08T07:07:09.000Z"];
   int charsPrinted;
-  
+  class Machine * machine = Machine::current;
+  struct timespec started;
+  if (machine == NULL || machine->log == NULL) return;
+
   va_list args;
+  clock_gettime(CLOCK_MONOTONIC, &started);
   va_start(args, fmt);
-  updateTimeBuf();
+  updateTimeBuf(timeBuf, sizeof timeBuf);
   charsPrinted = snprintf(buffer, sizeof level + sizeof timeBuf + 2, "%s %s ",
                           level, timeBuf);
   vsnprintf(buffer + charsPrinted, 256 - charsPrinted, fmt, args);
-  fwrite(buffer, strlen(buffer), 1, logfile);
+  fwrite(buffer, strlen(buffer), 1, machine->log);
   va_end(args);
+  machine->logNanos += nanosSince(&started);
 }
 
-void removeTimerCallback(class callbackRecord * c) {
-  printLog("INFO", "Trying to remove callbackRecord * %p,  size of timerQueue: %d\n", c, timerqueue.size());
-  auto it = std::find(timerqueue.begin(), timerqueue.end(), c);
-  if (it != timerqueue.end()) {
-    printLog("INFO", "Removing timerCallback.\n");
-    timerqueue.erase(it);
-  }
-}
-
-void addTimeSpec(struct timespec * after, struct timespec * before, long increment ) {
-  after->tv_nsec = before->tv_nsec + increment;
-  after->tv_sec = before->tv_sec;
-  if (after->tv_nsec>1000000000) {
-    after->tv_sec++;
-    after->tv_nsec -= 1000000000;
-  }
-}
-
-bool nowIsLessThan(struct timespec * after) {
-  struct timespec now;
-  clock_gettime(CLOCK_MONOTONIC, &now);
-  return !compareTimeSpec(now, *after);
-}
-
-char * getCpuTimeStr (char * buffer, int size) {
-  snprintf(buffer, size, "%10ld.%10ld", cpu.totalInstructionTime.tv_sec, cpu.totalInstructionTime.tv_nsec);
-  return buffer;
-}
-
-std::function<int(class callbackRecord *)> interrupt = [](class callbackRecord * c)->int {
-  struct timespec then;
-  printLog("INFO", "1 ms Interrupt timer ENTRY\n");
-  cpu.interruptPending = 1;
-  timeoutInNanosecs(&then, 1000000);
-  addToTimerQueue(interrupt, then);
-  printLog("INFO", "1 ms Interrupt timer  EXIT\n");
-  return 0;
-};
-
-
-std::function<int(class callbackRecord *)> updateScreen = [](class callbackRecord * c)->int {
-  struct timespec then;
-  //printLog("INFO", "60Hz redraw timer timer ENTRY\n");
-  dpw->updateScreen();
-  timeoutInNanosecs(&then, 16666666); // 16 ms
-  addToTimerQueue(updateScreen, then);
-  //printLog("INFO", "60Hz redraw timer  EXIT\n");
-  return 0;
-};
-
 int main(int argc, char *argv[]) {
-  struct timespec now,before, after, diff, then;
+  struct timespec now,before, after, diff;
   
   //char buffer[100];
   struct winsize w;
   bool negative;
+  // The machine shown in the UI.
+  class Session * session = new Session();
+  class Machine * machine = &session->machine;
   ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
-  logfile = fopen("dp2200.log", "w");
+  machine->log = fopen("dp2200.log", "w");
+  Machine::current = machine;
   printLog("INFO", "Starting up %d\n", 10);
   if ((w.ws_col < 179) || (w.ws_row < 46)) {
     fprintf(stderr, "Too small screen. Increase terminal window to be bigger than 179 x 46. Current screen size is %d x %d\n", w.ws_col, w.ws_row);
@@ -332,53 +155,46 @@ int main(int argc, char *argv[]) {
   set_escdelay(100);
   timeout(0);
   refresh();
-  dpw = new dp2200Window(&cpu);
-  r = rw = new registerWindow(&cpu);
-  cw = new commandWindow(&cpu);
-  windows[0] = cw;
-  windows[1] = rw;
-  windows[2] = dpw;
+  session->panel = new registerWindow(&machine->cpu);
+  session->screen = new dp2200Window(&machine->cpu, session->panel);
+  session->command = new commandWindow(session);
+  windows[0] = session->command;
+  windows[1] = session->panel;
+  windows[2] = session->screen;
   windows[activeWindow]->hightlightWindow();
-  timeoutInNanosecs(&then, 1000000);
-  addToTimerQueue(interrupt, then);
-  timeoutInNanosecs(&then, 16666666);
-  addToTimerQueue(updateScreen, then);  
+  machine->screen = session->screen;
+  machine->onLights = [session]() { session->panel->stateChanged(); };
+  machine->onFrame = [session]() { session->screen->updateScreen(); };
+  session->history.onKey = [session](int key) { session->screen->handleKey(key); };
   //cpuRunner();
   while (1) { // event loop
-    //cpu.interruptPending = 1;
-    clock_gettime(CLOCK_MONOTONIC, &before);
-    addTimeSpec(&after, &before, (long) (yield/100 * 1000000));
-    while (running && nowIsLessThan(&after)) {
-      // Run instructions
-      if (cpu.execute()) {
-        if (cpu.cpuIs5500()) {
-          if (cpu.isAutorestartEnabled()) {
-            cpu.P=0175724;
-          } else {
-            running = false;
-          }
-        } else {
-          running = false;
-        }
-      } 
-      //printLog("INFO", "%s\n", getCpuTimeStr(buffer, 100));
-      if (std::find(cpu.breakpoints.begin(), cpu.breakpoints.end(), cpu.P)!=cpu.breakpoints.end()) {
-        running = false;
-      } 
-      //printLog("INFO", "%s size=%d \n", getCpuTimeStr(buffer, 100), timerqueue.size());
-      if (timerqueue.size()>0 && compareTimeSpec(timerqueue.front()->deadline, cpu.totalInstructionTime)) {
-        //printLog("INFO", "Not executing callback %s top=%10ld.%10ld \n", getCpuTimeStr(buffer, 100), timerqueue.front()->deadline.tv_sec, timerqueue.front()->deadline.tv_nsec);
-        continue;
+    struct timespec uiStarted;
+    bool idle;
+    session->history.update();
+    session->stats.update();
+    if (session->recorder.isReplaying()) {
+      session->command->replayEvents();
+    }
+    machine->stopAt = std::min(session->recorder.nextInstruction(), session->history.nextStop());
+    if (!machine->running) {
+      clock_gettime(CLOCK_MONOTONIC, &uiStarted);
+      session->screen->updateScreen();
+      session->screen->pumpEvents();
+      // getch may have buffered more input, only sleep when it is drained.
+      idle = !pollKeyboard(session) && session->recorder.nextInstruction() != machine->cpu.instructions;
+      session->stats.uiNanos += nanosSince(&uiStarted);
+      if (idle) {
+        waitForInput(session->screen);
       }
-      if (timerqueue.size() == 0) continue;
-      //printLog("INFO", "Executing callback %s top=%10ld.%10ld \n", getCpuTimeStr(buffer, 100), timerqueue.front()->deadline.tv_sec, timerqueue.front()->deadline.tv_nsec);
-      auto callBack = timerqueue.front()->cb;
-      class callbackRecord * timerRecord = timerqueue.front();
-      delete timerqueue.front();
-      timerqueue.erase(timerqueue.begin());
-      callBack(timerRecord);
+      continue;
     }
-    pollKeyboard();
+    //cpu.interruptPending = 1;
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    addTimeSpec(&after, &before, (long) (machine->yield/100 * 1000000));
+    machine->run(&after);
+    clock_gettime(CLOCK_MONOTONIC, &uiStarted);
+    pollKeyboard(session);
+    session->stats.uiNanos += nanosSince(&uiStarted);
     addTimeSpec(&after, &before, 1000000); // 1 ms
 
     // calculate time between after and now 
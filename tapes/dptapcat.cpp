@@ -0,0 +1,346 @@
+// Catalog and verify Datapoint cassette images in .tap format.
+//
+// Every .tap file given, or found below a directory given, is scanned by a
+// pool of worker threads, one file per worker at a time. A file is mapped into
+// memory and walked record by record. Each record is written to the index with
+// its type, the file it belongs to, its load address range and the result of
+// the checks dp2200tap does:
+//
+//    BOOT      the first record of the tape, if it is not a header
+//    HEADER    0201 0176, file number and its complement, 4 bytes long
+//    NUMERIC   0303 0074, checksums, load address and its complement, data
+//    SYMBOLIC  0347 0030, checksums, text
+//    OTHER     anything else
+//
+// Checks that fail are listed in the errors field of the record:
+//
+//    framing   the length after the record differs from the one before it
+//    truncated the file ends inside the record
+//    size      the record is too short for its type
+//    number    the complement of the file number is wrong
+//    checksum  the XOR or circulating checksum is wrong
+//    address   the complement of the load address is wrong in a record with
+//              a bad checksum
+//    unknown   an OTHER record after the boot record
+//
+// A numeric record with good checksums but no complemented load address holds
+// data, not code, and has no address range. Records after the end of tape
+// marker, file 127, are left over from earlier recordings and are marked with
+// end. A tape with an error in any other record is damaged. The index is CSV on standard output, or
+// JSON with -j, in file name order whatever the order the workers finished.
+// A summary of the damaged tapes is written to standard error and the exit
+// status is 1 if any tape is damaged, 2 if a file could not be read.
+//
+// Build: c++ -std=c++17 -O2 -o dptapcat dptapcat.cpp -lpthread
+// Usage: dptapcat [-j] [-t threads] path ...
+
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <filesystem>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+struct record {
+  long offset;
+  int size;
+  const char * type;
+  int file;
+  // Load address range of a numeric record, -1 when it has none.
+  int first;
+  int last;
+  const char * checksum;
+  std::string errors;
+  bool end;
+};
+
+struct tape {
+  std::string path;
+  long length;
+  std::vector<struct record> records;
+  int files;
+  int damaged;
+  std::string error;
+};
+
+int isFileHeader(const unsigned char * buffer) {
+  if ((buffer[0]==0201) && (buffer[1]==0176)) {
+    return 1;
+  }
+  return 0;
+}
+
+int isNumericRecord(const unsigned char * buffer) {
+  if ((buffer[0]==0303) && (buffer[1]==0074)) {
+    return 1;
+  }
+  return 0;
+}
+
+int isSymbolicRecord(const unsigned char * buffer) {
+  if ((buffer[0]==0347) && (buffer[1]==0030)) {
+    return 1;
+  }
+  return 0;
+}
+
+int isChecksumOK(const unsigned char * buffer, int size) {
+  unsigned char xorChecksum;
+  unsigned char circulatedChecksum;
+  int i;
+  xorChecksum = buffer[2];
+  circulatedChecksum = buffer[3];
+  for (i=4;i<size;i++) {
+    int lowestBit;
+    xorChecksum ^= buffer[i];
+    circulatedChecksum ^=buffer[i];
+    lowestBit = 0x01 & circulatedChecksum;
+    circulatedChecksum >>= 1;
+    circulatedChecksum |= (0x80 & (lowestBit<<7));
+  }
+  if ((xorChecksum == 0) && (circulatedChecksum == 0)) return 1;
+  return 0;
+}
+
+// Record lengths are stored as 32 bit little endian numbers before and after
+// each record.
+long getLength(const unsigned char * p) {
+  return (long) (p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned) p[3] << 24));
+}
+
+void addError(struct record * r, const char * error) {
+  if (r->errors.size() > 0) r->errors += "|";
+  r->errors += error;
+}
+
+void checkRecord(const unsigned char * b, struct record * r, int * file) {
+  int size = r->size;
+  if (size >= 2 && isFileHeader(b)) {
+    r->type = "HEADER";
+    if (size != 4) {
+      addError(r, "size");
+    } else {
+      if (b[2] != (0xff & ~b[3])) addError(r, "number");
+      r->file = *file = b[2];
+    }
+  } else if (size >= 2 && isNumericRecord(b)) {
+    r->type = "NUMERIC";
+    if (size < 8) {
+      addError(r, "size");
+    } else {
+      r->checksum = "ok";
+      if (!isChecksumOK(b, size)) {
+        r->checksum = "bad";
+        addError(r, "checksum");
+      }
+      if ((b[4] == (0xff & ~b[6])) && (b[5] == (0xff & ~b[7]))) {
+        r->first = (b[4] << 8) | b[5];
+        r->last = r->first + size - 9;
+      } else if (r->checksum[0] == 'b') {
+        addError(r, "address");
+      }
+    }
+  } else if (size >= 2 && isSymbolicRecord(b)) {
+    r->type = "SYMBOLIC";
+    if (size < 4) {
+      addError(r, "size");
+    } else {
+      r->checksum = "ok";
+      if (!isChecksumOK(b, size)) {
+        r->checksum = "bad";
+        addError(r, "checksum");
+      }
+    }
+  } else if (r->offset == 0) {
+    r->type = "BOOT";
+  } else {
+    r->type = "OTHER";
+    addError(r, "unknown");
+  }
+}
+
+void scanTape(struct tape * t) {
+  const unsigned char * map = NULL;
+  struct stat st;
+  long position = 0;
+  int file = -1;
+  bool end = false;
+  int fd;
+  t->files = 0;
+  t->damaged = 0;
+  fd = open(t->path.c_str(), O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    t->error = strerror(errno);
+    if (fd >= 0) close(fd);
+    return;
+  }
+  t->length = st.st_size;
+  if (t->length > 0) {
+    map = (const unsigned char *) mmap(NULL, t->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      t->error = strerror(errno);
+      close(fd);
+      return;
+    }
+    madvise((void *) map, t->length, MADV_SEQUENTIAL);
+  }
+  close(fd);
+  while (position < t->length) {
+    struct record r = {position, 0, "", file, -1, -1, "", "", end};
+    long size = position + 4 <= t->length ? getLength(map + position) : -1;
+    if (size < 0 || position + 4 + size > t->length) {
+      r.type = "OTHER";
+      r.size = size < 0 ? t->length - position : t->length - position - 4;
+      addError(&r, "truncated");
+      t->records.push_back(r);
+      break;
+    }
+    r.size = size;
+    checkRecord(map + position + 4, &r, &file);
+    if (r.type[0] == 'H' && r.errors.size() == 0) {
+      t->files++;
+      end = end || file == 127;
+    }
+    if (position + 8 + size > t->length) {
+      addError(&r, "truncated");
+    } else if (getLength(map + position + 4 + size) != size) {
+      addError(&r, "framing");
+    }
+    t->records.push_back(r);
+    position += 8 + size;
+  }
+  for (auto it = t->records.begin(); it != t->records.end(); it++) {
+    if (it->errors.size() > 0 && !it->end) t->damaged++;
+  }
+  if (map != NULL) munmap((void *) map, t->length);
+}
+
+std::string jsonString(std::string s) {
+  std::string out = "\"";
+  char buffer[8];
+  for (auto c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if ((unsigned char) c < 0x20) {
+      snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+      out += buffer;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+std::string csvString(std::string s) {
+  std::string out = "\"";
+  for (auto c : s) {
+    if (c == '"') out += '"';
+    out += c;
+  }
+  return out + "\"";
+}
+
+void printCsv(std::vector<struct tape> & tapes) {
+  printf("tape,record,offset,size,type,file,first,last,checksum,errors,end\n");
+  for (auto t = tapes.begin(); t != tapes.end(); t++) {
+    for (size_t i = 0; i < t->records.size(); i++) {
+      struct record * r = &t->records[i];
+      printf("%s,%zu,%ld,%d,%s,%d,%d,%d,%s,%s,%d\n", csvString(t->path).c_str(), i, r->offset, r->size, r->type, r->file,
+             r->first, r->last, r->checksum, r->errors.c_str(), r->end);
+    }
+  }
+}
+
+void printJson(std::vector<struct tape> & tapes) {
+  printf("[\n");
+  for (auto t = tapes.begin(); t != tapes.end(); t++) {
+    printf("  {\"tape\": %s, \"length\": %ld, \"files\": %d, \"records\": %zu, \"damaged\": %d, \"error\": %s,\n   \"index\": [",
+           jsonString(t->path).c_str(), t->length, t->files, t->records.size(), t->damaged, jsonString(t->error).c_str());
+    for (size_t i = 0; i < t->records.size(); i++) {
+      struct record * r = &t->records[i];
+      printf("%s\n    {\"offset\": %ld, \"size\": %d, \"type\": \"%s\", \"file\": %d, \"first\": %d, \"last\": %d, \"checksum\": \"%s\", \"errors\": \"%s\", \"end\": %s}",
+             i == 0 ? "" : ",", r->offset, r->size, r->type, r->file, r->first, r->last, r->checksum, r->errors.c_str(), r->end ? "true" : "false");
+    }
+    printf("]}%s\n", t + 1 == tapes.end() ? "" : ",");
+  }
+  printf("]\n");
+}
+
+bool isTap(const std::filesystem::path & p) {
+  std::string extension = p.extension().string();
+  std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+  return extension == ".tap";
+}
+
+int main (int argc, char * argv[]) {
+  std::vector<struct tape> tapes;
+  std::vector<std::thread> workers;
+  std::atomic<size_t> next(0);
+  bool json = false;
+  int threads = std::thread::hardware_concurrency();
+  int opt, damaged = 0, failed = 0;
+  while ((opt = getopt(argc, argv, "jt:")) != -1) {
+    switch (opt) {
+      case 'j':
+        json = true;
+        break;
+      case 't':
+        threads = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-j] [-t threads] path ...\n", argv[0]);
+        exit(2);
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "Usage: %s [-j] [-t threads] path ...\n", argv[0]);
+    exit(2);
+  }
+  for (int i = optind; i < argc; i++) {
+    std::error_code ec;
+    if (std::filesystem::is_directory(argv[i], ec)) {
+      for (auto it = std::filesystem::recursive_directory_iterator(argv[i], ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+        if (it->is_regular_file(ec) && isTap(it->path())) tapes.push_back({it->path().string(), 0, {}, 0, 0, ""});
+      }
+    } else {
+      tapes.push_back({argv[i], 0, {}, 0, 0, ""});
+    }
+  }
+  std::sort(tapes.begin(), tapes.end(), [](const struct tape & a, const struct tape & b) { return a.path < b.path; });
+  if (threads < 1) threads = 1;
+  for (int i = 0; i < threads; i++) {
+    workers.push_back(std::thread([&]() {
+      size_t n;
+      while ((n = next++) < tapes.size()) scanTape(&tapes[n]);
+    }));
+  }
+  for (auto it = workers.begin(); it != workers.end(); it++) it->join();
+  if (json) {
+    printJson(tapes);
+  } else {
+    printCsv(tapes);
+  }
+  for (auto t = tapes.begin(); t != tapes.end(); t++) {
+    if (t->error.size() > 0) {
+      fprintf(stderr, "%s: %s\n", t->path.c_str(), t->error.c_str());
+      failed++;
+    } else if (t->damaged > 0) {
+      auto r = std::find_if(t->records.begin(), t->records.end(), [](const struct record & r) { return r.errors.size() > 0 && !r.end; });
+      fprintf(stderr, "%s: %d of %zu records damaged, first is record %ld at offset %ld (%s)\n", t->path.c_str(), t->damaged,
+              t->records.size(), (long) (r - t->records.begin()), r->offset, r->errors.c_str());
+      damaged++;
+    }
+  }
+  fprintf(stderr, "%zu tapes, %d damaged, %d unreadable\n", tapes.size(), damaged, failed);
+  if (failed > 0) return 2;
+  return damaged > 0 ? 1 : 0;
+}
@@ -0,0 +1,322 @@
+// Repair damaged records in Datapoint cassette images in .tap format.
+//
+// Numeric and symbolic records carry two checksums that isChecksumOK checks:
+// byte 2 is the XOR of the data bytes and byte 3 is a circulating checksum
+// that is XORed with each data byte and rotated right one bit. For a record
+// that fails them every single error that could explain it is tried:
+//
+//    flip      one bit of the record is wrong
+//    insert    a byte was lost, it is put back
+//    delete    a byte too many was read, it is removed
+//
+// Both checksums are linear, so the XOR checksum alone gives the flipped bit,
+// the lost byte or the value of the extra byte, and the circulating state
+// before and the contribution after every position, computed once per record,
+// tell in constant time whether the circulating checksum holds too. Since it
+// rotates by one bit per byte it only tells a position modulo eight, so the
+// repairs that fit are ranked: a numeric record gets a point for a load address
+// that matches its complement and one for each neighbouring numeric record its
+// address range continues. A record is only repaired if one repair ranks
+// highest. Records do not always follow each other without a gap, so a repair
+// that won on addresses alone is a good guess rather than certain, and the
+// report says how many other repairs fit the checksums. The records are searched by a pool of worker threads.
+//
+// Every change is reported on standard output. The repaired tape is written to
+// the output file, unless -n is given. The exit status is 1 if a record could
+// not be repaired.
+//
+// Build: c++ -std=c++17 -O2 -o dptapfix dptapfix.cpp -lpthread
+// Usage: dptapfix [-n] [-t threads] in.tap [out.tap]
+
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+struct repair {
+  enum { FLIP, INSERT, DELETE } kind;
+  // Position in the record, the bit flipped or the byte inserted.
+  int position;
+  int value;
+  int score;
+};
+
+struct block {
+  long offset;
+  std::vector<unsigned char> data;
+  bool failed;
+  std::vector<struct repair> repairs;
+  bool repaired;
+  // Repairs that fit the checksums but ranked lower than the one made.
+  int alternatives;
+};
+
+int isNumericRecord(const unsigned char * buffer) {
+  if ((buffer[0]==0303) && (buffer[1]==0074)) {
+    return 1;
+  }
+  return 0;
+}
+
+int isSymbolicRecord(const unsigned char * buffer) {
+  if ((buffer[0]==0347) && (buffer[1]==0030)) {
+    return 1;
+  }
+  return 0;
+}
+
+int isChecksumOK(const unsigned char * buffer, int size) {
+  unsigned char xorChecksum;
+  unsigned char circulatedChecksum;
+  int i;
+  xorChecksum = buffer[2];
+  circulatedChecksum = buffer[3];
+  for (i=4;i<size;i++) {
+    int lowestBit;
+    xorChecksum ^= buffer[i];
+    circulatedChecksum ^=buffer[i];
+    lowestBit = 0x01 & circulatedChecksum;
+    circulatedChecksum >>= 1;
+    circulatedChecksum |= (0x80 & (lowestBit<<7));
+  }
+  if ((xorChecksum == 0) && (circulatedChecksum == 0)) return 1;
+  return 0;
+}
+
+unsigned char rotate(unsigned char value, int count) {
+  count &= 7;
+  return (unsigned char) ((value >> count) | (value << (8 - count)));
+}
+
+bool isRecord(const std::vector<unsigned char> & b) {
+  return b.size() >= 4 && (isNumericRecord(b.data()) || isSymbolicRecord(b.data()));
+}
+
+// A numeric record with a good load address, the first and last address it
+// loads.
+bool addressRange(const std::vector<unsigned char> & b, int * first, int * last) {
+  if (b.size() < 8 || !isNumericRecord(b.data())) return false;
+  if (b[4] != (0xff & ~b[6]) || b[5] != (0xff & ~b[7])) return false;
+  *first = (b[4] << 8) | b[5];
+  *last = *first + b.size() - 9;
+  return true;
+}
+
+std::vector<unsigned char> applyRepair(const std::vector<unsigned char> & b, const struct repair & r) {
+  std::vector<unsigned char> out = b;
+  switch (r.kind) {
+    case repair::FLIP:
+      out[r.position] ^= 1 << r.value;
+      break;
+    case repair::INSERT:
+      out.insert(out.begin() + r.position, r.value);
+      break;
+    case repair::DELETE:
+      out.erase(out.begin() + r.position);
+      break;
+  }
+  return out;
+}
+
+// Every single error that makes both checksums hold.
+void search(struct block * blk) {
+  const std::vector<unsigned char> & b = blk->data;
+  const unsigned char * d = b.data() + 4;
+  int m = b.size() - 4;
+  std::vector<unsigned char> before(m + 1), after(m + 1);
+  unsigned char x = b[2];
+  // before[i] is the circulating checksum after i data bytes, after[i] what
+  // the data bytes from i on add to it.
+  before[0] = b[3];
+  for (int i = 0; i < m; i++) {
+    x ^= d[i];
+    before[i + 1] = rotate(before[i] ^ d[i], 1);
+  }
+  after[m] = 0;
+  for (int i = m - 1; i >= 0; i--) {
+    after[i] = rotate(d[i], m - i) ^ after[i + 1];
+  }
+  unsigned char c = before[m];
+  for (int k = 0; k < 8; k++) {
+    if (x == (1 << k) && c == 0) blk->repairs.push_back({repair::FLIP, 2, k, 0});
+    if (x == 0 && c == rotate(1 << k, m)) blk->repairs.push_back({repair::FLIP, 3, k, 0});
+    for (int i = 0; i < m; i++) {
+      if (x == (1 << k) && c == rotate(1 << k, m - i)) blk->repairs.push_back({repair::FLIP, 4 + i, k, 0});
+    }
+  }
+  for (int i = 0; i <= m; i++) {
+    if ((rotate(rotate(before[i] ^ x, 1), m - i) ^ after[i]) == 0) blk->repairs.push_back({repair::INSERT, 4 + i, x, 0});
+  }
+  for (int i = 0; i < m; i++) {
+    if (d[i] == x && (rotate(before[i], m - i - 1) ^ after[i + 1]) == 0) blk->repairs.push_back({repair::DELETE, 4 + i, d[i], 0});
+  }
+  // Inserting or removing a byte next to an equal one gives the same record.
+  std::vector<struct repair> unique;
+  std::vector<std::vector<unsigned char>> results;
+  for (auto r = blk->repairs.begin(); r != blk->repairs.end(); r++) {
+    std::vector<unsigned char> result = applyRepair(b, *r);
+    if (std::find(results.begin(), results.end(), result) == results.end()) {
+      results.push_back(result);
+      unique.push_back(*r);
+    }
+  }
+  blk->repairs = unique;
+}
+
+// Neighbours are taken from the tape as read, so the ranking does not depend
+// on the order the records are repaired in.
+void rank(struct block * blk, const std::vector<struct block> & tape, size_t n) {
+  int first = -1, last = -1, previousFirst = -1, previousLast = -1, nextFirst = -1, nextLast = -1;
+  bool previous = n > 0 && !tape[n - 1].failed && addressRange(tape[n - 1].data, &previousFirst, &previousLast);
+  bool next = n + 1 < tape.size() && !tape[n + 1].failed && addressRange(tape[n + 1].data, &nextFirst, &nextLast);
+  int best = -1, count = 0;
+  for (auto r = blk->repairs.begin(); r != blk->repairs.end(); r++) {
+    if (addressRange(applyRepair(blk->data, *r), &first, &last)) {
+      r->score = 1 + (previous && previousLast + 1 == first) + (next && last + 1 == nextFirst);
+    }
+    if (r->score > best) {
+      best = r->score;
+      count = 0;
+    }
+    if (r->score == best) count++;
+  }
+  blk->repaired = count == 1;
+  if (blk->repaired) {
+    for (auto r = blk->repairs.begin(); r != blk->repairs.end(); r++) {
+      if (r->score == best) {
+        blk->data = applyRepair(blk->data, *r);
+        blk->alternatives = blk->repairs.size() - 1;
+        blk->repairs = {*r};
+        break;
+      }
+    }
+  }
+}
+
+void describe(const struct repair & r, const std::vector<unsigned char> & original, char * buffer, size_t size) {
+  switch (r.kind) {
+    case repair::FLIP:
+      snprintf(buffer, size, "bit %d of byte %d flipped, %03o to %03o", r.value, r.position, original[r.position],
+               original[r.position] ^ (1 << r.value));
+      break;
+    case repair::INSERT:
+      snprintf(buffer, size, "lost byte %03o inserted at %d", r.value, r.position);
+      break;
+    case repair::DELETE:
+      snprintf(buffer, size, "extra byte %03o removed at %d", r.value, r.position);
+      break;
+  }
+}
+
+bool readTape(const char * fileName, std::vector<struct block> * blocks) {
+  FILE * in;
+  int size;
+  long offset = 0;
+  in = fopen(fileName, "r");
+  if (in == NULL) return false;
+  while (fread(&size, 4, 1, in) == 1) {
+    struct block blk = {offset, std::vector<unsigned char>(size < 0 ? 0 : size), false, {}, false, 0};
+    if (size < 0 || fread(blk.data.data(), 1, size, in) != (size_t) size || fread(&size, 4, 1, in) != 1) {
+      fclose(in);
+      return false;
+    }
+    blocks->push_back(blk);
+    offset += 8 + blk.data.size();
+  }
+  fclose(in);
+  return true;
+}
+
+bool writeTape(const char * fileName, std::vector<struct block> & blocks) {
+  FILE * out;
+  int size;
+  bool ok = true;
+  out = fopen(fileName, "w");
+  if (out == NULL) return false;
+  for (auto it = blocks.begin(); it != blocks.end(); it++) {
+    size = it->data.size();
+    ok = ok && fwrite(&size, 4, 1, out) == 1 && fwrite(it->data.data(), 1, size, out) == (size_t) size && fwrite(&size, 4, 1, out) == 1;
+  }
+  return fclose(out) == 0 && ok;
+}
+
+int main (int argc, char * argv[]) {
+  std::vector<struct block> blocks, original;
+  std::vector<size_t> failed;
+  std::vector<std::thread> workers;
+  std::atomic<size_t> next(0);
+  bool dryRun = false;
+  int threads = std::thread::hardware_concurrency();
+  int opt, unrepaired = 0;
+  char buffer[100];
+  while ((opt = getopt(argc, argv, "nt:")) != -1) {
+    switch (opt) {
+      case 'n':
+        dryRun = true;
+        break;
+      case 't':
+        threads = atoi(optarg);
+        break;
+      default:
+        optind = argc;
+    }
+  }
+  if (argc - optind != (dryRun ? 1 : 2)) {
+    fprintf(stderr, "Usage: %s [-n] [-t threads] in.tap [out.tap]\n", argv[0]);
+    exit(2);
+  }
+  if (!readTape(argv[optind], &blocks)) {
+    fprintf(stderr, "Unable to read %s\n", argv[optind]);
+    exit(2);
+  }
+  for (size_t i = 0; i < blocks.size(); i++) {
+    if (isRecord(blocks[i].data) && !isChecksumOK(blocks[i].data.data(), blocks[i].data.size())) {
+      blocks[i].failed = true;
+      failed.push_back(i);
+    }
+  }
+  original = blocks;
+  if (threads < 1) threads = 1;
+  for (int i = 0; i < threads; i++) {
+    workers.push_back(std::thread([&]() {
+      size_t n;
+      while ((n = next++) < failed.size()) {
+        search(&blocks[failed[n]]);
+        rank(&blocks[failed[n]], original, failed[n]);
+      }
+    }));
+  }
+  for (auto it = workers.begin(); it != workers.end(); it++) it->join();
+  for (auto n = failed.begin(); n != failed.end(); n++) {
+    struct block * blk = &blocks[*n];
+    printf("record %zu at offset %ld, %zu bytes: ", *n, blk->offset, original[*n].data.size());
+    if (blk->repaired) {
+      describe(blk->repairs[0], original[*n].data, buffer, sizeof(buffer));
+      if (blk->alternatives > 0) {
+        printf("%s, %d other repairs fit the checksums but not the addresses as well\n", buffer, blk->alternatives);
+      } else {
+        printf("%s\n", buffer);
+      }
+    } else if (blk->repairs.size() == 0) {
+      printf("no single error explains the checksums\n");
+      unrepaired++;
+    } else {
+      printf("%zu repairs fit equally well, left as it is\n", blk->repairs.size());
+      for (auto r = blk->repairs.begin(); r != blk->repairs.end(); r++) {
+        describe(*r, original[*n].data, buffer, sizeof(buffer));
+        printf("    %s\n", buffer);
+      }
+      unrepaired++;
+    }
+  }
+  printf("%zu records failed the checksums, %zu repaired\n", failed.size(), failed.size() - unrepaired);
+  if (!dryRun && !writeTape(argv[optind + 1], blocks)) {
+    fprintf(stderr, "Unable to write %s\n", argv[optind + 1]);
+    exit(2);
+  }
+  return unrepaired > 0 ? 1 : 0;
+}
@@ -11,7 +11,7 @@
 // off that recording.  The audio format must be in RIFF WAV format,
 // non-compressed, one or two channels.  It allows for mono/stereo input,
 // any input sampling rate (lower sampling rates increase the decoding
-// error rate), and 8b or 16b samples.
+// error rate), and 8b, 16b, 24b or 32b integer or 32b or 64b float samples.
 
 // The Datapoint 2200 records data bits using a FSK method, namely one
 // half cycle at frequency X means a one bit and one full cycle at
@@ -60,6 +60,7 @@
 #include <string.h>
 #include <vector>
 #include <cmath>
+#include <algorithm>
 
 // support dumping records as intel hex files
 #define SUPPORT_HEX 1
@@ -102,7 +103,9 @@ enum { OFMT_TAP = 0, OFMT_BIN, OFMT_HEX } opt_ofmt;
 // .wav file attributes
 bool inmono;             // input  file is mono (1) or stereo (0)
 int sample_bytes;        // number of bytes per sample
+bool infloat;            // samples are IEEE float rather than integer
 uint32 expected_samples; // number of samples in file
+uint32 samples_left;     // samples in the file not yet read
 uint32 sample_rate;      // samples/second
 
 FILE *fIn; // input audio file handle
@@ -137,18 +140,24 @@ void tfprintf(int verbosity, FILE *fp, char *fmt, ...) {
   }
 }
 
-void tprintf(int verbosity, const char *fmt, ...) {
+void tprintf_out(const char *fmt, ...) {
   char buff[1000];
   va_list args;
 
-  if (verbosity <= opt_v) {
-    va_start(args, fmt);
-    vsnprintf(buff, sizeof(buff), fmt, args);
-    va_end(args);
-    fputs(buff, stdout);
-  }
+  va_start(args, fmt);
+  vsnprintf(buff, sizeof(buff), fmt, args);
+  va_end(args);
+  fputs(buff, stdout);
 }
 
+// the verbosity is checked before the call, as most reports are made for
+// every bit or peak and would otherwise cost more than the decoding.
+#define tprintf(verbosity, ...)                                                \
+  do {                                                                         \
+    if ((verbosity) <= opt_v)                                                  \
+      tprintf_out(__VA_ARGS__);                                                \
+  } while (0)
+
 // ========================================================================
 // WAV file parsing
 
@@ -175,6 +184,10 @@ const uint32 WaveID = ('W' << 0) | ('A' << 8) | ('V' << 16) | ('E' << 24);
 const uint32 FmtID = ('f' << 0) | ('m' << 8) | ('t' << 16) | (' ' << 24);
 const uint32 DataID = ('d' << 0) | ('a' << 8) | ('t' << 16) | ('a' << 24);
 
+const int16 WaveFormatPCM = 1;
+const int16 WaveFormatFloat = 3;
+const int16 WaveFormatExtensible = (int16)0xFFFE;
+
 void errex(const char *msg) {
   fprintf(stderr, "Error: %s\n", msg);
   exit(-1);
@@ -190,7 +203,8 @@ void CheckHeader(void) {
   uint32 Frequency = 0; // sample frequency
   uint32 AvgBPS;        // we'll ignore this
   uint16 BlockAlign;    // we'll ignore this
-  uint16 BitsPerSample;
+  uint16 BitsPerSample = 0;
+  bool gotFormat = false;
 
   //  RIFF Header
   if (fread(&groupID, 4, 1, fIn) != 1)
@@ -204,52 +218,68 @@ void CheckHeader(void) {
   if (riffType != WaveID)
     errex("input file not a WAV file");
 
-  // Format definition
-  if (fread(&chunkID, 4, 1, fIn) != 1)
-    errex("Cant' read file");
-  if (chunkID != FmtID)
+  // Format definition and sound data. other chunks, and any part of the
+  // format definition we don't need, are skipped.
+  for (;;) {
+    if (fread(&chunkID, 4, 1, fIn) != 1)
+      errex("file didn't contain a DATA header");
+    if (fread(&ChunkSize, 4, 1, fIn) != 1)
+      errex("Cant' read file");
+    if (chunkID == DataID)
+      break;
+    if (chunkID != FmtID) {
+      fseek(fIn, (ChunkSize + 1) & ~1, SEEK_CUR);
+      continue;
+    }
+    if (ChunkSize < 16)
+      errex("Missing format definition");
+    if (fread(&FormatTag, 2, 1, fIn) != 1)
+      errex("Cant' read file");
+    if (fread(&Channels, 2, 1, fIn) != 1)
+      errex("Cant' read file");
+    if (fread(&Frequency, 4, 1, fIn) != 1)
+      errex("Cant' read file");
+    if (fread(&AvgBPS, 4, 1, fIn) != 1)
+      errex("Cant' read file");
+    if (fread(&BlockAlign, 2, 1, fIn) != 1)
+      errex("Cant' read file");
+    if (fread(&BitsPerSample, 2, 1, fIn) != 1)
+      errex("Cant' read file");
+    if (FormatTag == WaveFormatExtensible && ChunkSize >= 40) {
+      // the real format tag starts the subformat GUID
+      uint8 extension[24];
+      if (fread(extension, 24, 1, fIn) != 1)
+        errex("Cant' read file");
+      FormatTag = extension[8] | (extension[9] << 8);
+      ChunkSize -= 24;
+    }
+    fseek(fIn, ((ChunkSize + 1) & ~1) - 16, SEEK_CUR);
+    gotFormat = true;
+  }
+  if (!gotFormat)
     errex("Missing format definition");
-  if (fread(&ChunkSize, 4, 1, fIn) != 1)
-    errex("Cant' read file");
-  if (fread(&FormatTag, 2, 1, fIn) != 1)
-    errex("Cant' read file");
-  if (FormatTag != 1)
+
+  if (FormatTag != WaveFormatPCM && FormatTag != WaveFormatFloat)
     errex("Error: can't deal with compressed data\n");
-  if (fread(&Channels, 2, 1, fIn) != 1)
-    errex("Cant' read file");
   if (Channels != 1 && Channels != 2)
     errex("Error: can't handle too many channels");
   inmono = (Channels == 1);
-  if (fread(&Frequency, 4, 1, fIn) != 1)
-    errex("Cant' read file");
-  if (fread(&AvgBPS, 4, 1, fIn) != 1)
-    errex("Cant' read file");
-  if (fread(&BlockAlign, 2, 1, fIn) != 1)
-    errex("Cant' read file");
-  if (fread(&BitsPerSample, 2, 1, fIn) != 1)
-    errex("Cant' read file");
 
-  if (BitsPerSample == 8)
-    sample_bytes = 1;
-  else if (BitsPerSample == 16)
-    sample_bytes = 2;
-  else
-    errex("samples must be either 8b or 16b\n");
+  infloat = (FormatTag == WaveFormatFloat);
+  sample_bytes = BitsPerSample / 8;
+  if (infloat && BitsPerSample != 32 && BitsPerSample != 64)
+    errex("float samples must be either 32b or 64b\n");
+  if (!infloat && BitsPerSample != 8 && BitsPerSample != 16 &&
+      BitsPerSample != 24 && BitsPerSample != 32)
+    errex("samples must be either 8b, 16b, 24b or 32b\n");
 
   sample_rate = Frequency;
   if (Frequency < 11000)
     errex("Warning: the sample rate is low -- it might hurt conversion");
 
-  // Data section
-  if (fread(&chunkID, 4, 1, fIn) != 1)
-    errex("Cant' read file");
-  if (chunkID != DataID)
-    errex("file didn't contain a DATA header");
-  if (fread(&ChunkSize, 4, 1, fIn) != 1)
-    errex("Cant' read file");
-
   // compute dependent parameters
   expected_samples = ChunkSize / (sample_bytes * Channels);
+  samples_left = expected_samples;
 
   // period, in samples
   samples_per_bit = (float)sample_rate / zero_freq;
@@ -261,44 +291,142 @@ void CheckHeader(void) {
 
   float sec = (float)expected_samples / sample_rate;
   tprintf(1, "File: '%s'\n", opt_ifn);
-  tprintf(1, "WAV format: %d samples/sec, %db %s\n", sample_rate,
-          8 * sample_bytes, inmono ? "mono" : "stereo");
+  tprintf(1, "WAV format: %d samples/sec, %db %s%s\n", sample_rate,
+          8 * sample_bytes, infloat ? "float " : "", inmono ? "mono" : "stereo");
   tprintf(1, "Expected # of samples: %ld", expected_samples);
   tprintf(1, " (%.2f seconds)\n", sec);
 }
 
-// return a mono sample from the input file.
-// if the input file is in stereo, it averages the two channels.
-// this routine reads blocks for efficiency, but doles out one sample
-// per request.
-sample_t GetMonoSample(void) {
-  sample_t newsamp;
-
-  if (inmono && (sample_bytes == 1)) {
-    // mono 8b
-    int8 b0 = (int8)fgetc(fIn) - 128;
-    newsamp = (sample_t)(b0 << 8);
-  } else if (inmono && (sample_bytes == 2)) {
-    uint8 b0 = (uint8)fgetc(fIn);
-    int8 b1 = (int8)fgetc(fIn);
-    newsamp = (sample_t)((b1 << 8) + b0);
-  } else if (!inmono && (sample_bytes == 1)) {
-    // 8b stereo
-    int8 b0 = fgetc(fIn) - 128;
-    int8 b1 = fgetc(fIn) - 128;
-    newsamp = (sample_t)((b0 + b1) << 7);
-  } else if (!inmono && (sample_bytes == 2)) {
-    // 16b stereo
-    uint8 b0 = (uint8)fgetc(fIn);
-    int8 b1 = (int8)fgetc(fIn);
-    uint8 b2 = (uint8)fgetc(fIn);
-    int8 b3 = (int8)fgetc(fIn);
-    sample_t left = (sample_t)((b1 << 8) + b0);
-    sample_t right = (sample_t)((b3 << 8) + b2);
-    newsamp = (left + right + 1) >> 1;
+// =========================================================================
+// sample conversion
+//
+// the input file is read a block at a time and each block is turned into
+// mono samples by a loop for its format. the loops are kept free of calls
+// and branches so the compiler can vectorize them. stereo is averaged.
+
+// bytes of the input file read at a time
+#define RAWBUFSIZE 65536
+
+uint8 rawbuf[RAWBUFSIZE];
+
+// 8b samples are unsigned
+void ConvertU8(const uint8 *in, sample_t *out, int n) {
+  if (inmono) {
+    for (int i = 0; i < n; i++)
+      out[i] = (sample_t)((in[i] - 128) * 256);
+  } else {
+    for (int i = 0; i < n; i++)
+      out[i] = (sample_t)((in[2 * i] - 128 + in[2 * i + 1] - 128) * 128);
+  }
+}
+
+void ConvertS16(const uint8 *in, sample_t *out, int n) {
+  if (inmono) {
+    for (int i = 0; i < n; i++)
+      out[i] = (sample_t)(in[2 * i] | (in[2 * i + 1] << 8));
+  } else {
+    for (int i = 0; i < n; i++) {
+      sample_t left = (sample_t)(in[4 * i] | (in[4 * i + 1] << 8));
+      sample_t right = (sample_t)(in[4 * i + 2] | (in[4 * i + 3] << 8));
+      out[i] = (left + right + 1) >> 1;
+    }
   }
+}
 
-  return newsamp;
+// the top 16 bits of 24b and 32b samples are used
+void ConvertS24(const uint8 *in, sample_t *out, int n) {
+  if (inmono) {
+    for (int i = 0; i < n; i++)
+      out[i] = (sample_t)(in[3 * i + 1] | (in[3 * i + 2] << 8));
+  } else {
+    for (int i = 0; i < n; i++) {
+      sample_t left = (sample_t)(in[6 * i + 1] | (in[6 * i + 2] << 8));
+      sample_t right = (sample_t)(in[6 * i + 4] | (in[6 * i + 5] << 8));
+      out[i] = (left + right + 1) >> 1;
+    }
+  }
+}
+
+void ConvertS32(const uint8 *in, sample_t *out, int n) {
+  if (inmono) {
+    for (int i = 0; i < n; i++)
+      out[i] = (sample_t)(in[4 * i + 2] | (in[4 * i + 3] << 8));
+  } else {
+    for (int i = 0; i < n; i++) {
+      sample_t left = (sample_t)(in[8 * i + 2] | (in[8 * i + 3] << 8));
+      sample_t right = (sample_t)(in[8 * i + 6] | (in[8 * i + 7] << 8));
+      out[i] = (left + right + 1) >> 1;
+    }
+  }
+}
+
+// float samples are full scale at +/-1.0, and are clipped beyond that
+#define FLOAT_TO_SAMPLE(f)                                                     \
+  ((sample_t)(MAX(-32768.0, MIN(32767.0, (f) * 32767.0)) +                     \
+              ((f) < 0 ? -0.5 : 0.5)))
+
+void ConvertF32(const uint8 *in, sample_t *out, int n) {
+  if (inmono) {
+    for (int i = 0; i < n; i++) {
+      float f;
+      memcpy(&f, &in[4 * i], 4);
+      out[i] = FLOAT_TO_SAMPLE(f);
+    }
+  } else {
+    for (int i = 0; i < n; i++) {
+      float f[2];
+      memcpy(f, &in[8 * i], 8);
+      out[i] = FLOAT_TO_SAMPLE((f[0] + f[1]) * 0.5f);
+    }
+  }
+}
+
+void ConvertF64(const uint8 *in, sample_t *out, int n) {
+  if (inmono) {
+    for (int i = 0; i < n; i++) {
+      double f;
+      memcpy(&f, &in[8 * i], 8);
+      out[i] = FLOAT_TO_SAMPLE(f);
+    }
+  } else {
+    for (int i = 0; i < n; i++) {
+      double f[2];
+      memcpy(f, &in[16 * i], 16);
+      out[i] = FLOAT_TO_SAMPLE((f[0] + f[1]) * 0.5);
+    }
+  }
+}
+
+// fill out[] with the next n mono samples of the input file.
+// past the end of the sound data the samples are zero.
+void GetMonoSamples(sample_t *out, int n) {
+  const int frame_bytes = sample_bytes * (inmono ? 1 : 2);
+
+  while (n > 0) {
+    int want = MIN((uint32)n, MIN(samples_left, (uint32)(RAWBUFSIZE / frame_bytes)));
+    int got = (want > 0) ? fread(rawbuf, frame_bytes, want, fIn) : 0;
+
+    if (got == 0) {
+      memset(out, 0, n * sizeof(sample_t));
+      samples_left = 0;
+      return;
+    }
+    if (infloat && sample_bytes == 4)
+      ConvertF32(rawbuf, out, got);
+    else if (infloat)
+      ConvertF64(rawbuf, out, got);
+    else if (sample_bytes == 1)
+      ConvertU8(rawbuf, out, got);
+    else if (sample_bytes == 2)
+      ConvertS16(rawbuf, out, got);
+    else if (sample_bytes == 3)
+      ConvertS24(rawbuf, out, got);
+    else
+      ConvertS32(rawbuf, out, got);
+    samples_left -= got;
+    out += got;
+    n -= got;
+  }
 }
 
 // =========================================================================
@@ -340,10 +468,10 @@ int sample_addr(int32 n) {
     windowstart += QTRWORKBUF;
     windowoffset = (QTRWORKBUF + windowoffset) & WORKBUFMASK;
 
-    // fill up newly exposed portion of buffer
+    // fill up newly exposed portion of buffer.  windowoffset is a
+    // multiple of QTRWORKBUF so the portion doesn't wrap.
     int off = (windowoffset + 3 * QTRWORKBUF) & WORKBUFMASK;
-    for (int32 t = off; t < off + QTRWORKBUF; t++)
-      inbuf[t] = GetMonoSample();
+    GetMonoSamples(&inbuf[off], QTRWORKBUF);
   }
 
   return (n - windowstart + windowoffset) & WORKBUFMASK;
@@ -363,13 +491,12 @@ void FillInbuffer(void) {
   windowoffset = 0;
 
   // fill the first half of the buffer with the first file sample
-  s = GetMonoSample();
+  GetMonoSamples(&s, 1);
   for (t = 0; t <= HALFWORKBUF; t++)
     inbuf[t] = s;
 
   // now fill up the rest
-  for (t = HALFWORKBUF + 1; t < WORKBUFSIZE; t++)
-    inbuf[t] = GetMonoSample();
+  GetMonoSamples(&inbuf[HALFWORKBUF + 1], WORKBUFSIZE - HALFWORKBUF - 1);
 }
 #define OBUFFER_SIZE 16384
 uint8 obuff_buffer[OBUFFER_SIZE];
@@ -1058,55 +1185,80 @@ void FindTransitions() {
 //   Compare this derivative with in relative scale to a fixed value
 
 
-struct S {
-  sample_t s;
-  double scaled;
-  uint32 index;
-  bool highest;
-  bool lowest;
-  double distance;
-  bool peak;
-  bool highPeak;
-};
-
-typedef struct S Sample;
-
-typedef std::vector<Sample> SampleBuffer;
-
-struct HL {
+// The window is kept in a ring of the most recent samples. Instead of
+// copying, rescaling and rescanning the window every time it moves:
+// - each sample is classified as a high or low peak once, when the sample
+//   after it arrives, and the peaks are queued in order
+// - the ring is stored twice over, so the window is always contiguous and
+//   the highest and lowest sample are found by a loop the compiler
+//   vectorizes
+// - a sample is only scaled when a peak or the knee search needs it
+// The window only ever moves forward, and is never longer than 80 samples.
+
+#define RING_SIZE 256 // make this a power of two
+#define RING_MASK (RING_SIZE - 1)
+
+enum { PEAK_NONE = 0, PEAK_LOW, PEAK_HIGH };
+
+struct W {
+  // by sample index modulo RING_SIZE, and again RING_SIZE further on
+  sample_t value[2 * RING_SIZE];
+  uint8 peak[RING_SIZE];
+  // indices of the queued peaks, oldest first
+  uint32 peaks[RING_SIZE];
+  uint32 peaksFirst, peaksLast;
+  // the window is sample start up to but not including end
+  uint32 start;
+  uint32 end;
   sample_t highValue;
   sample_t lowValue;
-  uint32 highIndex;
-  uint32 lowIndex;
-  uint32 highBufferIndex;
-  uint32 lowBufferIndex;
+  double scalingValue;
 };
 
-typedef struct HL HiLo;
-
-HiLo findHighestLowest (SampleBuffer * sb) {
-  HiLo hilo;
-  hilo.highValue = (*sb)[0].s;
-  hilo.lowValue = (*sb)[0].s;;
-  hilo.highIndex = (*sb)[0].index;
-  hilo.lowIndex = (*sb)[0].index; 
-  hilo.highBufferIndex = 0;
-  hilo.lowBufferIndex = 0; 
-  uint32 currentBufferIndex;
-  for (uint32 i=1; i< sb->size(); i++) {
-    if ((*sb)[i].s > hilo.highValue) {
-      hilo.highValue = (*sb)[i].s;
-      hilo.highIndex = (*sb)[i].index;
-      hilo.highBufferIndex = i;
+typedef struct W Window;
+
+#define VALUE(w, n) ((w)->value[(n) & RING_MASK])
+
+// move the window forward to cover start..end-1, reading samples up to end.
+void moveWindow(uint32 * nSamp, Window * w, uint32 start, uint32 end) {
+  const sample_t * v;
+  sample_t high, low;
+  tprintf(3, "Moving window to %ld..%ld\n", start, end);
+  w->start = start;
+  w->end = end;
+  for (uint32 n = *nSamp; n < end; n++) {
+    sample_t s = GETIN(n);
+    w->value[n & RING_MASK] = s;
+    w->value[(n & RING_MASK) + RING_SIZE] = s;
+    // the top or bottom of a local slope
+    if (n >= 2) {
+      sample_t diff1 = VALUE(w, n - 1) - VALUE(w, n - 2);
+      sample_t diff2 = s - VALUE(w, n - 1);
+      uint8 type = ((diff1 < 0) & (diff2 >= 0)) * PEAK_LOW | ((diff1 > 0) & (diff2 <= 0)) * PEAK_HIGH;
+      w->peak[(n - 1) & RING_MASK] = type;
+      w->peaks[w->peaksLast & RING_MASK] = n - 1;
+      w->peaksLast += (type != PEAK_NONE);
     }
-    if ((*sb)[i].s < hilo.lowValue) {
-      hilo.lowValue = (*sb)[i].s;
-      hilo.lowIndex = (*sb)[i].index;
-      hilo.lowBufferIndex = i;
-    }    
-  } 
-  tprintf(3, "Highest in buffer is %d at %ld and Lowest is %d at %ld\n", hilo.highValue, hilo.highIndex, hilo.lowValue, hilo.lowIndex);
-  return hilo;
+  }
+  *nSamp = MAX(*nSamp, end);
+  // peaks are only looked for from the third sample of the window, where
+  // the two samples before them are in the window
+  while (w->peaksFirst != w->peaksLast && w->peaks[w->peaksFirst & RING_MASK] < start + 2) w->peaksFirst++;
+  v = &w->value[start & RING_MASK];
+  high = low = v[0];
+  for (uint32 i = 1; i < end - start; i++) {
+    high = MAX(high, v[i]);
+    low = MIN(low, v[i]);
+  }
+  w->highValue = high;
+  w->lowValue = low;
+  w->scalingValue = fabs(((double) w->highValue)-((double) w->lowValue));
+  tprintf(3, "Highest in buffer is %d and Lowest is %d\n", w->highValue, w->lowValue);
+}
+
+// the sample n relative to the lowest and highest of the window, 0.0 to 1.0
+double scaled(Window * w, uint32 n) {
+  return (( ((double)VALUE(w, n))-((double)w->lowValue)))/ w->scalingValue;
 }
 
 struct P {
@@ -1119,85 +1271,20 @@ struct P {
 
 typedef std::vector<struct P> Peaks;
 
-void savePeak(SampleBuffer * sb, Peaks * ps, bool highPeak, uint32 i) {
-  struct P p;
-  (*sb)[i+1].peak = true;
-  (*sb)[i+1].highPeak = highPeak;
-  p.value = (*sb)[i+1].s;
-  p.hiPeak = highPeak;
-  p.index = (*sb)[i+1].index;
-  p.scaled = (*sb)[i+1].scaled;
-  p.bufferIndex = i+1;
-  ps->push_back(p);
-  tprintf(3, "%s peak found at %ld unscaled=%d scaled=%f\n", p.hiPeak?"High":"Low", p.index, p.value, p.scaled);
-}
-
-Peaks findPeaks (SampleBuffer * sb) {
-  Peaks ps;
-  
-  sample_t diff1, diff2;
-  
-  for (uint32 i=1; i< sb->size()-2; i++) {
-    diff1 = (*sb)[i+1].s - (*sb)[i].s;
-    diff2 = (*sb)[i+2].s - (*sb)[i+1].s;
-    if (diff1<0 && diff2>=0) { // Low local maxima
-      savePeak(sb, &ps, false, i);
-    } else if (diff1>0 && diff2 <=0) { // high local maxima
-      savePeak(sb, &ps, true, i);  
-    } else {
-      (*sb)[i+1].peak = false;  
-    }     
-  } 
-  return ps;
-}
-
-void fillSampleBuffer (uint32 * nSamp, SampleBuffer * sb, int count) {
-  // First remove old samples
-  sb->clear();
-  for (int i = 0; i < count && *nSamp < expected_samples; i++, (*nSamp)++) {
-    Sample t;
-    t.scaled = 0.0;
-    t.index = *nSamp;
-    t.highest = false;
-    t.lowest = false;
-    t.distance = 0.0;
-    t.peak = false;
-    t.highPeak = false;
-    sample_t s=GETIN(*nSamp);
-    t.s = s;
-    tprintf(3, "Getting nSamp=%ld sample=%d\n", *nSamp, s); 
-    sb->push_back(t);
-  }  
-}
-
-void fillSampleBuffer (uint32 * nSamp, SampleBuffer * sb, int count, uint32 startIndex) {
-  // First remove old samples
-  tprintf(3, "Clearing sampleBuffer from %d to %d\n", (sb->begin())->index, startIndex);
-  while ((sb->begin())->index < startIndex) {
-    sb->erase(sb->begin()); 
+// the peaks of the window, in order.
+void findPeaks (Window * w, Peaks * ps) {
+  ps->clear();
+  for (uint32 q = w->peaksFirst; q != w->peaksLast; q++) {
+    struct P p;
+    uint32 n = w->peaks[q & RING_MASK];
+    p.value = VALUE(w, n);
+    p.hiPeak = w->peak[n & RING_MASK] == PEAK_HIGH;
+    p.index = n;
+    p.scaled = scaled(w, n);
+    p.bufferIndex = n - w->start;
+    ps->push_back(p);
+    tprintf(3, "%s peak found at %ld unscaled=%d scaled=%f\n", p.hiPeak?"High":"Low", p.index, p.value, p.scaled);
   }
-  count -= sb->size();
-  for (int i = 0; i < count && *nSamp < expected_samples; i++, (*nSamp)++) {
-    sample_t s=GETIN(*nSamp);
-    Sample t;
-    t.s = s;
-    t.scaled = 0.0;
-    t.index = *nSamp;
-    t.highest = false;
-    t.lowest = false;
-    t.distance = 0.0;
-    t.peak = false;
-    t.highPeak = false;
-    tprintf(3, "Getting nSamp=%ld sample=%d\n", *nSamp, s); 
-    sb->push_back(t);
-  }  
-}
-
-void scaleBuffer (SampleBuffer * sb, double scalingValue, sample_t lowest) {
-  for (int i=0; i<sb->size(); i++) {
-    (*sb)[i].scaled = (( ((double)((*sb)[i].s))-((double)lowest)))/  scalingValue;
-    tprintf(3, "Scale buffer value %d (%ld) with scalingValue %f/%d to %f\n",(*sb)[i].s, (*sb)[i].index, scalingValue, lowest, (*sb)[i].scaled );
-  } 
 }
 
 struct PeakScore {
@@ -1216,10 +1303,10 @@ bool compareSort (struct PeakScore a,struct PeakScore b) { return (a.score<b.sco
 typedef std::vector<struct PeakScore> PeakScores;
 
 
-PeakScores calculateScores (Peaks * ps) {
-  PeakScores scores;
+void calculateScores (Peaks * ps, PeakScores & scores) {
   struct PeakScore s;
-  for (int i = 0; i < ps->size() - 1; i++)
+  scores.clear();
+  for (int i = 0; i + 1 < ps->size(); i++)
   {
     for (int j = i + 1; j < ps->size(); j++)
     {
@@ -1251,15 +1338,14 @@ PeakScores calculateScores (Peaks * ps) {
   for (int i = 0; i < scores.size(); i++) {
     tprintf(3, "Sorted: score=%f at %ld, %ld\n", scores[i].score, scores[i].firstIndex,scores[i].lastIndex );
   }
-  return scores;
 }
 
 
 
 
-PeakScores calculateScoresSingle (Peaks * ps, bool lastPeakIsHigh,double lastPeakAmplitude) {
+void calculateScoresSingle (Peaks * ps, bool lastPeakIsHigh,double lastPeakAmplitude, PeakScores & scores) {
   struct PeakScore s;
-  PeakScores scores;
+  scores.clear();
   for (int i=0; i < ps->size(); i++) {
     tprintf(3, "Processing peaks %d lastPeakIsHigh=%s currentPeakIsHigh=%s scaled=%f lastPeakAmplitude=%f", (*ps)[i].index, lastPeakIsHigh?"TRUE":"FALSE", (*ps)[i].hiPeak?"TRUE":"FALSE", (*ps)[i].scaled, lastPeakAmplitude);
     if ((lastPeakIsHigh && (!((*ps)[i].hiPeak))) ||((!lastPeakIsHigh) && ((*ps)[i].hiPeak))) { 
@@ -1288,44 +1374,39 @@ PeakScores calculateScoresSingle (Peaks * ps, bool lastPeakIsHigh,double lastPea
   for (int i = 0; i < scores.size(); i++) {
     tprintf(3, "Sorted: score=%f at %ld\n", scores[i].score, scores[i].firstIndex );
   }  
-  return scores;
 }
 
-uint32 findKnee(SampleBuffer * s, uint32 peakBufferIndex) {
-  double peak = (*s)[peakBufferIndex].scaled;
-  double previousPeak = (*s)[0].scaled;
+uint32 findKnee(Window * w, uint32 peakBufferIndex) {
+  double peak = scaled(w, w->start + peakBufferIndex);
+  double previousPeak = scaled(w, w->start);
   double distance = fabs(peak-previousPeak);
-  bool isHighPeak = (*s)[peakBufferIndex].highPeak;
   uint32 i;
   for (i=peakBufferIndex; i > 0; i--) {
-    tprintf(3, "findKnee: searching. i=%ld highPeak=%s scaled=%f distance=%f scaled/distance=%f\n", i, (*s)[i].highPeak?"TRUE":"FALSE",(*s)[i].scaled, distance, (*s)[i].scaled/distance );
-    if ((fabs(((*s)[i].scaled)-previousPeak)/distance)<0.925f) break; 
+    double s = scaled(w, w->start + i);
+    tprintf(3, "findKnee: searching. i=%ld scaled=%f distance=%f scaled/distance=%f\n", i, s, distance, s/distance );
+    if ((fabs(s-previousPeak)/distance)<0.925f) break; 
   }
-  tprintf(3, "findKnee: peak=%f previousPeak=%d distance=%f foundKnee=%f at %d (%d) \n", peak, previousPeak, distance, (*s)[i].scaled, (*s)[i].index, i); 
-  return (*s)[i].index;  
+  tprintf(3, "findKnee: peak=%f previousPeak=%f distance=%f foundKnee=%f at %ld (%ld) \n", peak, previousPeak, distance, scaled(w, w->start + i), w->start + i, i); 
+  return w->start + i;  
 }
 
 void FindTransitions() {
-  SampleBuffer sampleBuffer;
-  sample_t low=32767, high=-32768, sample;
-  long lastPeak=0;
-  bool lastPeakIsHigh;
-  int lowestIndex, highestIndex;
+  // the ring is too large for the stack
+  static Window window;
+  // reused, so that they don't allocate once they have grown
+  static Peaks ps;
+  static PeakScores scores;
+  uint32 lastPeak=0;
+  bool lastPeakIsHigh = false;
 
-  HiLo hilo;
   while (nSamp < expected_samples) { 
     if (BSstate == BS_LOST) {
-      Peaks ps;
-      PeakScores scores;
-      fillSampleBuffer(&nSamp, &sampleBuffer, 80);
-      hilo = findHighestLowest(&sampleBuffer);
-      scaleBuffer(&sampleBuffer, fabs(((double) hilo.highValue)-((double) hilo.lowValue)), hilo.lowValue);
-      ps = findPeaks(&sampleBuffer);
-      scores = calculateScores(&ps);
+      moveWindow(&nSamp, &window, nSamp, MIN(nSamp + 80, expected_samples));
+      findPeaks(&window, &ps);
+      calculateScores(&ps, scores);
       // Take the first one which has lowest score. Lower score is better..
       if (scores.size()>0) {
-        uint32 lastBufferIndex = scores[0].lastBufferIndex;
-        lastPeakIsHigh = sampleBuffer[lastBufferIndex].highPeak;
+        lastPeakIsHigh = window.peak[scores[0].lastIndex & RING_MASK] == PEAK_HIGH;
         DecodeBits(scores[0].firstIndex);
         DecodeBits(scores[0].lastIndex);
         tprintf(3, "firstBufferIndex=%ld lastBufferIndex=%ld lastPeakIsHigh=%s\n",  scores[0].firstBufferIndex, scores[0].lastBufferIndex, lastPeakIsHigh?"TRUE":"FALSE");
@@ -1334,22 +1415,20 @@ void FindTransitions() {
         tprintf(3, "Didn't find any peaks. Scores is empty.\n");
       }
     } else {
-      Peaks ps;
-      PeakScores scores;
-      fillSampleBuffer(&nSamp, &sampleBuffer, 67, lastPeak);
-      hilo = findHighestLowest(&sampleBuffer);
-      scaleBuffer(&sampleBuffer, fabs(((double) hilo.highValue)-((double) hilo.lowValue)), hilo.lowValue);
-      ps = findPeaks(&sampleBuffer);
-      scores = calculateScoresSingle(&ps, lastPeakIsHigh, sampleBuffer[0].scaled); 
+      // from the last peak, at least 67 samples or up to what was read
+      moveWindow(&nSamp, &window, lastPeak, MAX(nSamp, MIN(lastPeak + 67, expected_samples)));
+      findPeaks(&window, &ps);
+      calculateScoresSingle(&ps, lastPeakIsHigh, scaled(&window, window.start), scores); 
       if (scores.size()>0) {
-        uint32 firstBufferIndex = scores[0].firstBufferIndex;
-        uint32 kneeIndex = findKnee(&sampleBuffer, firstBufferIndex);
-        lastPeakIsHigh = sampleBuffer[firstBufferIndex].highPeak;
+        uint32 kneeIndex = findKnee(&window, scores[0].firstBufferIndex);
+        lastPeakIsHigh = window.peak[scores[0].firstIndex & RING_MASK] == PEAK_HIGH;
         lastPeak =  scores[0].firstIndex;
         tprintf(3, "kneeIndex=%ld\n", kneeIndex);
         DecodeBits(kneeIndex);
       } else {
-        DecodeBits(sampleBuffer[sampleBuffer.size()].index);
+        // Nothing but silence, move on as after a long pulse.
+        lastPeak = window.end - 1;
+        DecodeBits(lastPeak);
         tprintf(3, "Didn't find any peaks. Scores is empty.\n");
       }
     }
@@ -0,0 +1,350 @@
+// Render Datapoint cassette images in .tap format as WAV audio.
+//
+// Each record of the image is written the way the 2200 writes it and the way
+// dpwav2tap reads it back:
+//
+//    a train of one bits, the leader before the first record and the gap
+//    between records
+//    the sync 010
+//    every byte, eight bits lsb first, followed by the sync 010
+//    eleven one bits that end the record
+//
+// Bits are recorded with a flux transition at the start of every bit cell and
+// another in the middle of a zero bit. At 7.5 ips the cell rate is 3850 per
+// second, a one is a half cycle of 1925 Hz and a zero a full cycle of 3850 Hz.
+// -s gives another tape speed and -z the cell rate directly. The default is
+// the 1037.64 cells per second dpwav2tap is tuned for, captures played back at
+// about 1 7/8 ips. dpwav2tap reads nothing but that cell rate sampled at
+// 44100 Hz, the other speeds are for recording.
+//
+// Two waveforms can be rendered:
+//
+//    pulse     what a read head gives back, a Lorentzian pulse of alternating
+//              polarity at every transition, PW50 (the width at half height)
+//              set by -p as a fraction of a cell
+//    square    the write current, for recording audio back onto a real tape,
+//              which dpwav2tap does not read
+//
+// The channel can be impaired to give decoders something realistic to do:
+//
+//    -e %      tape speed error
+//    -W %      wow, a 0.5 Hz speed variation
+//    -F %      flutter, an 8 Hz speed variation
+//    -j        random timing jitter of each transition, RMS as a fraction of
+//              a cell
+//    -n dB     white noise, the signal to noise ratio against the peak of a
+//              single pulse
+//    -d rate   dropouts per second, each -D ms long and 20 dB deep
+//    -a        DC offset as a fraction of full scale
+//    -A dB     a fade of the signal from the start to the end of the audio
+//
+// The same seed, -S, always gives the same audio.
+//
+// Build: c++ -std=c++17 -O2 -o tap2wav tap2wav.cpp
+// Usage: tap2wav [options] in.tap out.wav
+
+#include <math.h>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Cells per second at 7.5 ips.
+#define CELL_RATE_75 3850.0
+// What dpwav2tap expects.
+#define CELL_RATE_DEFAULT 1037.64
+#define WOW_FREQUENCY 0.5
+#define FLUTTER_FREQUENCY 8.0
+#define DROPOUT_DEPTH 0.1
+// Pulses are cut off this many PW50 from their centre.
+#define PULSE_SPAN 12.0
+// Silence before and after the recording, in seconds.
+#define SILENCE 0.25
+#define BLOCK_SAMPLES 4096
+
+struct options {
+  int rate = 44100;
+  int bits = 16;
+  int channels = 1;
+  double cellRate = CELL_RATE_DEFAULT;
+  int leader = 4000;
+  int gap = 1078;
+  bool square = false;
+  double pw50 = 0.3;
+  double level = -6.0;
+  double speedError = 0.0;
+  double wow = 0.0;
+  double flutter = 0.0;
+  double jitter = 0.0;
+  double snr = -1.0;
+  double dropouts = 0.0;
+  double dropoutLength = 2.0;
+  double offset = 0.0;
+  double fade = 0.0;
+  unsigned seed = 1;
+};
+
+struct transition {
+  double time;
+  signed char polarity;
+};
+
+void usage(const char * name) {
+  fprintf(stderr, "Usage: %s [-r rate] [-b 8|16|24|32] [-c 1|2] [-s ips | -z cells/s] [-l cells] [-g cells]\n"
+          "       [-w pulse|square] [-p pw50] [-L dBFS] [-e %%] [-W %%] [-F %%] [-j rms] [-n dB]\n"
+          "       [-d rate] [-D ms] [-a offset] [-A dB] [-S seed] in.tap out.wav\n", name);
+  exit(2);
+}
+
+// Record lengths are stored as 32 bit little endian numbers before and after
+// each record.
+long getLength(const unsigned char * p) {
+  return (long) (p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned) p[3] << 24));
+}
+
+int readTap(const char * fileName, std::vector<std::vector<unsigned char>> & records) {
+  std::vector<unsigned char> image;
+  unsigned char buffer[65536];
+  size_t n, position = 0;
+  FILE * file = fopen(fileName, "rb");
+  if (file == NULL) {
+    perror(fileName);
+    return 0;
+  }
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) image.insert(image.end(), buffer, buffer + n);
+  fclose(file);
+  while (position + 4 <= image.size()) {
+    long size = getLength(&image[position]);
+    // A zero length is a tape mark and is not repeated.
+    if (size == 0) {
+      position += 4;
+      continue;
+    }
+    if (position + 8 + size > image.size() || getLength(&image[position + 4 + size]) != size) {
+      fprintf(stderr, "%s: bad record at offset %zu\n", fileName, position);
+      return 0;
+    }
+    records.push_back(std::vector<unsigned char>(&image[position + 4], &image[position + 4 + size]));
+    position += 8 + size;
+  }
+  if (position != image.size()) {
+    fprintf(stderr, "%s: truncated record at offset %zu\n", fileName, position);
+    return 0;
+  }
+  return 1;
+}
+
+void addBits(std::vector<unsigned char> & cells, int value, int count) {
+  for (int i = 0; i < count; i++) cells.push_back((value >> i) & 1);
+}
+
+// 010 is written in time order, as are the bits of a byte, lsb first.
+void encode(std::vector<std::vector<unsigned char>> & records, struct options & o, std::vector<unsigned char> & cells) {
+  for (int i = 0; i < o.leader; i++) cells.push_back(1);
+  for (auto r = records.begin(); r != records.end(); r++) {
+    addBits(cells, 2, 3);
+    for (auto b = r->begin(); b != r->end(); b++) {
+      addBits(cells, *b, 8);
+      addBits(cells, 2, 3);
+    }
+    addBits(cells, 0x7ff, 11);
+    for (int i = 0; i < o.gap; i++) cells.push_back(1);
+  }
+}
+
+// Transition times in samples, with the tape speed varying under wow, flutter
+// and the speed error.
+void place(std::vector<unsigned char> & cells, struct options & o, std::mt19937 & random, std::vector<struct transition> & transitions) {
+  std::normal_distribution<double> gauss(0.0, 1.0);
+  double time = SILENCE * o.rate;
+  double cell = o.rate / o.cellRate;
+  signed char polarity = 1;
+  for (auto c = cells.begin(); c != cells.end(); c++) {
+    double seconds = time / o.rate;
+    double speed = 1.0 + (o.speedError + o.wow * sin(2 * M_PI * WOW_FREQUENCY * seconds) +
+                          o.flutter * sin(2 * M_PI * FLUTTER_FREQUENCY * seconds)) / 100.0;
+    double length = cell / speed;
+    transitions.push_back({time + o.jitter * cell * gauss(random), polarity});
+    polarity = -polarity;
+    if (*c == 0) {
+      transitions.push_back({time + length / 2 + o.jitter * cell * gauss(random), polarity});
+      polarity = -polarity;
+    }
+    time += length;
+  }
+  // The transition that closes the last cell.
+  transitions.push_back({time + o.jitter * cell * gauss(random), polarity});
+}
+
+void put16(FILE * file, int v) {
+  fputc(v & 0xff, file);
+  fputc((v >> 8) & 0xff, file);
+}
+
+void put32(FILE * file, long v) {
+  put16(file, v & 0xffff);
+  put16(file, (v >> 16) & 0xffff);
+}
+
+// A plain 16 byte format chunk, also for float, as dpwav2tap reads no more.
+void writeHeader(FILE * file, struct options & o, long samples) {
+  int bytes = o.bits / 8;
+  long data = samples * bytes * o.channels;
+  fwrite("RIFF", 1, 4, file);
+  put32(file, 36 + data);
+  fwrite("WAVEfmt ", 1, 8, file);
+  put32(file, 16);
+  put16(file, o.bits == 32 ? 3 : 1);
+  put16(file, o.channels);
+  put32(file, o.rate);
+  put32(file, (long) o.rate * bytes * o.channels);
+  put16(file, bytes * o.channels);
+  put16(file, o.bits);
+  fwrite("data", 1, 4, file);
+  put32(file, data);
+}
+
+void putSample(std::vector<unsigned char> & out, double x, int bits) {
+  long v;
+  x = x > 1.0 ? 1.0 : x < -1.0 ? -1.0 : x;
+  switch (bits) {
+    case 8:
+      out.push_back(128 + lrint(x * 127));
+      break;
+    case 16:
+      v = lrint(x * 32767);
+      out.push_back(v & 0xff);
+      out.push_back((v >> 8) & 0xff);
+      break;
+    case 24:
+      v = lrint(x * 8388607);
+      out.push_back(v & 0xff);
+      out.push_back((v >> 8) & 0xff);
+      out.push_back((v >> 16) & 0xff);
+      break;
+    default: {
+      float f = x;
+      unsigned char b[4];
+      memcpy(b, &f, 4);
+      out.insert(out.end(), b, b + 4);
+    }
+  }
+}
+
+int render(const char * fileName, std::vector<struct transition> & transitions, struct options & o, std::mt19937 & random,
+           long * samples) {
+  std::normal_distribution<double> gauss(0.0, 1.0);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  std::vector<unsigned char> out;
+  double cell = o.rate / o.cellRate;
+  double pw50 = o.pw50 * cell;
+  double span = PULSE_SPAN * pw50;
+  double peak = pow(10.0, o.level / 20.0);
+  double noise = o.snr >= 0 ? peak * pow(10.0, -o.snr / 20.0) : 0.0;
+  double dropoutLength = o.dropoutLength / 1000.0 * o.rate;
+  double dropoutLeft = 0.0;
+  double end = transitions.back().time + cell;
+  size_t first = 0, last;
+  FILE * file;
+  *samples = (long) ceil(end + SILENCE * o.rate);
+  file = strcmp(fileName, "-") == 0 ? stdout : fopen(fileName, "wb");
+  if (file == NULL) {
+    perror(fileName);
+    return 0;
+  }
+  writeHeader(file, o, *samples);
+  for (long n = 0; n < *samples; n++) {
+    double x = 0.0, gain;
+    while (first < transitions.size() && transitions[first].time < n - span) first++;
+    if (o.square) {
+      // The level of the last transition, the edge spread over the sample
+      // it falls in so that its time is kept below a sample.
+      if (n >= transitions.front().time && n < end) {
+        for (last = first; last < transitions.size() && transitions[last].time <= n; last++) {}
+        x = last > 0 ? transitions[last - 1].polarity : 0;
+        if (last < transitions.size() && transitions[last].time < n + 1) {
+          double f = n + 1 - transitions[last].time;
+          x = x * (1 - f) + transitions[last].polarity * f;
+        }
+      }
+    } else {
+      for (last = first; last < transitions.size() && transitions[last].time < n + span; last++) {
+        double u = 2 * (n - transitions[last].time) / pw50;
+        x += transitions[last].polarity / (1 + u * u);
+      }
+    }
+    gain = peak * pow(10.0, -o.fade * n / *samples / 20.0);
+    if (dropoutLeft <= 0 && o.dropouts > 0 && uniform(random) < o.dropouts / o.rate) dropoutLeft = dropoutLength;
+    if (dropoutLeft > 0) {
+      // Raised cosine in and out of the dropout.
+      double depth = 0.5 - 0.5 * cos(2 * M_PI * dropoutLeft / dropoutLength);
+      gain *= 1 - (1 - DROPOUT_DEPTH) * (dropoutLength < 2 ? 1 : depth);
+      dropoutLeft--;
+    }
+    x = x * gain + o.offset + noise * gauss(random);
+    for (int c = 0; c < o.channels; c++) putSample(out, x, o.bits);
+    if (out.size() >= BLOCK_SAMPLES * 8 || n + 1 == *samples) {
+      if (fwrite(out.data(), 1, out.size(), file) != out.size()) break;
+      out.clear();
+    }
+  }
+  if (ferror(file) || (file != stdout && fclose(file) != 0)) {
+    perror(fileName);
+    return 0;
+  }
+  return 1;
+}
+
+int main(int argc, char * argv[]) {
+  std::vector<std::vector<unsigned char>> records;
+  std::vector<unsigned char> cells;
+  std::vector<struct transition> transitions;
+  struct options o;
+  long samples, bytes = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:b:c:s:z:l:g:w:p:L:e:W:F:j:n:d:D:a:A:S:")) != -1) {
+    switch (opt) {
+      case 'r': o.rate = atoi(optarg); break;
+      case 'b': o.bits = atoi(optarg); break;
+      case 'c': o.channels = atoi(optarg); break;
+      case 's': o.cellRate = CELL_RATE_75 * atof(optarg) / 7.5; break;
+      case 'z': o.cellRate = atof(optarg); break;
+      case 'l': o.leader = atoi(optarg); break;
+      case 'g': o.gap = atoi(optarg); break;
+      case 'w':
+        if (strcmp(optarg, "square") != 0 && strcmp(optarg, "pulse") != 0) usage(argv[0]);
+        o.square = strcmp(optarg, "square") == 0;
+        break;
+      case 'p': o.pw50 = atof(optarg); break;
+      case 'L': o.level = atof(optarg); break;
+      case 'e': o.speedError = atof(optarg); break;
+      case 'W': o.wow = atof(optarg); break;
+      case 'F': o.flutter = atof(optarg); break;
+      case 'j': o.jitter = atof(optarg); break;
+      case 'n': o.snr = atof(optarg); break;
+      case 'd': o.dropouts = atof(optarg); break;
+      case 'D': o.dropoutLength = atof(optarg); break;
+      case 'a': o.offset = atof(optarg); break;
+      case 'A': o.fade = atof(optarg); break;
+      case 'S': o.seed = strtoul(optarg, NULL, 0); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (optind + 2 != argc || o.rate < 1000 || o.cellRate <= 0 || o.pw50 <= 0 || o.leader < 0 || o.gap < 0 ||
+      (o.bits != 8 && o.bits != 16 && o.bits != 24 && o.bits != 32) || (o.channels != 1 && o.channels != 2)) {
+    usage(argv[0]);
+  }
+  std::mt19937 random(o.seed);
+  if (!readTap(argv[optind], records)) return 1;
+  encode(records, o, cells);
+  place(cells, o, random, transitions);
+  if (!render(argv[optind + 1], transitions, o, random, &samples)) return 1;
+  for (auto r = records.begin(); r != records.end(); r++) bytes += r->size();
+  fprintf(stderr, "%s: %zu records, %ld bytes, %zu cells, %.1f seconds at %d Hz, %.2f samples per cell\n", argv[optind],
+          records.size(), bytes, cells.size(), (double) samples / o.rate, o.rate, o.rate / o.cellRate);
+  return 0;
+}